@@ -0,0 +1,582 @@
+#ifndef BATCH_HPP_
+#define BATCH_HPP_
+
+#include "deadline.hpp"
+#include "io.hpp"
+#include "priority.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <filesystem>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/**
+ * @brief One image of a batch: the PNG to read and the PNG to write.
+ */
+struct Batch_Job {
+  std::string input;
+  std::string output;
+  /** Time the job may take from the start of its decoding; 0 for none. */
+  std::chrono::milliseconds deadline{0};
+  Priority priority = Priority::INTERACTIVE;
+};
+
+/**
+ * @brief Reads a batch list with one job per line.
+ *
+ * Each line holds an input path, optionally an output path and then
+ * optionally a deadline in milliseconds and a priority class name, in either
+ * order, separated by whitespace; without an output the result is
+ * "out-<input name>" beside the input. Blank lines and lines starting with
+ * '#' are skipped. Paths cannot contain whitespace.
+ *
+ * @param path List file.
+ * @param priority Class of the jobs that name none.
+ * @return std::vector<Batch_Job> The jobs in list order.
+ * @throws std::runtime_error If the file cannot be read or a field after the
+ * output is neither a number nor a priority class.
+ */
+std::vector<Batch_Job>
+load_batch_list(const std::filesystem::path &path,
+                Priority priority = Priority::INTERACTIVE);
+
+/**
+ * @brief An image between two stages of the batch pipeline.
+ */
+struct Batch_Image {
+  std::vector<unsigned char> bytes;
+  unsigned int width = 0;
+  unsigned int height = 0;
+  std::string format;
+};
+
+/**
+ * @brief The work done on each image, one function per pipeline stage.
+ *
+ * Stages run concurrently on different images and each may be called from
+ * several threads at once; throwing fails only that job.
+ */
+struct Batch_Stages {
+  std::function<Batch_Image(const std::vector<unsigned char> &png)> decode;
+  std::function<Batch_Image(Batch_Image image)> filter;
+  std::function<std::vector<unsigned char>(const Batch_Image &image)> encode;
+  /** Peak bytes a job needs from decoding until it is written, estimated
+   * from its PNG header; only called with a memory budget. */
+  std::function<std::size_t(const std::vector<unsigned char> &png)> footprint;
+};
+
+/**
+ * @brief Queue bounds of the batch pipeline.
+ */
+struct Batch_Options {
+  /** Files read or being read ahead of the decode stage. */
+  unsigned int read_ahead = 16;
+  /** Images waiting for, or being worked on by, each later stage. */
+  unsigned int queue_capacity = 2;
+  /** Bytes the jobs being decoded, filtered or encoded may need together,
+   * by Batch_Stages::footprint; 0 for no limit. */
+  std::size_t memory_budget = 0;
+};
+
+/**
+ * @brief Names of the pipeline stages, in order.
+ */
+inline constexpr const char *batch_stage_names[] = {"decode", "filter",
+                                                    "encode"};
+
+/**
+ * @brief Outcome of run_batch.
+ */
+struct Batch_Result {
+  std::size_t failures = 0;
+  /** Average seconds per image of each stage, in batch_stage_names order. */
+  double stage_seconds[3] = {};
+  /** Final thread budget of each stage. */
+  unsigned int stage_threads[3] = {};
+  /** Jobs that waited for memory before decoding. */
+  std::size_t deferred = 0;
+  /** Jobs whose footprint alone exceeded the memory budget. */
+  std::size_t oversized = 0;
+  /** Jobs that failed because their deadline expired. */
+  std::size_t expired = 0;
+  /** Largest total footprint of the jobs admitted at once. */
+  std::size_t peak_bytes = 0;
+  /** Seconds from the start of the batch until each job was written or
+   * failed, in list order. */
+  std::vector<double> job_seconds;
+};
+
+/**
+ * @brief Runs every job through a read, decode, filter, encode and write
+ * pipeline, so image N+1 decodes while image N is filtered and image N-1
+ * encodes.
+ *
+ * Stages are joined by bounded queues: reads are queued on io while fewer
+ * than read_ahead files wait for decoding, and a stage only starts an image
+ * when the next queue has room, so memory stays bounded however long the list
+ * is. Writes are queued on io as encodes finish.
+ *
+ * The calling thread and every pool worker run the stages. Each stage has a
+ * thread budget proportional to its measured time per image, refitted as
+ * images complete, so the slowest stage (usually encode) gets the most
+ * threads; idle threads still take work over budget rather than wait, and
+ * help with the pool bands that filters split into. Later stages are served
+ * first to drain the pipeline.
+ *
+ * With a memory budget, a job is admitted to decoding only while the
+ * footprints of the admitted jobs fit in it; until it is written, its
+ * footprint stays reserved. A job that does not fit is deferred and smaller
+ * jobs read after it may go first, but only for read_ahead admissions, after
+ * which it waits for memory to free up. A job larger than the whole budget
+ * runs alone. Reads pause while the files waiting for decoding and the
+ * admitted jobs together exceed the budget.
+ *
+ * A job's deadline starts when it is admitted to decoding and is current
+ * while its stages run, so the filters and the codec stop cooperatively once
+ * it expires and a stage may fall back to a cheaper result. A job whose
+ * deadline expires, including while it waits between stages, fails.
+ *
+ * Reads, admissions and stage starts choose between the priority classes by
+ * the pool's priority_policy(), whose thread limits cap the stages working on
+ * each class at once; within a class jobs keep list order. A job's class is
+ * current while its stages run, so the pool bands of interactive filters
+ * start before those of bulk ones. An interactive image may exceed a queue
+ * bound by one while bulk images hold the queue.
+ *
+ * @param jobs Jobs to run.
+ * @param io Backend for the reads and writes.
+ * @param options Queue bounds and memory budget.
+ * @param stages Work done on each image.
+ * @param log Receives one "<input>: <error>" line per failed job.
+ * @return Batch_Result Failures, the stage costs and budgets, and the
+ * admission counts.
+ */
+Batch_Result run_batch(const std::vector<Batch_Job> &jobs, File_IO &io,
+                       const Batch_Options &options,
+                       const Batch_Stages &stages, std::ostream &log);
+
+#endif
+
+#ifdef BATCH_IMPLEMENTATION
+
+#include "thread_pool.hpp"
+#include "trace.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <utility>
+
+std::vector<Batch_Job> load_batch_list(const std::filesystem::path &path,
+                                       Priority priority) {
+  std::ifstream file(path);
+  if (!file)
+    throw std::runtime_error("Unable to open batch list: " + path.string());
+
+  std::vector<Batch_Job> jobs;
+  std::string line;
+  while (std::getline(file, line)) {
+    std::istringstream fields(line);
+    Batch_Job job;
+    job.priority = priority;
+    if (!(fields >> job.input) || job.input[0] == '#')
+      continue;
+    if (!(fields >> job.output)) {
+      std::filesystem::path output{job.input};
+      output.replace_filename("out-" + output.filename().string());
+      job.output = output.string();
+    }
+    for (std::string field; fields >> field;) {
+      if (field.find_first_not_of("0123456789") == std::string::npos &&
+          field.size() <= 9) {
+        job.deadline = std::chrono::milliseconds{std::stoul(field)};
+        continue;
+      }
+      try {
+        job.priority = parse_priority(field);
+      } catch (const std::invalid_argument &) {
+        throw std::runtime_error("Invalid field in batch list: " + line);
+      }
+    }
+    jobs.push_back(std::move(job));
+  }
+  return jobs;
+}
+
+/* Set while a thread runs the batch loop, so the loop tasks that a stage's
+ * own pool wait picks up return at once instead of nesting. */
+static thread_local bool batch_worker = false;
+
+/* Shared state of one run_batch call; guarded by mutex. */
+struct Batch_Pipeline {
+  static constexpr int stage_count = 3;
+  static constexpr int DECODE = 0, FILTER = 1, ENCODE = 2;
+
+  struct Item {
+    std::size_t job;
+    std::vector<unsigned char> png;
+    Batch_Image image;
+    std::size_t footprint = 0;
+    bool deferred = false;
+    Deadline deadline{};
+    Priority priority = Priority::INTERACTIVE;
+  };
+
+  std::mutex mutex;
+  std::condition_variable changed;
+  std::size_t reading = 0, finished = 0, loops = 0;
+  /* Jobs of each class in list order, and how many of them were read. */
+  std::vector<std::size_t> unread[priority_count];
+  std::size_t next_read[priority_count] = {};
+  /* Threads working on each class, and the choice of class for reads. */
+  Priority_Lanes lanes, read_lanes;
+  std::deque<Item> queues[stage_count];
+  unsigned int active[stage_count] = {};
+  double seconds[stage_count] = {};
+  std::size_t runs[stage_count] = {};
+  unsigned int budget[stage_count] = {};
+  unsigned int threads = 1;
+  /* Footprints of the admitted jobs, their total, the bytes of the files
+   * waiting for decoding, and the admissions that skipped the oldest. */
+  std::vector<std::size_t> reserved;
+  std::size_t admitted_bytes = 0, queued_bytes = 0;
+  std::size_t passed_over[priority_count] = {};
+  Batch_Result result;
+
+  /* Splits the threads in proportion to the mean time per image, at least
+   * one each; stages not yet measured keep every thread. */
+  void rebalance() {
+    double total = 0.0;
+    for (int s = 0; s < stage_count; ++s) {
+      if (runs[s] == 0)
+        return;
+      total += seconds[s] / static_cast<double>(runs[s]);
+    }
+    for (int s = 0; s < stage_count; ++s) {
+      const double share = seconds[s] / static_cast<double>(runs[s]) / total;
+      budget[s] = std::max(
+          1u, static_cast<unsigned int>(std::lround(share * threads)));
+    }
+  }
+
+  /* Whether stage s has an image of class p waiting. */
+  bool waiting(int s, int p) const {
+    return std::any_of(queues[s].begin(), queues[s].end(), [p](const Item &i) {
+      return static_cast<int>(i.priority) == p;
+    });
+  }
+
+  /* Room for one more image of class p after stage s, counting those it is
+   * working on; encoded images go straight to the writer. */
+  bool has_room(int s, unsigned int capacity, int p) const {
+    if (s == ENCODE)
+      return true;
+    const bool overtake = p == static_cast<int>(Priority::INTERACTIVE) &&
+                          waiting(s + 1, static_cast<int>(Priority::BULK));
+    return queues[s + 1].size() + active[s] < capacity + overtake;
+  }
+
+  /* Removes the oldest image of class p from the queue of stage s. */
+  Item take(int s, int p) {
+    std::deque<Item> &queue = queues[s];
+    auto it = std::find_if(queue.begin(), queue.end(), [p](const Item &i) {
+      return static_cast<int>(i.priority) == p;
+    });
+    Item item = std::move(*it);
+    queue.erase(it);
+    return item;
+  }
+
+  bool fits(std::size_t footprint, std::size_t budget) const {
+    return budget == 0 || admitted_bytes == 0 ||
+           footprint <= budget - std::min(admitted_bytes, budget);
+  }
+
+  /* Position in the decode queue of the next job of class p to admit, or
+   * -1; the oldest job of the class is deferred if it does not fit, and may
+   * be passed over by the class a limited number of times. */
+  std::ptrdiff_t admissible(std::size_t budget, std::size_t patience, int p) {
+    std::deque<Item> &queue = queues[DECODE];
+    auto of_class = [p](const Item &i) {
+      return static_cast<int>(i.priority) == p;
+    };
+    const auto oldest = std::find_if(queue.begin(), queue.end(), of_class);
+    if (oldest == queue.end())
+      return -1;
+    if (fits(oldest->footprint, budget))
+      return oldest - queue.begin();
+    if (!oldest->deferred) {
+      oldest->deferred = true;
+      ++result.deferred;
+    }
+    if (passed_over[p] >= patience)
+      return -1;
+    for (auto it = oldest + 1; it != queue.end(); ++it)
+      if (of_class(*it) && fits(it->footprint, budget))
+        return it - queue.begin();
+    return -1;
+  }
+
+  /* Removes the item at index from the decode queue and reserves its
+   * footprint. */
+  Item admit(std::size_t index, std::size_t budget) {
+    std::deque<Item> &queue = queues[DECODE];
+    const auto position = queue.begin() + static_cast<std::ptrdiff_t>(index);
+    Item item = std::move(*position);
+    const bool oldest =
+        std::none_of(queue.begin(), position, [&](const Item &i) {
+          return i.priority == item.priority;
+        });
+    queue.erase(position);
+    std::size_t &passed = passed_over[static_cast<int>(item.priority)];
+    passed = oldest ? 0 : passed + 1;
+    queued_bytes -= item.png.size();
+    if (budget != 0 && item.footprint > budget)
+      ++result.oversized;
+    reserved[item.job] = item.footprint;
+    admitted_bytes += item.footprint;
+    result.peak_bytes = std::max(result.peak_bytes, admitted_bytes);
+    return item;
+  }
+};
+
+Batch_Result run_batch(const std::vector<Batch_Job> &jobs, File_IO &io,
+                       const Batch_Options &options,
+                       const Batch_Stages &stages, std::ostream &log) {
+  using Item = Batch_Pipeline::Item;
+  Thread_Pool &pool = default_thread_pool();
+  Batch_Pipeline pipeline;
+  pipeline.threads = pool.size();
+  std::fill(std::begin(pipeline.budget), std::end(pipeline.budget),
+            pipeline.threads);
+  const unsigned int read_ahead = std::max(options.read_ahead, 1u);
+  const unsigned int capacity = std::max(options.queue_capacity, 1u);
+  const std::size_t budget = stages.footprint ? options.memory_budget : 0;
+  pipeline.reserved.assign(jobs.size(), 0);
+  pipeline.result.job_seconds.assign(jobs.size(), 0.0);
+  for (std::size_t job = 0; job < jobs.size(); ++job)
+    pipeline.unread[static_cast<int>(jobs[job].priority)].push_back(job);
+  const Priority_Policy policy = pool.priority_policy();
+  pipeline.lanes = Priority_Lanes(policy);
+  pipeline.read_lanes = Priority_Lanes({policy.bulk_share, {}});
+  const auto start = std::chrono::steady_clock::now();
+
+  auto fail = [&](std::size_t job, const std::string &error) {
+    std::lock_guard lock(pipeline.mutex);
+    log << jobs[job].input << ": " << error << '\n';
+    ++pipeline.result.failures;
+  };
+  /* Notifies under the lock: once the last job finishes run_batch may return
+   * and destroy the condition variable. */
+  auto complete = [&](std::size_t job) {
+    std::lock_guard lock(pipeline.mutex);
+    ++pipeline.finished;
+    pipeline.admitted_bytes -= std::exchange(pipeline.reserved[job], 0);
+    pipeline.result.job_seconds[job] =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+            .count();
+    pipeline.changed.notify_all();
+  };
+
+  /* Runs one step of stage s on an item taken from its queue. */
+  auto run_stage = [&](int s, Item item) {
+    const auto start = std::chrono::steady_clock::now();
+    bool ok = true, expired = false;
+    std::vector<unsigned char> encoded;
+    try {
+      Trace_Span span("batch", batch_stage_names[s],
+                      static_cast<std::int64_t>(item.job),
+                      static_cast<std::int64_t>(item.job + 1));
+      Deadline_Scope scope(item.deadline);
+      Priority_Scope priority(item.priority);
+      check_deadline();
+      if (s == Batch_Pipeline::DECODE)
+        item.image = stages.decode(std::exchange(item.png, {}));
+      else if (s == Batch_Pipeline::FILTER)
+        item.image = stages.filter(std::move(item.image));
+      else
+        encoded = stages.encode(std::exchange(item.image, {}));
+    } catch (const Deadline_Exceeded &exception) {
+      fail(item.job, exception.what());
+      ok = false;
+      expired = true;
+    } catch (const std::exception &exception) {
+      fail(item.job, exception.what());
+      ok = false;
+    }
+    const double elapsed =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+            .count();
+
+    {
+      std::lock_guard lock(pipeline.mutex);
+      --pipeline.active[s];
+      pipeline.lanes.finish(item.priority);
+      pipeline.result.expired += expired;
+      pipeline.seconds[s] += elapsed;
+      ++pipeline.runs[s];
+      pipeline.rebalance();
+      if (ok && s != Batch_Pipeline::ENCODE)
+        pipeline.queues[s + 1].push_back(std::move(item));
+    }
+    pipeline.changed.notify_all();
+    if (!ok)
+      return complete(item.job);
+    if (s == Batch_Pipeline::ENCODE) {
+      const std::size_t job = item.job;
+      io.write(jobs[job].output, std::move(encoded),
+               [&, job](std::error_code error) {
+                 if (error)
+                   fail(job, "Error writing file: " + error.message());
+                 complete(job);
+               });
+    }
+  };
+
+  /* Every thread runs this loop: queue reads while the decode queue has
+   * room, else take the latest stage with work, within budget if possible,
+   * else help with pool bands. */
+  auto work = [&] {
+    if (batch_worker)
+      return;
+    batch_worker = true;
+    for (;;) {
+      std::unique_lock lock(pipeline.mutex);
+      if (pipeline.finished == jobs.size())
+        break;
+
+      bool unread[priority_count];
+      for (int p = 0; p < priority_count; ++p)
+        unread[p] = pipeline.next_read[p] < pipeline.unread[p].size();
+      if ((unread[0] || unread[1]) &&
+          pipeline.reading + pipeline.queues[Batch_Pipeline::DECODE].size() <
+              read_ahead &&
+          (budget == 0 ||
+           pipeline.admitted_bytes + pipeline.queued_bytes < budget)) {
+        const int p = pipeline.read_lanes.choose(unread);
+        pipeline.read_lanes.finish(static_cast<Priority>(p));
+        const std::size_t job =
+            pipeline.unread[p][pipeline.next_read[p]++];
+        ++pipeline.reading;
+        lock.unlock();
+        io.read(jobs[job].input, [&, job](std::vector<unsigned char> png,
+                                          std::error_code error) {
+          /* A header the estimate cannot read fails in decode instead. */
+          std::size_t footprint = 0;
+          if (!error && budget != 0) {
+            try {
+              footprint = stages.footprint(png);
+            } catch (const std::exception &) {
+            }
+          }
+          {
+            std::lock_guard lock(pipeline.mutex);
+            --pipeline.reading;
+            if (!error) {
+              pipeline.queued_bytes += png.size();
+              pipeline.queues[Batch_Pipeline::DECODE].push_back(
+                  {job, std::move(png), {}, footprint, false, {},
+                   jobs[job].priority});
+            }
+          }
+          pipeline.changed.notify_all();
+          if (error) {
+            fail(job, "Error reading file: " + error.message());
+            complete(job);
+          }
+        });
+        continue;
+      }
+
+      /* The stage each class would start, then the class to serve. */
+      std::ptrdiff_t admissible[priority_count];
+      int stage[priority_count];
+      bool waiting[priority_count];
+      for (int p = 0; p < priority_count; ++p) {
+        admissible[p] = pipeline.admissible(budget, read_ahead, p);
+        stage[p] = -1;
+        for (bool within_budget : {true, false})
+          for (int s = Batch_Pipeline::ENCODE; s >= 0 && stage[p] < 0; --s)
+            if ((s == Batch_Pipeline::DECODE ? admissible[p] >= 0
+                                             : pipeline.waiting(s, p)) &&
+                pipeline.has_room(s, capacity, p) &&
+                (!within_budget || pipeline.active[s] < pipeline.budget[s]))
+              stage[p] = s;
+        waiting[p] = stage[p] >= 0;
+      }
+      const int lane = pipeline.lanes.choose(waiting);
+      if (lane >= 0) {
+        const int chosen = stage[lane];
+        Item item;
+        if (chosen == Batch_Pipeline::DECODE) {
+          item = pipeline.admit(static_cast<std::size_t>(admissible[lane]),
+                                budget);
+          if (jobs[item.job].deadline.count() > 0)
+            item.deadline = Deadline(Deadline::Clock::now() +
+                                     jobs[item.job].deadline);
+        } else {
+          item = pipeline.take(chosen, lane);
+        }
+        ++pipeline.active[chosen];
+        lock.unlock();
+        run_stage(chosen, std::move(item));
+        continue;
+      }
+
+      lock.unlock();
+      if (pool.run_pending_task())
+        continue;
+      lock.lock();
+      pipeline.changed.wait_for(lock, std::chrono::milliseconds(1));
+    }
+    batch_worker = false;
+  };
+
+  /* The loops on pool workers reference this frame; wait for all of them,
+   * running those still queued. */
+  pipeline.loops = pipeline.threads - 1;
+  for (unsigned int i = 1; i < pipeline.threads; ++i)
+    pool.submit([&] {
+      work();
+      std::lock_guard lock(pipeline.mutex);
+      --pipeline.loops;
+      pipeline.changed.notify_all();
+    });
+  work();
+  for (;;) {
+    {
+      std::lock_guard lock(pipeline.mutex);
+      if (pipeline.loops == 0)
+        break;
+    }
+    if (!pool.run_pending_task()) {
+      std::unique_lock lock(pipeline.mutex);
+      pipeline.changed.wait_for(lock, std::chrono::milliseconds(1),
+                                [&] { return pipeline.loops == 0; });
+    }
+  }
+  io.drain();
+
+  Batch_Result result = pipeline.result;
+  for (int s = 0; s < Batch_Pipeline::stage_count; ++s) {
+    result.stage_seconds[s] =
+        pipeline.runs[s] ? pipeline.seconds[s] /
+                               static_cast<double>(pipeline.runs[s])
+                         : 0.0;
+    result.stage_threads[s] = pipeline.budget[s];
+  }
+  return result;
+}
+
+#endif
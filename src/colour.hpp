@@ -0,0 +1,712 @@
+#ifndef COLOUR_HPP_
+#define COLOUR_HPP_
+
+#include <array>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Colour spaces supported by the conversion routines.
+ *
+ * All spaces are stored as three interleaved 8-bit channels:
+ * - YCbCr: BT.601 or BT.709 matrix, full (0-255) or limited (16-235 luma,
+ *   16-240 chroma) range, chroma centred on 128.
+ * - HSV: hue scaled to 0-255 (256 steps per turn), saturation and value 0-255.
+ * - Lab: CIE L*a*b* (D65) with L* scaled to 0-255 and a*, b* offset by 128.
+ */
+enum class Colour_Space {
+  RGB,
+  YCBCR_601,
+  YCBCR_601_LIMITED,
+  YCBCR_709,
+  YCBCR_709_LIMITED,
+  HSV,
+  LAB,
+};
+
+/**
+ * @brief Parses a colour space name ("rgb", "ycbcr601", "ycbcr601-limited",
+ * "ycbcr709", "ycbcr709-limited", "hsv", "lab").
+ *
+ * @param name Colour space name as passed on the command line.
+ * @return Colour_Space The matching colour space.
+ * @throws std::invalid_argument If the name is not a known colour space.
+ */
+Colour_Space colour_space_from_string(const std::string &name);
+
+/**
+ * @brief Returns short names of the three planes of a colour space, e.g.
+ * {"y", "cb", "cr"}, for naming planar outputs.
+ */
+std::array<std::string, 3> colour_space_planes(Colour_Space space);
+
+/**
+ * @brief Returns the index of the plane holding luma or lightness (Y, V or
+ * L*), so single-plane filters can run on it alone.
+ *
+ * @throws std::invalid_argument For RGB, which has no such plane.
+ */
+unsigned int colour_space_luma_plane(Colour_Space space);
+
+/**
+ * @brief Converts an RGB image to another colour space using SIMD.
+ *
+ * Pixels are deinterleaved 16 at a time with pshufb. YCbCr uses a 3x3 matrix
+ * in Q13 fixed point evaluated with pmaddwd, HSV is computed four pixels at a
+ * time in single precision, and Lab decodes sRGB through a 256-entry gamma
+ * table and takes the cube root through an interpolated table.
+ *
+ * @param rgb Input RGB buffer (3 bytes per pixel).
+ * @param space Target colour space.
+ * @return std::vector<unsigned char> Converted output (same size as input).
+ * @throws std::invalid_argument If buffer size is not a multiple of 3.
+ */
+std::vector<unsigned char> convert_rgb_to(const std::vector<unsigned char> &rgb,
+                                          Colour_Space space);
+
+/**
+ * @brief Converts an image from the given colour space back to RGB.
+ *
+ * @param bytes Input buffer in the given colour space (3 bytes per pixel).
+ * @param space Colour space of the input.
+ * @return std::vector<unsigned char> RGB output (same size as input).
+ * @throws std::invalid_argument If buffer size is not a multiple of 3.
+ */
+std::vector<unsigned char>
+convert_to_rgb(const std::vector<unsigned char> &bytes, Colour_Space space);
+
+/**
+ * @brief Splits an interleaved image into one buffer per channel.
+ *
+ * @param bytes Interleaved input (channels bytes per pixel).
+ * @param channels Number of interleaved channels.
+ * @return std::vector<std::vector<unsigned char>> One plane per channel.
+ * @throws std::invalid_argument If the buffer size is not a multiple of
+ * channels.
+ */
+std::vector<std::vector<unsigned char>>
+split_planes(const std::vector<unsigned char> &bytes, unsigned int channels);
+
+/**
+ * @brief Interleaves planes of equal size into a single buffer.
+ *
+ * @param planes Planes to interleave, in channel order.
+ * @return std::vector<unsigned char> Interleaved output.
+ * @throws std::invalid_argument If the planes differ in size.
+ */
+std::vector<unsigned char>
+merge_planes(const std::vector<std::vector<unsigned char>> &planes);
+
+#endif
+
+#ifdef COLOUR_IMPLEMENTATION
+
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#include <xmmintrin.h>
+
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+Colour_Space colour_space_from_string(const std::string &name) {
+  if (name == "rgb")
+    return Colour_Space::RGB;
+  else if (name == "ycbcr601")
+    return Colour_Space::YCBCR_601;
+  else if (name == "ycbcr601-limited")
+    return Colour_Space::YCBCR_601_LIMITED;
+  else if (name == "ycbcr709")
+    return Colour_Space::YCBCR_709;
+  else if (name == "ycbcr709-limited")
+    return Colour_Space::YCBCR_709_LIMITED;
+  else if (name == "hsv")
+    return Colour_Space::HSV;
+  else if (name == "lab")
+    return Colour_Space::LAB;
+  else
+    throw std::invalid_argument("Invalid colour space");
+}
+
+std::array<std::string, 3> colour_space_planes(Colour_Space space) {
+  switch (space) {
+  case Colour_Space::RGB:
+    return {"r", "g", "b"};
+  case Colour_Space::HSV:
+    return {"h", "s", "v"};
+  case Colour_Space::LAB:
+    return {"l", "a", "b"};
+  default:
+    return {"y", "cb", "cr"};
+  }
+}
+
+unsigned int colour_space_luma_plane(Colour_Space space) {
+  if (space == Colour_Space::RGB)
+    throw std::invalid_argument("RGB has no luma plane");
+  return space == Colour_Space::HSV ? 2 : 0;
+}
+
+/* pshufb masks moving 16 interleaved RGB pixels (3 vectors) into planes:
+ * entry [plane][vector] selects that vector's bytes belonging to the plane. */
+static constexpr std::array<std::array<std::array<char, 16>, 3>, 3>
+make_deinterleave_masks() {
+  std::array<std::array<std::array<char, 16>, 3>, 3> masks{};
+  for (int plane = 0; plane < 3; ++plane)
+    for (int vec = 0; vec < 3; ++vec)
+      for (int i = 0; i < 16; ++i) {
+        const int index = 3 * i + plane - 16 * vec;
+        masks[plane][vec][i] =
+            static_cast<char>(index >= 0 && index < 16 ? index : 0x80);
+      }
+  return masks;
+}
+
+/* The inverse: entry [vector][plane] selects plane bytes for that vector. */
+static constexpr std::array<std::array<std::array<char, 16>, 3>, 3>
+make_interleave_masks() {
+  std::array<std::array<std::array<char, 16>, 3>, 3> masks{};
+  for (int vec = 0; vec < 3; ++vec)
+    for (int plane = 0; plane < 3; ++plane)
+      for (int i = 0; i < 16; ++i) {
+        const int byte = 16 * vec + i;
+        masks[vec][plane][i] =
+            static_cast<char>(byte % 3 == plane ? byte / 3 : 0x80);
+      }
+  return masks;
+}
+
+static constexpr auto deinterleave_masks = make_deinterleave_masks();
+static constexpr auto interleave_masks = make_interleave_masks();
+
+static __m128i load_mask(const std::array<char, 16> &mask) {
+  return _mm_loadu_si128(reinterpret_cast<const __m128i *>(mask.data()));
+}
+
+static void deinterleave_rgb16(const unsigned char *src, __m128i planes[3]) {
+  const __m128i v[3] = {
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(src)),
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 16)),
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 32))};
+  for (int p = 0; p < 3; ++p) {
+    const auto &masks = deinterleave_masks[p];
+    planes[p] = _mm_or_si128(
+        _mm_or_si128(_mm_shuffle_epi8(v[0], load_mask(masks[0])),
+                     _mm_shuffle_epi8(v[1], load_mask(masks[1]))),
+        _mm_shuffle_epi8(v[2], load_mask(masks[2])));
+  }
+}
+
+static void interleave_rgb16(const __m128i planes[3], unsigned char *dst) {
+  for (int v = 0; v < 3; ++v)
+    _mm_storeu_si128(
+        reinterpret_cast<__m128i *>(dst + 16 * v),
+        _mm_or_si128(
+            _mm_or_si128(
+                _mm_shuffle_epi8(planes[0], load_mask(interleave_masks[v][0])),
+                _mm_shuffle_epi8(planes[1], load_mask(interleave_masks[v][1]))),
+            _mm_shuffle_epi8(planes[2], load_mask(interleave_masks[v][2]))));
+}
+
+/* Runs a 16-pixel kernel over a buffer; the tail goes through a padded copy so
+ * every pixel takes the same code path. */
+template <typename Kernel>
+static std::vector<unsigned char>
+convert_pixels16(const std::vector<unsigned char> &bytes, Kernel kernel) {
+  if (bytes.size() % 3 != 0)
+    throw std::invalid_argument("RGB buffer must have a multiple of 3 bytes");
+
+  std::vector<unsigned char> output(bytes.size());
+  const std::size_t pixels = bytes.size() / 3;
+  const std::size_t blocks = pixels / 16;
+
+  default_thread_pool().parallel_for(
+      0, blocks, [&](std::size_t first, std::size_t last) {
+        for (std::size_t block = first; block < last; ++block)
+          kernel(bytes.data() + block * 48, output.data() + block * 48);
+      });
+
+  const std::size_t done = blocks * 48;
+  if (done < bytes.size()) {
+    unsigned char in[48] = {}, out[48];
+    std::memcpy(in, bytes.data() + done, bytes.size() - done);
+    kernel(in, out);
+    std::memcpy(output.data() + done, out, bytes.size() - done);
+  }
+
+  return output;
+}
+
+/* out_c = sum_i m[c][i] * in_i + offset[c] */
+struct Colour_Matrix {
+  double m[3][3];
+  double offset[3];
+};
+
+/* Q13 coefficients as pmaddwd pairs: (m0, m1) and (m2, rounded offset/256). */
+struct Fixed_Colour_Matrix {
+  __m128i pair01[3];
+  __m128i pair2o[3];
+};
+
+static Fixed_Colour_Matrix to_fixed(const Colour_Matrix &matrix) {
+  Fixed_Colour_Matrix fixed;
+  for (int c = 0; c < 3; ++c) {
+    const auto q = [](double v) {
+      return static_cast<short>(std::lround(v * 8192.0));
+    };
+    const auto offset = static_cast<short>(
+        std::lround((matrix.offset[c] * 8192.0 + 4096.0) / 256.0));
+    fixed.pair01[c] = _mm_set_epi16(
+        q(matrix.m[c][1]), q(matrix.m[c][0]), q(matrix.m[c][1]),
+        q(matrix.m[c][0]), q(matrix.m[c][1]), q(matrix.m[c][0]),
+        q(matrix.m[c][1]), q(matrix.m[c][0]));
+    fixed.pair2o[c] =
+        _mm_set_epi16(offset, q(matrix.m[c][2]), offset, q(matrix.m[c][2]),
+                      offset, q(matrix.m[c][2]), offset, q(matrix.m[c][2]));
+  }
+  return fixed;
+}
+
+static void colour_matrix16(const unsigned char *src, unsigned char *dst,
+                            const Fixed_Colour_Matrix &fixed) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i one = _mm_set1_epi16(256);
+
+  __m128i in[3], out[3];
+  deinterleave_rgb16(src, in);
+
+  /* Four groups of four pixels as 16-bit (in0, in1) and (in2, 256) pairs. */
+  __m128i p01[4], p2o[4];
+  for (int half = 0; half < 2; ++half) {
+    const __m128i a = half ? _mm_unpackhi_epi8(in[0], zero)
+                           : _mm_unpacklo_epi8(in[0], zero);
+    const __m128i b = half ? _mm_unpackhi_epi8(in[1], zero)
+                           : _mm_unpacklo_epi8(in[1], zero);
+    const __m128i c = half ? _mm_unpackhi_epi8(in[2], zero)
+                           : _mm_unpacklo_epi8(in[2], zero);
+    p01[2 * half] = _mm_unpacklo_epi16(a, b);
+    p01[2 * half + 1] = _mm_unpackhi_epi16(a, b);
+    p2o[2 * half] = _mm_unpacklo_epi16(c, one);
+    p2o[2 * half + 1] = _mm_unpackhi_epi16(c, one);
+  }
+
+  for (int c = 0; c < 3; ++c) {
+    __m128i sums[4];
+    for (int g = 0; g < 4; ++g)
+      sums[g] = _mm_srai_epi32(
+          _mm_add_epi32(_mm_madd_epi16(p01[g], fixed.pair01[c]),
+                        _mm_madd_epi16(p2o[g], fixed.pair2o[c])),
+          13);
+    out[c] = _mm_packus_epi16(_mm_packs_epi32(sums[0], sums[1]),
+                              _mm_packs_epi32(sums[2], sums[3]));
+  }
+
+  interleave_rgb16(out, dst);
+}
+
+static Colour_Matrix ycbcr_matrix(Colour_Space space) {
+  const bool bt709 = space == Colour_Space::YCBCR_709 ||
+                     space == Colour_Space::YCBCR_709_LIMITED;
+  const bool limited = space == Colour_Space::YCBCR_601_LIMITED ||
+                       space == Colour_Space::YCBCR_709_LIMITED;
+  const double kr = bt709 ? 0.2126 : 0.299;
+  const double kb = bt709 ? 0.0722 : 0.114;
+  const double kg = 1.0 - kr - kb;
+  const double ys = limited ? 219.0 / 255.0 : 1.0;
+  const double cs = limited ? 224.0 / 255.0 : 1.0;
+  const double cb = cs / (2.0 * (1.0 - kb));
+  const double cr = cs / (2.0 * (1.0 - kr));
+
+  return {{{ys * kr, ys * kg, ys * kb},
+           {-cb * kr, -cb * kg, cb * (1.0 - kb)},
+           {cr * (1.0 - kr), -cr * kg, -cr * kb}},
+          {limited ? 16.0 : 0.0, 128.0, 128.0}};
+}
+
+static Colour_Matrix invert_colour_matrix(const Colour_Matrix &f) {
+  const auto &m = f.m;
+  const double det = m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1]) -
+                     m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0]) +
+                     m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+
+  Colour_Matrix inv{};
+  for (int r = 0; r < 3; ++r)
+    for (int c = 0; c < 3; ++c) {
+      /* Cofactor of m[c][r], cyclic indices keep the sign positive. */
+      const int r1 = (c + 1) % 3, r2 = (c + 2) % 3;
+      const int c1 = (r + 1) % 3, c2 = (r + 2) % 3;
+      inv.m[r][c] = (m[r1][c1] * m[r2][c2] - m[r1][c2] * m[r2][c1]) / det;
+    }
+  for (int r = 0; r < 3; ++r)
+    inv.offset[r] = -(inv.m[r][0] * f.offset[0] + inv.m[r][1] * f.offset[1] +
+                      inv.m[r][2] * f.offset[2]);
+  return inv;
+}
+
+static void rgb_to_hsv16(const unsigned char *src, unsigned char *dst) {
+  const __m128i zero = _mm_setzero_si128();
+  __m128i in[3], out[3];
+  deinterleave_rgb16(src, in);
+
+  __m128i h32[4], s32[4];
+  for (int g = 0; g < 4; ++g) {
+    __m128 ch[3];
+    for (int c = 0; c < 3; ++c) {
+      const __m128i w = g < 2 ? _mm_unpacklo_epi8(in[c], zero)
+                              : _mm_unpackhi_epi8(in[c], zero);
+      ch[c] = _mm_cvtepi32_ps(g % 2 ? _mm_unpackhi_epi16(w, zero)
+                                    : _mm_unpacklo_epi16(w, zero));
+    }
+    const __m128 r = ch[0], gr = ch[1], b = ch[2];
+    const __m128 mx = _mm_max_ps(r, _mm_max_ps(gr, b));
+    const __m128 mn = _mm_min_ps(r, _mm_min_ps(gr, b));
+    const __m128 d = _mm_sub_ps(mx, mn);
+    const __m128 has_d = _mm_cmpgt_ps(d, _mm_setzero_ps());
+
+    const __m128 scale = _mm_div_ps(_mm_set1_ps(60.0f), d);
+    const __m128 hr = _mm_mul_ps(_mm_sub_ps(gr, b), scale);
+    const __m128 hg = _mm_add_ps(_mm_mul_ps(_mm_sub_ps(b, r), scale),
+                                 _mm_set1_ps(120.0f));
+    const __m128 hb = _mm_add_ps(_mm_mul_ps(_mm_sub_ps(r, gr), scale),
+                                 _mm_set1_ps(240.0f));
+    const __m128 is_r = _mm_cmpeq_ps(mx, r);
+    const __m128 is_g = _mm_andnot_ps(is_r, _mm_cmpeq_ps(mx, gr));
+    const __m128 is_b = _mm_andnot_ps(_mm_or_ps(is_r, is_g), has_d);
+    __m128 h = _mm_or_ps(_mm_or_ps(_mm_and_ps(is_r, hr), _mm_and_ps(is_g, hg)),
+                         _mm_and_ps(is_b, hb));
+    h = _mm_and_ps(h, has_d);
+    h = _mm_add_ps(h, _mm_and_ps(_mm_cmplt_ps(h, _mm_setzero_ps()),
+                                 _mm_set1_ps(360.0f)));
+
+    h32[g] = _mm_and_si128(
+        _mm_cvtps_epi32(_mm_mul_ps(h, _mm_set1_ps(256.0f / 360.0f))),
+        _mm_set1_epi32(255));
+    s32[g] = _mm_cvtps_epi32(_mm_and_ps(
+        _mm_div_ps(_mm_mul_ps(d, _mm_set1_ps(255.0f)), mx), has_d));
+  }
+
+  out[0] = _mm_packus_epi16(_mm_packs_epi32(h32[0], h32[1]),
+                            _mm_packs_epi32(h32[2], h32[3]));
+  out[1] = _mm_packus_epi16(_mm_packs_epi32(s32[0], s32[1]),
+                            _mm_packs_epi32(s32[2], s32[3]));
+  out[2] = _mm_max_epu8(in[0], _mm_max_epu8(in[1], in[2]));
+  interleave_rgb16(out, dst);
+}
+
+static void hsv_to_rgb16(const unsigned char *src, unsigned char *dst) {
+  const __m128i zero = _mm_setzero_si128();
+  __m128i in[3], out[3];
+  deinterleave_rgb16(src, in);
+
+  __m128i res[3][4];
+  for (int g = 0; g < 4; ++g) {
+    __m128 ch[3];
+    for (int c = 0; c < 3; ++c) {
+      const __m128i w = g < 2 ? _mm_unpacklo_epi8(in[c], zero)
+                              : _mm_unpackhi_epi8(in[c], zero);
+      ch[c] = _mm_cvtepi32_ps(g % 2 ? _mm_unpackhi_epi16(w, zero)
+                                    : _mm_unpacklo_epi16(w, zero));
+    }
+    const __m128 hh = _mm_mul_ps(ch[0], _mm_set1_ps(6.0f / 256.0f));
+    const __m128 s = _mm_mul_ps(ch[1], _mm_set1_ps(1.0f / 255.0f));
+    const __m128 v = ch[2];
+    const __m128i sector = _mm_cvttps_epi32(hh);
+    const __m128 f = _mm_sub_ps(hh, _mm_cvtepi32_ps(sector));
+    const __m128 one = _mm_set1_ps(1.0f);
+
+    const __m128 p = _mm_mul_ps(v, _mm_sub_ps(one, s));
+    const __m128 q = _mm_mul_ps(v, _mm_sub_ps(one, _mm_mul_ps(s, f)));
+    const __m128 t =
+        _mm_mul_ps(v, _mm_sub_ps(one, _mm_mul_ps(s, _mm_sub_ps(one, f))));
+
+    __m128 is[6];
+    for (int i = 0; i < 6; ++i)
+      is[i] = _mm_castsi128_ps(_mm_cmpeq_epi32(sector, _mm_set1_epi32(i)));
+
+    /* Per sector 0..5: R = v q p p t v, G = t v v q p p, B = p p t v v q. */
+    const __m128 *pick[3][6] = {{&v, &q, &p, &p, &t, &v},
+                                {&t, &v, &v, &q, &p, &p},
+                                {&p, &p, &t, &v, &v, &q}};
+    for (int c = 0; c < 3; ++c) {
+      __m128 value = _mm_setzero_ps();
+      for (int i = 0; i < 6; ++i)
+        value = _mm_or_ps(value, _mm_and_ps(is[i], *pick[c][i]));
+      res[c][g] = _mm_cvtps_epi32(value);
+    }
+  }
+
+  for (int c = 0; c < 3; ++c)
+    out[c] = _mm_packus_epi16(_mm_packs_epi32(res[c][0], res[c][1]),
+                              _mm_packs_epi32(res[c][2], res[c][3]));
+  interleave_rgb16(out, dst);
+}
+
+/* Tables for Lab: sRGB decode, cube root of t in [0, 1] and sRGB encode. */
+struct Lab_Tables {
+  static constexpr int cbrt_steps = 4096;
+  static constexpr int encode_steps = 4096;
+
+  float linear[256];
+  float cbrt[cbrt_steps + 2];
+  unsigned char encode[encode_steps + 1];
+
+  /* Linear sRGB to XYZ (D65), rows divided by the white point. */
+  float to_xyz[3][3];
+  float from_xyz[3][3];
+
+  Lab_Tables() {
+    for (int i = 0; i < 256; ++i) {
+      const double c = i / 255.0;
+      linear[i] = static_cast<float>(
+          c <= 0.04045 ? c / 12.92 : std::pow((c + 0.055) / 1.055, 2.4));
+    }
+
+    constexpr double e = 216.0 / 24389.0, k = 24389.0 / 27.0;
+    for (int i = 0; i <= cbrt_steps + 1; ++i) {
+      const double t = static_cast<double>(i) / cbrt_steps;
+      cbrt[i] = static_cast<float>(t > e ? std::cbrt(t) : (k * t + 16) / 116);
+    }
+
+    for (int i = 0; i <= encode_steps; ++i) {
+      const double l = static_cast<double>(i) / encode_steps;
+      const double c =
+          l <= 0.0031308 ? 12.92 * l : 1.055 * std::pow(l, 1.0 / 2.4) - 0.055;
+      encode[i] = static_cast<unsigned char>(std::lround(c * 255.0));
+    }
+
+    const double m[3][3] = {{0.4124564, 0.3575761, 0.1804375},
+                            {0.2126729, 0.7151522, 0.0721750},
+                            {0.0193339, 0.1191920, 0.9503041}};
+    const double white[3] = {0.95047, 1.0, 1.08883};
+
+    Colour_Matrix forward{};
+    for (int r = 0; r < 3; ++r)
+      for (int c = 0; c < 3; ++c)
+        forward.m[r][c] = m[r][c] / white[r];
+    const Colour_Matrix inverse = invert_colour_matrix(forward);
+    for (int r = 0; r < 3; ++r)
+      for (int c = 0; c < 3; ++c) {
+        to_xyz[r][c] = static_cast<float>(forward.m[r][c]);
+        from_xyz[r][c] = static_cast<float>(inverse.m[r][c]);
+      }
+  }
+};
+
+static const Lab_Tables &lab_tables() {
+  static const Lab_Tables tables;
+  return tables;
+}
+
+static __m128 matrix_row(const float row[3], __m128 a, __m128 b, __m128 c) {
+  return _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(row[0]), a),
+                               _mm_mul_ps(_mm_set1_ps(row[1]), b)),
+                    _mm_mul_ps(_mm_set1_ps(row[2]), c));
+}
+
+static void rgb_to_lab16(const unsigned char *src, unsigned char *dst) {
+  const Lab_Tables &tables = lab_tables();
+  __m128i res[3][4], out[3];
+
+  for (int g = 0; g < 4; ++g) {
+    alignas(16) float lin[3][4];
+    for (int i = 0; i < 4; ++i)
+      for (int c = 0; c < 3; ++c)
+        lin[c][i] = tables.linear[src[(4 * g + i) * 3 + c]];
+
+    const __m128 r = _mm_load_ps(lin[0]), gr = _mm_load_ps(lin[1]),
+                 b = _mm_load_ps(lin[2]);
+    __m128 t[3] = {matrix_row(tables.to_xyz[0], r, gr, b),
+                   matrix_row(tables.to_xyz[1], r, gr, b),
+                   matrix_row(tables.to_xyz[2], r, gr, b)};
+
+    /* f(t) by linear interpolation in the cube root table. */
+    __m128 f[3];
+    for (int c = 0; c < 3; ++c) {
+      const __m128 pos = _mm_mul_ps(
+          _mm_min_ps(_mm_max_ps(t[c], _mm_setzero_ps()), _mm_set1_ps(1.0f)),
+          _mm_set1_ps(static_cast<float>(Lab_Tables::cbrt_steps)));
+      const __m128i index = _mm_cvttps_epi32(pos);
+      const __m128 frac = _mm_sub_ps(pos, _mm_cvtepi32_ps(index));
+      alignas(16) int idx[4];
+      alignas(16) float lo[4], hi[4];
+      _mm_store_si128(reinterpret_cast<__m128i *>(idx), index);
+      for (int i = 0; i < 4; ++i) {
+        lo[i] = tables.cbrt[idx[i]];
+        hi[i] = tables.cbrt[idx[i] + 1];
+      }
+      const __m128 vlo = _mm_load_ps(lo);
+      f[c] =
+          _mm_add_ps(vlo, _mm_mul_ps(frac, _mm_sub_ps(_mm_load_ps(hi), vlo)));
+    }
+
+    const __m128 l = _mm_sub_ps(_mm_mul_ps(f[1], _mm_set1_ps(116.0f)),
+                                _mm_set1_ps(16.0f));
+    const __m128 a = _mm_mul_ps(_mm_sub_ps(f[0], f[1]), _mm_set1_ps(500.0f));
+    const __m128 bb = _mm_mul_ps(_mm_sub_ps(f[1], f[2]), _mm_set1_ps(200.0f));
+
+    res[0][g] = _mm_cvtps_epi32(_mm_mul_ps(l, _mm_set1_ps(255.0f / 100.0f)));
+    res[1][g] = _mm_cvtps_epi32(_mm_add_ps(a, _mm_set1_ps(128.0f)));
+    res[2][g] = _mm_cvtps_epi32(_mm_add_ps(bb, _mm_set1_ps(128.0f)));
+  }
+
+  for (int c = 0; c < 3; ++c)
+    out[c] = _mm_packus_epi16(_mm_packs_epi32(res[c][0], res[c][1]),
+                              _mm_packs_epi32(res[c][2], res[c][3]));
+  interleave_rgb16(out, dst);
+}
+
+static void lab_to_rgb16(const unsigned char *src, unsigned char *dst) {
+  const Lab_Tables &tables = lab_tables();
+  const __m128i zero = _mm_setzero_si128();
+  __m128i in[3];
+  deinterleave_rgb16(src, in);
+
+  for (int g = 0; g < 4; ++g) {
+    __m128 ch[3];
+    for (int c = 0; c < 3; ++c) {
+      const __m128i w = g < 2 ? _mm_unpacklo_epi8(in[c], zero)
+                              : _mm_unpackhi_epi8(in[c], zero);
+      ch[c] = _mm_cvtepi32_ps(g % 2 ? _mm_unpackhi_epi16(w, zero)
+                                    : _mm_unpacklo_epi16(w, zero));
+    }
+
+    const __m128 l = _mm_mul_ps(ch[0], _mm_set1_ps(100.0f / 255.0f));
+    const __m128 fy = _mm_mul_ps(_mm_add_ps(l, _mm_set1_ps(16.0f)),
+                                 _mm_set1_ps(1.0f / 116.0f));
+    const __m128 fx = _mm_add_ps(
+        fy, _mm_mul_ps(_mm_sub_ps(ch[1], _mm_set1_ps(128.0f)),
+                       _mm_set1_ps(1.0f / 500.0f)));
+    const __m128 fz = _mm_sub_ps(
+        fy, _mm_mul_ps(_mm_sub_ps(ch[2], _mm_set1_ps(128.0f)),
+                       _mm_set1_ps(1.0f / 200.0f)));
+
+    /* Inverse of f: f^3 above 6/29, linear segment below. */
+    __m128 t[3];
+    const __m128 fs[3] = {fx, fy, fz};
+    for (int c = 0; c < 3; ++c) {
+      const __m128 cube = _mm_mul_ps(fs[c], _mm_mul_ps(fs[c], fs[c]));
+      const __m128 linear =
+          _mm_mul_ps(_mm_sub_ps(fs[c], _mm_set1_ps(4.0f / 29.0f)),
+                     _mm_set1_ps(3.0f * 36.0f / 841.0f));
+      const __m128 above = _mm_cmpgt_ps(fs[c], _mm_set1_ps(6.0f / 29.0f));
+      t[c] = _mm_or_ps(_mm_and_ps(above, cube), _mm_andnot_ps(above, linear));
+    }
+
+    for (int c = 0; c < 3; ++c) {
+      const __m128 lin = _mm_min_ps(
+          _mm_max_ps(matrix_row(tables.from_xyz[c], t[0], t[1], t[2]),
+                     _mm_setzero_ps()),
+          _mm_set1_ps(1.0f));
+      alignas(16) int idx[4];
+      _mm_store_si128(reinterpret_cast<__m128i *>(idx),
+                      _mm_cvtps_epi32(_mm_mul_ps(
+                          lin, _mm_set1_ps(static_cast<float>(
+                                   Lab_Tables::encode_steps)))));
+      for (int i = 0; i < 4; ++i)
+        dst[(4 * g + i) * 3 + c] = tables.encode[idx[i]];
+    }
+  }
+}
+
+std::vector<unsigned char> convert_rgb_to(const std::vector<unsigned char> &rgb,
+                                          Colour_Space space) {
+  switch (space) {
+  case Colour_Space::RGB:
+    if (rgb.size() % 3 != 0)
+      throw std::invalid_argument("RGB buffer must have a multiple of 3 bytes");
+    return rgb;
+  case Colour_Space::HSV:
+    return convert_pixels16(rgb, rgb_to_hsv16);
+  case Colour_Space::LAB:
+    return convert_pixels16(rgb, rgb_to_lab16);
+  default: {
+    const Fixed_Colour_Matrix fixed = to_fixed(ycbcr_matrix(space));
+    return convert_pixels16(rgb, [&](const unsigned char *s, unsigned char *d) {
+      colour_matrix16(s, d, fixed);
+    });
+  }
+  }
+}
+
+std::vector<unsigned char>
+convert_to_rgb(const std::vector<unsigned char> &bytes, Colour_Space space) {
+  switch (space) {
+  case Colour_Space::RGB:
+    if (bytes.size() % 3 != 0)
+      throw std::invalid_argument("RGB buffer must have a multiple of 3 bytes");
+    return bytes;
+  case Colour_Space::HSV:
+    return convert_pixels16(bytes, hsv_to_rgb16);
+  case Colour_Space::LAB:
+    return convert_pixels16(bytes, lab_to_rgb16);
+  default: {
+    const Fixed_Colour_Matrix fixed =
+        to_fixed(invert_colour_matrix(ycbcr_matrix(space)));
+    return convert_pixels16(bytes,
+                            [&](const unsigned char *s, unsigned char *d) {
+                              colour_matrix16(s, d, fixed);
+                            });
+  }
+  }
+}
+
+std::vector<std::vector<unsigned char>>
+split_planes(const std::vector<unsigned char> &bytes, unsigned int channels) {
+  if (channels == 0 || bytes.size() % channels != 0)
+    throw std::invalid_argument("Buffer size must be a multiple of channels");
+
+  const std::size_t pixels = bytes.size() / channels;
+  std::vector<std::vector<unsigned char>> planes(
+      channels, std::vector<unsigned char>(pixels));
+
+  std::size_t i = 0;
+  if (channels == 3) {
+    for (; i + 16 <= pixels; i += 16) {
+      __m128i v[3];
+      deinterleave_rgb16(bytes.data() + i * 3, v);
+      for (int c = 0; c < 3; ++c)
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(planes[c].data() + i),
+                         v[c]);
+    }
+  }
+  for (; i < pixels; ++i)
+    for (unsigned int c = 0; c < channels; ++c)
+      planes[c][i] = bytes[i * channels + c];
+
+  return planes;
+}
+
+std::vector<unsigned char>
+merge_planes(const std::vector<std::vector<unsigned char>> &planes) {
+  if (planes.empty())
+    return {};
+  const std::size_t pixels = planes[0].size();
+  for (const auto &plane : planes)
+    if (plane.size() != pixels)
+      throw std::invalid_argument("Planes must all have the same size");
+
+  const std::size_t channels = planes.size();
+  std::vector<unsigned char> bytes(pixels * channels);
+
+  std::size_t i = 0;
+  if (channels == 3) {
+    for (; i + 16 <= pixels; i += 16) {
+      __m128i v[3];
+      for (int c = 0; c < 3; ++c)
+        v[c] = _mm_loadu_si128(
+            reinterpret_cast<const __m128i *>(planes[c].data() + i));
+      interleave_rgb16(v, bytes.data() + i * 3);
+    }
+  }
+  for (; i < pixels; ++i)
+    for (std::size_t c = 0; c < channels; ++c)
+      bytes[i * channels + c] = planes[c][i];
+
+  return bytes;
+}
+
+#endif
@@ -0,0 +1,186 @@
+#ifndef DEADLINE_HPP_
+#define DEADLINE_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <stdexcept>
+
+/**
+ * @brief Thrown by check_deadline() once the current deadline has passed.
+ */
+class Deadline_Exceeded : public std::runtime_error {
+public:
+  Deadline_Exceeded() : std::runtime_error("Deadline exceeded") {}
+};
+
+/**
+ * @brief The time by which the work of one job must stop.
+ *
+ * Work is cancelled cooperatively: the pool checks the deadline between the
+ * tasks and row bands of a filter, and the PNG codec between deflate blocks,
+ * and they throw Deadline_Exceeded once it has expired. A default-constructed
+ * deadline never expires. Copies of a deadline made with a time, even
+ * Clock::time_point::max(), share cancel(), so every thread working on a job
+ * stops when any holder cancels it.
+ */
+class Deadline {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  /** A deadline that never expires. */
+  Deadline() = default;
+
+  /**
+   * @param when Time at which the deadline expires.
+   */
+  explicit Deadline(Clock::time_point when);
+
+  /**
+   * @brief Whether the deadline can expire, i.e. it has a time or a cancel
+   * flag; work with an unlimited deadline skips the checks.
+   */
+  bool limited() const;
+
+  /**
+   * @brief Whether the time has passed or the deadline was cancelled.
+   */
+  bool expired() const;
+
+  /**
+   * @brief Time left, zero once expired; Clock::duration::max() if unlimited.
+   */
+  Clock::duration remaining() const;
+
+  /**
+   * @brief Expires this deadline and every copy of it at once; a
+   * default-constructed deadline has no copies to share this with.
+   */
+  void cancel();
+
+  /**
+   * @brief A deadline at the given fraction of the remaining time that is
+   * also cancelled with this one.
+   *
+   * @param fraction Share of remaining(), between 0 and 1.
+   */
+  Deadline portion(double fraction) const;
+
+private:
+  Clock::time_point when_ = Clock::time_point::max();
+  std::shared_ptr<std::atomic<bool>> cancelled_;
+};
+
+/**
+ * @brief The deadline of the work running on the calling thread.
+ *
+ * Thread_Pool::run and parallel_for carry it into the tasks they start.
+ */
+const Deadline &current_deadline();
+
+/**
+ * @brief Throws Deadline_Exceeded if current_deadline() has expired.
+ */
+void check_deadline();
+
+/**
+ * @brief Makes a deadline current on the calling thread for its lifetime,
+ * restoring the previous one afterwards.
+ */
+class Deadline_Scope {
+public:
+  explicit Deadline_Scope(Deadline deadline);
+  ~Deadline_Scope();
+
+  Deadline_Scope(const Deadline_Scope &) = delete;
+  Deadline_Scope &operator=(const Deadline_Scope &) = delete;
+
+private:
+  Deadline previous_;
+};
+
+/**
+ * @brief Runs full, falling back to degraded if it cannot finish in time.
+ *
+ * With a limited current deadline, full gets the given share of the time
+ * left; if it runs out while the current deadline has not, degraded runs with
+ * the rest. Without a deadline full simply runs.
+ *
+ * @param share Fraction of the remaining time given to full.
+ * @param full Work at full quality.
+ * @param degraded Cheaper work with a result of the same type.
+ * @throws Deadline_Exceeded If the current deadline expires in either.
+ */
+template <typename Full, typename Degraded>
+auto run_with_fallback(double share, Full &&full, Degraded &&degraded) {
+  const Deadline deadline = current_deadline();
+  if (!deadline.limited())
+    return full();
+  try {
+    Deadline_Scope scope(deadline.portion(share));
+    return full();
+  } catch (const Deadline_Exceeded &) {
+    if (deadline.expired())
+      throw;
+  }
+  return degraded();
+}
+
+#endif
+
+#ifdef DEADLINE_IMPLEMENTATION
+
+#include <algorithm>
+#include <utility>
+
+static thread_local Deadline deadline_current;
+
+Deadline::Deadline(Clock::time_point when)
+    : when_(when), cancelled_(std::make_shared<std::atomic<bool>>(false)) {}
+
+bool Deadline::limited() const { return cancelled_ != nullptr; }
+
+bool Deadline::expired() const {
+  return cancelled_ && (cancelled_->load(std::memory_order_relaxed) ||
+                        Clock::now() >= when_);
+}
+
+Deadline::Clock::duration Deadline::remaining() const {
+  if (!cancelled_)
+    return Clock::duration::max();
+  if (cancelled_->load(std::memory_order_relaxed))
+    return Clock::duration::zero();
+  return std::max(when_ - Clock::now(), Clock::duration::zero());
+}
+
+void Deadline::cancel() {
+  if (!cancelled_)
+    cancelled_ = std::make_shared<std::atomic<bool>>(false);
+  cancelled_->store(true, std::memory_order_relaxed);
+}
+
+Deadline Deadline::portion(double fraction) const {
+  if (!cancelled_ || when_ == Clock::time_point::max())
+    return *this;
+  Deadline part = *this;
+  part.when_ = Clock::now() +
+               std::chrono::duration_cast<Clock::duration>(
+                   remaining() * std::clamp(fraction, 0.0, 1.0));
+  return part;
+}
+
+const Deadline &current_deadline() { return deadline_current; }
+
+void check_deadline() {
+  if (deadline_current.expired())
+    throw Deadline_Exceeded();
+}
+
+Deadline_Scope::Deadline_Scope(Deadline deadline)
+    : previous_(std::exchange(deadline_current, std::move(deadline))) {}
+
+Deadline_Scope::~Deadline_Scope() {
+  deadline_current = std::move(previous_);
+}
+
+#endif
@@ -0,0 +1,464 @@
+#ifndef FFT_HPP_
+#define FFT_HPP_
+
+#include <cstddef>
+#include <vector>
+
+/**
+ * @brief Complex FFT of a fixed power-of-two size on split real/imag arrays.
+ *
+ * Uses a Stockham autosort formulation (no bit reversal) made of radix-4
+ * stages plus one radix-2 stage when log2(n) is odd. Butterflies run four at
+ * a time with SSE, vectorized across the stride once it reaches four and
+ * across the butterfly index with a 4x4 transpose in the first stage. Methods
+ * are const and use thread-local scratch, so one plan can be shared between
+ * threads.
+ */
+class Fft_Plan {
+public:
+  /**
+   * @brief Precomputes twiddle factors for a transform of size n.
+   *
+   * @param n Transform size, must be a power of two.
+   * @throws std::invalid_argument If n is not a power of two.
+   */
+  explicit Fft_Plan(std::size_t n);
+
+  std::size_t size() const { return n_; }
+
+  /**
+   * @brief In-place forward transform, X[k] = sum x[j] e^(-2 pi i jk / n).
+   */
+  void forward(float *re, float *im) const;
+
+  /**
+   * @brief In-place inverse transform, scaled by 1/n.
+   */
+  void inverse(float *re, float *im) const;
+
+private:
+  std::size_t n_;
+  std::vector<std::vector<float>> twiddles_;
+};
+
+/**
+ * @brief Real-to-complex FFT of a power-of-two size.
+ *
+ * The n real samples are packed into n/2 complex values, transformed with an
+ * Fft_Plan of half the size and split into the n/2 + 1 non-redundant bins.
+ */
+class Real_Fft_Plan {
+public:
+  /**
+   * @param n Transform size, must be a power of two of at least 2.
+   * @throws std::invalid_argument If n is not a power of two of at least 2.
+   */
+  explicit Real_Fft_Plan(std::size_t n);
+
+  std::size_t size() const { return n_; }
+
+  /**
+   * @brief Transforms n real samples into n/2 + 1 complex bins.
+   */
+  void forward(const float *in, float *re, float *im) const;
+
+  /**
+   * @brief Transforms n/2 + 1 complex bins back into n real samples, scaled
+   * by 1/n so that inverse(forward(x)) == x.
+   */
+  void inverse(const float *re, const float *im, float *out) const;
+
+private:
+  std::size_t n_;
+  Fft_Plan half_;
+  std::vector<float> cos_, sin_;
+};
+
+/**
+ * @brief 2D real-to-complex FFT over a rows x cols block.
+ *
+ * Rows go through Real_Fft_Plan, then each of the cols/2 + 1 spectrum
+ * columns goes through a complex Fft_Plan. Spectra are stored row-major with
+ * cols/2 + 1 entries per row.
+ */
+class Real_Fft_2D_Plan {
+public:
+  /**
+   * @throws std::invalid_argument If rows or cols is not a power of two, or
+   * cols is less than 2.
+   */
+  Real_Fft_2D_Plan(std::size_t rows, std::size_t cols);
+
+  std::size_t rows() const { return rows_; }
+  std::size_t cols() const { return cols_; }
+  std::size_t spectrum_cols() const { return cols_ / 2 + 1; }
+
+  void forward(const float *in, float *re, float *im) const;
+  void inverse(const float *re, const float *im, float *out) const;
+
+private:
+  std::size_t rows_, cols_;
+  Real_Fft_Plan row_plan_;
+  Fft_Plan column_plan_;
+};
+
+#endif
+
+#ifdef FFT_IMPLEMENTATION
+
+#include <xmmintrin.h>
+
+#include <algorithm>
+#include <cmath>
+#include <numbers>
+#include <stdexcept>
+
+static bool is_power_of_two(std::size_t n) { return n && !(n & (n - 1)); }
+
+Fft_Plan::Fft_Plan(std::size_t n) : n_(n) {
+  if (!is_power_of_two(n))
+    throw std::invalid_argument("FFT size must be a power of two");
+
+  /* Per radix-4 stage: w^p, w^2p, w^3p for p < n/4, stored re/im split. */
+  for (std::size_t len = n; len >= 4; len /= 4) {
+    const std::size_t quarter = len / 4;
+    std::vector<float> table(6 * quarter);
+    for (std::size_t p = 0; p < quarter; ++p) {
+      for (std::size_t k = 1; k <= 3; ++k) {
+        const double angle = -2.0 * std::numbers::pi *
+                             static_cast<double>(k * p) /
+                             static_cast<double>(len);
+        table[(2 * k - 2) * quarter + p] = static_cast<float>(std::cos(angle));
+        table[(2 * k - 1) * quarter + p] = static_cast<float>(std::sin(angle));
+      }
+    }
+    twiddles_.push_back(std::move(table));
+  }
+}
+
+static void fft_radix4_stage(std::size_t len, std::size_t s, const float *xr,
+                             const float *xi, float *yr, float *yi,
+                             const float *tw) {
+  const std::size_t quarter = len / 4;
+  const float *w1r = tw, *w1i = tw + quarter;
+  const float *w2r = tw + 2 * quarter, *w2i = tw + 3 * quarter;
+  const float *w3r = tw + 4 * quarter, *w3i = tw + 5 * quarter;
+
+  auto cmul_re = [](__m128 ar, __m128 ai, __m128 br, __m128 bi) {
+    return _mm_sub_ps(_mm_mul_ps(ar, br), _mm_mul_ps(ai, bi));
+  };
+  auto cmul_im = [](__m128 ar, __m128 ai, __m128 br, __m128 bi) {
+    return _mm_add_ps(_mm_mul_ps(ar, bi), _mm_mul_ps(ai, br));
+  };
+
+  if (s >= 4) {
+    for (std::size_t p = 0; p < quarter; ++p) {
+      const __m128 v1r = _mm_set1_ps(w1r[p]), v1i = _mm_set1_ps(w1i[p]);
+      const __m128 v2r = _mm_set1_ps(w2r[p]), v2i = _mm_set1_ps(w2i[p]);
+      const __m128 v3r = _mm_set1_ps(w3r[p]), v3i = _mm_set1_ps(w3i[p]);
+      const std::size_t ia = s * p, ib = s * (p + quarter),
+                        ic = s * (p + 2 * quarter), id = s * (p + 3 * quarter);
+      const std::size_t o = s * 4 * p;
+
+      for (std::size_t q = 0; q < s; q += 4) {
+        const __m128 ar = _mm_loadu_ps(xr + ia + q),
+                     ai = _mm_loadu_ps(xi + ia + q);
+        const __m128 br = _mm_loadu_ps(xr + ib + q),
+                     bi = _mm_loadu_ps(xi + ib + q);
+        const __m128 cr = _mm_loadu_ps(xr + ic + q),
+                     ci = _mm_loadu_ps(xi + ic + q);
+        const __m128 dr = _mm_loadu_ps(xr + id + q),
+                     di = _mm_loadu_ps(xi + id + q);
+
+        const __m128 apc_r = _mm_add_ps(ar, cr), apc_i = _mm_add_ps(ai, ci);
+        const __m128 amc_r = _mm_sub_ps(ar, cr), amc_i = _mm_sub_ps(ai, ci);
+        const __m128 bpd_r = _mm_add_ps(br, dr), bpd_i = _mm_add_ps(bi, di);
+        const __m128 bmd_r = _mm_sub_ps(br, dr), bmd_i = _mm_sub_ps(bi, di);
+
+        const __m128 t1r = _mm_add_ps(amc_r, bmd_i),
+                     t1i = _mm_sub_ps(amc_i, bmd_r);
+        const __m128 t2r = _mm_sub_ps(apc_r, bpd_r),
+                     t2i = _mm_sub_ps(apc_i, bpd_i);
+        const __m128 t3r = _mm_sub_ps(amc_r, bmd_i),
+                     t3i = _mm_add_ps(amc_i, bmd_r);
+
+        _mm_storeu_ps(yr + o + q, _mm_add_ps(apc_r, bpd_r));
+        _mm_storeu_ps(yi + o + q, _mm_add_ps(apc_i, bpd_i));
+        _mm_storeu_ps(yr + o + s + q, cmul_re(v1r, v1i, t1r, t1i));
+        _mm_storeu_ps(yi + o + s + q, cmul_im(v1r, v1i, t1r, t1i));
+        _mm_storeu_ps(yr + o + 2 * s + q, cmul_re(v2r, v2i, t2r, t2i));
+        _mm_storeu_ps(yi + o + 2 * s + q, cmul_im(v2r, v2i, t2r, t2i));
+        _mm_storeu_ps(yr + o + 3 * s + q, cmul_re(v3r, v3i, t3r, t3i));
+        _mm_storeu_ps(yi + o + 3 * s + q, cmul_im(v3r, v3i, t3r, t3i));
+      }
+    }
+    return;
+  }
+
+  std::size_t p = 0;
+  if (s == 1) {
+    /* Vectorize across p; the four outputs of each butterfly are adjacent,
+     * so a 4x4 transpose turns them into contiguous stores. */
+    for (; p + 4 <= quarter; p += 4) {
+      const __m128 ar = _mm_loadu_ps(xr + p), ai = _mm_loadu_ps(xi + p);
+      const __m128 br = _mm_loadu_ps(xr + p + quarter),
+                   bi = _mm_loadu_ps(xi + p + quarter);
+      const __m128 cr = _mm_loadu_ps(xr + p + 2 * quarter),
+                   ci = _mm_loadu_ps(xi + p + 2 * quarter);
+      const __m128 dr = _mm_loadu_ps(xr + p + 3 * quarter),
+                   di = _mm_loadu_ps(xi + p + 3 * quarter);
+
+      const __m128 apc_r = _mm_add_ps(ar, cr), apc_i = _mm_add_ps(ai, ci);
+      const __m128 amc_r = _mm_sub_ps(ar, cr), amc_i = _mm_sub_ps(ai, ci);
+      const __m128 bpd_r = _mm_add_ps(br, dr), bpd_i = _mm_add_ps(bi, di);
+      const __m128 bmd_r = _mm_sub_ps(br, dr), bmd_i = _mm_sub_ps(bi, di);
+
+      const __m128 t1r = _mm_add_ps(amc_r, bmd_i),
+                   t1i = _mm_sub_ps(amc_i, bmd_r);
+      const __m128 t2r = _mm_sub_ps(apc_r, bpd_r),
+                   t2i = _mm_sub_ps(apc_i, bpd_i);
+      const __m128 t3r = _mm_sub_ps(amc_r, bmd_i),
+                   t3i = _mm_add_ps(amc_i, bmd_r);
+
+      const __m128 v1r = _mm_loadu_ps(w1r + p), v1i = _mm_loadu_ps(w1i + p);
+      const __m128 v2r = _mm_loadu_ps(w2r + p), v2i = _mm_loadu_ps(w2i + p);
+      const __m128 v3r = _mm_loadu_ps(w3r + p), v3i = _mm_loadu_ps(w3i + p);
+
+      __m128 y0r = _mm_add_ps(apc_r, bpd_r), y0i = _mm_add_ps(apc_i, bpd_i);
+      __m128 y1r = cmul_re(v1r, v1i, t1r, t1i),
+             y1i = cmul_im(v1r, v1i, t1r, t1i);
+      __m128 y2r = cmul_re(v2r, v2i, t2r, t2i),
+             y2i = cmul_im(v2r, v2i, t2r, t2i);
+      __m128 y3r = cmul_re(v3r, v3i, t3r, t3i),
+             y3i = cmul_im(v3r, v3i, t3r, t3i);
+
+      _MM_TRANSPOSE4_PS(y0r, y1r, y2r, y3r);
+      _MM_TRANSPOSE4_PS(y0i, y1i, y2i, y3i);
+
+      _mm_storeu_ps(yr + 4 * p, y0r);
+      _mm_storeu_ps(yr + 4 * p + 4, y1r);
+      _mm_storeu_ps(yr + 4 * p + 8, y2r);
+      _mm_storeu_ps(yr + 4 * p + 12, y3r);
+      _mm_storeu_ps(yi + 4 * p, y0i);
+      _mm_storeu_ps(yi + 4 * p + 4, y1i);
+      _mm_storeu_ps(yi + 4 * p + 8, y2i);
+      _mm_storeu_ps(yi + 4 * p + 12, y3i);
+    }
+  }
+
+  for (; p < quarter; ++p) {
+    for (std::size_t q = 0; q < s; ++q) {
+      const std::size_t a = q + s * p, b = a + s * quarter,
+                        c = a + 2 * s * quarter, d = a + 3 * s * quarter;
+      const float apc_r = xr[a] + xr[c], apc_i = xi[a] + xi[c];
+      const float amc_r = xr[a] - xr[c], amc_i = xi[a] - xi[c];
+      const float bpd_r = xr[b] + xr[d], bpd_i = xi[b] + xi[d];
+      const float bmd_r = xr[b] - xr[d], bmd_i = xi[b] - xi[d];
+
+      const float t1r = amc_r + bmd_i, t1i = amc_i - bmd_r;
+      const float t2r = apc_r - bpd_r, t2i = apc_i - bpd_i;
+      const float t3r = amc_r - bmd_i, t3i = amc_i + bmd_r;
+
+      const std::size_t o = q + s * 4 * p;
+      yr[o] = apc_r + bpd_r;
+      yi[o] = apc_i + bpd_i;
+      yr[o + s] = w1r[p] * t1r - w1i[p] * t1i;
+      yi[o + s] = w1r[p] * t1i + w1i[p] * t1r;
+      yr[o + 2 * s] = w2r[p] * t2r - w2i[p] * t2i;
+      yi[o + 2 * s] = w2r[p] * t2i + w2i[p] * t2r;
+      yr[o + 3 * s] = w3r[p] * t3r - w3i[p] * t3i;
+      yi[o + 3 * s] = w3r[p] * t3i + w3i[p] * t3r;
+    }
+  }
+}
+
+static void fft_radix2_stage(std::size_t s, const float *xr, const float *xi,
+                             float *yr, float *yi) {
+  std::size_t q = 0;
+  for (; q + 4 <= s; q += 4) {
+    const __m128 ar = _mm_loadu_ps(xr + q), ai = _mm_loadu_ps(xi + q);
+    const __m128 br = _mm_loadu_ps(xr + q + s), bi = _mm_loadu_ps(xi + q + s);
+    _mm_storeu_ps(yr + q, _mm_add_ps(ar, br));
+    _mm_storeu_ps(yi + q, _mm_add_ps(ai, bi));
+    _mm_storeu_ps(yr + q + s, _mm_sub_ps(ar, br));
+    _mm_storeu_ps(yi + q + s, _mm_sub_ps(ai, bi));
+  }
+  for (; q < s; ++q) {
+    const float ar = xr[q], ai = xi[q], br = xr[q + s], bi = xi[q + s];
+    yr[q] = ar + br;
+    yi[q] = ai + bi;
+    yr[q + s] = ar - br;
+    yi[q + s] = ai - bi;
+  }
+}
+
+void Fft_Plan::forward(float *re, float *im) const {
+  if (n_ < 2)
+    return;
+
+  thread_local std::vector<float> scratch;
+  if (scratch.size() < 2 * n_)
+    scratch.resize(2 * n_);
+
+  float *xr = re, *xi = im;
+  float *yr = scratch.data(), *yi = scratch.data() + n_;
+
+  std::size_t len = n_, s = 1, stage = 0;
+  for (; len >= 4; len /= 4, s *= 4, ++stage) {
+    fft_radix4_stage(len, s, xr, xi, yr, yi, twiddles_[stage].data());
+    std::swap(xr, yr);
+    std::swap(xi, yi);
+  }
+  if (len == 2) {
+    fft_radix2_stage(s, xr, xi, yr, yi);
+    std::swap(xr, yr);
+    std::swap(xi, yi);
+  }
+
+  if (xr != re) {
+    std::copy_n(xr, n_, re);
+    std::copy_n(xi, n_, im);
+  }
+}
+
+void Fft_Plan::inverse(float *re, float *im) const {
+  for (std::size_t i = 0; i < n_; ++i)
+    im[i] = -im[i];
+
+  forward(re, im);
+
+  const float scale = 1.0f / static_cast<float>(n_);
+  for (std::size_t i = 0; i < n_; ++i) {
+    re[i] *= scale;
+    im[i] *= -scale;
+  }
+}
+
+static std::size_t checked_real_fft_size(std::size_t n) {
+  if (n < 2 || !is_power_of_two(n))
+    throw std::invalid_argument("Real FFT size must be a power of two >= 2");
+  return n;
+}
+
+Real_Fft_Plan::Real_Fft_Plan(std::size_t n)
+    : n_(checked_real_fft_size(n)), half_(n / 2), cos_(n / 2 + 1),
+      sin_(n / 2 + 1) {
+  for (std::size_t k = 0; k <= n / 2; ++k) {
+    const double angle = -2.0 * std::numbers::pi * static_cast<double>(k) /
+                         static_cast<double>(n);
+    cos_[k] = static_cast<float>(std::cos(angle));
+    sin_[k] = static_cast<float>(std::sin(angle));
+  }
+}
+
+void Real_Fft_Plan::forward(const float *in, float *re, float *im) const {
+  const std::size_t m = n_ / 2;
+
+  thread_local std::vector<float> packed;
+  if (packed.size() < 2 * m)
+    packed.resize(2 * m);
+  float *zr = packed.data(), *zi = packed.data() + m;
+
+  for (std::size_t k = 0; k < m; ++k) {
+    zr[k] = in[2 * k];
+    zi[k] = in[2 * k + 1];
+  }
+
+  half_.forward(zr, zi);
+
+  for (std::size_t k = 0; k <= m; ++k) {
+    const std::size_t a = k % m, b = (m - k) % m;
+    /* Even and odd sample spectra: Fe = (Z[k] + Z*[m-k]) / 2,
+     * Fo = (Z[k] - Z*[m-k]) / 2i. */
+    const float fe_r = 0.5f * (zr[a] + zr[b]), fe_i = 0.5f * (zi[a] - zi[b]);
+    const float fo_r = 0.5f * (zi[a] + zi[b]), fo_i = -0.5f * (zr[a] - zr[b]);
+    re[k] = fe_r + cos_[k] * fo_r - sin_[k] * fo_i;
+    im[k] = fe_i + cos_[k] * fo_i + sin_[k] * fo_r;
+  }
+}
+
+void Real_Fft_Plan::inverse(const float *re, const float *im,
+                            float *out) const {
+  const std::size_t m = n_ / 2;
+
+  thread_local std::vector<float> packed;
+  if (packed.size() < 2 * m)
+    packed.resize(2 * m);
+  float *zr = packed.data(), *zi = packed.data() + m;
+
+  for (std::size_t k = 0; k < m; ++k) {
+    const std::size_t b = m - k;
+    const float fe_r = 0.5f * (re[k] + re[b]), fe_i = 0.5f * (im[k] - im[b]);
+    const float d_r = 0.5f * (re[k] - re[b]), d_i = 0.5f * (im[k] + im[b]);
+    /* Fo = d / W^k = d * conj(W^k). */
+    const float fo_r = d_r * cos_[k] + d_i * sin_[k];
+    const float fo_i = d_i * cos_[k] - d_r * sin_[k];
+    zr[k] = fe_r - fo_i;
+    zi[k] = fe_i + fo_r;
+  }
+
+  half_.inverse(zr, zi);
+
+  for (std::size_t k = 0; k < m; ++k) {
+    out[2 * k] = zr[k];
+    out[2 * k + 1] = zi[k];
+  }
+}
+
+Real_Fft_2D_Plan::Real_Fft_2D_Plan(std::size_t rows, std::size_t cols)
+    : rows_(rows), cols_(cols), row_plan_(cols), column_plan_(rows) {}
+
+void Real_Fft_2D_Plan::forward(const float *in, float *re, float *im) const {
+  const std::size_t sc = spectrum_cols();
+  for (std::size_t y = 0; y < rows_; ++y)
+    row_plan_.forward(in + y * cols_, re + y * sc, im + y * sc);
+
+  thread_local std::vector<float> column;
+  if (column.size() < 2 * rows_)
+    column.resize(2 * rows_);
+  float *cr = column.data(), *ci = column.data() + rows_;
+
+  for (std::size_t x = 0; x < sc; ++x) {
+    for (std::size_t y = 0; y < rows_; ++y) {
+      cr[y] = re[y * sc + x];
+      ci[y] = im[y * sc + x];
+    }
+    column_plan_.forward(cr, ci);
+    for (std::size_t y = 0; y < rows_; ++y) {
+      re[y * sc + x] = cr[y];
+      im[y * sc + x] = ci[y];
+    }
+  }
+}
+
+void Real_Fft_2D_Plan::inverse(const float *re, const float *im,
+                               float *out) const {
+  const std::size_t sc = spectrum_cols();
+
+  thread_local std::vector<float> spectrum;
+  if (spectrum.size() < 2 * rows_ * sc)
+    spectrum.resize(2 * rows_ * sc);
+  float *sr = spectrum.data(), *si = spectrum.data() + rows_ * sc;
+
+  thread_local std::vector<float> column;
+  if (column.size() < 2 * rows_)
+    column.resize(2 * rows_);
+  float *cr = column.data(), *ci = column.data() + rows_;
+
+  for (std::size_t x = 0; x < sc; ++x) {
+    for (std::size_t y = 0; y < rows_; ++y) {
+      cr[y] = re[y * sc + x];
+      ci[y] = im[y * sc + x];
+    }
+    column_plan_.inverse(cr, ci);
+    for (std::size_t y = 0; y < rows_; ++y) {
+      sr[y * sc + x] = cr[y];
+      si[y * sc + x] = ci[y];
+    }
+  }
+
+  for (std::size_t y = 0; y < rows_; ++y)
+    row_plan_.inverse(sr + y * sc, si + y * sc, out + y * cols_);
+}
+
+#endif
@@ -59,7 +59,11 @@ std::pair<std::vector<double>, int> generate_gaussian_kernel(double sigma);
  * @brief Applies Gaussian blur to an RGB image using separable convolution.
  *
  * Uses a two-pass approach (horizontal then vertical) for O(n*r) complexity
- * instead of O(n*r^2) for a full 2D convolution.
+ * instead of O(n*r^2) for a full 2D convolution, running both passes through
+ * the SIMD separable engine in apply_separable_convolution. The intermediate
+ * is float and the result is rounded once, within one level of
+ * reference_gaussian; versions that truncated after each pass gave results up
+ * to two levels darker.
  *
  * @param bytes Input RGB buffer (3 bytes per pixel).
  * @param width Image width in pixels.
@@ -72,6 +76,29 @@ std::vector<unsigned char>
 apply_gaussian_rgb(const std::vector<unsigned char> &bytes, unsigned int width,
                    unsigned int height, unsigned int blur_strength);
 
+/**
+ * @brief Applies Gaussian blur to an image with any number of channels.
+ *
+ * Same as apply_gaussian_rgb, but for interleaved buffers of the given channel
+ * count, e.g. a single luma plane.
+ *
+ * @param bytes Input buffer (channels bytes per pixel).
+ * @param width Image width in pixels.
+ * @param height Image height in pixels.
+ * @param channels Number of interleaved channels per pixel.
+ * @param blur_strength Blur intensity (sigma = blur_strength / 10.0).
+ * @param linear_light Blur in linear light: decode sRGB before the
+ * horizontal pass and re-encode after the vertical pass (see
+ * apply_separable_convolution_linear).
+ * @return std::vector<unsigned char> Blurred output (same size as input).
+ * @throws std::invalid_argument If the buffer size does not match the
+ * dimensions.
+ */
+std::vector<unsigned char>
+apply_gaussian(const std::vector<unsigned char> &bytes, unsigned int width,
+               unsigned int height, unsigned int channels,
+               unsigned int blur_strength, bool linear_light = false);
+
 /**
  * @brief Applies Laplacian edge detection to an RGB image.
  *
@@ -92,6 +119,21 @@ std::vector<unsigned char>
 apply_laplacian_rgb(const std::vector<unsigned char> &bytes, unsigned int width,
                     unsigned int height);
 
+/**
+ * @brief Applies the Laplacian kernel of apply_laplacian_rgb to a greyscale
+ * image, for callers that already hold its luma plane.
+ *
+ * @param grey Input greyscale buffer (1 byte per pixel).
+ * @param width Image width in pixels.
+ * @param height Image height in pixels.
+ * @return std::vector<unsigned char> Greyscale edge map (1 byte per pixel).
+ * @throws std::invalid_argument If the buffer size does not match the
+ * dimensions.
+ */
+std::vector<unsigned char>
+apply_laplacian(const std::vector<unsigned char> &grey, unsigned int width,
+                unsigned int height);
+
 #endif
 
 #ifdef FILTERS_IMPLEMENTATION
@@ -101,6 +143,7 @@ apply_laplacian_rgb(const std::vector<unsigned char> &bytes, unsigned int width,
 #include <tmmintrin.h>
 #include <xmmintrin.h>
 
+#include "convolve.hpp"
 #include "lodepng.h"
 
 #include <boost/align/is_aligned.hpp>
@@ -210,72 +253,42 @@ apply_gaussian_rgb(const std::vector<unsigned char> &bytes, unsigned int width,
   if (bytes.size() % 3 != 0)
     throw std::invalid_argument("RGB buffer must have a multiple of 3 bytes");
 
-  const int w = static_cast<int>(width);
-  const int h = static_cast<int>(height);
-  const int channels = 3;
+  return apply_gaussian(bytes, width, height, 3, blur_strength);
+}
 
+std::vector<unsigned char>
+apply_gaussian(const std::vector<unsigned char> &bytes, unsigned int width,
+               unsigned int height, unsigned int channels,
+               unsigned int blur_strength, bool linear_light) {
   double sigma = static_cast<double>(blur_strength) / 10.0;
   if (sigma < 0.1)
     sigma = 0.1;
 
-  auto [kernel, radius] = generate_gaussian_kernel(sigma);
-
-  std::vector<unsigned char> temp(bytes.size());
-  std::vector<unsigned char> output(bytes.size());
-  const unsigned char *src = bytes.data();
-
-  for (int y = 0; y < h; ++y) {
-    for (int x = 0; x < w; ++x) {
-      for (int c = 0; c < channels; ++c) {
-        double sum = 0.0;
-        for (int k = -radius; k <= radius; ++k) {
-          int sx = std::clamp(x + k, 0, w - 1);
-          sum += kernel[k + radius] * src[(y * w + sx) * channels + c];
-        }
-        temp[(y * w + x) * channels + c] =
-            static_cast<unsigned char>(std::clamp(sum, 0.0, 255.0));
-      }
-    }
-  }
-
-  for (int y = 0; y < h; ++y) {
-    for (int x = 0; x < w; ++x) {
-      for (int c = 0; c < channels; ++c) {
-        double sum = 0.0;
-        for (int k = -radius; k <= radius; ++k) {
-          int sy = std::clamp(y + k, 0, h - 1);
-          sum += kernel[k + radius] * temp[(sy * w + x) * channels + c];
-        }
-        output[(y * w + x) * channels + c] =
-            static_cast<unsigned char>(std::clamp(sum, 0.0, 255.0));
-      }
-    }
-  }
+  const std::vector<double> kernel = generate_gaussian_kernel(sigma).first;
+  const std::vector<float> taps(kernel.begin(), kernel.end());
 
-  return output;
+  if (linear_light)
+    return apply_separable_convolution_linear(bytes, width, height, channels,
+                                              taps, taps);
+  return apply_separable_convolution(bytes, width, height, channels, taps,
+                                     taps);
 }
 
 std::vector<unsigned char>
 apply_laplacian_rgb(const std::vector<unsigned char> &bytes, unsigned int width,
                     unsigned int height) {
-  if (bytes.size() % 3 != 0)
-    throw std::invalid_argument("RGB buffer must have a multiple of 3 bytes");
+  return apply_laplacian(apply_greyscale_rgb_simd(bytes), width, height);
+}
+
+std::vector<unsigned char>
+apply_laplacian(const std::vector<unsigned char> &grey, unsigned int width,
+                unsigned int height) {
+  if (grey.size() != static_cast<std::size_t>(width) * height)
+    throw std::invalid_argument("Buffer size does not match image dimensions");
 
   const int w = static_cast<int>(width);
   const int h = static_cast<int>(height);
-  const std::size_t pixels = static_cast<std::size_t>(w * h);
-
-  std::vector<unsigned char> grey(pixels);
-  const unsigned char *src = bytes.data();
-
-  for (std::size_t i = 0; i < pixels; ++i) {
-    const std::size_t idx = i * 3;
-    const unsigned char r = src[idx];
-    const unsigned char g = src[idx + 1];
-    const unsigned char b = src[idx + 2];
-    grey[i] =
-        static_cast<unsigned char>((77 * r + 150 * g + 29 * b + 128) >> 8);
-  }
+  const std::size_t pixels = grey.size();
 
   std::vector<unsigned char> output(pixels);
 
@@ -0,0 +1,438 @@
+#ifndef HISTOGRAM_HPP_
+#define HISTOGRAM_HPP_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief 256-bin histogram of an 8-bit plane.
+ */
+using Histogram = std::array<std::uint32_t, 256>;
+
+/**
+ * @brief Builds the histogram of a single-channel 8-bit buffer.
+ *
+ * The buffer is split across the thread pool. Each band counts into four
+ * interleaved sub-histograms so that runs of equal values do not serialize on
+ * store-to-load forwarding, bytes are fetched 16 at a time with SIMD loads,
+ * and the per-band histograms are merged in parallel by bin range.
+ *
+ * @param data Pointer to the plane.
+ * @param size Number of bytes in the plane.
+ * @return Histogram Count of each byte value.
+ */
+Histogram compute_histogram(const unsigned char *data, std::size_t size);
+
+/**
+ * @brief Applies global histogram equalization.
+ *
+ * Single-channel input (such as the output of apply_greyscale_rgb_simd) is
+ * remapped directly. RGB input is equalized on its luma: the luma change of
+ * each pixel is added to all three channels, which leaves Cb and Cr unchanged.
+ *
+ * @param bytes Input buffer (1 or 3 bytes per pixel).
+ * @param width Image width in pixels.
+ * @param height Image height in pixels.
+ * @param channels Number of channels per pixel (1 or 3).
+ * @return std::vector<unsigned char> Equalized output (same size as input).
+ * @throws std::invalid_argument If the buffer size does not match the
+ * dimensions or channels is not 1 or 3.
+ */
+std::vector<unsigned char>
+apply_equalize(const std::vector<unsigned char> &bytes, unsigned int width,
+               unsigned int height, unsigned int channels);
+
+/**
+ * @brief Clips a histogram at clip_limit times its mean bin count and spreads
+ * the clipped counts evenly over all bins, keeping its total.
+ *
+ * @param hist Histogram to clip in place.
+ * @param area Total of the histogram, e.g. the pixels of a CLAHE tile.
+ * @param clip_limit Clip limit relative to the mean bin count; 0 or less
+ * leaves the histogram unchanged.
+ */
+void clip_histogram(Histogram &hist, std::uint32_t area, double clip_limit);
+
+/**
+ * @brief Applies contrast limited adaptive histogram equalization (CLAHE).
+ *
+ * The image is divided into tiles_x by tiles_y tiles of equal size, fewer
+ * when the image is too small for that many tiles of a whole number of
+ * pixels. Tiles reaching past the right or bottom edge are filled by
+ * mirroring the image there. Each tile histogram is
+ * clipped at clip_limit times the mean bin count, the excess is redistributed
+ * evenly and the result is turned into a lookup table. Pixels are remapped by
+ * bilinear interpolation between the four nearest tile tables, with the
+ * interpolation done eight pixels at a time in 16-bit fixed point.
+ *
+ * @param bytes Input buffer (1 or 3 bytes per pixel).
+ * @param width Image width in pixels.
+ * @param height Image height in pixels.
+ * @param channels Number of channels per pixel (1 or 3).
+ * @param tiles_x Number of tiles across.
+ * @param tiles_y Number of tiles down.
+ * @param clip_limit Histogram clip limit relative to the mean bin count.
+ * @return std::vector<unsigned char> Equalized output (same size as input).
+ * @throws std::invalid_argument If the buffer size does not match the
+ * dimensions, channels is not 1 or 3 or there are no tiles.
+ */
+std::vector<unsigned char>
+apply_clahe(const std::vector<unsigned char> &bytes, unsigned int width,
+            unsigned int height, unsigned int channels, unsigned int tiles_x,
+            unsigned int tiles_y, double clip_limit);
+
+#endif
+
+#ifdef HISTOGRAM_IMPLEMENTATION
+
+#include <emmintrin.h>
+
+#include "filters.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+/* Counts bytes into four sub-histograms and adds them to hist. */
+static void accumulate_histogram(const unsigned char *data, std::size_t size,
+                                 std::uint32_t *hist) {
+  alignas(64) std::uint32_t sub[4][256] = {};
+
+  std::size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+    std::uint64_t lo = static_cast<std::uint64_t>(_mm_cvtsi128_si64(v));
+    std::uint64_t hi = static_cast<std::uint64_t>(
+        _mm_cvtsi128_si64(_mm_unpackhi_epi64(v, v)));
+    for (int j = 0; j < 8; j += 4) {
+      ++sub[0][(lo >> (8 * j)) & 0xFF];
+      ++sub[1][(lo >> (8 * j + 8)) & 0xFF];
+      ++sub[2][(lo >> (8 * j + 16)) & 0xFF];
+      ++sub[3][(lo >> (8 * j + 24)) & 0xFF];
+      ++sub[0][(hi >> (8 * j)) & 0xFF];
+      ++sub[1][(hi >> (8 * j + 8)) & 0xFF];
+      ++sub[2][(hi >> (8 * j + 16)) & 0xFF];
+      ++sub[3][(hi >> (8 * j + 24)) & 0xFF];
+    }
+  }
+  for (; i < size; ++i)
+    ++sub[i & 3][data[i]];
+
+  for (int b = 0; b < 256; ++b)
+    hist[b] += sub[0][b] + sub[1][b] + sub[2][b] + sub[3][b];
+}
+
+Histogram compute_histogram(const unsigned char *data, std::size_t size) {
+  constexpr std::size_t min_band = 1 << 16;
+
+  Thread_Pool &pool = default_thread_pool();
+  const std::size_t bands =
+      std::clamp<std::size_t>(size / min_band, 1, pool.size());
+
+  std::vector<Histogram> partial(bands, Histogram{});
+
+  pool.run(bands, [&](std::size_t band) {
+    const std::size_t first = size * band / bands;
+    const std::size_t last = size * (band + 1) / bands;
+    accumulate_histogram(data + first, last - first, partial[band].data());
+  });
+
+  Histogram hist{};
+  pool.run(4, [&](std::size_t part) {
+    for (std::size_t b = part * 64; b < (part + 1) * 64; ++b)
+      for (const auto &p : partial)
+        hist[b] += p[b];
+  });
+
+  return hist;
+}
+
+static void check_luma_buffer(const std::vector<unsigned char> &bytes,
+                              unsigned int width, unsigned int height,
+                              unsigned int channels) {
+  if (channels != 1 && channels != 3)
+    throw std::invalid_argument("Only 1 and 3 channel images are supported");
+  if (bytes.size() != static_cast<std::size_t>(width) * height * channels)
+    throw std::invalid_argument("Buffer size does not match image dimensions");
+}
+
+/* Adds (new_luma - old_luma) to every channel of each RGB pixel. */
+static std::vector<unsigned char>
+apply_luma_delta(const std::vector<unsigned char> &rgb,
+                 const std::vector<unsigned char> &old_luma,
+                 const std::vector<unsigned char> &new_luma,
+                 unsigned int width) {
+  std::vector<unsigned char> output(rgb.size());
+  const std::size_t row_bytes = static_cast<std::size_t>(width) * 3;
+  const std::size_t rows = old_luma.size() / width;
+
+  default_thread_pool().parallel_for(0, rows, [&](std::size_t first,
+                                                  std::size_t last) {
+    std::vector<unsigned char> up(row_bytes), down(row_bytes);
+    for (std::size_t y = first; y < last; ++y) {
+      for (std::size_t x = 0; x < width; ++x) {
+        const int d = new_luma[y * width + x] - old_luma[y * width + x];
+        const auto u = static_cast<unsigned char>(std::max(d, 0));
+        const auto v = static_cast<unsigned char>(std::max(-d, 0));
+        up[x * 3] = up[x * 3 + 1] = up[x * 3 + 2] = u;
+        down[x * 3] = down[x * 3 + 1] = down[x * 3 + 2] = v;
+      }
+
+      const unsigned char *src = rgb.data() + y * row_bytes;
+      unsigned char *dst = output.data() + y * row_bytes;
+      std::size_t i = 0;
+      for (; i + 16 <= row_bytes; i += 16) {
+        __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        __m128i a =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(up.data() + i));
+        __m128i s =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(down.data() + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i),
+                         _mm_subs_epu8(_mm_adds_epu8(p, a), s));
+      }
+      for (; i < row_bytes; ++i)
+        dst[i] = static_cast<unsigned char>(
+            std::clamp(src[i] + up[i] - down[i], 0, 255));
+    }
+  });
+
+  return output;
+}
+
+std::vector<unsigned char>
+apply_equalize(const std::vector<unsigned char> &bytes, unsigned int width,
+               unsigned int height, unsigned int channels) {
+  check_luma_buffer(bytes, width, height, channels);
+  if (bytes.empty())
+    return bytes;
+
+  const std::vector<unsigned char> luma =
+      channels == 3 ? apply_greyscale_rgb_simd(bytes) : bytes;
+  const Histogram hist = compute_histogram(luma.data(), luma.size());
+
+  std::array<unsigned char, 256> lut;
+  const std::uint64_t total = luma.size();
+  std::uint64_t cdf = 0, cdf_min = 0;
+  for (int v = 0; v < 256; ++v) {
+    cdf += hist[v];
+    if (cdf_min == 0)
+      cdf_min = cdf;
+    lut[v] = total == cdf_min
+                 ? static_cast<unsigned char>(v)
+                 : static_cast<unsigned char>(
+                       ((cdf - cdf_min) * 255 + (total - cdf_min) / 2) /
+                       (total - cdf_min));
+  }
+
+  std::vector<unsigned char> equalized(luma.size());
+  default_thread_pool().parallel_for(
+      0, luma.size(), [&](std::size_t first, std::size_t last) {
+        for (std::size_t i = first; i < last; ++i)
+          equalized[i] = lut[luma[i]];
+      });
+
+  if (channels == 1)
+    return equalized;
+  return apply_luma_delta(bytes, luma, equalized, width);
+}
+
+void clip_histogram(Histogram &hist, std::uint32_t area, double clip_limit) {
+  if (clip_limit <= 0.0)
+    return;
+  const auto limit = std::max<std::uint32_t>(
+      1, static_cast<std::uint32_t>(clip_limit * area / 256.0));
+
+  std::uint32_t excess = 0;
+  for (auto &count : hist) {
+    if (count > limit) {
+      excess += count - limit;
+      count = limit;
+    }
+  }
+
+  /* The remainder goes one count each to evenly spaced bins. */
+  const std::uint32_t share = excess / 256;
+  const std::uint32_t remainder = excess % 256;
+  for (auto &count : hist)
+    count += share;
+  if (remainder) {
+    const std::uint32_t step = std::max<std::uint32_t>(1, 256 / remainder);
+    for (std::uint32_t i = 0, b = 0; i < remainder; ++i, b += step)
+      ++hist[b];
+  }
+}
+
+/* Clips a tile histogram and turns it into a lookup table. */
+static void build_clahe_lut(Histogram &hist, std::uint32_t area,
+                            double clip_limit, unsigned char *lut) {
+  clip_histogram(hist, area, clip_limit);
+
+  const double scale = area ? 255.0 / area : 0.0;
+  std::uint32_t cdf = 0;
+  for (int v = 0; v < 256; ++v) {
+    cdf += hist[v];
+    lut[v] = static_cast<unsigned char>(
+        std::min(255.0, std::round(cdf * scale)));
+  }
+}
+
+std::vector<unsigned char>
+apply_clahe(const std::vector<unsigned char> &bytes, unsigned int width,
+            unsigned int height, unsigned int channels, unsigned int tiles_x,
+            unsigned int tiles_y, double clip_limit) {
+  check_luma_buffer(bytes, width, height, channels);
+  if (tiles_x == 0 || tiles_y == 0)
+    throw std::invalid_argument("CLAHE needs at least one tile");
+  if (bytes.empty())
+    return bytes;
+
+  const std::vector<unsigned char> luma =
+      channels == 3 ? apply_greyscale_rgb_simd(bytes) : bytes;
+
+  const int w = static_cast<int>(width);
+  const int h = static_cast<int>(height);
+  /* Tiles are rounded up to whole pixels; the count is then reduced to the
+   * tiles that still hold some, e.g. 8 tiles across 10 pixels become 5 of 2
+   * and 8 across 20 become 7 of 3, the last reaching one pixel past the
+   * edge. */
+  const int wanted_x = static_cast<int>(std::min(tiles_x, width));
+  const int wanted_y = static_cast<int>(std::min(tiles_y, height));
+  const int tile_w = (w + wanted_x - 1) / wanted_x;
+  const int tile_h = (h + wanted_y - 1) / wanted_y;
+  const int tx = (w + tile_w - 1) / tile_w;
+  const int ty = (h + tile_h - 1) / tile_h;
+
+  std::vector<unsigned char> luts(static_cast<std::size_t>(tx * ty) * 256);
+
+  Thread_Pool &pool = default_thread_pool();
+
+  pool.run(static_cast<std::size_t>(tx * ty), [&](std::size_t tile) {
+    const int ix = static_cast<int>(tile) % tx;
+    const int iy = static_cast<int>(tile) / tx;
+    const int x0 = ix * tile_w, x1 = std::min(w, x0 + tile_w);
+    const int y0 = iy * tile_h;
+
+    /* Every tile counts tile_w x tile_h pixels, so that all are clipped
+     * alike. The part past the edge, shorter than a tile, mirrors the pixels
+     * before it without repeating the edge pixel. */
+    const auto mirror = [](int i, int size) {
+      return i < size ? i : std::max(0, 2 * size - 2 - i);
+    };
+    Histogram hist{};
+    for (int y = y0; y < y0 + tile_h; ++y) {
+      const unsigned char *row = luma.data() + mirror(y, h) * w;
+      accumulate_histogram(row + x0, static_cast<std::size_t>(x1 - x0),
+                           hist.data());
+      for (int x = x1; x < x0 + tile_w; ++x)
+        ++hist[row[mirror(x, w)]];
+    }
+
+    build_clahe_lut(hist, static_cast<std::uint32_t>(tile_w * tile_h),
+                    clip_limit, luts.data() + tile * 256);
+  });
+
+  /* Tile index pairs and 8-bit weights, measured between tile centres. */
+  auto grid = [](int pos, int tile_size, int tiles, int &lo, int &hi,
+                 std::uint16_t &weight) {
+    const double g = (pos + 0.5) / tile_size - 0.5;
+    lo = static_cast<int>(std::floor(g));
+    int frac = static_cast<int>(std::lround((g - lo) * 256.0));
+    if (lo < 0) {
+      lo = 0;
+      frac = 0;
+    } else if (lo >= tiles - 1) {
+      lo = tiles - 1;
+      frac = 0;
+    }
+    hi = std::min(lo + 1, tiles - 1);
+    if (frac >= 256) {
+      lo = hi;
+      frac = 0;
+    }
+    weight = static_cast<std::uint16_t>(frac);
+  };
+
+  std::vector<int> col_lo(static_cast<std::size_t>(w));
+  std::vector<int> col_hi(static_cast<std::size_t>(w));
+  std::vector<std::uint16_t> col_w(static_cast<std::size_t>(w));
+  for (int x = 0; x < w; ++x)
+    grid(x, tile_w, tx, col_lo[x], col_hi[x], col_w[x]);
+
+  std::vector<unsigned char> equalized(luma.size());
+
+  pool.parallel_for(0, static_cast<std::size_t>(h), [&](std::size_t first,
+                                                        std::size_t last) {
+    const __m128i full = _mm_set1_epi16(256);
+    const __m128i round = _mm_set1_epi16(128);
+
+    for (int y = static_cast<int>(first); y < static_cast<int>(last); ++y) {
+      int row_lo, row_hi;
+      std::uint16_t wy;
+      grid(y, tile_h, ty, row_lo, row_hi, wy);
+
+      const unsigned char *top = luts.data() + row_lo * tx * 256;
+      const unsigned char *bottom = luts.data() + row_hi * tx * 256;
+      const unsigned char *src = luma.data() + y * w;
+      unsigned char *dst = equalized.data() + y * w;
+
+      const __m128i vwy = _mm_set1_epi16(static_cast<short>(wy));
+      const __m128i vwy_inv = _mm_sub_epi16(full, vwy);
+
+      int x = 0;
+      for (; x + 8 <= w; x += 8) {
+        alignas(16) std::uint16_t a[8], b[8], c[8], d[8], wx[8];
+        for (int j = 0; j < 8; ++j) {
+          const unsigned char v = src[x + j];
+          a[j] = top[col_lo[x + j] * 256 + v];
+          b[j] = top[col_hi[x + j] * 256 + v];
+          c[j] = bottom[col_lo[x + j] * 256 + v];
+          d[j] = bottom[col_hi[x + j] * 256 + v];
+          wx[j] = col_w[x + j];
+        }
+
+        const __m128i vwx = _mm_load_si128(reinterpret_cast<__m128i *>(wx));
+        const __m128i vwx_inv = _mm_sub_epi16(full, vwx);
+
+        auto lerp = [&](__m128i p, __m128i q, __m128i wp, __m128i wq) {
+          __m128i sum = _mm_add_epi16(_mm_mullo_epi16(p, wp),
+                                      _mm_mullo_epi16(q, wq));
+          return _mm_srli_epi16(_mm_add_epi16(sum, round), 8);
+        };
+
+        __m128i upper =
+            lerp(_mm_load_si128(reinterpret_cast<__m128i *>(a)),
+                 _mm_load_si128(reinterpret_cast<__m128i *>(b)), vwx_inv, vwx);
+        __m128i lower =
+            lerp(_mm_load_si128(reinterpret_cast<__m128i *>(c)),
+                 _mm_load_si128(reinterpret_cast<__m128i *>(d)), vwx_inv, vwx);
+        __m128i result = lerp(upper, lower, vwy_inv, vwy);
+
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(dst + x),
+                         _mm_packus_epi16(result, result));
+      }
+
+      for (; x < w; ++x) {
+        const unsigned char v = src[x];
+        const int wx = col_w[x];
+        const int upper = (top[col_lo[x] * 256 + v] * (256 - wx) +
+                           top[col_hi[x] * 256 + v] * wx + 128) >>
+                          8;
+        const int lower = (bottom[col_lo[x] * 256 + v] * (256 - wx) +
+                           bottom[col_hi[x] * 256 + v] * wx + 128) >>
+                          8;
+        dst[x] =
+            static_cast<unsigned char>((upper * (256 - wy) + lower * wy + 128) >>
+                                       8);
+      }
+    }
+  });
+
+  if (channels == 1)
+    return equalized;
+  return apply_luma_delta(bytes, luma, equalized, width);
+}
+
+#endif
@@ -0,0 +1,277 @@
+#ifndef INTEGRAL_HPP_
+#define INTEGRAL_HPP_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+/**
+ * @brief Summed-area table of one 8-bit channel with 32 or 64-bit sums.
+ *
+ * The table has (width + 1) x (height + 1) entries with a zero first row and
+ * column, so at(x, y) is the sum over [0, x) x [0, y) and any box sum costs
+ * four lookups. Sums wrap modulo 2^32 for the 32-bit table, which still gives
+ * exact box sums as long as a single box sum fits in 32 bits (boxes up to
+ * about 16M pixels, or 66K pixels for squared tables); use 64-bit
+ * accumulators beyond that.
+ *
+ * Rows are prefix-summed inside SSE registers. Row bands are built in
+ * parallel, each relative to its first row, and a second parallel pass adds
+ * the carried sums of the bands above.
+ */
+template <typename T> class Integral_Image {
+  static_assert(std::is_same_v<T, std::uint32_t> ||
+                    std::is_same_v<T, std::uint64_t>,
+                "Integral_Image supports 32 and 64-bit accumulators");
+
+public:
+  /**
+   * @brief Builds the table for one channel of an interleaved image.
+   *
+   * @param data Image buffer (channels bytes per pixel).
+   * @param width Image width in pixels.
+   * @param height Image height in pixels.
+   * @param channels Number of interleaved channels per pixel.
+   * @param channel Channel to integrate.
+   * @param squared Integrate squared values instead (for local variance).
+   * @throws std::invalid_argument If channel is not less than channels.
+   */
+  Integral_Image(const unsigned char *data, unsigned int width,
+                 unsigned int height, unsigned int channels = 1,
+                 unsigned int channel = 0, bool squared = false);
+
+  unsigned int width() const { return width_; }
+  unsigned int height() const { return height_; }
+
+  /**
+   * @brief Sum over [0, x) x [0, y).
+   */
+  T at(unsigned int x, unsigned int y) const {
+    return table_[static_cast<std::size_t>(y) * (width_ + 1) + x];
+  }
+
+  /**
+   * @brief The width + 1 entries at(0, y) .. at(width, y), for vectorized
+   * box sums along a row.
+   */
+  const T *row(unsigned int y) const {
+    return table_.data() + static_cast<std::size_t>(y) * (width_ + 1);
+  }
+
+  /**
+   * @brief Sum over the box [x0, x1) x [y0, y1), clipped to the image.
+   */
+  T box_sum(int x0, int y0, int x1, int y1) const {
+    const int w = static_cast<int>(width_), h = static_cast<int>(height_);
+    const auto cx = [&](int x) {
+      return static_cast<unsigned int>(std::clamp(x, 0, w));
+    };
+    const auto cy = [&](int y) {
+      return static_cast<unsigned int>(std::clamp(y, 0, h));
+    };
+    return static_cast<T>(at(cx(x1), cy(y1)) - at(cx(x0), cy(y1)) -
+                          at(cx(x1), cy(y0)) + at(cx(x0), cy(y0)));
+  }
+
+private:
+  unsigned int width_, height_;
+  std::vector<T> table_;
+};
+
+/**
+ * @brief Applies a box (mean) filter using one summed-area table per channel.
+ *
+ * Each output pixel is the rounded mean of the box_width x box_height window
+ * centred on it, computed in O(1) regardless of the box size. Near the edges
+ * the window is clipped to the image and the mean is taken over the pixels
+ * that remain.
+ *
+ * @param bytes Input buffer (channels bytes per pixel).
+ * @param width Image width in pixels.
+ * @param height Image height in pixels.
+ * @param channels Number of interleaved channels per pixel.
+ * @param box_width Window width in pixels.
+ * @param box_height Window height in pixels.
+ * @return std::vector<unsigned char> Filtered output (same size as input).
+ * @throws std::invalid_argument If the buffer size does not match the
+ * dimensions or the box is empty.
+ */
+std::vector<unsigned char>
+apply_box_filter(const std::vector<unsigned char> &bytes, unsigned int width,
+                 unsigned int height, unsigned int channels,
+                 unsigned int box_width, unsigned int box_height);
+
+#endif
+
+#ifdef INTEGRAL_IMPLEMENTATION
+
+#include <emmintrin.h>
+
+#include "thread_pool.hpp"
+
+#include <stdexcept>
+
+/* Widens one channel of a row to T, optionally squaring. */
+template <typename T>
+static void integral_load_row(const unsigned char *row, unsigned int width,
+                              unsigned int channels, bool squared, T *out) {
+  for (unsigned int x = 0; x < width; ++x) {
+    const T v = row[x * channels];
+    out[x] = squared ? v * v : v;
+  }
+}
+
+/* In-register inclusive prefix sum of a row of 32-bit values. */
+static void integral_prefix_row(std::uint32_t *row, unsigned int width) {
+  __m128i carry = _mm_setzero_si128();
+  unsigned int x = 0;
+  for (; x + 4 <= width; x += 4) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<__m128i *>(row + x));
+    v = _mm_add_epi32(v, _mm_slli_si128(v, 4));
+    v = _mm_add_epi32(v, _mm_slli_si128(v, 8));
+    v = _mm_add_epi32(v, carry);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(row + x), v);
+    carry = _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 3, 3, 3));
+  }
+  std::uint32_t sum = static_cast<std::uint32_t>(_mm_cvtsi128_si32(carry));
+  for (; x < width; ++x)
+    row[x] = sum += row[x];
+}
+
+/* In-register inclusive prefix sum of a row of 64-bit values. */
+static void integral_prefix_row(std::uint64_t *row, unsigned int width) {
+  __m128i carry = _mm_setzero_si128();
+  unsigned int x = 0;
+  for (; x + 2 <= width; x += 2) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<__m128i *>(row + x));
+    v = _mm_add_epi64(v, _mm_slli_si128(v, 8));
+    v = _mm_add_epi64(v, carry);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(row + x), v);
+    carry = _mm_unpackhi_epi64(v, v);
+  }
+  std::uint64_t sum = static_cast<std::uint64_t>(_mm_cvtsi128_si64(carry));
+  for (; x < width; ++x)
+    row[x] = sum += row[x];
+}
+
+/* dst[i] += src[i] for count values. */
+template <typename T>
+static void integral_add_row(T *dst, const T *src, std::size_t count) {
+  constexpr std::size_t lanes = 16 / sizeof(T);
+  std::size_t i = 0;
+  for (; i + lanes <= count; i += lanes) {
+    __m128i a = _mm_loadu_si128(reinterpret_cast<__m128i *>(dst + i));
+    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+    if constexpr (sizeof(T) == 4)
+      a = _mm_add_epi32(a, b);
+    else
+      a = _mm_add_epi64(a, b);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), a);
+  }
+  for (; i < count; ++i)
+    dst[i] += src[i];
+}
+
+template <typename T>
+Integral_Image<T>::Integral_Image(const unsigned char *data,
+                                  unsigned int width, unsigned int height,
+                                  unsigned int channels, unsigned int channel,
+                                  bool squared)
+    : width_(width), height_(height),
+      table_(static_cast<std::size_t>(width + 1) * (height + 1), T{0}) {
+  if (channel >= channels)
+    throw std::invalid_argument("Channel index out of range");
+  if (width == 0 || height == 0)
+    return;
+
+  const std::size_t stride = width + 1;
+  const std::size_t src_stride = static_cast<std::size_t>(width) * channels;
+  Thread_Pool &pool = default_thread_pool();
+  const std::size_t bands = std::min<std::size_t>(pool.size(), height);
+
+  /* Pass 1: every band integrates its rows as if it started at the top. */
+  pool.run(bands, [&](std::size_t band) {
+    const std::size_t first = height * band / bands;
+    const std::size_t last = height * (band + 1) / bands;
+    for (std::size_t y = first; y < last; ++y) {
+      T *row = table_.data() + (y + 1) * stride + 1;
+      integral_load_row(data + y * src_stride + channel, width, channels,
+                        squared, row);
+      integral_prefix_row(row, width);
+      if (y > first)
+        integral_add_row(row, row - stride, width);
+    }
+  });
+
+  if (bands == 1)
+    return;
+
+  /* Carried sums: the global value of the last row above each band. */
+  std::vector<std::vector<T>> carry(bands);
+  carry[0].assign(width, T{0});
+  for (std::size_t band = 1; band < bands; ++band) {
+    const std::size_t last_above = height * band / bands;
+    carry[band] = carry[band - 1];
+    integral_add_row(carry[band].data(),
+                     table_.data() + last_above * stride + 1, width);
+  }
+
+  /* Pass 2: add the carried sums to every row of the lower bands. */
+  pool.run(bands - 1, [&](std::size_t index) {
+    const std::size_t band = index + 1;
+    const std::size_t first = height * band / bands;
+    const std::size_t last = height * (band + 1) / bands;
+    for (std::size_t y = first; y < last; ++y)
+      integral_add_row(table_.data() + (y + 1) * stride + 1,
+                       carry[band].data(), width);
+  });
+}
+
+template class Integral_Image<std::uint32_t>;
+template class Integral_Image<std::uint64_t>;
+
+std::vector<unsigned char>
+apply_box_filter(const std::vector<unsigned char> &bytes, unsigned int width,
+                 unsigned int height, unsigned int channels,
+                 unsigned int box_width, unsigned int box_height) {
+  if (bytes.size() != static_cast<std::size_t>(width) * height * channels)
+    throw std::invalid_argument("Buffer size does not match image dimensions");
+  if (box_width == 0 || box_height == 0)
+    throw std::invalid_argument("Box must not be empty");
+
+  std::vector<unsigned char> output(bytes.size());
+  const int w = static_cast<int>(width), h = static_cast<int>(height);
+  const int c = static_cast<int>(channels);
+  const int left = static_cast<int>(box_width / 2);
+  const int top = static_cast<int>(box_height / 2);
+
+  for (unsigned int ch = 0; ch < channels; ++ch) {
+    const Integral_Image<std::uint32_t> sat(bytes.data(), width, height,
+                                            channels, ch);
+
+    default_thread_pool().parallel_for(
+        0, height, [&](std::size_t first, std::size_t last) {
+          for (int y = static_cast<int>(first); y < static_cast<int>(last);
+               ++y) {
+            const int y0 = std::max(0, y - top);
+            const int y1 = std::min(h, y - top + static_cast<int>(box_height));
+            for (int x = 0; x < w; ++x) {
+              const int x0 = std::max(0, x - left);
+              const int x1 =
+                  std::min(w, x - left + static_cast<int>(box_width));
+              const auto area =
+                  static_cast<std::uint32_t>((x1 - x0) * (y1 - y0));
+              output[static_cast<std::size_t>((y * w + x) * c) + ch] =
+                  static_cast<unsigned char>(
+                      (sat.box_sum(x0, y0, x1, y1) + area / 2) / area);
+            }
+          }
+        });
+  }
+
+  return output;
+}
+
+#endif
@@ -0,0 +1,530 @@
+#ifndef IO_HPP_
+#define IO_HPP_
+
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <vector>
+
+/**
+ * @brief Receives the contents of a file read by File_IO, or the error.
+ */
+using Read_Callback =
+    std::function<void(std::vector<unsigned char> bytes, std::error_code error)>;
+
+/**
+ * @brief Receives the outcome of a file written by File_IO.
+ */
+using Write_Callback = std::function<void(std::error_code error)>;
+
+/**
+ * @brief Whole-file reads and writes that keep several requests in flight.
+ *
+ * read() and write() return once the request is queued and block only while
+ * the backend already has its queue depth of requests in flight. Callbacks
+ * run on a backend thread, so they should hand work off (e.g. submit it to the
+ * thread pool) rather than compute or block on further I/O themselves.
+ */
+class File_IO {
+public:
+  virtual ~File_IO() = default;
+
+  /**
+   * @brief Queues a read of a whole file.
+   *
+   * @param path File to read.
+   * @param done Called with the bytes, or with an empty buffer and the error.
+   */
+  virtual void read(std::filesystem::path path, Read_Callback done) = 0;
+
+  /**
+   * @brief Queues a write that creates or truncates a file.
+   *
+   * @param path File to write.
+   * @param bytes Contents.
+   * @param done Called once the data is written and the file closed.
+   */
+  virtual void write(std::filesystem::path path,
+                     std::vector<unsigned char> bytes, Write_Callback done) = 0;
+
+  /**
+   * @brief Waits until every queued request has completed.
+   */
+  virtual void drain() = 0;
+
+  /**
+   * @brief Name of the backend, "io_uring" or "blocking".
+   */
+  virtual std::string name() const = 0;
+};
+
+/**
+ * @brief Selects the File_IO backend.
+ *
+ * AUTO uses io_uring when the kernel provides it and falls back to BLOCKING,
+ * which runs blocking reads and writes on dedicated threads.
+ */
+enum class File_IO_Backend {
+  AUTO,
+  URING,
+  BLOCKING,
+};
+
+/**
+ * @brief Parses a backend name ("auto", "uring" or "blocking").
+ *
+ * @throws std::invalid_argument If the name is not a known backend.
+ */
+File_IO_Backend file_io_backend_from_string(const std::string &name);
+
+/**
+ * @brief Creates a File_IO backend.
+ *
+ * @param backend Backend to use.
+ * @param queue_depth Maximum number of requests in flight, at least 1.
+ * @return std::unique_ptr<File_IO> The backend.
+ * @throws std::runtime_error If URING was requested and io_uring is not
+ * available, e.g. on kernels before 5.6 or where seccomp blocks it.
+ */
+std::unique_ptr<File_IO> make_file_io(File_IO_Backend backend,
+                                      unsigned int queue_depth);
+
+#endif
+
+#ifdef IO_IMPLEMENTATION
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+File_IO_Backend file_io_backend_from_string(const std::string &name) {
+  if (name == "auto")
+    return File_IO_Backend::AUTO;
+  if (name == "uring")
+    return File_IO_Backend::URING;
+  if (name == "blocking")
+    return File_IO_Backend::BLOCKING;
+  throw std::invalid_argument("Invalid I/O backend");
+}
+
+static std::error_code last_error() {
+  return {errno, std::generic_category()};
+}
+
+/* Counts requests in flight and blocks submitters at the queue depth. */
+class IO_Slots {
+public:
+  explicit IO_Slots(unsigned int depth) : depth_(std::max(depth, 1u)) {}
+
+  void acquire() {
+    std::unique_lock lock(mutex_);
+    changed_.wait(lock, [&] { return in_flight_ < depth_; });
+    ++in_flight_;
+  }
+
+  void release() {
+    {
+      std::lock_guard lock(mutex_);
+      --in_flight_;
+    }
+    changed_.notify_all();
+  }
+
+  void wait_idle() {
+    std::unique_lock lock(mutex_);
+    changed_.wait(lock, [&] { return in_flight_ == 0; });
+  }
+
+  unsigned int depth() const { return depth_; }
+
+private:
+  const unsigned int depth_;
+  unsigned int in_flight_ = 0;
+  std::mutex mutex_;
+  std::condition_variable changed_;
+};
+
+/* Blocking I/O on a set of threads, one request per thread at a time. */
+class Blocking_File_IO final : public File_IO {
+public:
+  explicit Blocking_File_IO(unsigned int queue_depth) : slots_(queue_depth) {
+    for (unsigned int i = 0; i < slots_.depth(); ++i)
+      threads_.emplace_back([this] { worker_loop(); });
+  }
+
+  ~Blocking_File_IO() override {
+    {
+      std::lock_guard lock(mutex_);
+      stopping_ = true;
+    }
+    available_.notify_all();
+    for (auto &thread : threads_)
+      thread.join();
+  }
+
+  void read(std::filesystem::path path, Read_Callback done) override {
+    submit([path = std::move(path), done = std::move(done)] {
+      std::vector<unsigned char> bytes;
+      std::error_code error;
+      const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+      struct stat status;
+      if (fd < 0 || ::fstat(fd, &status) != 0) {
+        error = last_error();
+      } else {
+        bytes.resize(static_cast<std::size_t>(status.st_size));
+        std::size_t offset = 0;
+        while (offset < bytes.size()) {
+          const ssize_t count =
+              ::read(fd, bytes.data() + offset, bytes.size() - offset);
+          if (count < 0 && errno == EINTR)
+            continue;
+          if (count < 0)
+            error = last_error();
+          if (count <= 0)
+            break;
+          offset += static_cast<std::size_t>(count);
+        }
+        bytes.resize(error ? 0 : offset);
+      }
+      if (fd >= 0)
+        ::close(fd);
+      done(std::move(bytes), error);
+    });
+  }
+
+  void write(std::filesystem::path path, std::vector<unsigned char> bytes,
+             Write_Callback done) override {
+    submit([path = std::move(path), bytes = std::move(bytes),
+            done = std::move(done)] {
+      std::error_code error;
+      const int fd =
+          ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+      if (fd < 0) {
+        error = last_error();
+      } else {
+        std::size_t offset = 0;
+        while (offset < bytes.size()) {
+          const ssize_t count =
+              ::write(fd, bytes.data() + offset, bytes.size() - offset);
+          if (count < 0 && errno == EINTR)
+            continue;
+          if (count < 0) {
+            error = last_error();
+            break;
+          }
+          offset += static_cast<std::size_t>(count);
+        }
+        if (::close(fd) != 0 && !error)
+          error = last_error();
+      }
+      done(error);
+    });
+  }
+
+  void drain() override { slots_.wait_idle(); }
+
+  std::string name() const override { return "blocking"; }
+
+private:
+  void submit(std::function<void()> request) {
+    slots_.acquire();
+    {
+      std::lock_guard lock(mutex_);
+      requests_.push_back(std::move(request));
+    }
+    available_.notify_one();
+  }
+
+  void worker_loop() {
+    for (;;) {
+      std::function<void()> request;
+      {
+        std::unique_lock lock(mutex_);
+        available_.wait(lock,
+                        [this] { return stopping_ || !requests_.empty(); });
+        if (requests_.empty())
+          return;
+        request = std::move(requests_.front());
+        requests_.pop_front();
+      }
+      request();
+      slots_.release();
+    }
+  }
+
+  IO_Slots slots_;
+  std::vector<std::thread> threads_;
+  std::deque<std::function<void()>> requests_;
+  std::mutex mutex_;
+  std::condition_variable available_;
+  bool stopping_ = false;
+};
+
+/* io_uring through raw syscalls. Submitters fill SQEs under a mutex and
+ * enter them at once; one completion thread reaps CQEs, resubmits short
+ * transfers and runs the callbacks. Opening and closing stay synchronous. */
+class Uring_File_IO final : public File_IO {
+public:
+  explicit Uring_File_IO(unsigned int queue_depth) : slots_(queue_depth) {
+    /* Room for every request in flight plus the shutdown NOP. */
+    unsigned int entries = 1;
+    while (entries < slots_.depth() + 1)
+      entries *= 2;
+
+    io_uring_params params;
+    std::memset(&params, 0, sizeof params);
+    fd_ = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+    if (fd_ < 0)
+      throw std::system_error(last_error(), "io_uring_setup");
+
+    sq_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    cq_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+      sq_size_ = cq_size_ = std::max(sq_size_, cq_size_);
+    sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+
+    sq_ring_ = map(sq_size_, IORING_OFF_SQ_RING);
+    cq_ring_ = params.features & IORING_FEAT_SINGLE_MMAP
+                   ? sq_ring_
+                   : map(cq_size_, IORING_OFF_CQ_RING);
+    sqes_ = static_cast<io_uring_sqe *>(map(sqes_size_, IORING_OFF_SQES));
+
+    auto at = [](void *ring, unsigned int offset) {
+      return reinterpret_cast<unsigned int *>(static_cast<char *>(ring) +
+                                              offset);
+    };
+    sq_tail_ = at(sq_ring_, params.sq_off.tail);
+    sq_mask_ = *at(sq_ring_, params.sq_off.ring_mask);
+    sq_array_ = at(sq_ring_, params.sq_off.array);
+    cq_head_ = at(cq_ring_, params.cq_off.head);
+    cq_tail_ = at(cq_ring_, params.cq_off.tail);
+    cq_mask_ = *at(cq_ring_, params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe *>(static_cast<char *>(cq_ring_) +
+                                             params.cq_off.cqes);
+    probe_operations();
+
+    completer_ = std::thread([this] { completion_loop(); });
+  }
+
+  ~Uring_File_IO() override {
+    drain();
+    {
+      std::lock_guard lock(submit_mutex_);
+      io_uring_sqe &sqe = next_sqe();
+      sqe.opcode = IORING_OP_NOP;
+      sqe.user_data = 0;
+      enter_one();
+    }
+    completer_.join();
+    unmap();
+    ::close(fd_);
+  }
+
+  void read(std::filesystem::path path, Read_Callback done) override {
+    slots_.acquire();
+    auto request = std::make_unique<Request>();
+    request->read_done = std::move(done);
+    request->fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat status;
+    if (request->fd < 0 || ::fstat(request->fd, &status) != 0)
+      return finish(std::move(request), last_error());
+    request->bytes.resize(static_cast<std::size_t>(status.st_size));
+    if (request->bytes.empty())
+      return finish(std::move(request), {});
+    submit(request.release());
+  }
+
+  void write(std::filesystem::path path, std::vector<unsigned char> bytes,
+             Write_Callback done) override {
+    slots_.acquire();
+    auto request = std::make_unique<Request>();
+    request->write = true;
+    request->write_done = std::move(done);
+    request->bytes = std::move(bytes);
+    request->fd =
+        ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (request->fd < 0)
+      return finish(std::move(request), last_error());
+    if (request->bytes.empty())
+      return finish(std::move(request), {});
+    submit(request.release());
+  }
+
+  void drain() override { slots_.wait_idle(); }
+
+  std::string name() const override { return "io_uring"; }
+
+private:
+  struct Request {
+    bool write = false;
+    int fd = -1;
+    std::vector<unsigned char> bytes;
+    std::size_t done = 0;
+    Read_Callback read_done;
+    Write_Callback write_done;
+  };
+
+  /* Rings exist since 5.1 but READ and WRITE only since 5.6. */
+  void probe_operations() {
+    constexpr unsigned int count = IORING_OP_WRITE + 1;
+    std::vector<unsigned char> buffer(sizeof(io_uring_probe) +
+                                      count * sizeof(io_uring_probe_op));
+    auto *probe = reinterpret_cast<io_uring_probe *>(buffer.data());
+    if (::syscall(__NR_io_uring_register, fd_, IORING_REGISTER_PROBE, probe,
+                  count) < 0 ||
+        probe->last_op < IORING_OP_WRITE ||
+        !(probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED) ||
+        !(probe->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED)) {
+      unmap();
+      ::close(fd_);
+      throw std::system_error(
+          std::make_error_code(std::errc::function_not_supported),
+          "io_uring read and write");
+    }
+  }
+
+  void *map(std::size_t size, long long offset) {
+    void *ring = ::mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, fd_, offset);
+    if (ring == MAP_FAILED) {
+      const std::error_code error = last_error();
+      unmap();
+      ::close(fd_);
+      throw std::system_error(error, "io_uring mmap");
+    }
+    return ring;
+  }
+
+  void unmap() {
+    if (sqes_)
+      ::munmap(sqes_, sqes_size_);
+    if (cq_ring_ && cq_ring_ != sq_ring_)
+      ::munmap(cq_ring_, cq_size_);
+    if (sq_ring_)
+      ::munmap(sq_ring_, sq_size_);
+  }
+
+  /* Callers hold submit_mutex_. */
+  io_uring_sqe &next_sqe() {
+    const unsigned int index = *sq_tail_ & sq_mask_;
+    io_uring_sqe &sqe = sqes_[index];
+    std::memset(&sqe, 0, sizeof sqe);
+    sq_array_[index] = index;
+    return sqe;
+  }
+
+  void enter_one() {
+    __atomic_store_n(sq_tail_, *sq_tail_ + 1, __ATOMIC_RELEASE);
+    while (::syscall(__NR_io_uring_enter, fd_, 1, 0, 0, nullptr, 0) < 0)
+      if (errno != EINTR && errno != EAGAIN)
+        throw std::system_error(last_error(), "io_uring_enter");
+  }
+
+  /* Queues the rest of a transfer; the Request is owned by the ring until
+   * its final completion. */
+  void submit(Request *request) {
+    const std::size_t remaining =
+        std::min<std::size_t>(request->bytes.size() - request->done, 1u << 30);
+    std::lock_guard lock(submit_mutex_);
+    io_uring_sqe &sqe = next_sqe();
+    sqe.opcode = request->write ? IORING_OP_WRITE : IORING_OP_READ;
+    sqe.fd = request->fd;
+    sqe.off = request->done;
+    sqe.addr = reinterpret_cast<std::uintptr_t>(request->bytes.data() +
+                                                request->done);
+    sqe.len = static_cast<unsigned int>(remaining);
+    sqe.user_data = reinterpret_cast<std::uintptr_t>(request);
+    enter_one();
+  }
+
+  void finish(std::unique_ptr<Request> request, std::error_code error) {
+    if (request->fd >= 0 && ::close(request->fd) != 0 && !error)
+      error = last_error();
+    if (request->write) {
+      request->write_done(error);
+    } else {
+      if (error)
+        request->bytes.clear();
+      request->read_done(std::move(request->bytes), error);
+    }
+    slots_.release();
+  }
+
+  void completion_loop() {
+    for (;;) {
+      const unsigned int head = *cq_head_;
+      if (head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+        ::syscall(__NR_io_uring_enter, fd_, 0, 1, IORING_ENTER_GETEVENTS,
+                  nullptr, 0);
+        continue;
+      }
+      const io_uring_cqe cqe = cqes_[head & cq_mask_];
+      __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+      if (cqe.user_data == 0)
+        return;
+
+      std::unique_ptr<Request> request(
+          reinterpret_cast<Request *>(cqe.user_data));
+      if (cqe.res == -EINTR || cqe.res == -EAGAIN) {
+        submit(request.release());
+      } else if (cqe.res < 0) {
+        finish(std::move(request), {-cqe.res, std::generic_category()});
+      } else if (cqe.res == 0 && !request->write) {
+        /* The file shrank after fstat. */
+        request->bytes.resize(request->done);
+        finish(std::move(request), {});
+      } else if (cqe.res == 0) {
+        finish(std::move(request), std::make_error_code(std::errc::io_error));
+      } else {
+        request->done += static_cast<std::size_t>(cqe.res);
+        if (request->done < request->bytes.size())
+          submit(request.release());
+        else
+          finish(std::move(request), {});
+      }
+    }
+  }
+
+  IO_Slots slots_;
+  int fd_ = -1;
+  std::size_t sq_size_ = 0, cq_size_ = 0, sqes_size_ = 0;
+  void *sq_ring_ = nullptr, *cq_ring_ = nullptr;
+  io_uring_sqe *sqes_ = nullptr;
+  unsigned int *sq_tail_, *sq_array_, *cq_head_, *cq_tail_;
+  unsigned int sq_mask_, cq_mask_;
+  io_uring_cqe *cqes_;
+  std::mutex submit_mutex_;
+  std::thread completer_;
+};
+
+std::unique_ptr<File_IO> make_file_io(File_IO_Backend backend,
+                                      unsigned int queue_depth) {
+  if (backend == File_IO_Backend::BLOCKING)
+    return std::make_unique<Blocking_File_IO>(queue_depth);
+  try {
+    return std::make_unique<Uring_File_IO>(queue_depth);
+  } catch (const std::system_error &error) {
+    if (backend == File_IO_Backend::URING)
+      throw std::runtime_error(std::string{"io_uring is not available: "} +
+                               error.what());
+    return std::make_unique<Blocking_File_IO>(queue_depth);
+  }
+}
+
+#endif
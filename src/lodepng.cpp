@@ -39,6 +39,16 @@ Rename this file to lodepng.cpp to use it for C++, or to lodepng.c to use it for
 #include <stdlib.h> /* allocations */
 #endif /* LODEPNG_COMPILE_ALLOCATORS */
 
+/*SIMD paths for Adam7 deinterlacing; the portable code is used when these aren't enabled at compile time*/
+#if defined(__SSSE3__)
+#include <tmmintrin.h> /* pshufb */
+#define LODEPNG_SSSE3
+#endif /* __SSSE3__ */
+#if defined(__BMI2__) && defined(__x86_64__)
+#include <immintrin.h> /* pdep */
+#define LODEPNG_BMI2
+#endif /* __BMI2__ */
+
 #if defined(_MSC_VER) && (_MSC_VER >= 1310) /*Visual Studio: A few warning types are not desired here.*/
 #pragma warning( disable : 4244 ) /*implicit conversions: not warned by gcc -Wall -Wextra and requires too much casts*/
 #pragma warning( disable : 4996 ) /*VS does not like fopen, but fopen_s is not standard C so unusable here*/
@@ -1215,7 +1225,8 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
 
 /*inflate a block with dynamic of fixed Huffman tree. btype must be 1 or 2.*/
 static unsigned inflateHuffmanBlock(ucvector* out, LodePNGBitReader* reader,
-                                    unsigned btype, size_t max_output_size) {
+                                    unsigned btype, size_t max_output_size,
+                                    size_t stop_output_size) {
   unsigned error = 0;
   HuffmanTree tree_ll; /*the huffman tree for literal and length codes*/
   HuffmanTree tree_d; /*the huffman tree for distance codes*/
@@ -1314,6 +1325,7 @@ static unsigned inflateHuffmanBlock(ucvector* out, LodePNGBitReader* reader,
     if(max_output_size && out->size > max_output_size) {
       ERROR_BREAK(109); /*error, larger than max size*/
     }
+    if(stop_output_size && out->size >= stop_output_size) done = 1; /*caller needs no more data*/
   }
 
   HuffmanTree_cleanup(&tree_ll);
@@ -1368,6 +1380,7 @@ static unsigned lodepng_inflatev(ucvector* out,
 
   while(!BFINAL) {
     unsigned BTYPE;
+    if(settings->cancel && settings->cancel(settings->cancel_context)) return 126;
     if(reader.bitsize - reader.bp < 3) return 52; /*error, bit pointer will jump past memory*/
     ensureBits9(&reader, 3);
     BFINAL = readBits(&reader, 1);
@@ -1375,9 +1388,11 @@ static unsigned lodepng_inflatev(ucvector* out,
 
     if(BTYPE == 3) return 20; /*error: invalid BTYPE*/
     else if(BTYPE == 0) error = inflateNoCompression(out, &reader, settings); /*no compression*/
-    else error = inflateHuffmanBlock(out, &reader, BTYPE, settings->max_output_size); /*compression, BTYPE 01 or 10*/
+    else error = inflateHuffmanBlock(out, &reader, BTYPE, settings->max_output_size,
+                                     settings->stop_output_size); /*compression, BTYPE 01 or 10*/
     if(!error && settings->max_output_size && out->size > settings->max_output_size) error = 109;
     if(error) break;
+    if(settings->stop_output_size && out->size >= settings->stop_output_size) break;
   }
 
   return error;
@@ -2075,7 +2090,8 @@ static unsigned lodepng_deflatev(ucvector* out, const unsigned char* in, size_t
       size_t end = start + blocksize;
       if(end > insize) end = insize;
 
-      if(settings->btype == 1) error = deflateFixed(&writer, &hash, in, start, end, settings, final);
+      if(settings->cancel && settings->cancel(settings->cancel_context)) error = 126;
+      else if(settings->btype == 1) error = deflateFixed(&writer, &hash, in, start, end, settings, final);
       else if(settings->btype == 2) error = deflateDynamic(&writer, &hash, in, start, end, settings, final);
     }
   }
@@ -2176,7 +2192,8 @@ static unsigned lodepng_zlib_decompressv(ucvector* out,
   error = inflatev(out, in + 2, insize - 2, settings);
   if(error) return error;
 
-  if(!settings->ignore_adler32) {
+  /*the checksum covers the whole stream, so it can't be verified if decompression stopped early*/
+  if(!settings->ignore_adler32 && !(settings->stop_output_size && out->size >= settings->stop_output_size)) {
     unsigned ADLER32 = lodepng_read32bitInt(&in[insize - 4]);
     unsigned checksum = adler32(out->data, (unsigned)(out->size));
     if(checksum != ADLER32) return 58; /*error, adler checksum not correct, data must be corrupted*/
@@ -2315,9 +2332,11 @@ void lodepng_compress_settings_init(LodePNGCompressSettings* settings) {
   settings->custom_zlib = 0;
   settings->custom_deflate = 0;
   settings->custom_context = 0;
+  settings->cancel = 0;
+  settings->cancel_context = 0;
 }
 
-const LodePNGCompressSettings lodepng_default_compress_settings = {2, 1, DEFAULT_WINDOWSIZE, 3, 128, 1, 0, 0, 0};
+const LodePNGCompressSettings lodepng_default_compress_settings = {2, 1, DEFAULT_WINDOWSIZE, 3, 128, 1, 0, 0, 0, 0, 0};
 
 
 #endif /*LODEPNG_COMPILE_ENCODER*/
@@ -2328,13 +2347,16 @@ void lodepng_decompress_settings_init(LodePNGDecompressSettings* settings) {
   settings->ignore_adler32 = 0;
   settings->ignore_nlen = 0;
   settings->max_output_size = 0;
+  settings->stop_output_size = 0;
 
   settings->custom_zlib = 0;
   settings->custom_inflate = 0;
   settings->custom_context = 0;
+  settings->cancel = 0;
+  settings->cancel_context = 0;
 }
 
-const LodePNGDecompressSettings lodepng_default_decompress_settings = {0, 0, 0, 0, 0, 0};
+const LodePNGDecompressSettings lodepng_default_decompress_settings = {0, 0, 0, 0, 0, 0, 0, 0, 0};
 
 #endif /*LODEPNG_COMPILE_DECODER*/
 
@@ -4372,6 +4394,11 @@ static void Adam7_getpassvalues(unsigned passw[7], unsigned passh[7], size_t fil
   }
 }
 
+/*number of Adam7 passes holding all pixels whose coordinates are multiples of scale (1, 2, 4 or 8)*/
+static unsigned Adam7_passes(unsigned scale) {
+  return scale == 8 ? 1 : scale == 4 ? 3 : scale == 2 ? 5 : 7;
+}
+
 #ifdef LODEPNG_COMPILE_DECODER
 
 /* ////////////////////////////////////////////////////////////////////////// */
@@ -4665,54 +4692,209 @@ static unsigned unfilter(unsigned char* out, const unsigned char* in, unsigned w
 }
 
 /*
-in: Adam7 interlaced image, with no padding bits between scanlines, but between
- reduced images so that each reduced image starts at a byte.
+Appends nbits bits of the byte-aligned in to the bit stream out at bit position *obp (MSB first) and
+advances *obp. The bits of out before *obp are kept, the ones after the appended bits of the last
+byte written are cleared. Works a byte at a time. in may overlap out as long as it doesn't start
+before the byte at *obp, and starts after it if *obp is not at a byte boundary.
+*/
+static void appendBits(unsigned char* out, size_t* obp, const unsigned char* in, size_t nbits) {
+  unsigned char* dst = &out[*obp >> 3u];
+  unsigned shift = (unsigned)(*obp & 7u);
+  unsigned rem = (unsigned)(nbits & 7u);
+  size_t nbytes = nbits >> 3u, i;
+  if(shift == 0) {
+    for(i = 0; i != nbytes; ++i) dst[i] = in[i];
+    if(rem) dst[nbytes] = (unsigned char)(in[nbytes] & (0xFFu << (8u - rem)));
+  } else {
+    /*carry holds the shift bits that spill over into the next output byte*/
+    unsigned carry = dst[0] & (0xFFu << (8u - shift)) & 0xFFu;
+    for(i = 0; i != nbytes; ++i) {
+      unsigned byte = in[i];
+      dst[i] = (unsigned char)(carry | (byte >> shift));
+      carry = (byte << (8u - shift)) & 0xFFu;
+    }
+    if(rem) {
+      unsigned last = in[nbytes] & (0xFFu << (8u - rem)) & 0xFFu;
+      dst[nbytes] = (unsigned char)(carry | (last >> shift));
+      if(shift + rem > 8u) dst[nbytes + 1] = (unsigned char)((last << (8u - shift)) & 0xFFu);
+    } else {
+      dst[nbytes] = (unsigned char)carry;
+    }
+  }
+  *obp += nbits;
+}
+
+/*
+Merges two rows of whole-byte pixels: out pixel 2i is even pixel i and out pixel 2i + 1 is odd pixel i.
+With SSSE3, blocks of pairs are built in 16-byte registers, each the OR of two pshufb of unaligned loads
+from the even and odd rows; pairs, regs, offset and mask describe these blocks for one bytewidth.
+*/
+typedef struct Adam7Interleaver {
+  size_t bytewidth;
+  size_t pairs; /*pixel pairs per block*/
+  size_t regs; /*16-byte output registers per block*/
+  size_t offset[2][3]; /*per source (even, odd) and register: byte offset of the load in the block*/
+  unsigned char mask[2][3][16]; /*per source and register: pshufb mask, 0x80 for the other source*/
+} Adam7Interleaver;
+
+static void Adam7Interleaver_init(Adam7Interleaver* il, size_t bytewidth) {
+  size_t r, k, src;
+  il->bytewidth = bytewidth;
+  /*the smallest block that fills whole registers, e.g. 8 pairs in 3 registers for RGB*/
+  il->regs = (bytewidth % 3u == 0) ? 3u : 1u;
+  il->pairs = 16u * il->regs / (2u * bytewidth);
+  for(r = 0; r != il->regs; ++r) {
+    for(src = 0; src != 2; ++src) {
+      il->offset[src][r] = (size_t)-1;
+      for(k = 0; k != 16; ++k) {
+        size_t pixel = (16u * r + k) / bytewidth, channel = (16u * r + k) % bytewidth;
+        size_t byte = pixel / 2u * bytewidth + channel;
+        if((pixel & 1u) == src && byte < il->offset[src][r]) il->offset[src][r] = byte;
+      }
+      if(il->offset[src][r] == (size_t)-1) il->offset[src][r] = 0;
+      for(k = 0; k != 16; ++k) {
+        size_t pixel = (16u * r + k) / bytewidth, channel = (16u * r + k) % bytewidth;
+        size_t byte = pixel / 2u * bytewidth + channel;
+        il->mask[src][r][k] = (unsigned char)((pixel & 1u) == src ? byte - il->offset[src][r] : 0x80u);
+      }
+    }
+  }
+}
+
+/*n is the number of output pixels: the even row has (n + 1) / 2 of them, the odd row n / 2*/
+static void interleavePixels(unsigned char* out, const unsigned char* even, const unsigned char* odd,
+                             size_t n, const Adam7Interleaver* il) {
+  size_t bytewidth = il->bytewidth, evencount = (n + 1u) / 2u, oddcount = n / 2u, i = 0, b;
+#ifdef LODEPNG_SSSE3
+  size_t r;
+  __m128i emask[3], omask[3];
+  for(r = 0; r != il->regs; ++r) {
+    emask[r] = _mm_loadu_si128((const __m128i*)il->mask[0][r]);
+    omask[r] = _mm_loadu_si128((const __m128i*)il->mask[1][r]);
+  }
+  /*only blocks whose 16-byte loads stay inside both rows*/
+  for(; (i + il->pairs) * bytewidth + 16u <= oddcount * bytewidth; i += il->pairs) {
+    for(r = 0; r != il->regs; ++r) {
+      __m128i e = _mm_loadu_si128((const __m128i*)&even[i * bytewidth + il->offset[0][r]]);
+      __m128i o = _mm_loadu_si128((const __m128i*)&odd[i * bytewidth + il->offset[1][r]]);
+      _mm_storeu_si128((__m128i*)&out[2u * i * bytewidth + 16u * r],
+                       _mm_or_si128(_mm_shuffle_epi8(e, emask[r]), _mm_shuffle_epi8(o, omask[r])));
+    }
+  }
+#endif /*LODEPNG_SSSE3*/
+  for(; i < evencount; ++i) {
+    for(b = 0; b != bytewidth; ++b) out[2u * i * bytewidth + b] = even[i * bytewidth + b];
+    if(i < oddcount) {
+      for(b = 0; b != bytewidth; ++b) out[(2u * i + 1u) * bytewidth + b] = odd[i * bytewidth + b];
+    }
+  }
+}
+
+/*spread[v] holds the 1, 2 or 4 bit pixels of byte v in the even pixel slots of 16 bits*/
+static void Adam7_initSpread(unsigned short spread[256], unsigned bpp) {
+  unsigned v, k;
+  for(v = 0; v != 256; ++v) {
+    unsigned result = 0;
+    for(k = 0; k != 8u / bpp; ++k) {
+      unsigned pixel = (v >> (8u - bpp * (k + 1u))) & ((1u << bpp) - 1u);
+      result |= pixel << (16u - bpp * (2u * k + 1u));
+    }
+    spread[v] = (unsigned short)result;
+  }
+}
+
+/*interleavePixels for 1, 2 or 4 bit pixels in byte-aligned rows. With BMI2, four bytes of each row are
+spread with pdep at once, otherwise a byte of each through the spread table.*/
+static void interleaveBits(unsigned char* out, const unsigned char* even, const unsigned char* odd,
+                           size_t n, unsigned bpp, const unsigned short spread[256]) {
+  size_t oddbytes = (n / 2u * bpp + 7u) / 8u, outbytes = (n * bpp + 7u) / 8u, i = 0;
+#ifdef LODEPNG_BMI2
+  const unsigned long long evenmask = bpp == 1 ? 0xAAAAAAAAAAAAAAAAull
+                                    : bpp == 2 ? 0xCCCCCCCCCCCCCCCCull : 0xF0F0F0F0F0F0F0F0ull;
+  for(; i + 4u <= oddbytes; i += 4u) {
+    unsigned e = ((unsigned)even[i] << 24u) | ((unsigned)even[i + 1] << 16u)
+               | ((unsigned)even[i + 2] << 8u) | even[i + 3];
+    unsigned o = ((unsigned)odd[i] << 24u) | ((unsigned)odd[i + 1] << 16u)
+               | ((unsigned)odd[i + 2] << 8u) | odd[i + 3];
+    unsigned long long v = _pdep_u64(e, evenmask) | _pdep_u64(o, ~evenmask);
+    unsigned b;
+    for(b = 0; b != 8; ++b) out[2u * i + b] = (unsigned char)(v >> (56u - 8u * b));
+  }
+#endif /*LODEPNG_BMI2*/
+  for(; 2u * i < outbytes; ++i) {
+    unsigned v = spread[even[i]] | (i < oddbytes ? (unsigned)spread[odd[i]] >> bpp : 0u);
+    out[2u * i] = (unsigned char)(v >> 8u);
+    if(2u * i + 1u < outbytes) out[2u * i + 1u] = (unsigned char)v;
+  }
+}
+
+/*
+in: Adam7 interlaced image, unfiltered, each scanline of each reduced image starting at a byte
+(the padded_passstart layout of Adam7_getpassvalues).
 out: the same pixels, but re-ordered so that they're now a non-interlaced image with size w*h
 bpp: bits per pixel
 out has the following size in bits: w * h * bpp.
-in is possibly bigger due to padding bits between reduced images.
-out must be big enough AND must be 0 everywhere if bpp < 8 in the current implementation
-(because that's likely a little bit faster)
-NOTE: comments about padding bits are only relevant if bpp < 8
+scale: 1 for the full image, or 2, 4 or 8 to only use the first 5, 3 or 1 passes, which hold exactly
+the pixels whose coordinates are multiples of scale; out is then the (w / scale) * (h / scale) image
+of those pixels (rounded up), and in only needs to hold these passes.
+Rows are built one at a time rather than scattering passes: odd rows are a copy of a pass 7 scanline
+and even rows interleave the pixels of passes 1 and 2, then 4, then 6 (passes 5, 3 and 1 start the
+rows with y % 4 == 2, y % 8 == 4 and y % 8 == 0).
 */
-static void Adam7_deinterlace(unsigned char* out, const unsigned char* in, unsigned w, unsigned h, unsigned bpp) {
+static unsigned Adam7_deinterlace(unsigned char* out, const unsigned char* in, unsigned w, unsigned h,
+                                  unsigned bpp, unsigned scale) {
+  /*the pass starting each row class, and the pass holding the odd pixels when halving the x step*/
+  static const unsigned ODD_PASS[9] = {0, 0, 5, 0, 3, 0, 0, 0, 1}; /*indexed by the x step being halved*/
   unsigned passw[7], passh[7];
   size_t filter_passstart[8], padded_passstart[8], passstart[8];
-  unsigned i;
+  size_t ow = (w + scale - 1u) / scale, oh = (h + scale - 1u) / scale;
+  size_t olinebytes = (ow * bpp + 7u) / 8u, obp = 0, y;
+  size_t rowbytes = ((size_t)w * bpp + 7u) / 8u + 1u;
+  unsigned char* buffer;
+  unsigned char* tmp[2];
+  Adam7Interleaver il;
+  unsigned short spread[256];
 
   Adam7_getpassvalues(passw, passh, filter_passstart, padded_passstart, passstart, w, h, bpp);
 
-  if(bpp >= 8) {
-    for(i = 0; i != 7; ++i) {
-      unsigned x, y, b;
-      size_t bytewidth = bpp / 8u;
-      for(y = 0; y < passh[i]; ++y)
-      for(x = 0; x < passw[i]; ++x) {
-        size_t pixelinstart = passstart[i] + (y * passw[i] + x) * bytewidth;
-        size_t pixeloutstart = ((ADAM7_IY[i] + (size_t)y * ADAM7_DY[i]) * (size_t)w
-                             + ADAM7_IX[i] + (size_t)x * ADAM7_DX[i]) * bytewidth;
-        for(b = 0; b < bytewidth; ++b) {
-          out[pixeloutstart + b] = in[pixelinstart + b];
-        }
-      }
-    }
-  } else /*bpp < 8: Adam7 with pixels < 8 bit is a bit trickier: with bit pointers*/ {
-    for(i = 0; i != 7; ++i) {
-      unsigned x, y, b;
-      unsigned ilinebits = bpp * passw[i];
-      unsigned olinebits = bpp * w;
-      size_t obp, ibp; /*bit pointers (for out and in buffer)*/
-      for(y = 0; y < passh[i]; ++y)
-      for(x = 0; x < passw[i]; ++x) {
-        ibp = (8 * passstart[i]) + (y * ilinebits + x * bpp);
-        obp = (ADAM7_IY[i] + (size_t)y * ADAM7_DY[i]) * olinebits + (ADAM7_IX[i] + (size_t)x * ADAM7_DX[i]) * bpp;
-        for(b = 0; b < bpp; ++b) {
-          unsigned char bit = readBitFromReversedStream(&ibp, in);
-          setBitOfReversedStream(&obp, out, bit);
-        }
-      }
+  /*two scratch rows for the intermediate interleaves*/
+  buffer = (unsigned char*)lodepng_malloc(2u * rowbytes);
+  if(!buffer) return 83; /*alloc fail*/
+  tmp[0] = buffer;
+  tmp[1] = buffer + rowbytes;
+
+  if(bpp >= 8) Adam7Interleaver_init(&il, bpp / 8u);
+  else Adam7_initSpread(spread, bpp);
+
+  for(y = 0; y < oh * scale; y += scale) {
+    unsigned pass = (y & 1u) ? 6u : (y & 2u) ? 4u : (y & 4u) ? 2u : 0u;
+    unsigned step = ADAM7_DX[pass], which = 0;
+    const unsigned char* src = &in[padded_passstart[pass] + (y - ADAM7_IY[pass]) / ADAM7_DY[pass]
+                                   * ((passw[pass] * bpp + 7u) / 8u)];
+    while(step > scale) {
+      unsigned oddpass = ODD_PASS[step];
+      const unsigned char* oddrow = &in[padded_passstart[oddpass] + (y - ADAM7_IY[oddpass]) / ADAM7_DY[oddpass]
+                                        * ((passw[oddpass] * bpp + 7u) / 8u)];
+      size_t n;
+      unsigned char* dst;
+      step /= 2u;
+      n = (w + step - 1u) / step;
+      /*the last interleave of a whole-byte row goes straight to the output*/
+      dst = (step == scale && bpp >= 8) ? &out[y / scale * olinebytes] : tmp[which];
+      if(bpp >= 8) interleavePixels(dst, src, oddrow, n, &il);
+      else interleaveBits(dst, src, oddrow, n, bpp, spread);
+      src = dst;
+      which ^= 1u;
+    }
+    if(bpp >= 8) {
+      if(src != &out[y / scale * olinebytes]) lodepng_memcpy(&out[y / scale * olinebytes], src, olinebytes);
+    } else {
+      appendBits(out, &obp, src, ow * bpp);
     }
   }
+
+  lodepng_free(buffer);
+  return 0;
 }
 
 static void removePaddingBits(unsigned char* out, const unsigned char* in,
@@ -4720,35 +4902,30 @@ static void removePaddingBits(unsigned char* out, const unsigned char* in,
   /*
   After filtering there are still padding bits if scanlines have non multiple of 8 bit amounts. They need
   to be removed (except at last scanline of (Adam7-reduced) image) before working with pure image buffers
-  for the Adam7 code, the color convert code and the output to the user.
+  for the color convert code and the output to the user.
   in and out are allowed to be the same buffer, in may also be higher but still overlapping; in must
-  have >= ilinebits*h bits, out must have >= olinebits*h bits, olinebits must be <= ilinebits
-  also used to move bits after earlier such operations happened, e.g. in a sequence of reduced images from Adam7
+  have >= ilinebits*h bits, out must have >= olinebits*h bits, olinebits must be <= ilinebits, and
+  ilinebits must be a whole number of bytes (every input scanline starts at a byte)
   only useful if (ilinebits - olinebits) is a value in the range 1..7
   */
   unsigned y;
-  size_t diff = ilinebits - olinebits;
-  size_t ibp = 0, obp = 0; /*input and output bit pointers*/
-  for(y = 0; y < h; ++y) {
-    size_t x;
-    for(x = 0; x < olinebits; ++x) {
-      unsigned char bit = readBitFromReversedStream(&ibp, in);
-      setBitOfReversedStream(&obp, out, bit);
-    }
-    ibp += diff;
-  }
+  size_t obp = 0; /*output bit pointer*/
+  for(y = 0; y < h; ++y) appendBits(out, &obp, &in[y * (ilinebits >> 3u)], olinebits);
 }
 
 /*out must be buffer big enough to contain full image, and in must contain the full decompressed data from
 the IDAT chunks (with filter index bytes and possible padding bits)
 return value is error*/
 static unsigned postProcessScanlines(unsigned char* out, unsigned char* in,
-                                     unsigned w, unsigned h, const LodePNGInfo* info_png) {
+                                     unsigned w, unsigned h, const LodePNGInfo* info_png,
+                                     unsigned scale) {
   /*
   This function converts the filtered-padded-interlaced data into pure 2D image buffer with the PNG's colortype.
   Steps:
   *) if no Adam7: 1) unfilter 2) remove padding bits (= possible extra bits per scanline if bpp < 8)
-  *) if adam7: 1) 7x unfilter 2) 7x remove padding bits 3) Adam7_deinterlace
+  *) if adam7: 1) 7x unfilter 2) Adam7_deinterlace, which also drops the padding bits
+  For Adam7, a scale of 2, 4 or 8 only processes the first passes and outputs the reduced image (see
+  Adam7_deinterlace); non-interlaced images ignore scale.
   NOTE: the in buffer will be overwritten with intermediate data!
   */
   unsigned bpp = lodepng_get_bpp(&info_png->color);
@@ -4767,24 +4944,91 @@ static unsigned postProcessScanlines(unsigned char* out, unsigned char* in,
 
     Adam7_getpassvalues(passw, passh, filter_passstart, padded_passstart, passstart, w, h, bpp);
 
-    for(i = 0; i != 7; ++i) {
+    for(i = 0; i != Adam7_passes(scale); ++i) {
       CERROR_TRY_RETURN(unfilter(&in[padded_passstart[i]], &in[filter_passstart[i]], passw[i], passh[i], bpp));
-      /*TODO: possible efficiency improvement: if in this reduced image the bits fit nicely in 1 scanline,
-      move bytes instead of bits or move not at all*/
-      if(bpp < 8) {
-        /*remove padding bits in scanlines; after this there still may be padding
-        bits between the different reduced images: each reduced image still starts nicely at a byte*/
-        removePaddingBits(&in[passstart[i]], &in[padded_passstart[i]], passw[i] * bpp,
-                          ((passw[i] * bpp + 7u) / 8u) * 8u, passh[i]);
-      }
     }
 
-    Adam7_deinterlace(out, in, w, h, bpp);
+    /*the reduced images keep their padding bits, Adam7_deinterlace reads them scanline by scanline*/
+    CERROR_TRY_RETURN(Adam7_deinterlace(out, in, w, h, bpp, scale));
+  }
+
+  return 0;
+}
+
+/*like postProcessScanlines for a non-interlaced image, but only outputs rows [row_begin, row_end).
+in must hold the filtered scanlines up to row_end. The rows above row_begin still have to be unfiltered
+since the filters of the rows below reference them, but they are reconstructed in place in the in
+buffer and never copied to out.*/
+static unsigned postProcessScanlineRows(unsigned char* out, unsigned char* in, unsigned w,
+                                        unsigned row_begin, unsigned row_end,
+                                        const LodePNGInfo* info_png) {
+  unsigned bpp = lodepng_get_bpp(&info_png->color);
+  size_t bytewidth, linebytes;
+  unsigned char* prevline = 0;
+  unsigned y;
+  if(bpp == 0) return 31; /*error: invalid colortype*/
+
+  bytewidth = (bpp + 7u) / 8u;
+  linebytes = lodepng_get_raw_size_idat(w, 1, bpp) - 1u;
+
+  if(bpp < 8 && w * bpp != linebytes * 8u) {
+    CERROR_TRY_RETURN(unfilter(in, in, w, row_end, bpp));
+    removePaddingBits(out, &in[linebytes * row_begin], w * bpp, linebytes * 8u, row_end - row_begin);
+    return 0;
   }
 
+  for(y = 0; y < row_end; ++y) {
+    unsigned char* scanline = &in[(1 + linebytes) * y];
+    unsigned char* recon = y < row_begin ? &in[linebytes * y] : &out[linebytes * (y - row_begin)];
+    CERROR_TRY_RETURN(unfilterScanline(recon, scanline + 1, prevline, bytewidth, scanline[0], linebytes));
+    prevline = recon;
+  }
   return 0;
 }
 
+/*moves rows [row_begin, row_end) of a w pixels wide image to the start of the buffer (in place)*/
+static void keepRows(unsigned char* image, unsigned w, unsigned row_begin, unsigned row_end, unsigned bpp) {
+  /*copying forward is safe in place: the write position never passes the read position*/
+  size_t linebits = (size_t)w * bpp;
+  if(linebits % 8u == 0) {
+    size_t i, offset = linebits / 8u * row_begin, size = linebits / 8u * (row_end - row_begin);
+    for(i = 0; i < size; ++i) image[i] = image[offset + i];
+  } else {
+    size_t ibp = linebits * row_begin, obp = 0, end = linebits * row_end;
+    while(ibp < end) {
+      unsigned char bit = readBitFromReversedStream(&ibp, image);
+      setBitOfReversedStream(&obp, image, bit);
+    }
+  }
+}
+
+/*keeps the pixels whose coordinates are multiples of scale of a w * h image, in place: the result is
+the (w / scale) * (h / scale) image (rounded up) at the start of the buffer*/
+static void subsamplePixels(unsigned char* image, unsigned w, unsigned h, unsigned bpp, unsigned scale) {
+  size_t ow = (w + scale - 1u) / scale, oh = (h + scale - 1u) / scale;
+  size_t x, y;
+  /*as in keepRows, the write position never passes the read position*/
+  if(bpp % 8u == 0) {
+    size_t bytewidth = bpp / 8u, b;
+    for(y = 0; y < oh; ++y)
+    for(x = 0; x < ow; ++x) {
+      const unsigned char* in = &image[((y * scale) * w + x * scale) * bytewidth];
+      unsigned char* out = &image[(y * ow + x) * bytewidth];
+      for(b = 0; b < bytewidth; ++b) out[b] = in[b];
+    }
+  } else {
+    size_t obp = 0;
+    for(y = 0; y < oh; ++y)
+    for(x = 0; x < ow; ++x) {
+      size_t ibp = ((y * scale) * w + x * scale) * bpp, b;
+      for(b = 0; b < bpp; ++b) {
+        unsigned char bit = readBitFromReversedStream(&ibp, image);
+        setBitOfReversedStream(&obp, image, bit);
+      }
+    }
+  }
+}
+
 static unsigned readChunk_PLTE(LodePNGColorMode* color, const unsigned char* data, size_t chunkLength) {
   unsigned pos = 0, i;
   color->palettesize = chunkLength / 3u;
@@ -5301,6 +5545,8 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
   unsigned char* scanlines = 0;
   size_t scanlines_size = 0, expected_size = 0;
   size_t outsize = 0;
+  unsigned row_begin, row_end, partial, scale;
+  LodePNGDecompressSettings zlibsettings = state->decoder.zlibsettings;
 
   /*for unknown chunk order*/
   unsigned unknown = 0;
@@ -5320,6 +5566,21 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
     CERROR_RETURN(state->error, 92); /*overflow possible due to amount of pixels*/
   }
 
+  row_begin = state->decoder.row_begin;
+  row_end = state->decoder.row_end;
+  if(row_begin == 0 && row_end == 0) row_end = *h;
+  if(row_begin >= row_end || row_end > *h) CERROR_RETURN(state->error, 124);
+  partial = row_begin != 0 || row_end != *h;
+
+  scale = state->decoder.preview_scale ? state->decoder.preview_scale : 1;
+  if(scale != 1 && scale != 2 && scale != 4 && scale != 8) CERROR_RETURN(state->error, 125);
+  if(scale != 1 && partial) CERROR_RETURN(state->error, 125);
+  if(scale != 1 && state->info_png.interlace_method == 0) {
+    /*non-interlaced previews are subsampled after decoding, which only needs the rows up to the last sampled one*/
+    row_end = (*h - 1u) / scale * scale + 1u;
+    partial = row_end != *h;
+  }
+
   /*the input filesize is a safe upper bound for the sum of idat chunks size*/
   idat = (unsigned char*)lodepng_malloc(insize);
   if(!idat) CERROR_RETURN(state->error, 83); /*alloc fail*/
@@ -5477,7 +5738,9 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
     If the decompressed size does not match the prediction, the image must be corrupt.*/
     if(state->info_png.interlace_method == 0) {
       unsigned bpp = lodepng_get_bpp(&state->info_png.color);
-      expected_size = lodepng_get_raw_size_idat(*w, *h, bpp);
+      expected_size = lodepng_get_raw_size_idat(*w, row_end, bpp);
+      /*rows are stored top to bottom, so the stream can be abandoned after the last needed one*/
+      if(row_end != *h) zlibsettings.stop_output_size = expected_size;
     } else {
       unsigned bpp = lodepng_get_bpp(&state->info_png.color);
       /*Adam-7 interlaced: expected size is the sum of the 7 sub-images sizes*/
@@ -5489,23 +5752,57 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
       expected_size += lodepng_get_raw_size_idat((*w + 1) >> 1, (*h + 1) >> 2, bpp);
       if(*w > 1) expected_size += lodepng_get_raw_size_idat((*w + 0) >> 1, (*h + 1) >> 1, bpp);
       expected_size += lodepng_get_raw_size_idat((*w + 0), (*h + 0) >> 1, bpp);
+      if(scale != 1) {
+        /*the passes are stored one after another, so a preview stops after the last pass it uses*/
+        unsigned passw[7], passh[7];
+        size_t filter_passstart[8], padded_passstart[8], passstart[8];
+        Adam7_getpassvalues(passw, passh, filter_passstart, padded_passstart, passstart, *w, *h, bpp);
+        if(filter_passstart[Adam7_passes(scale)] != expected_size) {
+          expected_size = filter_passstart[Adam7_passes(scale)];
+          zlibsettings.stop_output_size = expected_size;
+        }
+      }
     }
 
-    state->error = zlib_decompress(&scanlines, &scanlines_size, expected_size, idat, idatsize, &state->decoder.zlibsettings);
+    state->error = zlib_decompress(&scanlines, &scanlines_size, expected_size, idat, idatsize, &zlibsettings);
   }
-  if(!state->error && scanlines_size != expected_size) state->error = 91; /*decompressed size doesn't match prediction*/
+  /*when stopping early, the last inflated block may run past the needed rows*/
+  if(!state->error && zlibsettings.stop_output_size) {
+    if(scanlines_size < expected_size) state->error = 91; /*stream ended before the needed rows*/
+  } else if(!state->error && scanlines_size != expected_size) state->error = 91; /*decompressed size doesn't match prediction*/
   lodepng_free(idat);
 
   if(!state->error) {
-    outsize = lodepng_get_raw_size(*w, *h, &state->info_png.color);
+    if(state->info_png.interlace_method == 0) {
+      outsize = lodepng_get_raw_size(*w, row_end - row_begin, &state->info_png.color);
+    } else {
+      outsize = lodepng_get_raw_size((*w + scale - 1u) / scale, (*h + scale - 1u) / scale, &state->info_png.color);
+    }
     *out = (unsigned char*)lodepng_malloc(outsize);
     if(!*out) state->error = 83; /*alloc fail*/
   }
   if(!state->error) {
     lodepng_memset(*out, 0, outsize);
-    state->error = postProcessScanlines(*out, scanlines, *w, *h, &state->info_png);
+    if(state->info_png.interlace_method == 0 && partial) {
+      state->error = postProcessScanlineRows(*out, scanlines, *w, row_begin, row_end, &state->info_png);
+    } else {
+      state->error = postProcessScanlines(*out, scanlines, *w, *h, &state->info_png, scale);
+      /*Adam7 spreads every row over all passes, so interlaced images are cut after deinterlacing*/
+      if(!state->error && partial) {
+        keepRows(*out, *w, row_begin, row_end, lodepng_get_bpp(&state->info_png.color));
+      }
+    }
   }
   lodepng_free(scanlines);
+  if(!state->error && scale != 1) {
+    if(state->info_png.interlace_method == 0) {
+      subsamplePixels(*out, *w, row_end, lodepng_get_bpp(&state->info_png.color), scale);
+    }
+    *w = (*w + scale - 1u) / scale;
+    *h = (*h + scale - 1u) / scale;
+  } else if(!state->error) {
+    *h = row_end - row_begin;
+  }
 }
 
 unsigned lodepng_decode(unsigned char** out, unsigned* w, unsigned* h,
@@ -5596,6 +5893,9 @@ unsigned lodepng_decode24_file(unsigned char** out, unsigned* w, unsigned* h, co
 
 void lodepng_decoder_settings_init(LodePNGDecoderSettings* settings) {
   settings->color_convert = 1;
+  settings->row_begin = 0;
+  settings->row_end = 0;
+  settings->preview_scale = 0;
 #ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
   settings->read_text_chunks = 1;
   settings->remember_unknown_chunks = 0;
@@ -6117,6 +6417,12 @@ static size_t ilog2i(size_t i) {
   return i * l + ((i - (((size_t)1) << l)) << 1u);
 }
 
+/*checks the cancel callback every 64 scanlines of adaptive filtering, which tries five filters per row*/
+static unsigned filterCancelled(const LodePNGEncoderSettings* settings, unsigned y) {
+  const LodePNGCompressSettings* zlib = &settings->zlibsettings;
+  return (y & 63u) == 0 && zlib->cancel && zlib->cancel(zlib->cancel_context);
+}
+
 static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w, unsigned h,
                        const LodePNGColorMode* color, const LodePNGEncoderSettings* settings) {
   /*
@@ -6167,6 +6473,7 @@ static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w,
 
     if(!error) {
       for(y = 0; y != h; ++y) {
+        if(filterCancelled(settings, y)) { error = 126; break; }
         /*try the 5 filter types*/
         for(type = 0; type != 5; ++type) {
           size_t sum = 0;
@@ -6214,6 +6521,7 @@ static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w,
 
     if(!error) {
       for(y = 0; y != h; ++y) {
+        if(filterCancelled(settings, y)) { error = 126; break; }
         /*try the 5 filter types*/
         for(type = 0; type != 5; ++type) {
           size_t sum = 0;
@@ -6275,6 +6583,7 @@ static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w,
     }
     if(!error) {
       for(y = 0; y != h; ++y) /*try the 5 filter types*/ {
+        if(filterCancelled(settings, y)) { error = 126; break; }
         for(type = 0; type != 5; ++type) {
           unsigned testsize = (unsigned)linebytes;
           /*if(testsize > 8) testsize /= 8;*/ /*it already works good enough by testing a part of the row*/
@@ -7026,6 +7335,9 @@ const char* lodepng_error_text(unsigned code) {
     case 121: return "invalid chunk type name: may only contain [a-zA-Z]";
     case 122: return "invalid chunk type name: third character must be uppercase";
     case 123: return "invalid ICC profile size";
+    case 124: return "invalid decoder row range: row_begin must be below row_end and row_end at most the image height";
+    case 125: return "invalid preview scale: must be 0, 1, 2, 4 or 8 and can't be combined with a row range";
+    case 126: return "decoding or encoding cancelled by the cancel callback";
   }
   return "unknown error code";
 }
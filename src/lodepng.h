@@ -323,6 +323,12 @@ struct LodePNGDecompressSettings {
   Set to 0 to impose no limit (the default).*/
   size_t max_output_size;
 
+  /*If not 0, decompression stops successfully as soon as at least this many bytes were output. The
+  output may be somewhat larger than this (up to the end of the current deflate symbol or stored block)
+  and the Adler32 checksum is not verified, since the rest of the stream is never read. Used by the PNG
+  decoder to decode only the top rows of an image; custom decoders may ignore it. Default: 0.*/
+  size_t stop_output_size;
+
   /*use custom zlib decoder instead of built in one (default: null).
   Should return 0 if success, any non-0 if error (numeric value not exposed).*/
   unsigned (*custom_zlib)(unsigned char**, size_t*,
@@ -336,6 +342,12 @@ struct LodePNGDecompressSettings {
                              const LodePNGDecompressSettings*);
 
   const void* custom_context; /*optional custom settings for custom functions*/
+
+  /*If not null, called with cancel_context before each deflate block; a non-zero return stops
+  decompression with error 126. Lets a caller give up on a long decode, e.g. past a deadline. Custom
+  decoders may ignore it. Default: null.*/
+  unsigned (*cancel)(const void*);
+  const void* cancel_context;
 };
 
 extern const LodePNGDecompressSettings lodepng_default_decompress_settings;
@@ -369,6 +381,13 @@ struct LodePNGCompressSettings /*deflate = compress*/ {
                              const LodePNGCompressSettings*);
 
   const void* custom_context; /*optional custom settings for custom functions*/
+
+  /*If not null, called with cancel_context before each deflate block, and every 64 scanlines while
+  the PNG encoder chooses filters adaptively (LFS_MINSUM, LFS_ENTROPY or LFS_BRUTE_FORCE); a non-zero
+  return stops compression or encoding with error 126. Lets a caller give up on a long encode, e.g. past a deadline. Custom encoders may ignore it.
+  Default: null.*/
+  unsigned (*cancel)(const void*);
+  const void* cancel_context;
 };
 
 extern const LodePNGCompressSettings lodepng_default_compress_settings;
@@ -827,6 +846,22 @@ typedef struct LodePNGDecoderSettings {
 
   unsigned color_convert; /*whether to convert the PNG to the color type you want. Default: yes*/
 
+  /*Decode only scanlines [row_begin, row_end) instead of the whole image; the output then holds
+  row_end - row_begin rows and the height output parameter is set to that number. For non-interlaced
+  images, decompression stops after scanline row_end - 1, the rows above row_begin are unfiltered in
+  scratch memory only and color conversion runs on the requested rows alone. Interlaced images are
+  decoded fully and then cut to the requested rows. Both 0 (the default) decodes all rows; row_end
+  beyond the image height gives error 124.*/
+  unsigned row_begin;
+  unsigned row_end;
+
+  /*Decode a reduced-resolution preview holding the pixels whose coordinates are multiples of
+  preview_scale (2, 4 or 8); the width and height outputs are set to the reduced size, rounded up.
+  Adam7 passes 1-5, 1-3 and 1 hold exactly these pixels, so interlaced images only inflate, unfilter
+  and deinterlace those passes; non-interlaced images are decoded up to the last sampled row and then
+  subsampled. 0 or 1 (the default) decodes at full size. Can't be combined with a row range (error 125).*/
+  unsigned preview_scale;
+
 #ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
   unsigned read_text_chunks; /*if false but remember_unknown_chunks is true, they're stored in the unknown chunks*/
 
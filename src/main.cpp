@@ -1,10 +1,84 @@
 #include "lodepng.h"
 #define FILTERS_IMPLEMENTATION
 #include "filters.hpp"
+#undef FILTERS_IMPLEMENTATION
+#define MORPHOLOGY_IMPLEMENTATION
+#include "morphology.hpp"
+#undef MORPHOLOGY_IMPLEMENTATION
+#define DEADLINE_IMPLEMENTATION
+#include "deadline.hpp"
+#undef DEADLINE_IMPLEMENTATION
+#define PRIORITY_IMPLEMENTATION
+#include "priority.hpp"
+#undef PRIORITY_IMPLEMENTATION
+#define TRACE_IMPLEMENTATION
+#include "trace.hpp"
+#undef TRACE_IMPLEMENTATION
+#define THREAD_POOL_IMPLEMENTATION
+#include "thread_pool.hpp"
+#undef THREAD_POOL_IMPLEMENTATION
+#define HISTOGRAM_IMPLEMENTATION
+#include "histogram.hpp"
+#undef HISTOGRAM_IMPLEMENTATION
+#define FFT_IMPLEMENTATION
+#include "fft.hpp"
+#undef FFT_IMPLEMENTATION
+#define CONVOLVE_IMPLEMENTATION
+#include "convolve.hpp"
+#undef CONVOLVE_IMPLEMENTATION
+#define INTEGRAL_IMPLEMENTATION
+#include "integral.hpp"
+#undef INTEGRAL_IMPLEMENTATION
+#define COLOUR_IMPLEMENTATION
+#include "colour.hpp"
+#undef COLOUR_IMPLEMENTATION
+#define POINT_OPS_IMPLEMENTATION
+#include "point_ops.hpp"
+#undef POINT_OPS_IMPLEMENTATION
+#define THRESHOLD_IMPLEMENTATION
+#include "threshold.hpp"
+#undef THRESHOLD_IMPLEMENTATION
+#define ORIENTATION_IMPLEMENTATION
+#include "orientation.hpp"
+#undef ORIENTATION_IMPLEMENTATION
+#define ROI_IMPLEMENTATION
+#include "roi.hpp"
+#undef ROI_IMPLEMENTATION
+#define SYNTHETIC_IMPLEMENTATION
+#include "synthetic.hpp"
+#undef SYNTHETIC_IMPLEMENTATION
+#define REFERENCE_IMPLEMENTATION
+#include "reference.hpp"
+#undef REFERENCE_IMPLEMENTATION
+#define IO_IMPLEMENTATION
+#include "io.hpp"
+#undef IO_IMPLEMENTATION
+#define BATCH_IMPLEMENTATION
+#include "batch.hpp"
+#undef BATCH_IMPLEMENTATION
+#define METRICS_IMPLEMENTATION
+#include "metrics.hpp"
+#undef METRICS_IMPLEMENTATION
+#define TUNING_IMPLEMENTATION
+#include "tuning.hpp"
+#undef TUNING_IMPLEMENTATION
 
 #include <boost/program_options.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
 #include <iostream>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <optional>
 #include <print>
+#include <string_view>
+#include <type_traits>
 
 namespace po = boost::program_options;
 
@@ -13,6 +87,25 @@ enum Image_Filter {
   INVERT,
   GAUSSIAN,
   LAPLACE,
+  ERODE,
+  DILATE,
+  OPEN,
+  CLOSE,
+  EQUALIZE,
+  CLAHE,
+  CONVOLVE,
+  BOX,
+  COLOUR,
+  POINT,
+  THRESHOLD,
+  ROTATE90,
+  ROTATE180,
+  ROTATE270,
+  TRANSPOSE,
+  TRANSVERSE,
+  FLIPX,
+  FLIPY,
+  CROP,
 };
 
 Image_Filter filter_to_image_filter(std::string const &filter) {
@@ -24,6 +117,44 @@ Image_Filter filter_to_image_filter(std::string const &filter) {
     return Image_Filter::GAUSSIAN;
   else if (filter == "laplace")
     return Image_Filter::LAPLACE;
+  else if (filter == "erode")
+    return Image_Filter::ERODE;
+  else if (filter == "dilate")
+    return Image_Filter::DILATE;
+  else if (filter == "open")
+    return Image_Filter::OPEN;
+  else if (filter == "close")
+    return Image_Filter::CLOSE;
+  else if (filter == "equalize")
+    return Image_Filter::EQUALIZE;
+  else if (filter == "clahe")
+    return Image_Filter::CLAHE;
+  else if (filter == "convolve")
+    return Image_Filter::CONVOLVE;
+  else if (filter == "box")
+    return Image_Filter::BOX;
+  else if (filter == "colour")
+    return Image_Filter::COLOUR;
+  else if (filter == "point")
+    return Image_Filter::POINT;
+  else if (filter == "threshold")
+    return Image_Filter::THRESHOLD;
+  else if (filter == "rotate90")
+    return Image_Filter::ROTATE90;
+  else if (filter == "rotate180")
+    return Image_Filter::ROTATE180;
+  else if (filter == "rotate270")
+    return Image_Filter::ROTATE270;
+  else if (filter == "transpose")
+    return Image_Filter::TRANSPOSE;
+  else if (filter == "transverse")
+    return Image_Filter::TRANSVERSE;
+  else if (filter == "flipx")
+    return Image_Filter::FLIPX;
+  else if (filter == "flipy")
+    return Image_Filter::FLIPY;
+  else if (filter == "crop")
+    return Image_Filter::CROP;
   else
     throw std::invalid_argument("Invalid image filter");
 }
@@ -39,80 +170,1069 @@ LodePNGColorType format_to_color_type(std::string const &format) {
     throw std::invalid_argument("Invalid image format");
 }
 
-std::tuple<unsigned int, unsigned int, std::vector<unsigned char>>
-get_image_bytes(std::string const &filename, std::string const &format) {
+std::pair<unsigned int, unsigned int>
+parse_dimensions(std::string const &dimensions) {
+  auto separator = dimensions.find('x');
+  if (separator == std::string::npos)
+    throw std::invalid_argument("Dimensions must be given as NxM");
+  unsigned long first = std::stoul(dimensions.substr(0, separator));
+  unsigned long second = std::stoul(dimensions.substr(separator + 1));
+  if (first == 0 || second == 0)
+    throw std::invalid_argument("Dimensions must be non-zero");
+  return {static_cast<unsigned int>(first), static_cast<unsigned int>(second)};
+}
+
+/* Parses a byte count with an optional K, M or G suffix, in powers of 1024. */
+std::size_t parse_byte_size(std::string const &size) {
+  const std::size_t digits =
+      std::min(size.find_first_not_of("0123456789"), size.size());
+  std::size_t shift = 0;
+  if (digits + 1 == size.size())
+    shift = 10 * (std::string_view{"KMG"}.find(static_cast<char>(
+                      std::toupper(static_cast<unsigned char>(size.back())))) +
+                  1);
+  if (digits == 0 || digits > 19 ||
+      size.size() - digits != (shift == 0 ? 0u : 1u))
+    throw std::invalid_argument("Invalid size: " + size);
+  const unsigned long long value = std::stoull(size.substr(0, digits));
+  if (value > std::numeric_limits<std::size_t>::max() >> shift)
+    throw std::invalid_argument("Invalid size: " + size);
+  return static_cast<std::size_t>(value) << shift;
+}
+
+void define_metrics(Metrics_Registry &metrics) {
+  metrics.define_counter("simd_filter_images_total", "Input images decoded.");
+  metrics.define_counter("simd_filter_pixels_total", "Pixels decoded.");
+  metrics.define_counter("simd_filter_input_bytes_total",
+                         "Bytes of PNG files read.");
+  metrics.define_counter("simd_filter_outputs_total",
+                         "Outputs filtered, by filter.");
+  metrics.define_counter("simd_filter_output_bytes_total",
+                         "Bytes of PNG files written.");
+  metrics.define_counter("simd_filter_errors_total",
+                         "Runs that failed, by error type.");
+  metrics.define_counter("simd_filter_degraded_total",
+                         "Stages that fell back to a cheaper result to meet a "
+                         "deadline, by stage.");
+  metrics.define_histogram("simd_filter_stage_duration_seconds",
+                           "Time spent in each stage of a run.");
+  metrics.define_histogram("simd_filter_filter_duration_seconds",
+                           "Time spent in each filter.");
+  metrics.define_histogram("simd_filter_run_duration_seconds",
+                           "Time of a whole successful run.");
+  metrics.define_histogram("simd_filter_job_duration_seconds",
+                           "Time from the start of a batch until each image "
+                           "was written or failed, by priority class.");
+}
+
+/* Runs body and records its time under simd_filter_stage_duration_seconds
+ * and as a trace span; calls that throw are not recorded as metrics. */
+template <typename Body> auto timed_stage(const char *stage, Body &&body) {
+  Trace_Span span("stage", stage);
+  const auto start = std::chrono::steady_clock::now();
+  auto record = [&] {
+    default_metrics().observe(
+        "simd_filter_stage_duration_seconds", {{"stage", stage}},
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+            .count());
+  };
+  if constexpr (std::is_void_v<decltype(body())>) {
+    body();
+    record();
+  } else {
+    auto result = body();
+    record();
+    return result;
+  }
+}
+
+std::vector<unsigned char> load_png(std::string const &filename) {
+  std::vector<unsigned char> png;
+  auto error = timed_stage(
+      "read", [&] { return lodepng::load_file(png, filename); });
+  if (error)
+    throw std::runtime_error(std::string{"Error loading PNG file: "} +
+                             lodepng_error_text(error));
+  default_metrics().increment("simd_filter_input_bytes_total", {},
+                              static_cast<double>(png.size()));
+  return png;
+}
+
+/* Makes lodepng check the current deadline between deflate blocks; once it
+ * has expired the codec fails with error 126. */
+template <typename Settings> void cancel_at_deadline(Settings &settings) {
+  if (!current_deadline().limited())
+    return;
+  settings.cancel = [](const void *deadline) -> unsigned {
+    return static_cast<Deadline const *>(deadline)->expired();
+  };
+  settings.cancel_context = &current_deadline();
+}
+
+/* Counts a stage that gave a cheaper result to meet its deadline. */
+std::atomic<std::size_t> &degraded_stages() {
+  static std::atomic<std::size_t> count{0};
+  return count;
+}
+
+void note_degraded(const char *stage) {
+  default_metrics().increment("simd_filter_degraded_total",
+                              {{"stage", stage}});
+  ++degraded_stages();
+}
+
+std::pair<unsigned int, unsigned int>
+get_image_dimensions(std::vector<unsigned char> const &png) {
+  unsigned int width, height;
+  lodepng::State state;
+  auto error =
+      lodepng_inspect(&width, &height, &state, png.data(), png.size());
+  if (error)
+    throw std::runtime_error(std::string{"Error decoding PNG file: "} +
+                             lodepng_error_text(error));
+  return {width, height};
+}
+
+/* Decodes rows [row_begin, row_end) of the image; inflating stops after the
+ * last of them. A preview scale of 2, 4 or 8 decodes the image at that
+ * fraction of its size instead, from the early passes of interlaced PNGs. */
+std::vector<unsigned char> get_image_rows(std::vector<unsigned char> const &png,
+                                          std::string const &format,
+                                          unsigned int row_begin,
+                                          unsigned int row_end,
+                                          unsigned int preview_scale = 1) {
+  lodepng::State state;
+  state.info_raw.colortype = format_to_color_type(format);
+  state.info_raw.bitdepth = 8;
+  state.decoder.row_begin = row_begin;
+  state.decoder.row_end = row_end;
+  state.decoder.preview_scale = preview_scale;
+  cancel_at_deadline(state.decoder.zlibsettings);
   unsigned int width, height;
   std::vector<unsigned char> bytes;
-  lodepng::decode(bytes, width, height, filename, format_to_color_type(format));
-  return std::make_tuple(width, height, bytes);
+  auto error = timed_stage("decode", [&] {
+    return lodepng::decode(bytes, width, height, state, png);
+  });
+  if (error == 126)
+    throw Deadline_Exceeded();
+  if (error)
+    throw std::runtime_error(std::string{"Error decoding PNG file: "} +
+                             lodepng_error_text(error));
+  default_metrics().increment("simd_filter_images_total");
+  default_metrics().increment("simd_filter_pixels_total", {},
+                              static_cast<double>(width) * height);
+  return bytes;
+}
+
+/* Encodes within half the time left to the current deadline, falling back to
+ * fast compression: no LZ77 matching and the Paeth filter on every row, four
+ * to six times faster for files two to three times as large. */
+std::vector<unsigned char>
+encode_image_bytes(std::vector<unsigned char> const &bytes, unsigned int width,
+                   unsigned int height, std::string const &format,
+                   unsigned int bit_depth = 8) {
+  auto encode = [&](bool fast) {
+    lodepng::State state;
+    state.info_raw.colortype = format_to_color_type(format);
+    state.info_raw.bitdepth = bit_depth;
+    state.info_png.color.colortype = state.info_raw.colortype;
+    state.info_png.color.bitdepth = bit_depth;
+    state.encoder.zlibsettings.windowsize = encoder_tuning().window_size;
+    state.encoder.zlibsettings.lazymatching = encoder_tuning().lazy_matching;
+    if (fast) {
+      state.encoder.zlibsettings.use_lz77 = 0;
+      state.encoder.filter_strategy = LFS_FOUR;
+    }
+    cancel_at_deadline(state.encoder.zlibsettings);
+    std::vector<unsigned char> encoded;
+    auto error = timed_stage("encode", [&] {
+      return lodepng::encode(encoded, bytes, width, height, state);
+    });
+    if (error == 126)
+      throw Deadline_Exceeded();
+    if (error)
+      throw std::runtime_error(std::string{"Error encoding PNG file: "} +
+                               lodepng_error_text(error));
+    return encoded;
+  };
+  std::vector<unsigned char> encoded = run_with_fallback(
+      0.5, [&] { return encode(false); },
+      [&] {
+        note_degraded("encode");
+        return encode(true);
+      });
+  default_metrics().increment("simd_filter_output_bytes_total", {},
+                              static_cast<double>(encoded.size()));
+  return encoded;
 }
 
 void write_image_bytes(std::vector<unsigned char> const &bytes,
                        unsigned int width, unsigned int height,
-                       std::string const &filename, std::string const &format) {
-  std::vector<unsigned char> encoded;
-  auto error = lodepng::encode(encoded, bytes, width, height,
-                               format_to_color_type(format));
+                       std::string const &filename, std::string const &format,
+                       unsigned int bit_depth = 8) {
+  const std::vector<unsigned char> encoded =
+      encode_image_bytes(bytes, width, height, format, bit_depth);
+  timed_stage("write", [&] { lodepng::save_file(encoded, filename); });
+}
+
+std::string plane_filename(std::string const &filename,
+                           std::string const &plane) {
+  std::filesystem::path path{filename};
+  path.replace_filename(path.stem().string() + "-" + plane +
+                        path.extension().string());
+  return path.string();
+}
+
+/* Settings shared by every output of a run. */
+struct Filter_Options {
+  unsigned int blur_strength;
+  std::string element;
+  std::string tiles;
+  double clip_limit;
+  Convolution_Kernel kernel;
+  Colour_Space space;
+  std::optional<std::string> point_ops;
+  std::string threshold_method;
+  Threshold_Params threshold_params;
+  bool linear_light;
+  bool edges;
+};
+
+/* One requested output: the filter to run and the file it is written to. */
+struct Output_Job {
+  std::string filter;
+  std::string file;
+};
+
+Output_Job parse_output_job(std::string const &spec) {
+  auto separator = spec.find('=');
+  if (separator == std::string::npos || separator == 0 ||
+      separator + 1 == spec.size())
+    throw std::invalid_argument("Outputs must be given as filter=path");
+  Output_Job job{spec.substr(0, separator), spec.substr(separator + 1)};
+  filter_to_image_filter(job.filter);
+  return job;
+}
+
+bool is_orientation_filter(std::string const &filter) {
+  return filter == "rotate90" || filter == "rotate180" ||
+         filter == "rotate270" || filter == "transpose" ||
+         filter == "transverse" || filter == "flipx" || filter == "flipy";
+}
+
+/* Pixels a filter reads beyond each output pixel, i.e. how far outside a
+ * region the input has to extend for the region to match a full-image run.
+ * Filters whose statistics or tiles span the frame read all of it. */
+unsigned int filter_halo(std::string const &filter,
+                         Filter_Options const &options) {
+  constexpr unsigned int whole_frame = std::numeric_limits<unsigned int>::max();
+  if (filter == "equalize" || filter == "clahe")
+    return whole_frame;
+  if (filter == "gaussian")
+    return static_cast<unsigned int>(
+        generate_gaussian_kernel(options.blur_strength / 10.0).second);
+  if (filter == "laplace")
+    return 1;
+  if (filter == "erode" || filter == "dilate" || filter == "open" ||
+      filter == "close" || filter == "box") {
+    auto [se_width, se_height] = parse_dimensions(options.element);
+    const unsigned int radius = std::max(se_width, se_height) / 2;
+    /* Opening and closing chain two passes. */
+    return filter == "open" || filter == "close" ? 2 * radius : radius;
+  }
+  if (filter == "convolve")
+    return std::max(options.kernel.width, options.kernel.height) / 2;
+  if (filter == "threshold") {
+    unsigned int halo = options.edges ? 1 : 0;
+    const Threshold_Method method =
+        threshold_method_from_string(options.threshold_method);
+    if (method == Threshold_Method::OTSU)
+      return whole_frame;
+    if (method == Threshold_Method::ADAPTIVE_GAUSSIAN)
+      halo += static_cast<unsigned int>(
+          generate_gaussian_kernel(options.threshold_params.window / 6.0)
+              .second);
+    else if (method == Threshold_Method::ADAPTIVE_MEAN ||
+             method == Threshold_Method::SAUVOLA)
+      halo += options.threshold_params.window / 2;
+    return halo;
+  }
+  return 0;
+}
+
+/* A value computed by the first caller that needs it; concurrent callers
+ * wait for that result instead of computing their own. compute may use the
+ * pool, whose waits run other queued tasks on the same thread, so values
+ * that concurrent pool tasks share must be computed before they start. */
+template <typename T> class Shared_Value {
+public:
+  template <typename Compute> T const &get(Compute &&compute) {
+    std::call_once(once_, [&] { value_ = compute(); });
+    return value_;
+  }
+
+private:
+  std::once_flag once_;
+  T value_;
+};
+
+/* Intermediates of the filtered image that several outputs can share, such
+ * as the luma plane read by greyscale, laplace and threshold. */
+class Shared_Planes {
+public:
+  Shared_Planes(std::vector<unsigned char> const &image, unsigned int width,
+                unsigned int height, Colour_Space space)
+      : image_(image), width_(width), height_(height), space_(space) {}
+
+  std::vector<unsigned char> const &luma() {
+    return luma_.get([&] { return apply_greyscale_rgb_simd(image_); });
+  }
+
+  std::vector<unsigned char> const &edges() {
+    return edges_.get([&] { return apply_laplacian(luma(), width_, height_); });
+  }
+
+  std::vector<std::vector<unsigned char>> const &colour_planes() {
+    return colour_planes_.get(
+        [&] { return split_planes(convert_rgb_to(image_, space_), 3); });
+  }
+
+private:
+  std::vector<unsigned char> const &image_;
+  unsigned int width_;
+  unsigned int height_;
+  Colour_Space space_;
+  Shared_Value<std::vector<unsigned char>> luma_;
+  Shared_Value<std::vector<unsigned char>> edges_;
+  Shared_Value<std::vector<std::vector<unsigned char>>> colour_planes_;
+};
+
+/* The pixels a group of outputs filters: the whole decoded image, or the
+ * region grown by the halo the group's filters read. Outputs with the same
+ * input share its intermediates. */
+struct Filter_Input {
+  Filter_Input(std::vector<unsigned char> const &decoded, unsigned int width,
+               unsigned int height, std::optional<Roi> const &grown,
+               Colour_Space space)
+      : region(grown.value_or(Roi{0, 0, width, height})),
+        cropped(grown ? copy_view(crop_view(decoded, width, height, 3, region))
+                      : std::vector<unsigned char>{}),
+        image(grown ? cropped : decoded),
+        shared(image, region.width, region.height, space) {}
+
+  Roi region;
+  std::vector<unsigned char> cropped;
+  std::vector<unsigned char> const &image;
+  Shared_Planes shared;
+};
+
+struct Filtered_Image {
+  std::vector<unsigned char> bytes;
+  unsigned int width;
+  unsigned int height;
+  std::string format;
+};
+
+/* Runs one filter on an image of 3 channels, or on the luma plane alone when
+ * channels is 1; the image itself is left untouched. */
+Filtered_Image apply_filter(std::string const &filter,
+                            std::vector<unsigned char> const &image,
+                            unsigned int width, unsigned int height,
+                            unsigned int channels,
+                            Filter_Options const &options,
+                            Shared_Planes &shared) {
+  if (filter == "greyscale")
+    return {shared.luma(), width, height, "grey"};
+  if (filter == "invert")
+    return {apply_invert_rgb_simd(image), width, height, "rgb"};
+  if (filter == "gaussian")
+    return {apply_gaussian(image, width, height, channels,
+                           options.blur_strength, options.linear_light),
+            width, height, "rgb"};
+  if (filter == "laplace")
+    return {shared.edges(), width, height, "grey"};
+  if (filter == "erode" || filter == "dilate" || filter == "open" ||
+      filter == "close") {
+    auto [se_width, se_height] = parse_dimensions(options.element);
+    return {apply_morphology(image, width, height, channels,
+                             morphology_op_from_string(filter), se_width,
+                             se_height),
+            width, height, "rgb"};
+  }
+  if (filter == "equalize")
+    return {apply_equalize(image, width, height, channels), width, height,
+            "rgb"};
+  if (filter == "clahe") {
+    auto [tiles_x, tiles_y] = parse_dimensions(options.tiles);
+    return {apply_clahe(image, width, height, channels, tiles_x, tiles_y,
+                        options.clip_limit),
+            width, height, "rgb"};
+  }
+  if (filter == "convolve")
+    return {apply_convolution(image, width, height, channels, options.kernel),
+            width, height, "rgb"};
+  if (filter == "box") {
+    auto [box_width, box_height] = parse_dimensions(options.element);
+    return {apply_box_filter(image, width, height, channels, box_width,
+                             box_height),
+            width, height, "rgb"};
+  }
+  if (filter == "point") {
+    if (!options.point_ops)
+      throw std::invalid_argument("The point filter requires --ops");
+    return {apply_point_lut(image, parse_point_ops(*options.point_ops,
+                                                   channels)),
+            width, height, "rgb"};
+  }
+  if (filter == "threshold")
+    return {apply_threshold(options.edges ? shared.edges() : shared.luma(),
+                            width, height,
+                            threshold_method_from_string(
+                                options.threshold_method),
+                            options.threshold_params),
+            width, height, "grey"};
+  if (is_orientation_filter(filter)) {
+    const Orientation op = orientation_from_string(filter);
+    auto [oriented_width, oriented_height] =
+        oriented_dimensions(op, width, height);
+    return {apply_orientation(image, width, height, channels, op),
+            oriented_width, oriented_height, "rgb"};
+  }
+  if (filter == "colour")
+    return {convert_rgb_to(image, options.space), width, height, "rgb"};
+  return {image, width, height, "rgb"};
+}
+
+/* Runs filter_with(options) within a third of the time left to the current
+ * deadline, leaving the rest for encoding. If that runs out, the blur runs
+ * again with a quarter of the strength, i.e. a kernel a quarter the size;
+ * other filters have no cheaper form at the same size and use all the time. */
+template <typename Filter_With>
+auto filter_by_deadline(std::string const &filter,
+                        Filter_Options const &options,
+                        Filter_With &&filter_with) {
+  if (filter != "gaussian")
+    return filter_with(options);
+  return run_with_fallback(
+      1.0 / 3.0, [&] { return filter_with(options); },
+      [&] {
+        note_degraded("filter");
+        Filter_Options cheaper = options;
+        cheaper.blur_strength = std::max(1u, options.blur_strength / 4);
+        return filter_with(cheaper);
+      });
+}
+
+/* Keeps the top-left pixel of every scale x scale block, as --preview does
+ * for interlaced files. */
+std::vector<unsigned char>
+subsample_image(std::vector<unsigned char> const &bytes, unsigned int width,
+                unsigned int height, unsigned int channels,
+                unsigned int scale) {
+  const unsigned int preview_width = (width + scale - 1) / scale;
+  const unsigned int preview_height = (height + scale - 1) / scale;
+  std::vector<unsigned char> preview(std::size_t{preview_width} *
+                                     preview_height * channels);
+  unsigned char *out = preview.data();
+  for (unsigned int y = 0; y < height; y += scale)
+    for (unsigned int x = 0; x < width; x += scale) {
+      const unsigned char *pixel =
+          bytes.data() + (std::size_t{y} * width + x) * channels;
+      out = std::copy_n(pixel, channels, out);
+    }
+  return preview;
+}
+
+/* Runs body, which applies filter, in the filter stage: it is timed per
+ * filter, counted as an output and traced. */
+template <typename Body>
+void timed_filter(std::string const &filter, Body &&body) {
+  const auto start = std::chrono::steady_clock::now();
+  timed_stage("filter", [&] {
+    Trace_Span span("filter", filter);
+    body();
+  });
+  default_metrics().observe(
+      "simd_filter_filter_duration_seconds", {{"filter", filter}},
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+          .count());
+  default_metrics().increment("simd_filter_outputs_total",
+                              {{"filter", filter}});
+}
+
+/* Loads the profile saved by --tune and installs its machine-wide settings.
+ * A profile from a machine with a different core count, e.g. a home directory
+ * shared between instance types, is ignored. */
+std::optional<Tuning_Profile> load_tuning() {
+  const auto path = tuning_cache_path();
+  if (path.empty())
+    return std::nullopt;
+  try {
+    auto profile = load_tuning_profile(path);
+    if (!profile ||
+        profile->hardware_threads != std::thread::hardware_concurrency())
+      return std::nullopt;
+    apply_tuning_profile(*profile);
+    return profile;
+  } catch (std::exception const &error) {
+    std::println(std::cerr, "Ignoring tuning profile {}: {}", path.string(),
+                 error.what());
+    return std::nullopt;
+  }
+}
+
+/* Benchmarks every filter with the current options and saves the fastest
+ * settings for later runs. */
+void run_tuning(Filter_Options options) {
+  options.kernel = {5, 5, std::vector<float>(25, 1.0f / 25)};
+  options.point_ops = "gamma=2.2";
+  std::vector<std::string> filters;
+  for (std::string name :
+       {"greyscale", "invert", "gaussian", "laplace", "erode", "dilate",
+        "open", "close", "equalize", "clahe", "convolve", "box", "colour",
+        "point", "threshold", "rotate90", "rotate180", "rotate270",
+        "transpose", "transverse", "flipx", "flipy"})
+    filters.push_back(name);
+
+  const auto path = tuning_cache_path();
+  if (path.empty())
+    throw std::runtime_error("Set HOME or XDG_CACHE_HOME to save tuning");
+  const Tuning_Profile profile = tune(
+      filters,
+      [&](std::string const &filter, std::vector<unsigned char> const &rgb,
+          unsigned int width, unsigned int height) {
+        Shared_Planes shared(rgb, width, height, options.space);
+        apply_filter(filter, rgb, width, height, 3, options, shared);
+      },
+      std::cout);
+  save_tuning_profile(profile, path);
+  std::println("Saved tuning profile to {}", path.string());
+}
+
+/* Estimates the peak bytes of one batch image from its PNG header. The file
+ * is held until the image is written. Decoding holds the inflated scanlines,
+ * twice for interlaced images, and the RGB image; filtering holds the image,
+ * its result, a float intermediate and the luma and edge planes; encoding
+ * holds the result, its filtered scanlines and at worst as much output. */
+std::size_t estimate_batch_footprint(std::vector<unsigned char> const &png) {
+  unsigned int width, height;
+  lodepng::State state;
+  auto error =
+      lodepng_inspect(&width, &height, &state, png.data(), png.size());
   if (error)
-    throw std::runtime_error(std::string{"Error encoding PNG file: "} +
+    throw std::runtime_error(std::string{"Error decoding PNG file: "} +
                              lodepng_error_text(error));
-  lodepng::save_file(encoded, filename);
+  const std::size_t pixels = std::size_t{width} * height;
+  const std::size_t rgb = 3 * pixels;
+  const std::size_t scanlines =
+      lodepng_get_raw_size(width, height, &state.info_png.color) + height;
+  const std::size_t decode =
+      scanlines * (state.info_png.interlace_method ? 2 : 1) + rgb;
+  const std::size_t filter = 2 * rgb + rgb * sizeof(float) + 2 * pixels;
+  const std::size_t encode = rgb + 2 * (rgb + height);
+  return png.size() + std::max({decode, filter, encode});
 }
 
-int main(int argc, char *argv[]) {
-  unsigned int blur_strength;
+/* Records the time each batch job took under simd_filter_job_duration_seconds
+ * and, when both priority classes ran, prints their median and p99. */
+void report_job_latencies(std::vector<Batch_Job> const &jobs,
+                          std::vector<double> const &seconds) {
+  std::vector<double> by_class[priority_count];
+  for (std::size_t job = 0; job < jobs.size(); ++job) {
+    const auto p = static_cast<int>(jobs[job].priority);
+    default_metrics().observe("simd_filter_job_duration_seconds",
+                              {{"priority", priority_names[p]}},
+                              seconds[job]);
+    by_class[p].push_back(seconds[job]);
+  }
+  if (by_class[0].empty() || by_class[1].empty())
+    return;
+  for (int p = 0; p < priority_count; ++p) {
+    std::vector<double> &times = by_class[p];
+    std::ranges::sort(times);
+    /* Nearest-rank percentile, in milliseconds. */
+    auto percentile = [&](double q) {
+      const auto rank = static_cast<std::size_t>(
+          std::ceil(q * static_cast<double>(times.size())));
+      return times[std::max<std::size_t>(rank, 1) - 1] * 1000.0;
+    };
+    std::println("  {}: {} images, p50 {:.1f} ms, p99 {:.1f} ms",
+                 priority_names[p], times.size(), percentile(0.5),
+                 percentile(0.99));
+  }
+}
+
+/* Applies one filter to every image of a batch list, reading and writing the
+ * files through the chosen I/O backend. */
+int run_batch_mode(std::string const &list, std::string const &filter,
+                   Filter_Options const &options, File_IO_Backend backend,
+                   unsigned int io_depth, std::size_t memory_budget,
+                   std::chrono::milliseconds deadline, Priority priority) {
+  std::vector<Batch_Job> jobs = load_batch_list(list, priority);
+  bool deadlines = false;
+  for (Batch_Job &job : jobs) {
+    if (job.deadline.count() == 0)
+      job.deadline = deadline;
+    deadlines = deadlines || job.deadline.count() > 0;
+  }
+  const std::unique_ptr<File_IO> io = make_file_io(backend, io_depth);
+
+  Batch_Stages stages;
+  stages.decode = [&](std::vector<unsigned char> const &png) {
+    default_metrics().increment("simd_filter_input_bytes_total", {},
+                                static_cast<double>(png.size()));
+    const auto [width, height] = get_image_dimensions(png);
+    return Batch_Image{get_image_rows(png, "rgb", 0, height), width, height,
+                       "rgb"};
+  };
+  stages.filter = [&](Batch_Image image) {
+    Shared_Planes shared(image.bytes, image.width, image.height,
+                         options.space);
+    Filtered_Image result;
+    auto filter_with = [&](Filter_Options const &chosen) {
+      return apply_filter(filter, image.bytes, image.width, image.height, 3,
+                          chosen, shared);
+    };
+    /* Without a cheaper form at full size, a filter that runs out of time
+     * gives a quarter-size preview instead. */
+    auto preview = [&] {
+      note_degraded("filter");
+      const unsigned int width = (image.width + 3) / 4;
+      const unsigned int height = (image.height + 3) / 4;
+      const std::vector<unsigned char> bytes =
+          subsample_image(image.bytes, image.width, image.height, 3, 4);
+      Shared_Planes preview_shared(bytes, width, height, options.space);
+      return apply_filter(filter, bytes, width, height, 3, options,
+                          preview_shared);
+    };
+    timed_filter(filter, [&] {
+      result = filter == "gaussian"
+                   ? filter_by_deadline(filter, options, filter_with)
+                   : run_with_fallback(
+                         1.0 / 3.0, [&] { return filter_with(options); },
+                         preview);
+    });
+    return Batch_Image{std::move(result.bytes), result.width, result.height,
+                       result.format};
+  };
+  stages.encode = [&](Batch_Image const &image) {
+    return encode_image_bytes(image.bytes, image.width, image.height,
+                              image.format);
+  };
+  stages.footprint = estimate_batch_footprint;
+
+  /* Each stage may hold one image per thread plus one waiting. */
+  const Batch_Result result = run_batch(
+      jobs, *io,
+      {io_depth, default_thread_pool().size() + 1, memory_budget}, stages,
+      std::cerr);
+  std::println("Processed {} images with {} I/O, {} failed", jobs.size(),
+               io->name(), result.failures);
+  for (int s = 0; s < 3; ++s)
+    std::println("  {}: {:.1f} ms per image, {} threads", batch_stage_names[s],
+                 result.stage_seconds[s] * 1000.0, result.stage_threads[s]);
+  if (memory_budget != 0)
+    std::println("  memory: {:.1f} MiB peak of {:.1f} MiB, {} deferred, {} "
+                 "over budget",
+                 static_cast<double>(result.peak_bytes) / (1 << 20),
+                 static_cast<double>(memory_budget) / (1 << 20),
+                 result.deferred, result.oversized);
+  if (deadlines)
+    std::println("  deadlines: {} missed, {} stages degraded", result.expired,
+                 degraded_stages().load());
+  report_job_latencies(jobs, result.job_seconds);
+  const std::size_t failures = result.failures;
+  return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* Parses the command line and runs the requested mode. metrics_file is set as
+ * soon as --metrics is parsed so that main can export failed runs too. */
+int run(int argc, char *argv[], std::filesystem::path &metrics_file) {
+  const auto start = std::chrono::steady_clock::now();
+  Filter_Options options;
   std::string input_file, output_file;
   std::string filter;
+  std::vector<std::string> output_specs;
+  std::string kernel_file;
+  std::string colour_space;
+  std::string point_ops;
+  unsigned int bit_depth;
+  std::string roi_spec;
+  std::string roi_output;
+  unsigned int preview_scale;
+  std::string corpus_directory;
+  unsigned int corpus_max_size;
+  std::string metrics_path;
+  std::string trace_path;
+  std::string batch_list;
+  std::string io_backend;
+  unsigned int io_depth;
+  std::string memory_budget;
+  unsigned int deadline_ms;
+  std::string priority;
+  Priority_Policy priority_policy;
+  unsigned int self_test_cases;
+  std::uint32_t self_test_seed;
 
   po::options_description desc("Allowed options");
 
   // clang-format off
   desc.add_options()
     ("help,h", "Produce this help message")
+    ("tune", "Benchmark this machine and save the fastest settings for later runs")
+    ("corpus", po::value<std::string>(&corpus_directory), "Write the synthetic reference corpus of PNGs into a directory")
+    ("corpus-max-size", po::value<unsigned int>(&corpus_max_size)->default_value(4096), "Set the largest image side of the corpus (64 to 16384)")
+    ("self-test", po::value<unsigned int>(&self_test_cases)->implicit_value(1000), "Check the SIMD filters against scalar references on random images")
+    ("self-test-seed", po::value<std::uint32_t>(&self_test_seed)->default_value(1), "Set the seed of the --self-test cases")
+    ("metrics", po::value<std::string>(&metrics_path), "Add this run's counters and latencies to a Prometheus text file")
+    ("trace", po::value<std::string>(&trace_path), "Write a Chrome trace-event timeline of the run to a JSON file")
+    ("batch", po::value<std::string>(&batch_list), "Apply the filter to every PNG of a list file of 'input [output] [deadline] [priority]' lines")
+    ("io-backend", po::value<std::string>(&io_backend)->default_value("auto"), "Set the batch file I/O backend: auto, uring or blocking")
+    ("io-depth", po::value<unsigned int>(&io_depth)->default_value(16), "Set the number of batch file reads and writes in flight")
+    ("memory-budget", po::value<std::string>(&memory_budget)->default_value("0"), "Limit the memory batch images in progress may need, e.g. 4G; 0 for none")
+    ("deadline", po::value<unsigned int>(&deadline_ms)->default_value(0), "Set the milliseconds each image may take, degrading the result to meet it; 0 for none")
+    ("priority", po::value<std::string>(&priority)->default_value("interactive"), "Set the priority class of batch images whose line names none: interactive, bulk")
+    ("bulk-share", po::value<double>(&priority_policy.bulk_share)->default_value(0.1), "Set the fraction of contended work given to bulk images, 0 to 1")
+    ("interactive-threads", po::value<unsigned int>(&priority_policy.limits[0])->default_value(0), "Limit the threads working on interactive images; 0 for none")
+    ("bulk-threads", po::value<unsigned int>(&priority_policy.limits[1])->default_value(0), "Limit the threads working on bulk images; 0 for none")
     ("filter,F", po::value<std::string>(&filter)->default_value("greyscale"), "Set the image filter")
     ("input-file,I", po::value<std::string>(&input_file), "Set the input filename")
     ("output-file,O", po::value<std::string>(&output_file), "Set the output filename")
-    ("blur-strength", po::value<unsigned int>(&blur_strength)->default_value(10), "Set the gaussian blur strength");
+    ("output", po::value<std::vector<std::string>>(&output_specs)->composing(), "Add an output as filter=path; repeat to write several filters of one decode")
+    ("blur-strength", po::value<unsigned int>(&options.blur_strength)->default_value(10), "Set the gaussian blur strength")
+    ("element", po::value<std::string>(&options.element)->default_value("3x3"), "Set the morphology structuring element or box filter window as WxH")
+    ("tiles", po::value<std::string>(&options.tiles)->default_value("8x8"), "Set the CLAHE tile grid as NxM")
+    ("clip", po::value<double>(&options.clip_limit)->default_value(2.0), "Set the CLAHE clip limit")
+    ("kernel", po::value<std::string>(&kernel_file), "Set the convolution kernel file")
+    ("colour-space", po::value<std::string>(&colour_space)->default_value("ycbcr601"), "Set the colour space for the colour filter and --luma-only")
+    ("luma-only", "Filter only the luma plane of --colour-space")
+    ("planar", "Write each output channel to its own greyscale PNG")
+    ("linear-light", "Blur in linear light instead of on sRGB-encoded values")
+    ("ops", po::value<std::string>(&point_ops), "Set the point operation chain, e.g. gamma=2.2,contrast=1.2")
+    ("method", po::value<std::string>(&options.threshold_method)->default_value("otsu"), "Set the threshold method: fixed, otsu, adaptive-mean, adaptive-gaussian or sauvola")
+    ("level", po::value<unsigned int>(&options.threshold_params.level)->default_value(128), "Set the fixed threshold level")
+    ("window", po::value<unsigned int>(&options.threshold_params.window)->default_value(25), "Set the adaptive threshold window size")
+    ("offset", po::value<double>(&options.threshold_params.offset)->default_value(5.0), "Set the constant subtracted from the adaptive mean")
+    ("sauvola-k", po::value<double>(&options.threshold_params.k)->default_value(0.34), "Set the Sauvola k parameter")
+    ("edges", "Threshold the Laplacian edge map instead of the luma")
+    ("bit-depth", po::value<unsigned int>(&bit_depth)->default_value(8), "Set the bit depth of threshold output (1 or 8)")
+    ("roi", po::value<std::string>(&roi_spec), "Filter only the region x,y,w,h")
+    ("preview", po::value<unsigned int>(&preview_scale)->default_value(1), "Decode and filter at 1/2, 1/4 or 1/8 size (2, 4 or 8)")
+    ("roi-output", po::value<std::string>(&roi_output)->default_value("full"), "Write the full image with the region filtered (full) or only the region (crop)");
   // clang-format on
 
   po::variables_map vm;
   po::store(po::parse_command_line(argc, argv, desc), vm);
   po::notify(vm);
 
+  if (vm.count("metrics"))
+    metrics_file = metrics_path;
+  if (vm.count("trace"))
+    start_tracing(trace_path);
+
   if (vm.count("help")) {
     std::cout << desc << std::endl;
     return EXIT_SUCCESS;
   }
 
+  options.space = colour_space_from_string(colour_space);
+  options.linear_light = vm.count("linear-light") > 0;
+  options.edges = vm.count("edges") > 0;
+
+  if (vm.count("tune")) {
+    run_tuning(options);
+    return EXIT_SUCCESS;
+  }
+
+  if (vm.count("corpus")) {
+    const std::size_t written =
+        write_corpus(corpus_directory, corpus_max_size, std::cout);
+    std::println("Wrote {} images to {}", written, corpus_directory);
+    return EXIT_SUCCESS;
+  }
+
+  if (vm.count("self-test"))
+    return self_test(self_test_cases, self_test_seed, std::cout) == 0
+               ? EXIT_SUCCESS
+               : EXIT_FAILURE;
+
+  const std::optional<Tuning_Profile> tuning = load_tuning();
+
+  if (vm.count("batch")) {
+    for (const char *option : {"input-file", "output-file", "output", "roi",
+                               "planar", "luma-only"})
+      if (vm.count(option))
+        throw std::invalid_argument(std::string{"--"} + option +
+                                    " cannot be combined with --batch");
+    if (preview_scale != 1 || bit_depth != 8)
+      throw std::invalid_argument(
+          "--preview and --bit-depth cannot be combined with --batch");
+    filter_to_image_filter(filter);
+    if (filter == "crop")
+      throw std::invalid_argument("The crop filter requires --roi");
+    if (filter == "convolve") {
+      if (!vm.count("kernel"))
+        throw std::invalid_argument("The convolve filter requires --kernel");
+      options.kernel = load_convolution_kernel(kernel_file);
+    }
+    if (vm.count("ops"))
+      options.point_ops = point_ops;
+    if (!(priority_policy.bulk_share >= 0.0 &&
+          priority_policy.bulk_share <= 1.0))
+      throw std::invalid_argument("--bulk-share must be between 0 and 1");
+    default_thread_pool().set_priority_policy(priority_policy);
+    return run_batch_mode(batch_list, filter, options,
+                          file_io_backend_from_string(io_backend), io_depth,
+                          parse_byte_size(memory_budget),
+                          std::chrono::milliseconds{deadline_ms},
+                          parse_priority(priority));
+  }
+
   if (!vm.count("input-file")) {
     std::println(std::cerr, "Missing required option: input-file");
     std::cerr << desc << std::endl;
     return EXIT_FAILURE;
   }
 
-  if (!vm.count("output-file"))
-    output_file = "out-" + input_file;
+  /* Without --output, -F and -O describe the only output. */
+  std::vector<Output_Job> jobs;
+  if (!output_specs.empty()) {
+    if (vm.count("output-file"))
+      throw std::invalid_argument("--output replaces --output-file");
+    for (auto const &spec : output_specs)
+      jobs.push_back(parse_output_job(spec));
+  } else {
+    filter_to_image_filter(filter);
+    jobs.push_back(
+        {filter, vm.count("output-file") ? output_file : "out-" + input_file});
+  }
+  for (std::size_t i = 0; i < jobs.size(); ++i)
+    for (std::size_t j = 0; j < i; ++j)
+      if (jobs[i].file == jobs[j].file)
+        throw std::invalid_argument("Two outputs write to " + jobs[i].file);
+
+  auto any_job = [&](auto &&predicate) {
+    return std::any_of(jobs.begin(), jobs.end(), [&](Output_Job const &job) {
+      return predicate(job.filter);
+    });
+  };
+
+  if (bit_depth != 8 &&
+      (bit_depth != 1 ||
+       any_job([](std::string const &f) { return f != "threshold"; })))
+    throw std::invalid_argument("Bit depth 1 is only supported by threshold");
+
+  std::optional<Roi> roi;
+  if (vm.count("roi"))
+    roi = parse_roi(roi_spec);
+  else if (any_job([](std::string const &f) { return f == "crop"; }))
+    throw std::invalid_argument("The crop filter requires --roi");
+  if (roi_output != "full" && roi_output != "crop")
+    throw std::invalid_argument("--roi-output must be full or crop");
+  auto crop_output = [&](std::string const &f) {
+    return f == "crop" || roi_output == "crop";
+  };
+  if (roi && bit_depth == 1 &&
+      any_job([&](std::string const &f) { return !crop_output(f); }))
+    throw std::invalid_argument("Bit depth 1 needs --roi-output crop");
+
+  if (any_job([](std::string const &f) { return f == "convolve"; })) {
+    if (!vm.count("kernel"))
+      throw std::invalid_argument("The convolve filter requires --kernel");
+    options.kernel = load_convolution_kernel(kernel_file);
+  }
+  if (vm.count("ops"))
+    options.point_ops = point_ops;
+
+  const bool luma_only = vm.count("luma-only") > 0;
+  if (luma_only)
+    for (auto const &job : jobs)
+      if (job.filter == "greyscale" || job.filter == "invert" ||
+          job.filter == "laplace" || job.filter == "colour" ||
+          job.filter == "threshold" || is_orientation_filter(job.filter))
+        throw std::invalid_argument("The " + job.filter +
+                                    " filter does not support --luma-only");
+
+  if (preview_scale != 1 && preview_scale != 2 && preview_scale != 4 &&
+      preview_scale != 8)
+    throw std::invalid_argument("--preview must be 1, 2, 4 or 8");
 
-  auto [width, height, bytes] = get_image_bytes(input_file, "rgb");
+  /* The deadline covers the whole image, from reading it to writing the
+   * last output; the outputs' filters and encodes run under it. */
+  Deadline_Scope deadline_scope(
+      deadline_ms == 0 ? Deadline()
+                       : Deadline(Deadline::Clock::now() +
+                                  std::chrono::milliseconds{deadline_ms}));
+  const std::vector<unsigned char> png = load_png(input_file);
+  auto [width, height] = get_image_dimensions(png);
+  /* Previews are filtered at their reduced size; --roi refers to it too. */
+  width = (width + preview_scale - 1) / preview_scale;
+  height = (height + preview_scale - 1) / preview_scale;
+  const unsigned int image_width = width, image_height = height;
 
-  std::vector<unsigned char> filtered;
+  /* Each filter runs on the region plus the halo it reads around it, as it
+   * would on its own; the decode covers the widest of these regions. */
+  std::vector<unsigned int> halos;
+  for (auto const &job : jobs)
+    halos.push_back(roi ? filter_halo(job.filter, options) : 0);
+  Roi widest{0, 0, width, height};
+  if (roi)
+    widest = expand_roi(*roi, *std::max_element(halos.begin(), halos.end()),
+                        width, height);
+  if (tuning) {
+    std::vector<std::string> filters;
+    for (auto const &job : jobs)
+      filters.push_back(job.filter);
+    apply_tuning_for_image(*tuning, filters, widest.width, widest.height);
+  }
 
-  std::string output_format;
-  if (filter == "greyscale") {
-    filtered = apply_greyscale_rgb_simd(bytes);
-    output_format = "grey";
-  } else if (filter == "invert") {
-    filtered = apply_invert_rgb_simd(bytes);
-    output_format = "rgb";
-  } else if (filter == "gaussian") {
-    filtered = apply_gaussian_rgb(bytes, width, height, blur_strength);
-    output_format = "rgb";
-  } else if (filter == "laplace") {
-    filtered = apply_laplacian_rgb(bytes, width, height);
-    output_format = "grey";
+  /* When every result is cropped only the rows of the region are needed, so
+   * decoding stops after its last row; the ROI then refers to the decoded
+   * band. */
+  std::vector<unsigned char> bytes;
+  if (preview_scale != 1) {
+    bytes = get_image_rows(png, "rgb", 0, 0, preview_scale);
+  } else if (roi && !any_job([&](std::string const &f) {
+               return !crop_output(f);
+             })) {
+    bytes = get_image_rows(png, "rgb", widest.y, widest.y + widest.height);
+    roi->y -= widest.y;
+    height = widest.height;
   } else {
-    filtered = bytes;
+    bytes = get_image_rows(png, "rgb", 0, height);
+  }
+
+  /* Regions are gathered from views of the decoded image; the rest of the
+   * frame is untouched. */
+  std::map<unsigned int, Filter_Input> inputs;
+  for (unsigned int halo : halos)
+    if (!inputs.contains(halo))
+      inputs.try_emplace(
+          halo, bytes, width, height,
+          roi ? std::optional{expand_roi(*roi, halo, width, height)}
+              : std::nullopt,
+          options.space);
+
+  /* Intermediates the outputs share are computed before they fan out, as an
+   * output computing one could otherwise pick up a sibling waiting for it. */
+  for (std::size_t index = 0; index < jobs.size(); ++index) {
+    Shared_Planes &shared = inputs.at(halos[index]).shared;
+    std::string const &filter = jobs[index].filter;
+    if (luma_only)
+      shared.colour_planes();
+    if (filter == "greyscale" || (filter == "threshold" && !options.edges))
+      shared.luma();
+    if (filter == "laplace" || (filter == "threshold" && options.edges))
+      shared.edges();
   }
 
-  write_image_bytes(filtered, width, height, output_file, output_format);
-}
\ No newline at end of file
+  /* Outputs are independent branches of the one decode and run concurrently;
+   * the filters inside them split into bands on the same pool. */
+  default_thread_pool().run(jobs.size(), [&](std::size_t index) {
+    Output_Job const &job = jobs[index];
+    Filter_Input &input = inputs.at(halos[index]);
+    const Roi &region = input.region;
+    Filtered_Image result;
+    timed_filter(job.filter, [&] {
+      result = filter_by_deadline(
+          job.filter, options, [&](Filter_Options const &chosen) {
+            if (!luma_only)
+              return apply_filter(job.filter, input.image, region.width,
+                                  region.height, 3, chosen, input.shared);
+            const unsigned int luma_plane =
+                colour_space_luma_plane(options.space);
+            auto planes = input.shared.colour_planes();
+            Filtered_Image luma =
+                apply_filter(job.filter, planes[luma_plane], region.width,
+                             region.height, 1, chosen, input.shared);
+            planes[luma_plane] = std::move(luma.bytes);
+            luma.bytes = convert_to_rgb(merge_planes(planes), options.space);
+            return luma;
+          });
+    });
+
+    if (roi) {
+      const unsigned int output_channels = result.format == "rgb" ? 3 : 1;
+      if (result.width == region.width && result.height == region.height) {
+        const Roi inner{roi->x - region.x, roi->y - region.y, roi->width,
+                        roi->height};
+        result.bytes = copy_view(crop_view(result.bytes, result.width,
+                                           result.height, output_channels,
+                                           inner));
+        result.width = roi->width;
+        result.height = roi->height;
+      }
+      if (!crop_output(job.filter)) {
+        if (result.width != roi->width || result.height != roi->height)
+          throw std::invalid_argument("The " + job.filter +
+                                      " filter changes the region shape; use "
+                                      "--roi-output crop");
+        std::vector<unsigned char> frame = bytes;
+        paste_view(result.bytes, output_channels,
+                   crop_view(frame, image_width, image_height, 3, *roi));
+        result = {std::move(frame), image_width, image_height, "rgb"};
+      }
+    }
+
+    if (vm.count("planar")) {
+      if (result.format != "rgb")
+        throw std::invalid_argument("--planar needs a three channel output");
+      const auto names = colour_space_planes(
+          job.filter == "colour" ? options.space : Colour_Space::RGB);
+      const auto outputs = split_planes(result.bytes, 3);
+      for (std::size_t i = 0; i < outputs.size(); ++i)
+        write_image_bytes(outputs[i], result.width, result.height,
+                          plane_filename(job.file, names[i]), "grey");
+      return;
+    }
+
+    if (bit_depth == 1) {
+      write_image_bytes(pack_bits(result.bytes), result.width, result.height,
+                        job.file, "grey", 1);
+      return;
+    }
+
+    write_image_bytes(result.bytes, result.width, result.height, job.file,
+                      result.format);
+  });
+
+  default_metrics().observe(
+      "simd_filter_run_duration_seconds", {},
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+          .count());
+  return EXIT_SUCCESS;
+}
+
+/* Names the kind of a failure for simd_filter_errors_total. */
+std::string error_type(std::exception const &error) {
+  if (dynamic_cast<std::bad_alloc const *>(&error))
+    return "out_of_memory";
+  if (dynamic_cast<Deadline_Exceeded const *>(&error))
+    return "deadline";
+  if (dynamic_cast<std::logic_error const *>(&error))
+    return "usage";
+  if (dynamic_cast<std::runtime_error const *>(&error))
+    return "runtime";
+  return "other";
+}
+
+int main(int argc, char *argv[]) {
+  define_metrics(default_metrics());
+  trace_thread_name("main");
+  std::filesystem::path metrics_file;
+  try {
+    const int status = run(argc, argv, metrics_file);
+    finish_tracing();
+    if (!metrics_file.empty())
+      default_metrics().merge_into_file(metrics_file);
+    return status;
+  } catch (std::exception const &error) {
+    finish_tracing();
+    if (!metrics_file.empty()) {
+      default_metrics().increment("simd_filter_errors_total",
+                                  {{"type", error_type(error)}});
+      default_metrics().merge_into_file(metrics_file);
+    }
+    throw;
+  }
+}
@@ -0,0 +1,383 @@
+#ifndef METRICS_HPP_
+#define METRICS_HPP_
+
+#include <filesystem>
+#include <istream>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Label names and values of one metric series, in output order.
+ */
+using Metric_Labels = std::vector<std::pair<std::string, std::string>>;
+
+/**
+ * @brief Counters and latency histograms in the Prometheus text format.
+ *
+ * Every metric only ever grows: counters add up and histograms count
+ * observations into cumulative buckets. Two registries, or a registry and a
+ * file it wrote earlier, therefore merge by adding sample values, which lets
+ * short-lived processes accumulate into one file for the node exporter's
+ * textfile collector. All members are thread-safe.
+ */
+class Metrics_Registry {
+public:
+  /**
+   * @brief Upper bounds in seconds of the latency histogram buckets, from
+   * 1 ms to 1 minute; a +Inf bucket follows them.
+   */
+  static const std::vector<double> &latency_buckets();
+
+  /**
+   * @brief Declares a counter; samples of undeclared names are rejected.
+   *
+   * @param name Metric name, ending in _total by convention.
+   * @param help One-line description written as # HELP.
+   */
+  void define_counter(const std::string &name, const std::string &help);
+
+  /**
+   * @brief Declares a latency histogram with latency_buckets().
+   *
+   * @param name Metric name, ending in _seconds by convention.
+   * @param help One-line description written as # HELP.
+   */
+  void define_histogram(const std::string &name, const std::string &help);
+
+  /**
+   * @brief Adds a value to a counter series.
+   *
+   * @throws std::invalid_argument If name is not a declared counter.
+   */
+  void increment(const std::string &name, const Metric_Labels &labels = {},
+                 double value = 1.0);
+
+  /**
+   * @brief Records a duration in a histogram series.
+   *
+   * @throws std::invalid_argument If name is not a declared histogram.
+   */
+  void observe(const std::string &name, const Metric_Labels &labels,
+               double seconds);
+
+  /**
+   * @brief Writes every series with samples in the Prometheus text format.
+   */
+  void write_prometheus(std::ostream &out) const;
+
+  /**
+   * @brief Adds the samples of a file written by write_prometheus.
+   *
+   * Families missing from this registry are taken over with their help text.
+   * Comments other than # HELP and # TYPE, and histogram buckets whose bound
+   * is not one of latency_buckets(), are skipped.
+   *
+   * @throws std::runtime_error If a sample line is malformed.
+   */
+  void read_prometheus(std::istream &in);
+
+  /**
+   * @brief Adds this registry's samples to a metrics file.
+   *
+   * The file is read, merged and replaced by rename under an exclusive lock on
+   * a ".lock" file beside it, so concurrent processes do not lose updates and
+   * scrapers never see a partial file.
+   *
+   * @param path Metrics file, created with its directory if missing.
+   * @throws std::runtime_error If the file cannot be locked, read or written.
+   */
+  void merge_into_file(const std::filesystem::path &path) const;
+
+private:
+  enum class Type { COUNTER, HISTOGRAM };
+
+  /* Counters hold one value; histograms hold the cumulative count of every
+   * bucket bound, then the sum and the count. Series are keyed by their
+   * rendered label list. */
+  struct Family {
+    Type type = Type::COUNTER;
+    std::string help;
+    std::map<std::string, std::vector<double>> series;
+  };
+
+  Family &family(const std::string &name, Type type);
+  void add_sample(const std::string &sample, const std::string &labels,
+                  double value);
+
+  mutable std::mutex mutex_;
+  std::map<std::string, Family> families_;
+};
+
+/**
+ * @brief Returns the process-wide registry that the filters report to.
+ */
+Metrics_Registry &default_metrics();
+
+#endif
+
+#ifdef METRICS_IMPLEMENTATION
+
+#include <sys/file.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cmath>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+const std::vector<double> &Metrics_Registry::latency_buckets() {
+  static const std::vector<double> buckets{
+      0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25,
+      0.5,   1.0,    2.5,   5.0,  10.0,  25.0, 60.0};
+  return buckets;
+}
+
+/* Shortest form that keeps counts exact and durations to 15 digits. */
+static std::string format_value(double value) {
+  std::ostringstream out;
+  out << std::setprecision(15) << value;
+  return out.str();
+}
+
+static std::string render_labels(const Metric_Labels &labels) {
+  std::string out;
+  for (const auto &[name, value] : labels) {
+    if (!out.empty())
+      out += ',';
+    out += name + "=\"";
+    for (char c : value) {
+      if (c == '\n') {
+        out += "\\n";
+        continue;
+      }
+      if (c == '\\' || c == '"')
+        out += '\\';
+      out += c;
+    }
+    out += '"';
+  }
+  return out;
+}
+
+Metrics_Registry::Family &Metrics_Registry::family(const std::string &name,
+                                                   Type type) {
+  auto it = families_.find(name);
+  if (it == families_.end() || it->second.type != type)
+    throw std::invalid_argument("Undeclared metric: " + name);
+  return it->second;
+}
+
+void Metrics_Registry::define_counter(const std::string &name,
+                                      const std::string &help) {
+  std::lock_guard lock(mutex_);
+  families_[name] = {Type::COUNTER, help, {}};
+}
+
+void Metrics_Registry::define_histogram(const std::string &name,
+                                        const std::string &help) {
+  std::lock_guard lock(mutex_);
+  families_[name] = {Type::HISTOGRAM, help, {}};
+}
+
+void Metrics_Registry::increment(const std::string &name,
+                                 const Metric_Labels &labels, double value) {
+  std::lock_guard lock(mutex_);
+  auto &series = family(name, Type::COUNTER).series[render_labels(labels)];
+  series.resize(1);
+  series[0] += value;
+}
+
+void Metrics_Registry::observe(const std::string &name,
+                               const Metric_Labels &labels, double seconds) {
+  std::lock_guard lock(mutex_);
+  const auto &bounds = latency_buckets();
+  auto &series = family(name, Type::HISTOGRAM).series[render_labels(labels)];
+  series.resize(bounds.size() + 2);
+  for (std::size_t i = 0; i < bounds.size(); ++i)
+    if (seconds <= bounds[i])
+      series[i] += 1.0;
+  series[bounds.size()] += seconds;
+  series[bounds.size() + 1] += 1.0;
+}
+
+void Metrics_Registry::write_prometheus(std::ostream &out) const {
+  std::lock_guard lock(mutex_);
+  const auto &bounds = latency_buckets();
+  for (const auto &[name, family] : families_) {
+    if (family.series.empty())
+      continue;
+    out << "# HELP " << name << ' ' << family.help << "\n# TYPE " << name
+        << (family.type == Type::COUNTER ? " counter\n" : " histogram\n");
+    for (const auto &[labels, values] : family.series) {
+      if (family.type == Type::COUNTER) {
+        out << name << (labels.empty() ? "" : "{" + labels + "}") << ' '
+            << format_value(values[0]) << '\n';
+        continue;
+      }
+      const std::string prefix = labels.empty() ? "" : labels + ",";
+      const std::string braces = labels.empty() ? "" : "{" + labels + "}";
+      for (std::size_t i = 0; i < bounds.size(); ++i)
+        out << name << "_bucket{" << prefix << "le=\""
+            << format_value(bounds[i]) << "\"} "
+            << format_value(values[i]) << '\n';
+      out << name << "_bucket{" << prefix << "le=\"+Inf\"} "
+          << format_value(values[bounds.size() + 1]) << '\n'
+          << name << "_sum" << braces << ' '
+          << format_value(values[bounds.size()]) << '\n'
+          << name << "_count" << braces << ' '
+          << format_value(values[bounds.size() + 1]) << '\n';
+    }
+  }
+}
+
+void Metrics_Registry::add_sample(const std::string &sample,
+                                  const std::string &labels, double value) {
+  const auto &bounds = latency_buckets();
+  if (auto it = families_.find(sample);
+      it != families_.end() && it->second.type == Type::COUNTER) {
+    auto &series = it->second.series[labels];
+    series.resize(1);
+    series[0] += value;
+    return;
+  }
+
+  for (const std::string suffix : {"_bucket", "_sum", "_count"}) {
+    if (!sample.ends_with(suffix))
+      continue;
+    auto it = families_.find(sample.substr(0, sample.size() - suffix.size()));
+    if (it == families_.end() || it->second.type != Type::HISTOGRAM)
+      continue;
+
+    std::string key = labels;
+    std::size_t index = suffix == "_sum" ? bounds.size() : bounds.size() + 1;
+    if (suffix == "_bucket") {
+      /* le is always the last label; +Inf is the count and is not stored. */
+      const std::size_t le = labels.rfind("le=\"");
+      if (le == std::string::npos)
+        throw std::runtime_error("Histogram bucket without le: " + sample);
+      const std::string bound = labels.substr(le + 4, labels.size() - le - 5);
+      key = labels.substr(0, le == 0 ? 0 : le - 1);
+      if (bound == "+Inf")
+        return;
+      const double upper = std::stod(bound);
+      index = bounds.size();
+      for (std::size_t i = 0; i < bounds.size(); ++i)
+        if (std::abs(bounds[i] - upper) <= 1e-9 * bounds[i])
+          index = i;
+      if (index == bounds.size())
+        return;
+    }
+    auto &series = it->second.series[key];
+    series.resize(bounds.size() + 2);
+    series[index] += value;
+    return;
+  }
+  throw std::runtime_error("Sample of an undeclared metric: " + sample);
+}
+
+void Metrics_Registry::read_prometheus(std::istream &in) {
+  std::lock_guard lock(mutex_);
+  std::string line, help_name, help;
+  while (std::getline(in, line)) {
+    if (line.empty())
+      continue;
+    if (line.starts_with("# HELP ")) {
+      std::istringstream fields(line.substr(7));
+      fields >> help_name;
+      std::getline(fields >> std::ws, help);
+      continue;
+    }
+    if (line.starts_with("# TYPE ")) {
+      std::istringstream fields(line.substr(7));
+      std::string name, type;
+      fields >> name >> type;
+      if (!families_.contains(name) && (type == "counter" ||
+                                        type == "histogram"))
+        families_[name] = {type == "counter" ? Type::COUNTER : Type::HISTOGRAM,
+                           name == help_name ? help : "", {}};
+      continue;
+    }
+    if (line[0] == '#')
+      continue;
+
+    const std::size_t space = line.rfind(' ');
+    const std::size_t brace = line.find('{');
+    if (space == std::string::npos ||
+        (brace != std::string::npos &&
+         (brace > space || line[space - 1] != '}')))
+      throw std::runtime_error("Malformed metrics line: " + line);
+    const std::string sample = line.substr(0, std::min(brace, space));
+    const std::string labels =
+        brace == std::string::npos
+            ? ""
+            : line.substr(brace + 1, space - brace - 2);
+    double value;
+    try {
+      value = std::stod(line.substr(space + 1));
+    } catch (const std::logic_error &) {
+      throw std::runtime_error("Malformed metrics line: " + line);
+    }
+    add_sample(sample, labels, value);
+  }
+}
+
+/* Holds an exclusive flock on a file for the lifetime of the object. */
+class File_Lock {
+public:
+  explicit File_Lock(const std::filesystem::path &path)
+      : fd_(::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644)) {
+    if (fd_ < 0 || ::flock(fd_, LOCK_EX) != 0) {
+      if (fd_ >= 0)
+        ::close(fd_);
+      throw std::runtime_error("Unable to lock " + path.string());
+    }
+  }
+  ~File_Lock() { ::close(fd_); }
+
+  File_Lock(const File_Lock &) = delete;
+  File_Lock &operator=(const File_Lock &) = delete;
+
+private:
+  int fd_;
+};
+
+void Metrics_Registry::merge_into_file(
+    const std::filesystem::path &path) const {
+  if (path.has_parent_path())
+    std::filesystem::create_directories(path.parent_path());
+  std::filesystem::path lock_path = path, temporary = path;
+  lock_path += ".lock";
+  temporary += ".tmp";
+  File_Lock lock(lock_path);
+
+  Metrics_Registry merged;
+  {
+    std::lock_guard own(mutex_);
+    merged.families_ = families_;
+  }
+  if (std::ifstream existing(path); existing)
+    merged.read_prometheus(existing);
+
+  {
+    std::ofstream file(temporary);
+    merged.write_prometheus(file);
+    if (!file.flush())
+      throw std::runtime_error("Unable to write metrics: " +
+                               temporary.string());
+  }
+  std::filesystem::rename(temporary, path);
+}
+
+Metrics_Registry &default_metrics() {
+  static Metrics_Registry metrics;
+  return metrics;
+}
+
+#endif
@@ -0,0 +1,296 @@
+#ifndef MORPHOLOGY_HPP_
+#define MORPHOLOGY_HPP_
+
+#include <string>
+#include <vector>
+
+/**
+ * @brief Morphological operators supported by apply_morphology.
+ */
+enum class Morphology_Op {
+  ERODE,
+  DILATE,
+  OPEN,
+  CLOSE,
+};
+
+/**
+ * @brief Parses a morphology filter name ("erode", "dilate", "open", "close").
+ *
+ * @param name Filter name as passed on the command line.
+ * @return Morphology_Op The matching operator.
+ * @throws std::invalid_argument If the name is not a morphology filter.
+ */
+Morphology_Op morphology_op_from_string(const std::string &name);
+
+/**
+ * @brief Applies a morphological operator with a rectangular structuring
+ * element using the van Herk/Gil-Werman algorithm.
+ *
+ * Each 1D pass splits the line into blocks of the element size and builds
+ * prefix and suffix min/max arrays, so every output pixel costs three
+ * min/max operations regardless of the element size. Both passes run in SIMD
+ * with pmaxub/pminub: the vertical pass over column strips, the horizontal
+ * pass over 16 rows at a time transposed into columns. Pixels outside the
+ * image are treated as the identity of the operator, which matches edge
+ * clamping.
+ *
+ * @param bytes Input buffer (channels bytes per pixel).
+ * @param width Image width in pixels.
+ * @param height Image height in pixels.
+ * @param channels Number of interleaved channels per pixel.
+ * @param op Operator to apply.
+ * @param se_width Structuring element width in pixels.
+ * @param se_height Structuring element height in pixels.
+ * @return std::vector<unsigned char> Filtered output (same size as input).
+ * @throws std::invalid_argument If the buffer size does not match the
+ * dimensions or the structuring element is empty.
+ */
+std::vector<unsigned char>
+apply_morphology(const std::vector<unsigned char> &bytes, unsigned int width,
+                 unsigned int height, unsigned int channels, Morphology_Op op,
+                 unsigned int se_width, unsigned int se_height);
+
+#endif
+
+#ifdef MORPHOLOGY_IMPLEMENTATION
+
+#include "deadline.hpp"
+
+#include <emmintrin.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+struct Morph_Max {
+  static constexpr unsigned char identity = 0;
+  static unsigned char apply(unsigned char a, unsigned char b) {
+    return std::max(a, b);
+  }
+  static __m128i apply(__m128i a, __m128i b) { return _mm_max_epu8(a, b); }
+};
+
+struct Morph_Min {
+  static constexpr unsigned char identity = 255;
+  static unsigned char apply(unsigned char a, unsigned char b) {
+    return std::min(a, b);
+  }
+  static __m128i apply(__m128i a, __m128i b) { return _mm_min_epu8(a, b); }
+};
+
+Morphology_Op morphology_op_from_string(const std::string &name) {
+  if (name == "erode")
+    return Morphology_Op::ERODE;
+  else if (name == "dilate")
+    return Morphology_Op::DILATE;
+  else if (name == "open")
+    return Morphology_Op::OPEN;
+  else if (name == "close")
+    return Morphology_Op::CLOSE;
+  else
+    throw std::invalid_argument("Invalid morphology operator");
+}
+
+/* dst[i] = op(a[i], b[i]) for n bytes */
+template <typename Op>
+static void morph_combine(unsigned char *dst, const unsigned char *a,
+                          const unsigned char *b, std::size_t n) {
+  std::size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+    __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), Op::apply(va, vb));
+  }
+  for (; i < n; ++i)
+    dst[i] = Op::apply(a[i], b[i]);
+}
+
+/* Transposes a 16x16 byte block held as 16 rows. Interleaving row i with
+ * row i + 8 rotates the bits of each byte's row and column index by one;
+ * four rounds swap them. */
+static void transpose_16x16(__m128i (&block)[16]) {
+  for (int round = 0; round < 4; ++round) {
+    __m128i t[16];
+    for (int i = 0; i < 8; ++i) {
+      t[2 * i] = _mm_unpacklo_epi8(block[i], block[i + 8]);
+      t[2 * i + 1] = _mm_unpackhi_epi8(block[i], block[i + 8]);
+    }
+    std::copy_n(t, 16, block);
+  }
+}
+
+template <typename Op>
+static void morph_horizontal(const unsigned char *src, unsigned char *dst,
+                             int width, int height, int channels, int k) {
+  constexpr int lanes = 16;
+  const int padded = ((width + k - 1 + k - 1) / k) * k;
+  const auto stride = static_cast<std::size_t>(width) * channels;
+  const auto pixel = static_cast<std::size_t>(channels);
+  const std::size_t line = static_cast<std::size_t>(padded) * pixel;
+  const std::size_t left = static_cast<std::size_t>(k / 2) * pixel;
+  const std::size_t block = static_cast<std::size_t>(k) * pixel;
+  const std::size_t reach = block - pixel;
+
+  /* Sixteen rows are scanned at once, transposed so that each vector holds
+   * one byte of the line from every row. The padding around the row keeps
+   * the identity throughout. */
+  std::vector<unsigned char> x(line * lanes, Op::identity);
+  std::vector<unsigned char> g(x.size()), h(x.size());
+  const std::vector<unsigned char> identity(stride, Op::identity);
+  const auto at = [](std::vector<unsigned char> &v, std::size_t i) {
+    return reinterpret_cast<__m128i *>(v.data() + i * lanes);
+  };
+
+  for (int y0 = 0; y0 < height; y0 += lanes) {
+    check_deadline();
+    const int count = std::min(lanes, height - y0);
+    const unsigned char *rows[lanes];
+    for (int r = 0; r < lanes; ++r)
+      rows[r] = r < count ? src + static_cast<std::size_t>(y0 + r) * stride
+                          : identity.data();
+
+    std::size_t j = 0;
+    for (; j + 16 <= stride; j += 16) {
+      __m128i tile[16];
+      for (int r = 0; r < lanes; ++r)
+        tile[r] =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(rows[r] + j));
+      transpose_16x16(tile);
+      for (std::size_t i = 0; i < 16; ++i)
+        _mm_storeu_si128(at(x, left + j + i), tile[i]);
+    }
+    for (; j < stride; ++j)
+      for (int r = 0; r < lanes; ++r)
+        x[(left + j) * lanes + static_cast<std::size_t>(r)] = rows[r][j];
+
+    /* The prefix and suffix scans restart at every block of k pixels. */
+    for (std::size_t b = 0; b < line; b += block) {
+      std::copy_n(x.data() + b * lanes, pixel * lanes, g.data() + b * lanes);
+      morph_combine<Op>(g.data() + (b + pixel) * lanes, g.data() + b * lanes,
+                        x.data() + (b + pixel) * lanes, reach * lanes);
+      std::copy_n(x.data() + (b + reach) * lanes, pixel * lanes,
+                  h.data() + (b + reach) * lanes);
+      for (std::size_t i = b + reach; i-- > b;)
+        _mm_storeu_si128(at(h, i),
+                         Op::apply(_mm_loadu_si128(at(h, i + pixel)),
+                                   _mm_loadu_si128(at(x, i))));
+    }
+
+    /* Each output combines the suffix at the start of its window with the
+     * prefix at the end, and is transposed back into its row. */
+    j = 0;
+    for (; j + 16 <= stride; j += 16) {
+      __m128i tile[16];
+      for (std::size_t i = 0; i < 16; ++i)
+        tile[i] = Op::apply(_mm_loadu_si128(at(h, j + i)),
+                            _mm_loadu_si128(at(g, j + i + reach)));
+      transpose_16x16(tile);
+      for (int r = 0; r < count; ++r)
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(
+                             dst + static_cast<std::size_t>(y0 + r) * stride +
+                             j),
+                         tile[r]);
+    }
+    for (; j < stride; ++j)
+      for (int r = 0; r < count; ++r) {
+        const std::size_t i = static_cast<std::size_t>(r);
+        dst[static_cast<std::size_t>(y0 + r) * stride + j] =
+            Op::apply(h[j * lanes + i], g[(j + reach) * lanes + i]);
+      }
+  }
+}
+
+template <typename Op>
+static void morph_vertical(const unsigned char *src, unsigned char *dst,
+                           int width, int height, int channels, int k) {
+  constexpr int strip = 64;
+
+  const int stride = width * channels;
+  const int pad_top = k / 2;
+  const int padded = ((height + k - 1 + k - 1) / k) * k;
+
+  std::vector<unsigned char> g(static_cast<std::size_t>(padded * strip));
+  std::vector<unsigned char> h(static_cast<std::size_t>(padded * strip));
+  std::vector<unsigned char> identity(strip, Op::identity);
+
+  for (int x0 = 0; x0 < stride; x0 += strip) {
+    check_deadline();
+    const int sw = std::min(strip, stride - x0);
+
+    auto row_at = [&](int i) -> const unsigned char * {
+      const int y = i - pad_top;
+      return (y < 0 || y >= height) ? identity.data() : src + y * stride + x0;
+    };
+
+    for (int i = 0; i < padded; ++i) {
+      unsigned char *gi = g.data() + i * strip;
+      if (i % k == 0)
+        std::copy_n(row_at(i), sw, gi);
+      else
+        morph_combine<Op>(gi, gi - strip, row_at(i),
+                          static_cast<std::size_t>(sw));
+    }
+
+    for (int i = padded - 1; i >= 0; --i) {
+      unsigned char *hi = h.data() + i * strip;
+      if (i % k == k - 1)
+        std::copy_n(row_at(i), sw, hi);
+      else
+        morph_combine<Op>(hi, hi + strip, row_at(i),
+                          static_cast<std::size_t>(sw));
+    }
+
+    for (int y = 0; y < height; ++y)
+      morph_combine<Op>(dst + y * stride + x0, h.data() + y * strip,
+                        g.data() + (y + k - 1) * strip,
+                        static_cast<std::size_t>(sw));
+  }
+}
+
+template <typename Op>
+static std::vector<unsigned char>
+morph_rect(const std::vector<unsigned char> &bytes, int width, int height,
+           int channels, int se_width, int se_height) {
+  std::vector<unsigned char> temp(bytes.size());
+  std::vector<unsigned char> output(bytes.size());
+
+  morph_horizontal<Op>(bytes.data(), temp.data(), width, height, channels,
+                       se_width);
+  morph_vertical<Op>(temp.data(), output.data(), width, height, channels,
+                     se_height);
+
+  return output;
+}
+
+std::vector<unsigned char>
+apply_morphology(const std::vector<unsigned char> &bytes, unsigned int width,
+                 unsigned int height, unsigned int channels, Morphology_Op op,
+                 unsigned int se_width, unsigned int se_height) {
+  if (bytes.size() != static_cast<std::size_t>(width) * height * channels)
+    throw std::invalid_argument("Buffer size does not match image dimensions");
+  if (se_width == 0 || se_height == 0)
+    throw std::invalid_argument("Structuring element must not be empty");
+
+  const int w = static_cast<int>(width);
+  const int h = static_cast<int>(height);
+  const int c = static_cast<int>(channels);
+  const int sw = static_cast<int>(se_width);
+  const int sh = static_cast<int>(se_height);
+
+  switch (op) {
+  case Morphology_Op::ERODE:
+    return morph_rect<Morph_Min>(bytes, w, h, c, sw, sh);
+  case Morphology_Op::DILATE:
+    return morph_rect<Morph_Max>(bytes, w, h, c, sw, sh);
+  case Morphology_Op::OPEN:
+    return morph_rect<Morph_Max>(morph_rect<Morph_Min>(bytes, w, h, c, sw, sh),
+                                 w, h, c, sw, sh);
+  case Morphology_Op::CLOSE:
+    return morph_rect<Morph_Min>(morph_rect<Morph_Max>(bytes, w, h, c, sw, sh),
+                                 w, h, c, sw, sh);
+  }
+
+  return bytes;
+}
+
+#endif
@@ -0,0 +1,608 @@
+#ifndef ORIENTATION_HPP_
+#define ORIENTATION_HPP_
+
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Lossless rotations and reflections of an image.
+ *
+ * Rotations are clockwise. TRANSPOSE mirrors across the main diagonal and
+ * TRANSVERSE across the anti-diagonal; FLIPX mirrors left-right and FLIPY
+ * top-bottom.
+ */
+enum class Orientation {
+  ROTATE90,
+  ROTATE180,
+  ROTATE270,
+  TRANSPOSE,
+  TRANSVERSE,
+  FLIPX,
+  FLIPY,
+};
+
+/**
+ * @brief Parses an orientation name ("rotate90", "rotate180", "rotate270",
+ * "transpose", "transverse", "flipx", "flipy").
+ *
+ * @param name Orientation name as passed on the command line.
+ * @return Orientation The matching operation.
+ * @throws std::invalid_argument If the name is not a known operation.
+ */
+Orientation orientation_from_string(const std::string &name);
+
+/**
+ * @brief Maps an EXIF orientation tag to the operation that displays the
+ * image upright.
+ *
+ * @param tag EXIF orientation (1-8).
+ * @return std::optional<Orientation> The correcting operation, or nullopt for
+ * tag 1 (already upright).
+ * @throws std::invalid_argument If the tag is not in [1, 8].
+ */
+std::optional<Orientation> orientation_from_exif(unsigned int tag);
+
+/**
+ * @brief Block sizes of the transpose, in pixels.
+ *
+ * leaf is the largest block the cache-oblivious recursion hands to the
+ * register tiles, block the size of the tile pairs swapped by the in-place
+ * square transpose. Both must be non-zero multiples of 16; the defaults suit
+ * a 32 KiB L1 cache.
+ */
+struct Transpose_Tiling {
+  unsigned int leaf = 64;
+  unsigned int block = 64;
+};
+
+/**
+ * @brief Returns the process-wide tiling used by the transposes.
+ */
+Transpose_Tiling &transpose_tiling();
+
+/**
+ * @brief Returns the (width, height) of an image after the operation.
+ */
+std::pair<unsigned int, unsigned int>
+oriented_dimensions(Orientation op, unsigned int width, unsigned int height);
+
+/**
+ * @brief Rotates or reflects an interleaved image.
+ *
+ * The 90-degree operations are all one transpose with signed source and
+ * destination row strides. The transpose recursively halves the longer side
+ * (cache-oblivious tiling, so every level of the cache and TLB sees a working
+ * set that fits) down to leaves moved in register tiles: 16x16 bytes with
+ * four rounds of punpck for 1 channel, 4x4 pixels with 32-bit unpacks for 4
+ * channels, and 4x4 pixels widened to 32 bits with pshufb for 3 channels.
+ * Flips reverse 16 pixels at a time with pshufb. Row bands run in parallel.
+ *
+ * @param bytes Input buffer (channels bytes per pixel).
+ * @param width Image width in pixels.
+ * @param height Image height in pixels.
+ * @param channels Number of interleaved channels per pixel; 1, 3 and 4 use
+ * the SIMD kernels and other counts a scalar path.
+ * @param op Operation to apply.
+ * @return std::vector<unsigned char> Output with oriented_dimensions(op,
+ * width, height).
+ * @throws std::invalid_argument If the buffer size does not match the
+ * dimensions or channels is zero.
+ */
+std::vector<unsigned char>
+apply_orientation(const std::vector<unsigned char> &bytes, unsigned int width,
+                  unsigned int height, unsigned int channels, Orientation op);
+
+/**
+ * @brief Rotates or reflects an interleaved image in place.
+ *
+ * Flips and ROTATE180 always work in place using one row of scratch per
+ * thread. The 90-degree operations and the reflections across a diagonal work
+ * in place on square images by swapping tile pairs across the diagonal;
+ * other shapes fall back to apply_orientation and a buffer swap.
+ *
+ * @param bytes Buffer to transform (channels bytes per pixel).
+ * @param width Image width in pixels, updated to the new width.
+ * @param height Image height in pixels, updated to the new height.
+ * @param channels Number of interleaved channels per pixel.
+ * @param op Operation to apply.
+ * @throws std::invalid_argument If the buffer size does not match the
+ * dimensions or channels is zero.
+ */
+void apply_orientation_in_place(std::vector<unsigned char> &bytes,
+                                unsigned int &width, unsigned int &height,
+                                unsigned int channels, Orientation op);
+
+#endif
+
+#ifdef ORIENTATION_IMPLEMENTATION
+
+#include <emmintrin.h>
+#include <tmmintrin.h>
+
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+
+Transpose_Tiling &transpose_tiling() {
+  static Transpose_Tiling tiling;
+  return tiling;
+}
+
+Orientation orientation_from_string(const std::string &name) {
+  if (name == "rotate90")
+    return Orientation::ROTATE90;
+  else if (name == "rotate180")
+    return Orientation::ROTATE180;
+  else if (name == "rotate270")
+    return Orientation::ROTATE270;
+  else if (name == "transpose")
+    return Orientation::TRANSPOSE;
+  else if (name == "transverse")
+    return Orientation::TRANSVERSE;
+  else if (name == "flipx")
+    return Orientation::FLIPX;
+  else if (name == "flipy")
+    return Orientation::FLIPY;
+  else
+    throw std::invalid_argument("Invalid orientation");
+}
+
+std::optional<Orientation> orientation_from_exif(unsigned int tag) {
+  switch (tag) {
+  case 1:
+    return std::nullopt;
+  case 2:
+    return Orientation::FLIPX;
+  case 3:
+    return Orientation::ROTATE180;
+  case 4:
+    return Orientation::FLIPY;
+  case 5:
+    return Orientation::TRANSPOSE;
+  case 6:
+    return Orientation::ROTATE90;
+  case 7:
+    return Orientation::TRANSVERSE;
+  case 8:
+    return Orientation::ROTATE270;
+  default:
+    throw std::invalid_argument("EXIF orientation must be between 1 and 8");
+  }
+}
+
+static bool swaps_axes(Orientation op) {
+  return op == Orientation::ROTATE90 || op == Orientation::ROTATE270 ||
+         op == Orientation::TRANSPOSE || op == Orientation::TRANSVERSE;
+}
+
+std::pair<unsigned int, unsigned int>
+oriented_dimensions(Orientation op, unsigned int width, unsigned int height) {
+  if (swaps_axes(op))
+    return {height, width};
+  return {width, height};
+}
+
+/* A transpose dst(x, y) = src(y, x) between two strided views; negative
+ * strides walk rows bottom-up, which turns the transpose into a rotation. */
+struct Transpose_View {
+  const unsigned char *src;
+  std::ptrdiff_t src_stride;
+  unsigned char *dst;
+  std::ptrdiff_t dst_stride;
+  unsigned int channels;
+};
+
+/* Transposes a 16x16 byte tile: four rounds of unpacks interleave row pairs
+ * at 8, 16, 32 and 64 bits, leaving column c in vector bitreverse(c). */
+static void transpose_tile_1(const unsigned char *src, std::ptrdiff_t sstride,
+                             unsigned char *dst, std::ptrdiff_t dstride) {
+  __m128i a[16], b[16];
+  for (int r = 0; r < 16; ++r)
+    a[r] = _mm_loadu_si128(
+        reinterpret_cast<const __m128i *>(src + r * sstride));
+
+  for (int i = 0; i < 8; ++i) {
+    b[i] = _mm_unpacklo_epi8(a[2 * i], a[2 * i + 1]);
+    b[i + 8] = _mm_unpackhi_epi8(a[2 * i], a[2 * i + 1]);
+  }
+  for (int i = 0; i < 8; ++i) {
+    a[i] = _mm_unpacklo_epi16(b[2 * i], b[2 * i + 1]);
+    a[i + 8] = _mm_unpackhi_epi16(b[2 * i], b[2 * i + 1]);
+  }
+  for (int i = 0; i < 8; ++i) {
+    b[i] = _mm_unpacklo_epi32(a[2 * i], a[2 * i + 1]);
+    b[i + 8] = _mm_unpackhi_epi32(a[2 * i], a[2 * i + 1]);
+  }
+  for (int i = 0; i < 8; ++i) {
+    a[i] = _mm_unpacklo_epi64(b[2 * i], b[2 * i + 1]);
+    a[i + 8] = _mm_unpackhi_epi64(b[2 * i], b[2 * i + 1]);
+  }
+
+  static constexpr int reversed[16] = {0, 8, 4, 12, 2, 10, 6, 14,
+                                       1, 9, 5, 13, 3, 11, 7, 15};
+  for (int c = 0; c < 16; ++c)
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + c * dstride),
+                     a[reversed[c]]);
+}
+
+static void transpose4_epi32(__m128i &r0, __m128i &r1, __m128i &r2,
+                             __m128i &r3) {
+  const __m128i t0 = _mm_unpacklo_epi32(r0, r1);
+  const __m128i t1 = _mm_unpackhi_epi32(r0, r1);
+  const __m128i t2 = _mm_unpacklo_epi32(r2, r3);
+  const __m128i t3 = _mm_unpackhi_epi32(r2, r3);
+  r0 = _mm_unpacklo_epi64(t0, t2);
+  r1 = _mm_unpackhi_epi64(t0, t2);
+  r2 = _mm_unpacklo_epi64(t1, t3);
+  r3 = _mm_unpackhi_epi64(t1, t3);
+}
+
+/* Transposes a 4x4 tile of 4-byte pixels. */
+static void transpose_tile_4(const unsigned char *src, std::ptrdiff_t sstride,
+                             unsigned char *dst, std::ptrdiff_t dstride) {
+  __m128i r[4];
+  for (int i = 0; i < 4; ++i)
+    r[i] = _mm_loadu_si128(
+        reinterpret_cast<const __m128i *>(src + i * sstride));
+  transpose4_epi32(r[0], r[1], r[2], r[3]);
+  for (int i = 0; i < 4; ++i)
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i * dstride), r[i]);
+}
+
+/* Transposes a 4x4 tile of 3-byte pixels by widening each row to 32-bit
+ * lanes with pshufb; loads and stores touch exactly 12 bytes per row. */
+static void transpose_tile_3(const unsigned char *src, std::ptrdiff_t sstride,
+                             unsigned char *dst, std::ptrdiff_t dstride) {
+  const __m128i widen =
+      _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+  const __m128i narrow =
+      _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+
+  __m128i r[4];
+  for (int i = 0; i < 4; ++i) {
+    const unsigned char *row = src + i * sstride;
+    int tail;
+    std::memcpy(&tail, row + 8, 4);
+    r[i] = _mm_shuffle_epi8(
+        _mm_unpacklo_epi64(
+            _mm_loadl_epi64(reinterpret_cast<const __m128i *>(row)),
+            _mm_cvtsi32_si128(tail)),
+        widen);
+  }
+  transpose4_epi32(r[0], r[1], r[2], r[3]);
+  for (int i = 0; i < 4; ++i) {
+    unsigned char *row = dst + i * dstride;
+    const __m128i packed = _mm_shuffle_epi8(r[i], narrow);
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(row), packed);
+    const int tail = _mm_cvtsi128_si32(_mm_srli_si128(packed, 8));
+    std::memcpy(row + 8, &tail, 4);
+  }
+}
+
+/* Transposes the source block [x0, x0 + w) x [y0, y0 + h) of a leaf. */
+template <unsigned int C>
+static void transpose_leaf(const Transpose_View &view, unsigned int x0,
+                           unsigned int y0, unsigned int w, unsigned int h) {
+  const unsigned int channels = C ? C : view.channels;
+  const auto src_at = [&](unsigned int x, unsigned int y) {
+    return view.src + static_cast<std::ptrdiff_t>(y) * view.src_stride +
+           static_cast<std::ptrdiff_t>(x) * channels;
+  };
+  const auto dst_at = [&](unsigned int x, unsigned int y) {
+    return view.dst + static_cast<std::ptrdiff_t>(x) * view.dst_stride +
+           static_cast<std::ptrdiff_t>(y) * channels;
+  };
+
+  constexpr unsigned int tile = C == 1 ? 16 : 4;
+  unsigned int tiled_w = 0, tiled_h = 0;
+  if constexpr (C == 1 || C == 3 || C == 4) {
+    tiled_w = w / tile * tile;
+    tiled_h = h / tile * tile;
+    for (unsigned int y = 0; y < tiled_h; y += tile)
+      for (unsigned int x = 0; x < tiled_w; x += tile) {
+        const unsigned char *s = src_at(x0 + x, y0 + y);
+        unsigned char *d = dst_at(x0 + x, y0 + y);
+        if constexpr (C == 1)
+          transpose_tile_1(s, view.src_stride, d, view.dst_stride);
+        else if constexpr (C == 3)
+          transpose_tile_3(s, view.src_stride, d, view.dst_stride);
+        else
+          transpose_tile_4(s, view.src_stride, d, view.dst_stride);
+      }
+  }
+
+  /* Right and bottom remainders pixel by pixel. */
+  for (unsigned int y = 0; y < h; ++y) {
+    const unsigned int first = y < tiled_h ? tiled_w : 0;
+    for (unsigned int x = first; x < w; ++x)
+      std::memcpy(dst_at(x0 + x, y0 + y), src_at(x0 + x, y0 + y), channels);
+  }
+}
+
+/* Cache-oblivious recursion: halve the longer side on tile boundaries until
+ * the block fits a leaf. */
+template <unsigned int C>
+static void transpose_recursive(const Transpose_View &view, unsigned int x0,
+                                unsigned int y0, unsigned int w,
+                                unsigned int h) {
+  const unsigned int leaf = transpose_tiling().leaf;
+  if (w <= leaf && h <= leaf) {
+    transpose_leaf<C>(view, x0, y0, w, h);
+  } else if (w >= h) {
+    const unsigned int half = (w / 2 + 15) / 16 * 16;
+    transpose_recursive<C>(view, x0, y0, half, h);
+    transpose_recursive<C>(view, x0 + half, y0, w - half, h);
+  } else {
+    const unsigned int half = (h / 2 + 15) / 16 * 16;
+    transpose_recursive<C>(view, x0, y0, w, half);
+    transpose_recursive<C>(view, x0, y0 + half, w, h - half);
+  }
+}
+
+static void transpose_block(const Transpose_View &view, unsigned int x0,
+                            unsigned int y0, unsigned int w, unsigned int h) {
+  switch (view.channels) {
+  case 1:
+    return transpose_recursive<1>(view, x0, y0, w, h);
+  case 3:
+    return transpose_recursive<3>(view, x0, y0, w, h);
+  case 4:
+    return transpose_recursive<4>(view, x0, y0, w, h);
+  default:
+    return transpose_recursive<0>(view, x0, y0, w, h);
+  }
+}
+
+/* pshufb masks reversing 16 pixels of C bytes held in C vectors: entry
+ * [out][in] selects the bytes of input vector in for output vector out. */
+template <unsigned int C>
+static constexpr std::array<std::array<std::array<char, 16>, C>, C>
+make_reverse_masks() {
+  std::array<std::array<std::array<char, 16>, C>, C> masks{};
+  for (unsigned int o = 0; o < 16 * C; ++o) {
+    const unsigned int source = (15 - o / C) * C + o % C;
+    for (unsigned int in = 0; in < C; ++in)
+      masks[o / 16][in][o % 16] = static_cast<char>(
+          source / 16 == in ? static_cast<int>(source % 16) : 0x80);
+  }
+  return masks;
+}
+
+template <unsigned int C>
+static constexpr auto reverse_masks = make_reverse_masks<C>();
+
+/* dst[i] = src[count - 1 - i] for count pixels of C bytes. */
+template <unsigned int C>
+static void reverse_pixels(const unsigned char *src, unsigned char *dst,
+                           unsigned int count, unsigned int channels) {
+  const unsigned int c = C ? C : channels;
+  unsigned int i = 0;
+  if constexpr (C == 1 || C == 3 || C == 4) {
+    for (; i + 16 <= count; i += 16) {
+      const unsigned char *block = src + (count - i - 16) * C;
+      __m128i in[C];
+      for (unsigned int v = 0; v < C; ++v)
+        in[v] = _mm_loadu_si128(
+            reinterpret_cast<const __m128i *>(block + 16 * v));
+      for (unsigned int o = 0; o < C; ++o) {
+        __m128i out = _mm_setzero_si128();
+        for (unsigned int v = 0; v < C; ++v)
+          out = _mm_or_si128(
+              out, _mm_shuffle_epi8(
+                       in[v], _mm_loadu_si128(reinterpret_cast<const __m128i *>(
+                                  reverse_masks<C>[o][v].data()))));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i * C + 16 * o),
+                         out);
+      }
+    }
+  }
+  for (; i < count; ++i)
+    std::memcpy(dst + i * c, src + (count - 1 - i) * c, c);
+}
+
+static void reverse_row(const unsigned char *src, unsigned char *dst,
+                        unsigned int count, unsigned int channels) {
+  switch (channels) {
+  case 1:
+    return reverse_pixels<1>(src, dst, count, channels);
+  case 3:
+    return reverse_pixels<3>(src, dst, count, channels);
+  case 4:
+    return reverse_pixels<4>(src, dst, count, channels);
+  default:
+    return reverse_pixels<0>(src, dst, count, channels);
+  }
+}
+
+static void check_orientation_buffer(const std::vector<unsigned char> &bytes,
+                                     unsigned int width, unsigned int height,
+                                     unsigned int channels) {
+  if (channels == 0)
+    throw std::invalid_argument("Images need at least one channel");
+  if (bytes.size() != static_cast<std::size_t>(width) * height * channels)
+    throw std::invalid_argument("Buffer size does not match image dimensions");
+}
+
+/* Source and destination row steps turning the transpose into op. */
+static Transpose_View orientation_view(Orientation op,
+                                       const unsigned char *src,
+                                       unsigned char *dst, unsigned int width,
+                                       unsigned int height,
+                                       unsigned int channels) {
+  const std::ptrdiff_t src_stride =
+      static_cast<std::ptrdiff_t>(width) * channels;
+  const std::ptrdiff_t dst_stride =
+      static_cast<std::ptrdiff_t>(height) * channels;
+  const bool flip_src = op == Orientation::ROTATE90 ||
+                        op == Orientation::TRANSVERSE;
+  const bool flip_dst = op == Orientation::ROTATE270 ||
+                        op == Orientation::TRANSVERSE;
+  return {flip_src ? src + (height - 1) * src_stride : src,
+          flip_src ? -src_stride : src_stride,
+          flip_dst ? dst + (width - 1) * dst_stride : dst,
+          flip_dst ? -dst_stride : dst_stride, channels};
+}
+
+std::vector<unsigned char>
+apply_orientation(const std::vector<unsigned char> &bytes, unsigned int width,
+                  unsigned int height, unsigned int channels, Orientation op) {
+  check_orientation_buffer(bytes, width, height, channels);
+  std::vector<unsigned char> output(bytes.size());
+  if (bytes.empty())
+    return output;
+
+  const std::size_t stride = static_cast<std::size_t>(width) * channels;
+  Thread_Pool &pool = default_thread_pool();
+
+  if (swaps_axes(op)) {
+    const Transpose_View view = orientation_view(
+        op, bytes.data(), output.data(), width, height, channels);
+    /* Bands of source rows on tile boundaries, each tiled recursively. */
+    const std::size_t tiles = (height + 15) / 16;
+    pool.parallel_for(0, tiles, [&](std::size_t first, std::size_t last) {
+      const unsigned int y0 = static_cast<unsigned int>(first * 16);
+      const unsigned int y1 =
+          std::min(height, static_cast<unsigned int>(last * 16));
+      transpose_block(view, 0, y0, width, y1 - y0);
+    });
+    return output;
+  }
+
+  pool.parallel_for(0, height, [&](std::size_t first, std::size_t last) {
+    for (std::size_t y = first; y < last; ++y) {
+      unsigned char *dst = output.data() + y * stride;
+      switch (op) {
+      case Orientation::FLIPX:
+        reverse_row(bytes.data() + y * stride, dst, width, channels);
+        break;
+      case Orientation::FLIPY:
+        std::memcpy(dst, bytes.data() + (height - 1 - y) * stride, stride);
+        break;
+      default:
+        reverse_row(bytes.data() + (height - 1 - y) * stride, dst, width,
+                    channels);
+        break;
+      }
+    }
+  });
+  return output;
+}
+
+/* Transposes a square image in place: tile pairs across the diagonal are
+ * copied out and transposed back into each other's place. The pairs of the
+ * upper triangle, row by row, are split evenly between the threads, since
+ * rows of tiles near the top hold many more pairs than those at the bottom. */
+static void transpose_square_in_place(unsigned char *data, unsigned int size,
+                                      unsigned int channels) {
+  const unsigned int block = transpose_tiling().block;
+  const std::size_t stride = static_cast<std::size_t>(size) * channels;
+  const std::size_t blocks = (size + block - 1) / block;
+  const std::size_t pairs = blocks * (blocks + 1) / 2;
+
+  default_thread_pool().parallel_for(
+      0, pairs, [&](std::size_t first, std::size_t last) {
+        const std::size_t tile_stride = std::size_t{block} * channels;
+        std::vector<unsigned char> a(tile_stride * block), b(a.size());
+        /* Row bi of the triangle holds the blocks - bi pairs (bi, bj >= bi). */
+        std::size_t bi = 0, bj = first;
+        while (bj >= blocks - bi)
+          bj -= blocks - bi++;
+        bj += bi;
+        for (std::size_t pair = first; pair < last; ++pair) {
+          const unsigned int y0 = static_cast<unsigned int>(bi * block);
+          const unsigned int x0 = static_cast<unsigned int>(bj * block);
+          const unsigned int h = std::min(block, size - y0);
+          const unsigned int w = std::min(block, size - x0);
+
+          /* a = block (bi, bj) with h rows of w, b = block (bj, bi). */
+          for (unsigned int r = 0; r < h; ++r)
+            std::memcpy(a.data() + r * tile_stride,
+                        data + (y0 + r) * stride + x0 * channels,
+                        w * channels);
+          for (unsigned int r = 0; r < w; ++r)
+            std::memcpy(b.data() + r * tile_stride,
+                        data + (x0 + r) * stride + y0 * channels,
+                        h * channels);
+
+          const auto stride_d = static_cast<std::ptrdiff_t>(stride);
+          const auto tile_d = static_cast<std::ptrdiff_t>(tile_stride);
+          transpose_block({a.data(), tile_d,
+                           data + x0 * stride + y0 * channels, stride_d,
+                           channels},
+                          0, 0, w, h);
+          if (bj != bi)
+            transpose_block({b.data(), tile_d,
+                             data + y0 * stride + x0 * channels, stride_d,
+                             channels},
+                            0, 0, h, w);
+          if (++bj == blocks)
+            bj = ++bi;
+        }
+      });
+}
+
+void apply_orientation_in_place(std::vector<unsigned char> &bytes,
+                                unsigned int &width, unsigned int &height,
+                                unsigned int channels, Orientation op) {
+  check_orientation_buffer(bytes, width, height, channels);
+  if (bytes.empty())
+    return;
+
+  if (swaps_axes(op) && width != height) {
+    bytes = apply_orientation(bytes, width, height, channels, op);
+    std::swap(width, height);
+    return;
+  }
+
+  const std::size_t stride = static_cast<std::size_t>(width) * channels;
+  Thread_Pool &pool = default_thread_pool();
+  unsigned char *data = bytes.data();
+
+  if (swaps_axes(op)) {
+    transpose_square_in_place(data, width, channels);
+    if (op == Orientation::TRANSPOSE)
+      return;
+    /* Rotations and the transverse finish with a flip of the transpose. */
+    op = op == Orientation::ROTATE90    ? Orientation::FLIPX
+         : op == Orientation::ROTATE270 ? Orientation::FLIPY
+                                        : Orientation::ROTATE180;
+  }
+
+  if (op == Orientation::FLIPX) {
+    pool.parallel_for(0, height, [&](std::size_t first, std::size_t last) {
+      std::vector<unsigned char> row(stride);
+      for (std::size_t y = first; y < last; ++y) {
+        reverse_row(data + y * stride, row.data(), width, channels);
+        std::memcpy(data + y * stride, row.data(), stride);
+      }
+    });
+    return;
+  }
+
+  /* FLIPY and ROTATE180 exchange row y with row height - 1 - y. */
+  const bool reverse = op == Orientation::ROTATE180;
+  const std::size_t pairs = (height + 1) / 2;
+  pool.parallel_for(0, pairs, [&](std::size_t first, std::size_t last) {
+    std::vector<unsigned char> top(stride);
+    for (std::size_t y = first; y < last; ++y) {
+      unsigned char *upper = data + y * stride;
+      unsigned char *lower = data + (height - 1 - y) * stride;
+      if (!reverse) {
+        std::swap_ranges(upper, upper + stride, lower);
+        continue;
+      }
+      reverse_row(upper, top.data(), width, channels);
+      if (upper != lower)
+        reverse_row(lower, upper, width, channels);
+      std::memcpy(lower, top.data(), stride);
+    }
+  });
+}
+
+#endif
@@ -0,0 +1,559 @@
+#ifndef POINT_OPS_HPP_
+#define POINT_OPS_HPP_
+
+#include <array>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief A chain of per-byte point operations compiled into lookup tables.
+ *
+ * Every operation is composed into the existing table as it is added, so a
+ * chain of any length is applied with a single lookup per byte. Each
+ * operation may target one channel of an interleaved image or all of them;
+ * the table is kept per channel only while the channels actually differ.
+ */
+class Point_Lut {
+public:
+  using Table = std::array<unsigned char, 256>;
+
+  /** Targets every channel in the operations below. */
+  static constexpr int all_channels = -1;
+
+  /**
+   * @brief Creates an identity table for images with the given channel count.
+   *
+   * @param channels Number of interleaved channels per pixel.
+   * @throws std::invalid_argument If channels is zero.
+   */
+  explicit Point_Lut(unsigned int channels = 1);
+
+  unsigned int channels() const { return channels_; }
+
+  /** @brief True when every channel uses the same table. */
+  bool uniform() const { return tables_.size() == 1; }
+
+  /** @brief The table of one channel. */
+  const Table &table(unsigned int channel) const {
+    return tables_[uniform() ? 0 : channel];
+  }
+
+  /** @brief Adds delta, saturating to [0, 255]. */
+  Point_Lut &brightness(int delta, int channel = all_channels);
+
+  /** @brief Scales the distance from mid-grey by factor. */
+  Point_Lut &contrast(double factor, int channel = all_channels);
+
+  /** @brief Gamma correction: 255 * (v / 255)^(1 / gamma). */
+  Point_Lut &gamma(double gamma, int channel = all_channels);
+
+  /**
+   * @brief Tone curve through (input, output) control points.
+   *
+   * Points are interpolated with a monotone cubic (Fritsch-Carlson), so
+   * monotone control points give a monotone curve without overshoot. Inputs
+   * outside the first and last point take their outputs.
+   *
+   * @throws std::invalid_argument If fewer than two points are given, a
+   * value is outside [0, 255] or two points share an input.
+   */
+  Point_Lut &curves(std::vector<std::pair<int, int>> points,
+                    int channel = all_channels);
+
+  /**
+   * @brief Levels: maps [in_black, in_white] to [out_black, out_white] with a
+   * midtone gamma, clipping inputs outside the range.
+   *
+   * @throws std::invalid_argument If in_white <= in_black or gamma <= 0.
+   */
+  Point_Lut &levels(int in_black, int in_white, double gamma, int out_black,
+                    int out_white, int channel = all_channels);
+
+  /** @brief 255 for values >= level, 0 otherwise. */
+  Point_Lut &threshold(int level, int channel = all_channels);
+
+  /**
+   * @brief Quantizes to the given number of evenly spaced levels.
+   *
+   * @throws std::invalid_argument If levels is less than 2.
+   */
+  Point_Lut &posterize(unsigned int levels, int channel = all_channels);
+
+  /** @brief 255 - v. */
+  Point_Lut &invert(int channel = all_channels);
+
+private:
+  /* Composes f after the current table of one or all channels. */
+  template <typename F> Point_Lut &compose(int channel, F f);
+
+  unsigned int channels_;
+  std::vector<Table> tables_;
+};
+
+/**
+ * @brief Parses a point operation chain for the command line.
+ *
+ * The chain is a comma separated list of name[@channel][=arg:arg:...]
+ * entries applied left to right, for example
+ * "levels=16:235:1.0:0:255,gamma=2.2,curves@2=0:0:128:96:255:255,invert".
+ * Names and arguments match the Point_Lut methods: brightness=delta,
+ * contrast=factor, gamma=gamma, curves=in:out:in:out..., levels=in_black:
+ * in_white:gamma:out_black:out_white, threshold=level, posterize=levels and
+ * invert.
+ *
+ * @param spec Operation chain.
+ * @param channels Number of interleaved channels of the target image.
+ * @return Point_Lut The compiled tables.
+ * @throws std::invalid_argument If the chain is malformed.
+ */
+Point_Lut parse_point_ops(const std::string &spec, unsigned int channels);
+
+/**
+ * @brief Applies compiled point operations to an interleaved image.
+ *
+ * The 256-entry tables are looked up 16 bytes at a time with sixteen 16-entry
+ * pshufb lookups combined by XOR, or 64 bytes at a time with two
+ * vpermi2b lookups when built with AVX-512 VBMI. Distinct per-channel tables
+ * are each looked up and blended by channel position. Work is split across
+ * the thread pool.
+ *
+ * @param bytes Input buffer (lut.channels() bytes per pixel).
+ * @param lut Compiled point operations.
+ * @return std::vector<unsigned char> Output (same size as input).
+ * @throws std::invalid_argument If the buffer size is not a multiple of the
+ * channel count.
+ */
+std::vector<unsigned char>
+apply_point_lut(const std::vector<unsigned char> &bytes, const Point_Lut &lut);
+
+#endif
+
+#ifdef POINT_OPS_IMPLEMENTATION
+
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#if defined(__AVX512VBMI__) && defined(__AVX512BW__)
+#include <immintrin.h>
+#endif
+
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <numeric>
+#include <sstream>
+#include <stdexcept>
+
+static unsigned char clamp_byte(double value) {
+  return static_cast<unsigned char>(
+      std::clamp(std::nearbyint(value), 0.0, 255.0));
+}
+
+Point_Lut::Point_Lut(unsigned int channels) : channels_(channels), tables_(1) {
+  if (channels == 0)
+    throw std::invalid_argument("Point operations need at least one channel");
+  std::iota(tables_[0].begin(), tables_[0].end(), 0);
+}
+
+template <typename F> Point_Lut &Point_Lut::compose(int channel, F f) {
+  if (channel != all_channels &&
+      (channel < 0 || static_cast<unsigned int>(channel) >= channels_))
+    throw std::invalid_argument("Point operation channel out of range");
+
+  if (channel == all_channels) {
+    for (auto &table : tables_)
+      for (auto &value : table)
+        value = f(value);
+    return *this;
+  }
+
+  if (uniform() && channels_ > 1)
+    tables_.assign(channels_, tables_[0]);
+  for (auto &value : tables_[static_cast<std::size_t>(channel)])
+    value = f(value);
+
+  if (std::all_of(tables_.begin(), tables_.end(),
+                  [&](const Table &table) { return table == tables_[0]; }))
+    tables_.resize(1);
+  return *this;
+}
+
+Point_Lut &Point_Lut::brightness(int delta, int channel) {
+  return compose(channel, [=](unsigned char v) {
+    return static_cast<unsigned char>(std::clamp(v + delta, 0, 255));
+  });
+}
+
+Point_Lut &Point_Lut::contrast(double factor, int channel) {
+  return compose(channel, [=](unsigned char v) {
+    return clamp_byte((v - 127.5) * factor + 127.5);
+  });
+}
+
+Point_Lut &Point_Lut::gamma(double gamma, int channel) {
+  if (gamma <= 0.0)
+    throw std::invalid_argument("Gamma must be positive");
+  return compose(channel, [=](unsigned char v) {
+    return clamp_byte(255.0 * std::pow(v / 255.0, 1.0 / gamma));
+  });
+}
+
+Point_Lut &Point_Lut::curves(std::vector<std::pair<int, int>> points,
+                             int channel) {
+  if (points.size() < 2)
+    throw std::invalid_argument("Curves need at least two points");
+  for (const auto &[in, out] : points)
+    if (in < 0 || in > 255 || out < 0 || out > 255)
+      throw std::invalid_argument("Curve points must be within [0, 255]");
+  std::sort(points.begin(), points.end());
+
+  const std::size_t n = points.size();
+  std::vector<double> slope(n - 1), tangent(n);
+  for (std::size_t i = 0; i + 1 < n; ++i) {
+    const int dx = points[i + 1].first - points[i].first;
+    if (dx == 0)
+      throw std::invalid_argument("Curve points must have distinct inputs");
+    slope[i] =
+        static_cast<double>(points[i + 1].second - points[i].second) / dx;
+  }
+
+  /* Fritsch-Carlson tangents: zero at extrema, limited to avoid overshoot. */
+  tangent[0] = slope[0];
+  tangent[n - 1] = slope[n - 2];
+  for (std::size_t i = 1; i + 1 < n; ++i)
+    tangent[i] = slope[i - 1] * slope[i] <= 0.0
+                     ? 0.0
+                     : (slope[i - 1] + slope[i]) / 2.0;
+  for (std::size_t i = 0; i + 1 < n; ++i) {
+    if (slope[i] == 0.0) {
+      tangent[i] = tangent[i + 1] = 0.0;
+      continue;
+    }
+    const double a = tangent[i] / slope[i], b = tangent[i + 1] / slope[i];
+    const double length = a * a + b * b;
+    if (length > 9.0) {
+      const double scale = 3.0 / std::sqrt(length);
+      tangent[i] = scale * a * slope[i];
+      tangent[i + 1] = scale * b * slope[i];
+    }
+  }
+
+  Table curve;
+  for (int v = 0; v < 256; ++v) {
+    if (v <= points.front().first) {
+      curve[static_cast<std::size_t>(v)] =
+          static_cast<unsigned char>(points.front().second);
+      continue;
+    }
+    if (v >= points.back().first) {
+      curve[static_cast<std::size_t>(v)] =
+          static_cast<unsigned char>(points.back().second);
+      continue;
+    }
+    std::size_t i = 0;
+    while (points[i + 1].first < v)
+      ++i;
+    const double h = points[i + 1].first - points[i].first;
+    const double t = (v - points[i].first) / h;
+    const double t2 = t * t, t3 = t2 * t;
+    curve[static_cast<std::size_t>(v)] =
+        clamp_byte((2 * t3 - 3 * t2 + 1) * points[i].second +
+                   (t3 - 2 * t2 + t) * h * tangent[i] +
+                   (-2 * t3 + 3 * t2) * points[i + 1].second +
+                   (t3 - t2) * h * tangent[i + 1]);
+  }
+
+  return compose(channel, [&](unsigned char v) { return curve[v]; });
+}
+
+Point_Lut &Point_Lut::levels(int in_black, int in_white, double gamma,
+                             int out_black, int out_white, int channel) {
+  if (in_white <= in_black)
+    throw std::invalid_argument("Levels input white must exceed input black");
+  if (gamma <= 0.0)
+    throw std::invalid_argument("Gamma must be positive");
+  return compose(channel, [=](unsigned char v) {
+    const double t = std::clamp(static_cast<double>(v - in_black) /
+                                    (in_white - in_black),
+                                0.0, 1.0);
+    return clamp_byte(out_black +
+                      std::pow(t, 1.0 / gamma) * (out_white - out_black));
+  });
+}
+
+Point_Lut &Point_Lut::threshold(int level, int channel) {
+  return compose(channel, [=](unsigned char v) {
+    return static_cast<unsigned char>(v >= level ? 255 : 0);
+  });
+}
+
+Point_Lut &Point_Lut::posterize(unsigned int levels, int channel) {
+  if (levels < 2)
+    throw std::invalid_argument("Posterize needs at least two levels");
+  const double steps = levels - 1;
+  return compose(channel, [=](unsigned char v) {
+    return clamp_byte(std::nearbyint(v * steps / 255.0) * 255.0 / steps);
+  });
+}
+
+Point_Lut &Point_Lut::invert(int channel) {
+  return compose(channel, [](unsigned char v) {
+    return static_cast<unsigned char>(255 - v);
+  });
+}
+
+Point_Lut parse_point_ops(const std::string &spec, unsigned int channels) {
+  Point_Lut lut(channels);
+  std::istringstream entries(spec);
+  std::string entry;
+
+  while (std::getline(entries, entry, ',')) {
+    if (entry.empty())
+      continue;
+
+    const std::size_t equals = entry.find('=');
+    std::string name = entry.substr(0, equals);
+    std::vector<double> args;
+    if (equals != std::string::npos) {
+      std::istringstream values(entry.substr(equals + 1));
+      std::string value;
+      while (std::getline(values, value, ':')) {
+        std::size_t used = 0;
+        try {
+          args.push_back(std::stod(value, &used));
+        } catch (const std::exception &) {
+          used = 0;
+        }
+        if (used == 0 || used != value.size())
+          throw std::invalid_argument("Invalid point operation argument: " +
+                                      entry);
+      }
+    }
+
+    int channel = Point_Lut::all_channels;
+    if (const std::size_t at = name.find('@'); at != std::string::npos) {
+      channel = std::stoi(name.substr(at + 1));
+      name.resize(at);
+    }
+
+    const auto expect = [&](std::size_t count) {
+      if (args.size() != count)
+        throw std::invalid_argument("Wrong number of arguments for " + name);
+    };
+    const auto integer = [&](std::size_t i) {
+      return static_cast<int>(std::lround(args[i]));
+    };
+
+    if (name == "brightness") {
+      expect(1);
+      lut.brightness(integer(0), channel);
+    } else if (name == "contrast") {
+      expect(1);
+      lut.contrast(args[0], channel);
+    } else if (name == "gamma") {
+      expect(1);
+      lut.gamma(args[0], channel);
+    } else if (name == "curves") {
+      if (args.size() % 2 != 0)
+        throw std::invalid_argument("Curves need input:output pairs");
+      std::vector<std::pair<int, int>> points;
+      for (std::size_t i = 0; i < args.size(); i += 2)
+        points.emplace_back(integer(i), integer(i + 1));
+      lut.curves(std::move(points), channel);
+    } else if (name == "levels") {
+      expect(5);
+      lut.levels(integer(0), integer(1), args[2], integer(3), integer(4),
+                 channel);
+    } else if (name == "threshold") {
+      expect(1);
+      lut.threshold(integer(0), channel);
+    } else if (name == "posterize") {
+      expect(1);
+      if (args[0] < 2)
+        throw std::invalid_argument("Posterize needs at least two levels");
+      lut.posterize(static_cast<unsigned int>(integer(0)), channel);
+    } else if (name == "invert") {
+      expect(0);
+      lut.invert(channel);
+    } else {
+      throw std::invalid_argument("Invalid point operation: " + name);
+    }
+  }
+
+  return lut;
+}
+
+/* A 256-entry table as 16 SSE registers, or 4 AVX-512 registers. The SSE
+ * form holds each half as prefix differences: part[k] = T[k] ^ T[k - 1] for
+ * the 16-entry slices T of that half, so XOR-ing the slices up to k gives
+ * T[k]. */
+struct Lut_Registers16 {
+  __m128i part[16];
+};
+
+struct Lane_Mask16 {
+  __m128i lanes;
+};
+
+#if defined(__AVX512VBMI__) && defined(__AVX512BW__)
+struct Lut_Registers64 {
+  __m512i part[4];
+};
+#endif
+
+/* Tables and channel masks prepared once per apply_point_lut call. */
+struct Point_Lut_Simd {
+  unsigned int channels;
+  unsigned int phases;
+  /* tables[c][k]: entries 16k..16k+15 of channel c. */
+  std::vector<Lut_Registers16> tables;
+  /* masks[p * channels + c]: lanes of channel c in a vector at phase p. */
+  std::vector<Lane_Mask16> masks;
+#if defined(__AVX512VBMI__) && defined(__AVX512BW__)
+  std::vector<Lut_Registers64> tables512;
+  unsigned int phases512;
+  std::vector<__mmask64> masks512;
+#endif
+};
+
+static Point_Lut_Simd prepare_point_lut(const Point_Lut &lut) {
+  Point_Lut_Simd simd;
+  simd.channels = lut.uniform() ? 1 : lut.channels();
+  simd.phases = simd.channels / std::gcd(16u, simd.channels);
+  simd.tables.resize(simd.channels);
+  for (unsigned int c = 0; c < simd.channels; ++c) {
+    for (std::size_t k = 0; k < 16; ++k)
+      simd.tables[c].part[k] = _mm_loadu_si128(
+          reinterpret_cast<const __m128i *>(lut.table(c).data() + 16 * k));
+    for (std::size_t k = 15; k > 0; --k)
+      if (k != 8)
+        simd.tables[c].part[k] =
+            _mm_xor_si128(simd.tables[c].part[k], simd.tables[c].part[k - 1]);
+  }
+
+  for (unsigned int p = 0; p < simd.phases; ++p)
+    for (unsigned int c = 0; c < simd.channels; ++c) {
+      alignas(16) unsigned char lanes[16];
+      for (unsigned int j = 0; j < 16; ++j)
+        lanes[j] = (p * 16 + j) % simd.channels == c ? 0xFF : 0x00;
+      simd.masks.push_back(
+          {_mm_load_si128(reinterpret_cast<const __m128i *>(lanes))});
+    }
+
+#if defined(__AVX512VBMI__) && defined(__AVX512BW__)
+  simd.phases512 = simd.channels / std::gcd(64u, simd.channels);
+  simd.tables512.resize(simd.channels);
+  for (unsigned int c = 0; c < simd.channels; ++c)
+    for (std::size_t k = 0; k < 4; ++k)
+      simd.tables512[c].part[k] =
+          _mm512_loadu_si512(lut.table(c).data() + 64 * k);
+  for (unsigned int p = 0; p < simd.phases512; ++p)
+    for (unsigned int c = 0; c < simd.channels; ++c) {
+      __mmask64 mask = 0;
+      for (unsigned int j = 0; j < 64; ++j)
+        if ((p * 64 + j) % simd.channels == c)
+          mask |= __mmask64{1} << j;
+      simd.masks512.push_back(mask);
+    }
+#endif
+
+  return simd;
+}
+
+/* 256-entry lookup with pshufb, which zeroes lanes whose index has bit 7
+ * set. Subtracting 16 per slice makes slice k contribute only while k is at
+ * most the high nibble, so XOR-ing the prefix differences leaves the entry of
+ * the right slice. Both halves are looked up and bit 7 picks between them. */
+static __m128i lut_lookup16(__m128i index, const Lut_Registers16 &table) {
+  const __m128i upper = _mm_cmplt_epi8(index, _mm_setzero_si128());
+  const __m128i step = _mm_set1_epi8(16);
+  __m128i x = _mm_and_si128(index, _mm_set1_epi8(0x7F));
+  __m128i low = _mm_setzero_si128(), high = _mm_setzero_si128();
+  for (int k = 0; k < 8; ++k) {
+    low = _mm_xor_si128(low, _mm_shuffle_epi8(table.part[k], x));
+    high = _mm_xor_si128(high, _mm_shuffle_epi8(table.part[k + 8], x));
+    x = _mm_sub_epi8(x, step);
+  }
+  return _mm_xor_si128(low, _mm_and_si128(upper, _mm_xor_si128(low, high)));
+}
+
+#if defined(__AVX512VBMI__) && defined(__AVX512BW__)
+/* 256-entry lookup as two 128-entry vpermi2b lookups selected by bit 7. */
+static __m512i lut_lookup64(__m512i index, const Lut_Registers64 &table) {
+  const __m512i low =
+      _mm512_permutex2var_epi8(table.part[0], index, table.part[1]);
+  const __m512i high =
+      _mm512_permutex2var_epi8(table.part[2], index, table.part[3]);
+  return _mm512_mask_blend_epi8(_mm512_movepi8_mask(index), low, high);
+}
+#endif
+
+/* Looks up count bytes starting at a multiple of the channel count. */
+static void point_lut_range(const unsigned char *src, unsigned char *dst,
+                            std::size_t count, const Point_Lut &lut,
+                            const Point_Lut_Simd &simd) {
+  const unsigned int channels = simd.channels;
+  std::size_t i = 0;
+
+#if defined(__AVX512VBMI__) && defined(__AVX512BW__)
+  for (unsigned int phase = 0; i + 64 <= count;
+       i += 64, phase = (phase + 1) % simd.phases512) {
+    const __m512i index = _mm512_loadu_si512(src + i);
+    __m512i result = lut_lookup64(index, simd.tables512[0]);
+    for (unsigned int c = 1; c < channels; ++c)
+      result = _mm512_mask_blend_epi8(simd.masks512[phase * channels + c],
+                                      result,
+                                      lut_lookup64(index, simd.tables512[c]));
+    _mm512_storeu_si512(dst + i, result);
+  }
+#endif
+
+  for (unsigned int phase = static_cast<unsigned int>(i / 16 % simd.phases);
+       i + 16 <= count;
+       i += 16, phase = (phase + 1) % simd.phases) {
+    const __m128i index =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+    __m128i result;
+    if (channels == 1) {
+      result = lut_lookup16(index, simd.tables[0]);
+    } else {
+      result = _mm_setzero_si128();
+      for (unsigned int c = 0; c < channels; ++c)
+        result = _mm_or_si128(
+            result, _mm_and_si128(simd.masks[phase * channels + c].lanes,
+                                  lut_lookup16(index, simd.tables[c])));
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), result);
+  }
+
+  for (; i < count; ++i)
+    dst[i] = lut.table(static_cast<unsigned int>(i % lut.channels()))[src[i]];
+}
+
+std::vector<unsigned char>
+apply_point_lut(const std::vector<unsigned char> &bytes, const Point_Lut &lut) {
+  if (bytes.size() % lut.channels() != 0)
+    throw std::invalid_argument("Buffer size must be a multiple of channels");
+
+  std::vector<unsigned char> output(bytes.size());
+  const Point_Lut_Simd simd = prepare_point_lut(lut);
+
+  /* Chunks are multiples of 64 and of the channel count, so every chunk
+   * starts at channel 0 in the first phase. */
+  const std::size_t chunk = std::size_t{12288} * lut.channels();
+  const std::size_t chunks = (bytes.size() + chunk - 1) / chunk;
+
+  default_thread_pool().parallel_for(
+      0, chunks, [&](std::size_t first, std::size_t last) {
+        const std::size_t begin = first * chunk;
+        const std::size_t end = std::min(bytes.size(), last * chunk);
+        point_lut_range(bytes.data() + begin, output.data() + begin,
+                        end - begin, lut, simd);
+      });
+
+  return output;
+}
+
+#endif
@@ -0,0 +1,174 @@
+#ifndef PRIORITY_HPP_
+#define PRIORITY_HPP_
+
+#include <string_view>
+
+/**
+ * @brief Priority class of a job; interactive work is served first.
+ */
+enum class Priority {
+  INTERACTIVE,
+  BULK,
+};
+
+inline constexpr int priority_count = 2;
+
+/**
+ * @brief Names of the priority classes, in Priority order.
+ */
+inline constexpr const char *priority_names[] = {"interactive", "bulk"};
+
+/**
+ * @brief Parses a priority class name.
+ *
+ * @param name "interactive" or "bulk".
+ * @return Priority The class.
+ * @throws std::invalid_argument If the name is unknown.
+ */
+Priority parse_priority(std::string_view name);
+
+/**
+ * @brief How threads are shared between the priority classes.
+ */
+struct Priority_Policy {
+  /** Fraction of the work picked while both classes wait that goes to bulk,
+   * between 0 and 1, so bulk jobs are never starved. */
+  double bulk_share = 0.1;
+  /** Most threads working on each class at once, in Priority order; 0 for
+   * no limit. */
+  unsigned int limits[priority_count] = {};
+};
+
+/**
+ * @brief Chooses which priority class a free thread serves next.
+ *
+ * Interactive work goes first, except that while both classes have work
+ * waiting every 1 / bulk_share-th pick goes to bulk. A class at its thread
+ * limit is not picked. Not synchronised: callers hold their own lock.
+ */
+class Priority_Lanes {
+public:
+  explicit Priority_Lanes(const Priority_Policy &policy = {});
+
+  /**
+   * @brief Switches to another policy. Threads already counted on a class
+   * stay counted, so their finish() calls still balance; a class over a
+   * lowered limit is not picked until enough of them finish.
+   */
+  void set_policy(const Priority_Policy &policy);
+
+  /**
+   * @brief Picks a class with work waiting and counts a thread on it.
+   *
+   * @param waiting Whether each class has work that could start.
+   * @param exempt A class picked even at its limit, e.g. the class of a run
+   * the calling thread waits for, or -1.
+   * @return int The class as an index into Priority, or -1 if none may start.
+   */
+  int choose(const bool (&waiting)[priority_count], int exempt = -1);
+
+  /**
+   * @brief Counts a thread off a class once its work is done.
+   *
+   * @return bool True if the class was at its limit, so that a thread waiting
+   * for it may now pick it.
+   */
+  bool finish(Priority priority);
+
+private:
+  unsigned int limits_[priority_count] = {};
+  /* Bulk share and credit in thousandths of a pick. */
+  unsigned int share_ = 0;
+  unsigned int credit_ = 0;
+  unsigned int running_[priority_count] = {};
+};
+
+/**
+ * @brief The priority class of the work running on the calling thread;
+ * interactive unless set by a Priority_Scope.
+ *
+ * Thread_Pool::run queues its tasks in this class and runs them in it.
+ */
+Priority current_priority();
+
+/**
+ * @brief Makes a priority class current on the calling thread for its
+ * lifetime, restoring the previous one afterwards.
+ */
+class Priority_Scope {
+public:
+  explicit Priority_Scope(Priority priority);
+  ~Priority_Scope();
+
+  Priority_Scope(const Priority_Scope &) = delete;
+  Priority_Scope &operator=(const Priority_Scope &) = delete;
+
+private:
+  Priority previous_;
+};
+
+#endif
+
+#ifdef PRIORITY_IMPLEMENTATION
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+static thread_local Priority priority_current = Priority::INTERACTIVE;
+
+Priority parse_priority(std::string_view name) {
+  for (int p = 0; p < priority_count; ++p)
+    if (name == priority_names[p])
+      return static_cast<Priority>(p);
+  throw std::invalid_argument("Unknown priority: " + std::string{name});
+}
+
+Priority_Lanes::Priority_Lanes(const Priority_Policy &policy) {
+  set_policy(policy);
+}
+
+void Priority_Lanes::set_policy(const Priority_Policy &policy) {
+  std::copy_n(policy.limits, priority_count, limits_);
+  share_ = static_cast<unsigned int>(
+      std::lround(std::clamp(policy.bulk_share, 0.0, 1.0) * 1000.0));
+}
+
+int Priority_Lanes::choose(const bool (&waiting)[priority_count],
+                           int exempt) {
+  bool eligible[priority_count];
+  for (int p = 0; p < priority_count; ++p)
+    eligible[p] = waiting[p] && (p == exempt || limits_[p] == 0 ||
+                                 running_[p] < limits_[p]);
+
+  int chosen = -1;
+  if (eligible[0] && eligible[1]) {
+    /* Both wait: bulk earns its share of every pick and is served once it
+     * has earned a whole one. */
+    credit_ += share_;
+    chosen = credit_ >= 1000 ? 1 : 0;
+    if (chosen == 1)
+      credit_ -= 1000;
+  } else if (eligible[0] || eligible[1]) {
+    chosen = eligible[0] ? 0 : 1;
+  }
+  if (chosen >= 0)
+    ++running_[chosen];
+  return chosen;
+}
+
+bool Priority_Lanes::finish(Priority priority) {
+  const auto p = static_cast<int>(priority);
+  return running_[p]-- == limits_[p];
+}
+
+Priority current_priority() { return priority_current; }
+
+Priority_Scope::Priority_Scope(Priority priority)
+    : previous_(std::exchange(priority_current, priority)) {}
+
+Priority_Scope::~Priority_Scope() { priority_current = previous_; }
+
+#endif
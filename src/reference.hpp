@@ -0,0 +1,880 @@
+#ifndef REFERENCE_HPP_
+#define REFERENCE_HPP_
+
+#include "morphology.hpp"
+#include "orientation.hpp"
+#include "threshold.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+/**
+ * @brief Scalar reference for apply_greyscale_rgb_simd.
+ *
+ * One pixel at a time with the same fixed-point weights, so the result must
+ * match bit for bit.
+ *
+ * @param bytes Input RGB buffer (3 bytes per pixel).
+ * @return std::vector<unsigned char> Greyscale output (1 byte per pixel).
+ * @throws std::invalid_argument If buffer size is not a multiple of 3.
+ */
+std::vector<unsigned char>
+reference_greyscale_rgb(const std::vector<unsigned char> &bytes);
+
+/**
+ * @brief Scalar reference for apply_invert_rgb_simd; must match bit for bit.
+ *
+ * @param bytes Input buffer.
+ * @return std::vector<unsigned char> Inverted output (same size as input).
+ */
+std::vector<unsigned char>
+reference_invert(const std::vector<unsigned char> &bytes);
+
+/**
+ * @brief Scalar reference for apply_gaussian.
+ *
+ * Convolves the full 2D kernel in double precision with clamped edges and
+ * rounds once at the end, with no intermediate quantization. The SIMD engines
+ * use float or Q14 taps and may differ by one level (see self_test).
+ *
+ * @param bytes Input buffer (channels bytes per pixel).
+ * @param width Image width in pixels.
+ * @param height Image height in pixels.
+ * @param channels Number of interleaved channels per pixel.
+ * @param blur_strength Blur intensity (sigma = blur_strength / 10.0).
+ * @param linear_light Blur linear-light values decoded from sRGB.
+ * @return std::vector<unsigned char> Blurred output (same size as input).
+ * @throws std::invalid_argument If the buffer size does not match the
+ * dimensions.
+ */
+std::vector<unsigned char>
+reference_gaussian(const std::vector<unsigned char> &bytes, unsigned int width,
+                   unsigned int height, unsigned int channels,
+                   unsigned int blur_strength, bool linear_light = false);
+
+/**
+ * @brief Scalar reference for apply_laplacian; must match bit for bit.
+ *
+ * @param grey Input greyscale buffer (1 byte per pixel).
+ * @param width Image width in pixels.
+ * @param height Image height in pixels.
+ * @return std::vector<unsigned char> Greyscale edge map (1 byte per pixel).
+ * @throws std::invalid_argument If the buffer size does not match the
+ * dimensions.
+ */
+std::vector<unsigned char>
+reference_laplacian(const std::vector<unsigned char> &grey, unsigned int width,
+                    unsigned int height);
+
+/**
+ * @brief Scalar reference for apply_morphology; must match bit for bit.
+ *
+ * Takes the minimum (erode) or maximum (dilate) of each channel over the
+ * whole se_width x se_height rectangle starting se_width / 2 columns left and
+ * se_height / 2 rows above the pixel, clipped to the image; open and close
+ * apply both in turn.
+ *
+ * @param bytes Input buffer (channels bytes per pixel).
+ * @param width Image width in pixels.
+ * @param height Image height in pixels.
+ * @param channels Number of interleaved channels per pixel.
+ * @param op Operator to apply.
+ * @param se_width Structuring element width in pixels.
+ * @param se_height Structuring element height in pixels.
+ * @return std::vector<unsigned char> Filtered output (same size as input).
+ * @throws std::invalid_argument If the buffer size does not match the
+ * dimensions.
+ */
+std::vector<unsigned char>
+reference_morphology(const std::vector<unsigned char> &bytes,
+                     unsigned int width, unsigned int height,
+                     unsigned int channels, Morphology_Op op,
+                     unsigned int se_width, unsigned int se_height);
+
+/**
+ * @brief Scalar reference for the per-pixel levels of apply_threshold, which
+ * sets a pixel to 255 when it is above its level.
+ *
+ * OTSU tries every level with the class means computed from scratch; the
+ * adaptive methods average the clipped window in double precision,
+ * ADAPTIVE_GAUSSIAN with the full 2D kernel and unrounded means.
+ *
+ * @param grey Input buffer (1 byte per pixel).
+ * @param width Image width in pixels.
+ * @param height Image height in pixels.
+ * @param method Thresholding method.
+ * @param params Method parameters.
+ * @return std::vector<double> Level of each pixel.
+ * @throws std::invalid_argument If the buffer size does not match the
+ * dimensions.
+ */
+std::vector<double>
+reference_threshold_levels(const std::vector<unsigned char> &grey,
+                           unsigned int width, unsigned int height,
+                           Threshold_Method method,
+                           const Threshold_Params &params);
+
+/**
+ * @brief Differentially fuzzes the SIMD filters against the references.
+ *
+ * Each case draws a random size (widths that are not a multiple of the
+ * vector width, 1xN and Nx1 strips among them), channel count, blur strength
+ * and pixel data, and compares:
+ * - apply_greyscale_rgb_simd, apply_invert_rgb_simd, apply_laplacian and
+ *   apply_laplacian_rgb: bit exact
+ * - apply_gaussian on the separable engine and on the FFT engine, forced
+ *   through the convolution cost model: at most 1 level per sample
+ * - apply_gaussian in linear light: at most 1 level per sample
+ * - apply_morphology with a random operator and element: bit exact
+ * - apply_orientation_in_place transposing the largest square of the case
+ *   with tiles of 16 to 64 pixels: bit exact against apply_orientation
+ * - apply_threshold with every method: bit exact except for pixels within
+ *   float error of their level (one level for ADAPTIVE_GAUSSIAN, whose mean
+ *   is rounded)
+ * - clip_histogram on the histogram of the case: keeps its total
+ * - apply_clahe on a flat image, with more tiles than fit whole pixels:
+ *   stays flat
+ * - lodepng row ranges and previews of the case encoded with and without
+ *   Adam7: bit exact against the rows and subsampled pixels of a full decode
+ * - Priority_Lanes: gives bulk exactly its share of the contended picks and
+ *   never starts a class over its limit, also after the limits change while
+ *   threads run
+ * - run_batch over in-memory files with random priorities, queue bounds,
+ *   memory budget and class limits: writes every readable job once and
+ *   correctly, fails the others and keeps within the budget
+ *
+ * The instruction set is fixed at compile time, so each build checks the
+ * vector and scalar tail paths it was compiled with; build once per -march
+ * to cover several.
+ *
+ * @param cases Number of random cases.
+ * @param seed Seed of the case generator; the same seed gives the same cases.
+ * @param log Receives one line per failure and a summary.
+ * @return std::size_t Number of failed comparisons.
+ */
+std::size_t self_test(unsigned int cases, std::uint32_t seed,
+                      std::ostream &log);
+
+#endif
+
+#ifdef REFERENCE_IMPLEMENTATION
+
+#include "batch.hpp"
+#include "convolve.hpp"
+#include "filters.hpp"
+#include "histogram.hpp"
+#include "lodepng.h"
+#include "priority.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+std::vector<unsigned char>
+reference_greyscale_rgb(const std::vector<unsigned char> &bytes) {
+  if (bytes.size() % 3 != 0)
+    throw std::invalid_argument("RGB buffer must have a multiple of 3 bytes");
+
+  std::vector<unsigned char> output(bytes.size() / 3);
+  for (std::size_t i = 0; i < output.size(); ++i) {
+    const int r = bytes[i * 3], g = bytes[i * 3 + 1], b = bytes[i * 3 + 2];
+    output[i] = static_cast<unsigned char>((77 * r + 150 * g + 29 * b + 128) >> 8);
+  }
+  return output;
+}
+
+std::vector<unsigned char>
+reference_invert(const std::vector<unsigned char> &bytes) {
+  std::vector<unsigned char> output(bytes.size());
+  for (std::size_t i = 0; i < bytes.size(); ++i)
+    output[i] = static_cast<unsigned char>(255 - bytes[i]);
+  return output;
+}
+
+static double srgb_to_linear(double c) {
+  return c <= 0.04045 ? c / 12.92 : std::pow((c + 0.055) / 1.055, 2.4);
+}
+
+static double linear_to_srgb(double l) {
+  l = std::clamp(l, 0.0, 1.0);
+  return l <= 0.0031308 ? 12.92 * l : 1.055 * std::pow(l, 1.0 / 2.4) - 0.055;
+}
+
+/* Convolves with the full 2D Gaussian kernel and clamped edges. */
+static std::vector<double> reference_blur(const std::vector<double> &values,
+                                          int w, int h, int c, double sigma) {
+  const auto [kernel, radius] = generate_gaussian_kernel(sigma);
+  std::vector<double> output(values.size());
+  for (int y = 0; y < h; ++y)
+    for (int x = 0; x < w; ++x)
+      for (int ch = 0; ch < c; ++ch) {
+        double sum = 0.0;
+        for (int j = -radius; j <= radius; ++j) {
+          const int sy = std::clamp(y + j, 0, h - 1);
+          for (int i = -radius; i <= radius; ++i) {
+            const int sx = std::clamp(x + i, 0, w - 1);
+            sum += kernel[static_cast<std::size_t>(j + radius)] *
+                   kernel[static_cast<std::size_t>(i + radius)] *
+                   values[(static_cast<std::size_t>(sy) * w + sx) * c + ch];
+          }
+        }
+        output[(static_cast<std::size_t>(y) * w + x) * c + ch] = sum;
+      }
+  return output;
+}
+
+std::vector<unsigned char>
+reference_gaussian(const std::vector<unsigned char> &bytes, unsigned int width,
+                   unsigned int height, unsigned int channels,
+                   unsigned int blur_strength, bool linear_light) {
+  if (bytes.size() != static_cast<std::size_t>(width) * height * channels)
+    throw std::invalid_argument("Buffer size does not match image dimensions");
+
+  const double sigma =
+      std::max(static_cast<double>(blur_strength) / 10.0, 0.1);
+
+  std::vector<double> values(bytes.size());
+  for (std::size_t i = 0; i < bytes.size(); ++i)
+    values[i] = linear_light ? srgb_to_linear(bytes[i] / 255.0) : bytes[i];
+  const std::vector<double> blurred =
+      reference_blur(values, static_cast<int>(width), static_cast<int>(height),
+                     static_cast<int>(channels), sigma);
+
+  std::vector<unsigned char> output(bytes.size());
+  for (std::size_t i = 0; i < output.size(); ++i) {
+    const double sum =
+        linear_light ? linear_to_srgb(blurred[i]) * 255.0 : blurred[i];
+    output[i] =
+        static_cast<unsigned char>(std::clamp(std::lround(sum), 0L, 255L));
+  }
+  return output;
+}
+
+std::vector<unsigned char>
+reference_laplacian(const std::vector<unsigned char> &grey, unsigned int width,
+                    unsigned int height) {
+  if (grey.size() != static_cast<std::size_t>(width) * height)
+    throw std::invalid_argument("Buffer size does not match image dimensions");
+
+  const int w = static_cast<int>(width);
+  const int h = static_cast<int>(height);
+  auto at = [&](int x, int y) {
+    return static_cast<int>(grey[static_cast<std::size_t>(
+        std::clamp(y, 0, h - 1) * w + std::clamp(x, 0, w - 1))]);
+  };
+
+  std::vector<unsigned char> output(grey.size());
+  for (int y = 0; y < h; ++y)
+    for (int x = 0; x < w; ++x) {
+      const int sum = 4 * at(x, y) - at(x, y - 1) - at(x - 1, y) -
+                      at(x + 1, y) - at(x, y + 1);
+      output[static_cast<std::size_t>(y * w + x)] =
+          static_cast<unsigned char>(std::min(std::abs(sum), 255));
+    }
+  return output;
+}
+
+std::vector<unsigned char>
+reference_morphology(const std::vector<unsigned char> &bytes,
+                     unsigned int width, unsigned int height,
+                     unsigned int channels, Morphology_Op op,
+                     unsigned int se_width, unsigned int se_height) {
+  if (bytes.size() != static_cast<std::size_t>(width) * height * channels)
+    throw std::invalid_argument("Buffer size does not match image dimensions");
+  if (op == Morphology_Op::OPEN || op == Morphology_Op::CLOSE) {
+    const bool open = op == Morphology_Op::OPEN;
+    const auto first = open ? Morphology_Op::ERODE : Morphology_Op::DILATE;
+    const auto second = open ? Morphology_Op::DILATE : Morphology_Op::ERODE;
+    return reference_morphology(
+        reference_morphology(bytes, width, height, channels, first, se_width,
+                             se_height),
+        width, height, channels, second, se_width, se_height);
+  }
+
+  const bool erode = op == Morphology_Op::ERODE;
+  const int w = static_cast<int>(width);
+  const int h = static_cast<int>(height);
+  const int c = static_cast<int>(channels);
+  const int left = static_cast<int>(se_width / 2);
+  const int top = static_cast<int>(se_height / 2);
+
+  std::vector<unsigned char> output(bytes.size());
+  for (int y = 0; y < h; ++y)
+    for (int x = 0; x < w; ++x)
+      for (int ch = 0; ch < c; ++ch) {
+        unsigned char value = erode ? 255 : 0;
+        for (int sy = std::max(0, y - top);
+             sy < std::min(h, y - top + static_cast<int>(se_height)); ++sy)
+          for (int sx = std::max(0, x - left);
+               sx < std::min(w, x - left + static_cast<int>(se_width));
+               ++sx) {
+            const unsigned char sample =
+                bytes[(static_cast<std::size_t>(sy) * w + sx) * c + ch];
+            value = erode ? std::min(value, sample) : std::max(value, sample);
+          }
+        output[(static_cast<std::size_t>(y) * w + x) * c + ch] = value;
+      }
+  return output;
+}
+
+std::vector<double>
+reference_threshold_levels(const std::vector<unsigned char> &grey,
+                           unsigned int width, unsigned int height,
+                           Threshold_Method method,
+                           const Threshold_Params &params) {
+  if (grey.size() != static_cast<std::size_t>(width) * height)
+    throw std::invalid_argument("Buffer size does not match image dimensions");
+
+  if (method == Threshold_Method::FIXED)
+    return std::vector<double>(grey.size(), params.level);
+
+  if (method == Threshold_Method::OTSU) {
+    /* The first level with the largest between-class variance. */
+    double best = 0.0;
+    unsigned int level = 0;
+    for (unsigned int t = 0; t < 256; ++t) {
+      double below = 0.0, above = 0.0, below_sum = 0.0, above_sum = 0.0;
+      for (unsigned char v : grey) {
+        if (v <= t) {
+          below += 1.0;
+          below_sum += v;
+        } else {
+          above += 1.0;
+          above_sum += v;
+        }
+      }
+      if (below == 0.0 || above == 0.0)
+        continue;
+      const double difference = below_sum / below - above_sum / above;
+      const double between = below * above * difference * difference;
+      if (between > best) {
+        best = between;
+        level = t;
+      }
+    }
+    return std::vector<double>(grey.size(), level);
+  }
+
+  const int w = static_cast<int>(width);
+  const int h = static_cast<int>(height);
+  std::vector<double> levels(grey.size());
+
+  if (method == Threshold_Method::ADAPTIVE_GAUSSIAN) {
+    const std::vector<double> mean = reference_blur(
+        std::vector<double>(grey.begin(), grey.end()), w, h, 1,
+        params.window / 6.0);
+    for (std::size_t i = 0; i < levels.size(); ++i)
+      levels[i] = mean[i] - params.offset;
+    return levels;
+  }
+
+  const int radius = static_cast<int>(params.window / 2);
+  for (int y = 0; y < h; ++y)
+    for (int x = 0; x < w; ++x) {
+      double sum = 0.0, squares = 0.0, count = 0.0;
+      for (int sy = std::max(0, y - radius); sy < std::min(h, y + radius + 1);
+           ++sy)
+        for (int sx = std::max(0, x - radius);
+             sx < std::min(w, x + radius + 1); ++sx) {
+          const double v = grey[static_cast<std::size_t>(sy) * width +
+                                static_cast<std::size_t>(sx)];
+          sum += v;
+          squares += v * v;
+          count += 1.0;
+        }
+      const double m = sum / count;
+      const std::size_t i = static_cast<std::size_t>(y) * width +
+                            static_cast<std::size_t>(x);
+      if (method == Threshold_Method::SAUVOLA) {
+        const double s = std::sqrt(std::max(squares / count - m * m, 0.0));
+        levels[i] = m * (1.0 + params.k * (s / params.range - 1.0));
+      } else {
+        levels[i] = m - params.offset;
+      }
+    }
+  return levels;
+}
+
+/* Whole files in memory; requests complete inline on the calling thread. */
+class Memory_File_IO final : public File_IO {
+public:
+  void read(std::filesystem::path path, Read_Callback done) override {
+    std::vector<unsigned char> bytes;
+    bool found;
+    {
+      std::lock_guard lock(mutex_);
+      auto it = files_.find(path.string());
+      found = it != files_.end();
+      if (found)
+        bytes = it->second;
+    }
+    if (found)
+      done(std::move(bytes), {});
+    else
+      done({}, std::make_error_code(std::errc::no_such_file_or_directory));
+  }
+
+  void write(std::filesystem::path path, std::vector<unsigned char> bytes,
+             Write_Callback done) override {
+    {
+      std::lock_guard lock(mutex_);
+      files_[path.string()] = std::move(bytes);
+    }
+    done({});
+  }
+
+  void drain() override {}
+
+  std::string name() const override { return "memory"; }
+
+  std::map<std::string, std::vector<unsigned char>> files() {
+    std::lock_guard lock(mutex_);
+    return files_;
+  }
+
+  void add(const std::string &path, std::vector<unsigned char> bytes) {
+    std::lock_guard lock(mutex_);
+    files_[path] = std::move(bytes);
+  }
+
+private:
+  std::mutex mutex_;
+  std::map<std::string, std::vector<unsigned char>> files_;
+};
+
+/* Sets the cost model for the lifetime of the guard, so the FFT and direct
+ * engines can each be forced regardless of image size. */
+struct Cost_Model_Override {
+  Convolution_Cost_Model saved = convolution_cost_model();
+
+  explicit Cost_Model_Override(const Convolution_Cost_Model &model) {
+    convolution_cost_model() = model;
+  }
+  ~Cost_Model_Override() { convolution_cost_model() = saved; }
+};
+
+std::size_t self_test(unsigned int cases, std::uint32_t seed,
+                      std::ostream &log) {
+  std::mt19937 rng(seed);
+  auto uniform = [&](unsigned int low, unsigned int high) {
+    return std::uniform_int_distribution<unsigned int>(low, high)(rng);
+  };
+
+  std::size_t comparisons = 0, failures = 0;
+  unsigned int width = 0, height = 0, channels = 0;
+  std::string parameters;
+
+  /* Compares one output, reporting the first sample beyond tolerance. */
+  auto check = [&](const char *name, const std::vector<unsigned char> &actual,
+                   const std::vector<unsigned char> &expected,
+                   unsigned int out_channels, int tolerance) {
+    ++comparisons;
+    if (actual.size() != expected.size()) {
+      ++failures;
+      log << "FAIL " << name << ' ' << width << 'x' << height << 'x'
+          << channels << parameters << ": " << actual.size()
+          << " bytes, expected " << expected.size() << '\n';
+      return;
+    }
+    for (std::size_t i = 0; i < actual.size(); ++i) {
+      const int difference = std::abs(actual[i] - expected[i]);
+      if (difference <= tolerance)
+        continue;
+      const std::size_t pixel = i / out_channels;
+      ++failures;
+      log << "FAIL " << name << ' ' << width << 'x' << height << 'x'
+          << channels << parameters << ": " << static_cast<int>(actual[i])
+          << " instead of " << static_cast<int>(expected[i]) << " at ("
+          << pixel % width << ',' << pixel / width << ") channel "
+          << i % out_channels << '\n';
+      return;
+    }
+  };
+
+  /* Records a property check, reporting detail when it fails. */
+  auto expect = [&](const char *name, bool ok, const std::string &detail) {
+    ++comparisons;
+    if (ok)
+      return;
+    ++failures;
+    log << "FAIL " << name << ' ' << width << 'x' << height << 'x' << channels
+        << parameters << ": " << detail << '\n';
+  };
+
+  /* Compares a binary image with grey > level, ignoring pixels within band
+   * of their level. */
+  auto check_threshold = [&](const char *name,
+                             const std::vector<unsigned char> &actual,
+                             const std::vector<unsigned char> &grey,
+                             const std::vector<double> &levels, double band) {
+    std::vector<unsigned char> expected(grey.size());
+    for (std::size_t i = 0; i < grey.size(); ++i)
+      expected[i] = std::abs(grey[i] - levels[i]) <= band ? actual[i]
+                    : grey[i] > levels[i]                ? 255
+                                                         : 0;
+    check(name, actual, expected, 1, 0);
+  };
+
+  for (unsigned int n = 0; n < cases; ++n) {
+    /* Mostly small odd sizes to hit every tail length, with strips and a
+     * few sizes large enough for several vector blocks per row. */
+    switch (uniform(0, 5)) {
+    case 0:
+      width = 1;
+      height = uniform(1, 300);
+      break;
+    case 1:
+      width = uniform(1, 300);
+      height = 1;
+      break;
+    case 2:
+      width = uniform(64, 300);
+      height = uniform(2, 64);
+      break;
+    default:
+      width = uniform(1, 40);
+      height = uniform(1, 40);
+      break;
+    }
+    channels = uniform(1, 4);
+    const unsigned int blur_strength = uniform(0, 40);
+
+    /* Uniform noise, with runs of 0 and 255 to probe saturation. */
+    std::vector<unsigned char> image(static_cast<std::size_t>(width) * height *
+                                     channels);
+    const unsigned int extremes = uniform(0, 3);
+    for (auto &sample : image) {
+      const unsigned int roll = uniform(0, 7);
+      sample = static_cast<unsigned char>(
+          roll < extremes ? (roll % 2 ? 255 : 0) : uniform(0, 255));
+    }
+    std::vector<unsigned char> rgb(static_cast<std::size_t>(width) * height *
+                                   3);
+    for (auto &sample : rgb)
+      sample = static_cast<unsigned char>(uniform(0, 255));
+    const std::vector<unsigned char> grey = reference_greyscale_rgb(rgb);
+
+    parameters.clear();
+    check("greyscale", apply_greyscale_rgb_simd(rgb), grey, 1, 0);
+    check("invert", apply_invert_rgb_simd(rgb), reference_invert(rgb), 3, 0);
+    check("laplace", apply_laplacian(grey, width, height),
+          reference_laplacian(grey, width, height), 1, 0);
+    check("laplace-rgb", apply_laplacian_rgb(rgb, width, height),
+          reference_laplacian(grey, width, height), 1, 0);
+
+    parameters = " strength=" + std::to_string(blur_strength);
+    const std::vector<unsigned char> blurred =
+        reference_gaussian(image, width, height, channels, blur_strength);
+    {
+      Cost_Model_Override direct(
+          {1.0, 2.5, std::numeric_limits<double>::infinity()});
+      check("gaussian-separable",
+            apply_gaussian(image, width, height, channels, blur_strength),
+            blurred, channels, 1);
+    }
+    {
+      Cost_Model_Override fft({1.0, std::numeric_limits<double>::infinity(),
+                               22.0});
+      check("gaussian-fft",
+            apply_gaussian(image, width, height, channels, blur_strength),
+            blurred, channels, 1);
+    }
+    check("gaussian-linear",
+          apply_gaussian(image, width, height, channels, blur_strength, true),
+          reference_gaussian(image, width, height, channels, blur_strength,
+                             true),
+          channels, 1);
+
+    {
+      const auto op = static_cast<Morphology_Op>(uniform(0, 3));
+      const unsigned int se_width = uniform(1, 9), se_height = uniform(1, 9);
+      parameters = " op=" + std::to_string(static_cast<int>(op)) +
+                   " element=" + std::to_string(se_width) + 'x' +
+                   std::to_string(se_height);
+      check("morphology",
+            apply_morphology(image, width, height, channels, op, se_width,
+                             se_height),
+            reference_morphology(image, width, height, channels, op, se_width,
+                                 se_height),
+            channels, 0);
+    }
+
+    /* Square images swap tile pairs in place, split between the threads. */
+    {
+      const unsigned int side = std::min(width, height);
+      std::vector<unsigned char> square(
+          image.begin(),
+          image.begin() + std::ptrdiff_t{side} * side * channels);
+      const std::vector<unsigned char> expected = apply_orientation(
+          square, side, side, channels, Orientation::TRANSPOSE);
+      /* Small tiles give the threads several pairs each. */
+      const unsigned int saved_block = transpose_tiling().block;
+      transpose_tiling().block = 16 * uniform(1, 4);
+      unsigned int new_width = side, new_height = side;
+      apply_orientation_in_place(square, new_width, new_height, channels,
+                                 Orientation::TRANSPOSE);
+      const auto mismatch =
+          std::mismatch(square.begin(), square.end(), expected.begin());
+      parameters = " side=" + std::to_string(side) +
+                   " block=" + std::to_string(transpose_tiling().block);
+      transpose_tiling().block = saved_block;
+      expect("transpose-in-place", mismatch.first == square.end(),
+             "differs at byte " +
+                 std::to_string(mismatch.first - square.begin()));
+    }
+
+    {
+      Threshold_Params params;
+      params.level = uniform(0, 255);
+      params.window = uniform(1, 31);
+      params.offset = uniform(0, 100) / 10.0;
+      params.k = uniform(10, 60) / 100.0;
+      parameters = " level=" + std::to_string(params.level) +
+                   " window=" + std::to_string(params.window);
+      const std::pair<const char *, Threshold_Method> methods[] = {
+          {"threshold-fixed", Threshold_Method::FIXED},
+          {"threshold-otsu", Threshold_Method::OTSU},
+          {"threshold-mean", Threshold_Method::ADAPTIVE_MEAN},
+          {"threshold-gaussian", Threshold_Method::ADAPTIVE_GAUSSIAN},
+          {"threshold-sauvola", Threshold_Method::SAUVOLA}};
+      for (const auto &[name, method] : methods) {
+        /* Float window sums, and Sauvola's variance from them, stay within
+         * a fraction of a level; the Gaussian mean is rounded. */
+        const double band = method == Threshold_Method::ADAPTIVE_GAUSSIAN
+                                ? 1.001
+                            : method == Threshold_Method::SAUVOLA ? 0.25
+                                                                  : 0.001;
+        check_threshold(name,
+                        apply_threshold(grey, width, height, method, params),
+                        grey,
+                        reference_threshold_levels(grey, width, height,
+                                                   method, params),
+                        band);
+      }
+    }
+
+    /* Clipping only moves counts between bins. */
+    {
+      const double clip_limit = uniform(1, 80) / 10.0;
+      parameters = " clip=" + std::to_string(clip_limit);
+      Histogram hist = compute_histogram(grey.data(), grey.size());
+      clip_histogram(hist, static_cast<std::uint32_t>(grey.size()),
+                     clip_limit);
+      const std::uint64_t total =
+          std::accumulate(hist.begin(), hist.end(), std::uint64_t{0});
+      expect("clahe-clip", total == grey.size(),
+             "total " + std::to_string(total) + " instead of " +
+                 std::to_string(grey.size()));
+    }
+
+    /* Every tile of a flat image has the same table, also when more tiles
+     * are asked for than fit whole pixels, so the image stays flat. */
+    {
+      const unsigned int tiles_x = uniform(width / 2 + 1, width + 8);
+      const unsigned int tiles_y = uniform(height / 2 + 1, height + 8);
+      const double clip_limit = uniform(0, 80) / 10.0;
+      parameters = " tiles=" + std::to_string(tiles_x) + 'x' +
+                   std::to_string(tiles_y) +
+                   " clip=" + std::to_string(clip_limit);
+      const std::vector<unsigned char> flat(grey.size(),
+                                            static_cast<unsigned char>(
+                                                uniform(0, 255)));
+      const std::vector<unsigned char> equalized = apply_clahe(
+          flat, width, height, 1, tiles_x, tiles_y, clip_limit);
+      check("clahe-flat", equalized,
+            std::vector<unsigned char>(flat.size(), equalized.front()), 1, 0);
+    }
+
+    /* Row ranges and previews give the same pixels as a full decode. */
+    {
+      const bool interlaced = uniform(0, 1) != 0;
+      parameters = interlaced ? " adam7" : "";
+      lodepng::State encoder;
+      encoder.info_png.interlace_method = interlaced;
+      encoder.info_raw.colortype = LCT_RGB;
+      encoder.info_png.color.colortype = LCT_RGB;
+      encoder.encoder.auto_convert = 0;
+      std::vector<unsigned char> png;
+      expect("png-encode", !lodepng::encode(png, rgb, width, height, encoder),
+             "encoding failed");
+
+      auto decode = [&](unsigned int row_begin, unsigned int row_end,
+                        unsigned int preview_scale) {
+        lodepng::State state;
+        state.info_raw.colortype = LCT_RGB;
+        state.decoder.row_begin = row_begin;
+        state.decoder.row_end = row_end;
+        state.decoder.preview_scale = preview_scale;
+        unsigned int w = 0, h = 0;
+        std::vector<unsigned char> out;
+        if (lodepng::decode(out, w, h, state, png))
+          out.clear();
+        return out;
+      };
+      const std::vector<unsigned char> full = decode(0, 0, 1);
+      check("png-full", full, rgb, 3, 0);
+
+      const unsigned int row_begin = uniform(0, height - 1);
+      const unsigned int row_end = uniform(row_begin + 1, height);
+      parameters += " rows=" + std::to_string(row_begin) + '-' +
+                    std::to_string(row_end);
+      check("png-rows", decode(row_begin, row_end, 1),
+            std::vector<unsigned char>(
+                rgb.begin() + std::ptrdiff_t{row_begin} * width * 3,
+                rgb.begin() + std::ptrdiff_t{row_end} * width * 3),
+            3, 0);
+
+      const unsigned int scale = 2u << uniform(0, 2);
+      parameters = (interlaced ? " adam7" : "") +
+                   std::string{" preview="} + std::to_string(scale);
+      std::vector<unsigned char> subsampled;
+      for (unsigned int y = 0; y < height; y += scale)
+        for (unsigned int x = 0; x < width; x += scale)
+          for (unsigned int c = 0; c < 3; ++c)
+            subsampled.push_back(
+                rgb[(static_cast<std::size_t>(y) * width + x) * 3 + c]);
+      check("png-preview", decode(0, 0, scale), subsampled, 3, 0);
+    }
+
+    /* Bulk gets exactly its share of contended picks, and no class runs
+     * over its limit. */
+    {
+      Priority_Policy policy;
+      policy.bulk_share = uniform(0, 10) / 10.0;
+      parameters = " share=" + std::to_string(policy.bulk_share);
+      Priority_Lanes lanes(policy);
+      const bool both[priority_count] = {true, true};
+      unsigned int bulk = 0;
+      for (int pick = 0; pick < 100; ++pick) {
+        const int p = lanes.choose(both);
+        bulk += p == 1;
+        lanes.finish(static_cast<Priority>(p));
+      }
+      const auto expected_bulk =
+          static_cast<unsigned int>(std::lround(policy.bulk_share * 100.0));
+      expect("priority-share", bulk == expected_bulk,
+             std::to_string(bulk) + " bulk picks instead of " +
+                 std::to_string(expected_bulk));
+
+      policy.limits[0] = uniform(1, 3);
+      policy.limits[1] = uniform(1, 3);
+      Priority_Lanes limited(policy);
+      unsigned int running[priority_count] = {};
+      bool within = true;
+      for (int step = 0; step < 100; ++step) {
+        /* Halfway the limits change under the threads already running. */
+        if (step == 50) {
+          policy.limits[0] = uniform(1, 3);
+          policy.limits[1] = uniform(1, 3);
+          limited.set_policy(policy);
+        }
+        const bool waiting[priority_count] = {uniform(0, 3) != 0,
+                                              uniform(0, 3) != 0};
+        const int p = limited.choose(waiting);
+        if (p >= 0) {
+          within = within && waiting[p] && ++running[p] <= policy.limits[p];
+        } else {
+          for (int q = 0; q < priority_count; ++q)
+            within = within && (!waiting[q] || running[q] >= policy.limits[q]);
+        }
+        const int q = static_cast<int>(uniform(0, 1));
+        if (running[q] > 0 && uniform(0, 1)) {
+          --running[q];
+          limited.finish(static_cast<Priority>(q));
+        }
+      }
+      expect("priority-limits", within, "a class started over its limit");
+    }
+
+    /* The pipeline writes every readable job once, inverted by its filter
+     * stage, whatever the priorities, bounds, budget and limits. */
+    {
+      Thread_Pool &pool = default_thread_pool();
+      const Priority_Policy saved = pool.priority_policy();
+      Priority_Policy policy;
+      policy.bulk_share = uniform(0, 10) / 10.0;
+      policy.limits[0] = uniform(0, 2);
+      policy.limits[1] = uniform(0, 2);
+      pool.set_priority_policy(policy);
+
+      Memory_File_IO io;
+      std::vector<Batch_Job> jobs(uniform(1, 12));
+      std::map<std::string, std::vector<unsigned char>> expected;
+      std::size_t missing = 0;
+      for (std::size_t j = 0; j < jobs.size(); ++j) {
+        jobs[j].input = "in" + std::to_string(j);
+        jobs[j].output = "out" + std::to_string(j);
+        jobs[j].priority = uniform(0, 1) ? Priority::BULK
+                                         : Priority::INTERACTIVE;
+        if (uniform(0, 7) == 0) {
+          ++missing;
+          continue;
+        }
+        std::vector<unsigned char> bytes(
+            image.begin(),
+            image.begin() + uniform(0, static_cast<unsigned int>(
+                                           image.size())));
+        expected[jobs[j].output] = reference_invert(bytes);
+        io.add(jobs[j].input, std::move(bytes));
+      }
+
+      Batch_Stages stages;
+      stages.decode = [](const std::vector<unsigned char> &bytes) {
+        return Batch_Image{bytes, static_cast<unsigned int>(bytes.size()), 1,
+                           "grey"};
+      };
+      stages.filter = [](Batch_Image image) {
+        image.bytes = reference_invert(image.bytes);
+        return image;
+      };
+      stages.encode = [](const Batch_Image &image) { return image.bytes; };
+      stages.footprint = [](const std::vector<unsigned char> &bytes) {
+        return 2 * bytes.size() + 1;
+      };
+      Batch_Options options;
+      options.read_ahead = uniform(1, 4);
+      options.queue_capacity = uniform(1, 3);
+      options.memory_budget =
+          uniform(0, 1) ? 0 : uniform(1, 2 * static_cast<unsigned int>(
+                                                 image.size()) + 8);
+      parameters = " jobs=" + std::to_string(jobs.size()) +
+                   " budget=" + std::to_string(options.memory_budget);
+
+      std::ostringstream errors;
+      const Batch_Result result = run_batch(jobs, io, options, stages, errors);
+      pool.set_priority_policy(saved);
+
+      std::map<std::string, std::vector<unsigned char>> written = io.files();
+      std::erase_if(written, [](const auto &file) {
+        return file.first.starts_with("in");
+      });
+      expect("batch-outputs", written == expected,
+             std::to_string(written.size()) + " outputs, expected " +
+                 std::to_string(expected.size()));
+      expect("batch-failures", result.failures == missing,
+             std::to_string(result.failures) + " failures instead of " +
+                 std::to_string(missing));
+      expect("batch-budget",
+             options.memory_budget == 0 || result.oversized > 0 ||
+                 result.peak_bytes <= options.memory_budget,
+             std::to_string(result.peak_bytes) + " bytes admitted");
+    }
+  }
+
+  log << comparisons - failures << " of " << comparisons
+      << " comparisons passed over " << cases << " cases (seed " << seed
+      << ")\n";
+  return failures;
+}
+
+#endif
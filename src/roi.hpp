@@ -0,0 +1,227 @@
+#ifndef ROI_HPP_
+#define ROI_HPP_
+
+#include <cstddef>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+/**
+ * @brief A rectangle of whole pixels, x and y being its top-left corner.
+ */
+struct Roi {
+  unsigned int x = 0;
+  unsigned int y = 0;
+  unsigned int width = 0;
+  unsigned int height = 0;
+};
+
+/**
+ * @brief A strided window onto an interleaved image buffer.
+ *
+ * Views never own their pixels: row(y) points into the underlying image,
+ * stride bytes apart, so cropping costs nothing until the pixels are read.
+ */
+template <typename T> struct Basic_Image_View {
+  T *data = nullptr;
+  unsigned int width = 0;
+  unsigned int height = 0;
+  unsigned int channels = 0;
+  std::size_t stride = 0;
+
+  T *row(unsigned int y) const { return data + y * stride; }
+
+  operator Basic_Image_View<const T>() const
+    requires(!std::is_const_v<T>)
+  {
+    return {data, width, height, channels, stride};
+  }
+};
+
+using Image_View = Basic_Image_View<unsigned char>;
+using Const_Image_View = Basic_Image_View<const unsigned char>;
+
+/**
+ * @brief Parses a region given as "x,y,width,height".
+ *
+ * @param spec Region specification.
+ * @return Roi The parsed region.
+ * @throws std::invalid_argument If the specification is malformed or the
+ * region is empty.
+ */
+Roi parse_roi(const std::string &spec);
+
+/**
+ * @brief Grows a region by halo pixels on every side, clipped to the image.
+ *
+ * @param roi Region inside the image.
+ * @param halo Number of pixels to add on each side.
+ * @param width Image width in pixels.
+ * @param height Image height in pixels.
+ * @return Roi The enlarged region.
+ * @throws std::invalid_argument If the region is empty or not inside the
+ * image.
+ */
+Roi expand_roi(const Roi &roi, unsigned int halo, unsigned int width,
+               unsigned int height);
+
+/**
+ * @brief Returns a view of a rectangle of an interleaved image.
+ *
+ * @param bytes Image buffer (channels bytes per pixel).
+ * @param width Image width in pixels.
+ * @param height Image height in pixels.
+ * @param channels Number of interleaved channels per pixel.
+ * @param roi Rectangle to view.
+ * @return Const_Image_View View sharing the image buffer.
+ * @throws std::invalid_argument If the buffer size does not match the
+ * dimensions or the region is empty or not inside the image.
+ */
+Const_Image_View crop_view(const std::vector<unsigned char> &bytes,
+                           unsigned int width, unsigned int height,
+                           unsigned int channels, const Roi &roi);
+
+/**
+ * @brief Mutable overload of crop_view.
+ */
+Image_View crop_view(std::vector<unsigned char> &bytes, unsigned int width,
+                     unsigned int height, unsigned int channels,
+                     const Roi &roi);
+
+/**
+ * @brief Copies the pixels of a view into a tightly packed buffer.
+ *
+ * @param view View to read.
+ * @return std::vector<unsigned char> width * height * channels bytes.
+ */
+std::vector<unsigned char> copy_view(const Const_Image_View &view);
+
+/**
+ * @brief Writes a tightly packed buffer into a view.
+ *
+ * A single channel source is replicated into every channel of the view, so
+ * greyscale results can be pasted back into colour images.
+ *
+ * @param bytes Source buffer of view.width * view.height pixels.
+ * @param channels Channels per source pixel: 1 or view.channels.
+ * @param view View to overwrite.
+ * @throws std::invalid_argument If the source does not fit the view.
+ */
+void paste_view(const std::vector<unsigned char> &bytes, unsigned int channels,
+                const Image_View &view);
+
+#endif
+
+#ifdef ROI_IMPLEMENTATION
+
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+Roi parse_roi(const std::string &spec) {
+  std::istringstream stream(spec);
+  unsigned long values[4];
+  for (int i = 0; i < 4; ++i) {
+    std::string field;
+    if (!std::getline(stream, field, ',') || field.empty() ||
+        field.find_first_not_of("0123456789") != std::string::npos)
+      throw std::invalid_argument("Regions must be given as x,y,w,h");
+    values[i] = std::stoul(field);
+  }
+  if (!stream.eof())
+    throw std::invalid_argument("Regions must be given as x,y,w,h");
+  if (values[2] == 0 || values[3] == 0)
+    throw std::invalid_argument("Regions must be non-empty");
+  return {static_cast<unsigned int>(values[0]),
+          static_cast<unsigned int>(values[1]),
+          static_cast<unsigned int>(values[2]),
+          static_cast<unsigned int>(values[3])};
+}
+
+static void check_roi_bounds(unsigned int width, unsigned int height,
+                             const Roi &roi) {
+  if (roi.width == 0 || roi.height == 0)
+    throw std::invalid_argument("Regions must be non-empty");
+  if (roi.x >= width || roi.width > width - roi.x || roi.y >= height ||
+      roi.height > height - roi.y)
+    throw std::invalid_argument("Region lies outside the image");
+}
+
+Roi expand_roi(const Roi &roi, unsigned int halo, unsigned int width,
+               unsigned int height) {
+  check_roi_bounds(width, height, roi);
+  const unsigned int x0 = roi.x - std::min(roi.x, halo);
+  const unsigned int y0 = roi.y - std::min(roi.y, halo);
+  const unsigned int x1 =
+      roi.x + roi.width + std::min(width - roi.x - roi.width, halo);
+  const unsigned int y1 =
+      roi.y + roi.height + std::min(height - roi.y - roi.height, halo);
+  return {x0, y0, x1 - x0, y1 - y0};
+}
+
+static void check_roi(std::size_t size, unsigned int width,
+                      unsigned int height, unsigned int channels,
+                      const Roi &roi) {
+  if (size != static_cast<std::size_t>(width) * height * channels)
+    throw std::invalid_argument("Buffer size does not match image dimensions");
+  check_roi_bounds(width, height, roi);
+}
+
+Const_Image_View crop_view(const std::vector<unsigned char> &bytes,
+                           unsigned int width, unsigned int height,
+                           unsigned int channels, const Roi &roi) {
+  check_roi(bytes.size(), width, height, channels, roi);
+  const std::size_t stride = static_cast<std::size_t>(width) * channels;
+  return {bytes.data() + roi.y * stride + roi.x * channels, roi.width,
+          roi.height, channels, stride};
+}
+
+Image_View crop_view(std::vector<unsigned char> &bytes, unsigned int width,
+                     unsigned int height, unsigned int channels,
+                     const Roi &roi) {
+  check_roi(bytes.size(), width, height, channels, roi);
+  const std::size_t stride = static_cast<std::size_t>(width) * channels;
+  return {bytes.data() + roi.y * stride + roi.x * channels, roi.width,
+          roi.height, channels, stride};
+}
+
+std::vector<unsigned char> copy_view(const Const_Image_View &view) {
+  const std::size_t row_bytes =
+      static_cast<std::size_t>(view.width) * view.channels;
+  std::vector<unsigned char> output(row_bytes * view.height);
+  default_thread_pool().parallel_for(
+      0, view.height, [&](std::size_t first, std::size_t last) {
+        for (std::size_t y = first; y < last; ++y)
+          std::memcpy(output.data() + y * row_bytes,
+                      view.row(static_cast<unsigned int>(y)), row_bytes);
+      });
+  return output;
+}
+
+void paste_view(const std::vector<unsigned char> &bytes, unsigned int channels,
+                const Image_View &view) {
+  if (channels != 1 && channels != view.channels)
+    throw std::invalid_argument("Cannot paste between channel layouts");
+  const std::size_t row_bytes = static_cast<std::size_t>(view.width) * channels;
+  if (bytes.size() != row_bytes * view.height)
+    throw std::invalid_argument("Buffer size does not match the view");
+
+  default_thread_pool().parallel_for(
+      0, view.height, [&](std::size_t first, std::size_t last) {
+        for (std::size_t y = first; y < last; ++y) {
+          const unsigned char *src = bytes.data() + y * row_bytes;
+          unsigned char *dst = view.row(static_cast<unsigned int>(y));
+          if (channels == view.channels) {
+            std::memcpy(dst, src, row_bytes);
+            continue;
+          }
+          for (unsigned int x = 0; x < view.width; ++x)
+            std::memset(dst + x * view.channels, src[x], view.channels);
+        }
+      });
+}
+
+#endif
@@ -0,0 +1,483 @@
+#ifndef SYNTHETIC_HPP_
+#define SYNTHETIC_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Kinds of synthetic image content.
+ *
+ * NOISE is uniform white noise, GRADIENT smooth ramps, PHOTO soft shading
+ * with objects and a little sensor noise, UI flat panels with hard edges and
+ * TEXT rows of glyphs on a page. They span the range from incompressible to
+ * highly repetitive data, which stresses filters and codecs differently.
+ */
+enum class Synthetic_Content {
+  NOISE,
+  GRADIENT,
+  PHOTO,
+  UI,
+  TEXT,
+};
+
+/**
+ * @brief Parses a content name ("noise", "gradient", "photo", "ui", "text").
+ *
+ * @throws std::invalid_argument If the name is not a known content kind.
+ */
+Synthetic_Content synthetic_content_from_string(const std::string &name);
+
+/**
+ * @brief Returns the name of a content kind.
+ */
+std::string synthetic_content_name(Synthetic_Content content);
+
+/**
+ * @brief Generates a deterministic synthetic image in lodepng's raw layout.
+ *
+ * Every sample is a function of its coordinates and the seed only, so the
+ * same arguments give the same bytes on every machine and thread count. Grey
+ * layouts hold the luma of the RGB content. Samples of 16 bits are stored big
+ * endian; 1, 2 and 4-bit samples are packed MSB first with no padding between
+ * rows.
+ *
+ * @param content Kind of content.
+ * @param width Image width in pixels.
+ * @param height Image height in pixels.
+ * @param channels 1 (grey), 2 (grey and alpha), 3 (RGB) or 4 (RGBA).
+ * @param bit_depth 8 or 16, or 1, 2 or 4 for one channel.
+ * @param seed Varies the layout of objects, panels and glyphs.
+ * @return std::vector<unsigned char> The image.
+ * @throws std::invalid_argument If the dimensions are zero or the channel
+ * count and bit depth are not a PNG layout.
+ */
+std::vector<unsigned char>
+generate_synthetic_image(Synthetic_Content content, unsigned int width,
+                         unsigned int height, unsigned int channels = 3,
+                         unsigned int bit_depth = 8, std::uint32_t seed = 1);
+
+/**
+ * @brief Writes the reference corpus of synthetic PNGs into a directory.
+ *
+ * The corpus holds every content kind at square sizes from 64 up to max_size
+ * in powers of four, photos of odd sizes and 1xN and Nx1 strips, every PNG
+ * channel layout and bit depth of a photo, and photos and UI screenshots
+ * written with several filter strategies, compression levels and Adam7
+ * interlacing. A MANIFEST file lists each image with its parameters
+ * and an FNV-1a hash of its raw pixels, so regressions can check decodes.
+ *
+ * @param directory Directory to write to; created if missing.
+ * @param max_size Largest square side to generate, at most 16384.
+ * @param log Receives one line per image written.
+ * @return std::size_t Number of images written.
+ * @throws std::invalid_argument If max_size is below 64 or above 16384.
+ * @throws std::runtime_error If an image cannot be encoded or written.
+ */
+std::size_t write_corpus(const std::filesystem::path &directory,
+                         unsigned int max_size, std::ostream &log);
+
+#endif
+
+#ifdef SYNTHETIC_IMPLEMENTATION
+
+#include "lodepng.h"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <fstream>
+#include <stdexcept>
+
+Synthetic_Content synthetic_content_from_string(const std::string &name) {
+  if (name == "noise")
+    return Synthetic_Content::NOISE;
+  if (name == "gradient")
+    return Synthetic_Content::GRADIENT;
+  if (name == "photo")
+    return Synthetic_Content::PHOTO;
+  if (name == "ui")
+    return Synthetic_Content::UI;
+  if (name == "text")
+    return Synthetic_Content::TEXT;
+  throw std::invalid_argument("Invalid synthetic content");
+}
+
+std::string synthetic_content_name(Synthetic_Content content) {
+  switch (content) {
+  case Synthetic_Content::NOISE:
+    return "noise";
+  case Synthetic_Content::GRADIENT:
+    return "gradient";
+  case Synthetic_Content::PHOTO:
+    return "photo";
+  case Synthetic_Content::UI:
+    return "ui";
+  case Synthetic_Content::TEXT:
+    return "text";
+  }
+  return "";
+}
+
+/* Integer hash with good avalanche (lowbias32), chained over the inputs. */
+static std::uint32_t synthetic_mix(std::uint32_t v) {
+  v ^= v >> 16;
+  v *= 0x7FEB352Du;
+  v ^= v >> 15;
+  v *= 0x846CA68Bu;
+  v ^= v >> 16;
+  return v;
+}
+
+static std::uint32_t synthetic_hash(std::uint32_t seed, std::uint32_t a,
+                                    std::uint32_t b = 0, std::uint32_t c = 0) {
+  return synthetic_mix(synthetic_mix(synthetic_mix(seed ^ a) ^ b) ^ c);
+}
+
+/* Uniform in [0, 1). */
+static double synthetic_unit(std::uint32_t hash) {
+  return hash / 4294967296.0;
+}
+
+using Synthetic_Pixel = std::array<double, 4>;
+
+static Synthetic_Pixel synthetic_noise(unsigned int x, unsigned int y,
+                                       std::uint32_t seed) {
+  Synthetic_Pixel p;
+  for (std::uint32_t c = 0; c < 4; ++c)
+    p[c] = synthetic_unit(synthetic_hash(seed, x, y, c));
+  return p;
+}
+
+static Synthetic_Pixel synthetic_gradient(double u, double v) {
+  const double r = std::hypot(u - 0.5, v - 0.5) * std::sqrt(2.0);
+  return {u, v, 1 - (u + v) / 2, 1 - r};
+}
+
+/* Scene parameters shared by all pixels of a photo. */
+struct Synthetic_Scene {
+  struct Object {
+    double cx, cy, rx, ry;
+    std::array<double, 3> colour;
+  };
+  std::array<Object, 6> objects;
+  std::array<double, 3> phase;
+};
+
+static Synthetic_Scene synthetic_scene(std::uint32_t seed) {
+  Synthetic_Scene scene;
+  std::uint32_t n = 0;
+  auto next = [&] {
+    return synthetic_unit(synthetic_hash(seed, 0xC0FFEEu, n++));
+  };
+  for (auto &object : scene.objects) {
+    object.cx = next();
+    object.cy = 0.3 + 0.6 * next();
+    object.rx = 0.05 + 0.15 * next();
+    object.ry = 0.05 + 0.15 * next();
+    for (double &channel : object.colour)
+      channel = 0.15 + 0.7 * next();
+  }
+  for (double &phase : scene.phase)
+    phase = 6.283 * next();
+  return scene;
+}
+
+static Synthetic_Pixel synthetic_photo(const Synthetic_Scene &scene, double u,
+                                       double v, unsigned int x, unsigned int y,
+                                       std::uint32_t seed) {
+  /* Sky fading into ground, with soft large-scale lighting. */
+  Synthetic_Pixel p;
+  const double horizon = v < 0.45 ? 0.0 : 1.0;
+  const std::array<double, 3> sky{0.55, 0.7, 0.9}, ground{0.45, 0.4, 0.3};
+  for (std::size_t c = 0; c < 3; ++c)
+    p[c] = (horizon ? ground[c] : sky[c] - 0.25 * v) +
+           0.08 * std::sin(5 * u + scene.phase[c]) * std::cos(4 * v);
+
+  /* Later objects occlude earlier ones; their shading darkens to the rim. */
+  for (const auto &object : scene.objects) {
+    const double dx = (u - object.cx) / object.rx;
+    const double dy = (v - object.cy) / object.ry;
+    const double d = dx * dx + dy * dy;
+    if (d < 1)
+      for (std::size_t c = 0; c < 3; ++c)
+        p[c] = object.colour[c] * (1 - 0.35 * d);
+  }
+
+  /* Sensor noise of about one 8-bit step. */
+  for (std::uint32_t c = 0; c < 3; ++c)
+    p[c] += (synthetic_unit(synthetic_hash(seed, x, y, c)) - 0.5) / 128;
+  p[3] = 1;
+  return p;
+}
+
+/* Toolbar, sidebar and a grid of cards with headers, borders and lines of
+ * placeholder text, laid out in pixels like a real screenshot. */
+static Synthetic_Pixel synthetic_ui(unsigned int x, unsigned int y,
+                                    std::uint32_t seed) {
+  constexpr unsigned int toolbar = 40, sidebar = 200;
+  constexpr unsigned int card_w = 240, card_h = 160, gap = 16;
+  static constexpr std::array<std::array<double, 3>, 4> palette{
+      {{0.2, 0.45, 0.8}, {0.85, 0.3, 0.3}, {0.3, 0.65, 0.4}, {0.9, 0.7, 0.2}}};
+
+  if (y < toolbar)
+    return {0.16, 0.17, 0.2, 1};
+  if (x < sidebar)
+    return (y - toolbar) % 32 < 28 ? Synthetic_Pixel{0.93, 0.93, 0.95, 1}
+                                   : Synthetic_Pixel{0.85, 0.85, 0.88, 1};
+
+  const unsigned int cx = (x - sidebar) % (card_w + gap);
+  const unsigned int cy = (y - toolbar) % (card_h + gap);
+  if (cx < gap || cy < gap)
+    return {0.97, 0.97, 0.97, 1};
+  const unsigned int px = cx - gap, py = cy - gap;
+  if (px == 0 || py == 0 || px == card_w - gap - 1 || py == card_h - gap - 1)
+    return {0.8, 0.8, 0.82, 1};
+
+  const unsigned int card = synthetic_hash(seed, (x - sidebar) / (card_w + gap),
+                                           (y - toolbar) / (card_h + gap));
+  if (py < 32) {
+    const auto &colour = palette[card % palette.size()];
+    return {colour[0], colour[1], colour[2], 1};
+  }
+  /* Lines of placeholder text of varying length. */
+  const unsigned int line = (py - 32) / 16;
+  const unsigned int length = 60 + synthetic_hash(card, line) % 140;
+  if ((py - 32) % 16 >= 6 && (py - 32) % 16 < 12 && px >= 12 &&
+      px < 12 + length && px < card_w - gap - 12)
+    return {0.55, 0.55, 0.58, 1};
+  return {1, 1, 1, 1};
+}
+
+/* Dark 5x7 glyphs drawn at twice their size on a page, in words of 2 to 9
+ * characters from an alphabet of 40, so repeated glyphs compress like text. */
+static Synthetic_Pixel synthetic_text(unsigned int x, unsigned int y,
+                                      unsigned int width, std::uint32_t seed) {
+  constexpr unsigned int scale = 2, cell_w = 6 * scale, cell_h = 10 * scale;
+  const unsigned int margin = std::max(8u, width / 20);
+  const Synthetic_Pixel paper{0.98, 0.97, 0.94, 1};
+  if (x < margin || x >= width - std::min(width, margin) || y < margin)
+    return paper;
+
+  const unsigned int column = (x - margin) / cell_w;
+  const unsigned int row = (y - margin) / cell_h;
+  const unsigned int gx = (x - margin) % cell_w / scale;
+  const unsigned int gy = (y - margin) % cell_h / scale;
+  if (gx >= 5 || gy >= 7)
+    return paper;
+
+  /* Word breaks where the hash of the column says so. */
+  const std::uint32_t slot = synthetic_hash(seed, row, column);
+  if (slot % 7 == 0)
+    return paper;
+  const std::uint64_t glyph =
+      std::uint64_t{synthetic_hash(seed, 0x6C7970u, slot % 40)} << 32 |
+      synthetic_hash(seed, 0x6C7971u, slot % 40);
+  if (glyph >> (gy * 5 + gx) & 1)
+    return {0.1, 0.1, 0.12, 1};
+  return paper;
+}
+
+std::vector<unsigned char>
+generate_synthetic_image(Synthetic_Content content, unsigned int width,
+                         unsigned int height, unsigned int channels,
+                         unsigned int bit_depth, std::uint32_t seed) {
+  if (width == 0 || height == 0)
+    throw std::invalid_argument("Image dimensions must be non-zero");
+  if (channels < 1 || channels > 4)
+    throw std::invalid_argument("Synthetic images have 1 to 4 channels");
+  if (bit_depth != 8 && bit_depth != 16 &&
+      !(channels == 1 && (bit_depth == 1 || bit_depth == 2 || bit_depth == 4)))
+    throw std::invalid_argument("Bit depths below 8 need one channel; others "
+                                "must be 8 or 16");
+
+  const Synthetic_Scene scene = synthetic_scene(seed);
+  const unsigned int max_value = (1u << bit_depth) - 1;
+  const std::size_t row_samples = static_cast<std::size_t>(width) * channels;
+  const std::size_t bytes_per_sample = bit_depth == 16 ? 2 : 1;
+
+  /* Sub-byte rows share bytes, so they are quantized first and packed after
+   * the parallel part. */
+  const std::size_t row_bytes =
+      bit_depth < 8 ? row_samples : row_samples * bytes_per_sample;
+  std::vector<unsigned char> output(row_bytes * height);
+  default_thread_pool().parallel_for(
+      0, height, [&](std::size_t first, std::size_t last) {
+        for (std::size_t y = first; y < last; ++y) {
+          unsigned char *row = output.data() + y * row_bytes;
+          for (unsigned int x = 0; x < width; ++x) {
+            const double u = (x + 0.5) / width;
+            const double v = (static_cast<double>(y) + 0.5) / height;
+            const auto yy = static_cast<unsigned int>(y);
+            Synthetic_Pixel p{};
+            switch (content) {
+            case Synthetic_Content::NOISE:
+              p = synthetic_noise(x, yy, seed);
+              break;
+            case Synthetic_Content::GRADIENT:
+              p = synthetic_gradient(u, v);
+              break;
+            case Synthetic_Content::PHOTO:
+              p = synthetic_photo(scene, u, v, x, yy, seed);
+              break;
+            case Synthetic_Content::UI:
+              p = synthetic_ui(x, yy, seed);
+              break;
+            case Synthetic_Content::TEXT:
+              p = synthetic_text(x, yy, width, seed);
+              break;
+            }
+
+            /* Grey layouts take the luma and keep alpha last. */
+            std::array<double, 4> samples{p[0], p[1], p[2], p[3]};
+            if (channels <= 2) {
+              samples[0] = 0.299 * p[0] + 0.587 * p[1] + 0.114 * p[2];
+              samples[1] = p[3];
+            }
+            for (unsigned int c = 0; c < channels; ++c) {
+              const auto value = static_cast<unsigned int>(
+                  std::clamp(samples[c], 0.0, 1.0) * max_value + 0.5);
+              const std::size_t i = static_cast<std::size_t>(x) * channels + c;
+              if (bit_depth == 16) {
+                row[2 * i] = static_cast<unsigned char>(value >> 8);
+                row[2 * i + 1] = static_cast<unsigned char>(value);
+              } else {
+                row[i] = static_cast<unsigned char>(value);
+              }
+            }
+          }
+        }
+      });
+
+  if (bit_depth < 8) {
+    std::vector<unsigned char> packed((output.size() * bit_depth + 7) / 8);
+    for (std::size_t i = 0; i < output.size(); ++i) {
+      const std::size_t bit = i * bit_depth;
+      packed[bit / 8] |= static_cast<unsigned char>(
+          output[i] << (8 - bit_depth - bit % 8));
+    }
+    return packed;
+  }
+  return output;
+}
+
+/* 64-bit FNV-1a, for the manifest. */
+static std::uint64_t corpus_hash(const std::vector<unsigned char> &bytes) {
+  std::uint64_t hash = 0xCBF29CE484222325ull;
+  for (unsigned char byte : bytes)
+    hash = (hash ^ byte) * 0x100000001B3ull;
+  return hash;
+}
+
+/* Encoder settings a corpus image is written with. */
+struct Corpus_Encoding {
+  const char *name;
+  LodePNGFilterStrategy filter;
+  unsigned int btype;
+  unsigned int window_size;
+  unsigned int interlace;
+};
+
+static constexpr Corpus_Encoding corpus_encodings[] = {
+    {"default", LFS_MINSUM, 2, 2048, 0},
+    {"stored", LFS_ZERO, 0, 2048, 0},
+    {"fast", LFS_ZERO, 1, 512, 0},
+    {"best", LFS_ENTROPY, 2, 32768, 0},
+    {"adam7", LFS_MINSUM, 2, 2048, 1},
+};
+
+std::size_t write_corpus(const std::filesystem::path &directory,
+                         unsigned int max_size, std::ostream &log) {
+  if (max_size < 64 || max_size > 16384)
+    throw std::invalid_argument("Corpus sizes must be in [64, 16384]");
+  std::filesystem::create_directories(directory);
+  std::ofstream manifest(directory / "MANIFEST");
+  if (!manifest)
+    throw std::runtime_error("Unable to write the corpus manifest");
+  manifest << "# name content width height channels bit-depth encoding seed "
+              "fnv1a64\n";
+
+  std::size_t written = 0;
+  auto write = [&](Synthetic_Content content, unsigned int width,
+                   unsigned int height, unsigned int channels,
+                   unsigned int bit_depth, const Corpus_Encoding &encoding) {
+    static constexpr const char *layouts[] = {"", "grey", "ga", "rgb", "rgba"};
+    static constexpr LodePNGColorType colours[] = {
+        LCT_GREY, LCT_GREY, LCT_GREY_ALPHA, LCT_RGB, LCT_RGBA};
+    const std::uint32_t seed = synthetic_hash(width, height, channels);
+    const std::string name =
+        synthetic_content_name(content) + "-" + std::to_string(width) + "x" +
+        std::to_string(height) + "-" + layouts[channels] +
+        std::to_string(bit_depth) + "-" + encoding.name + ".png";
+    const std::vector<unsigned char> image = generate_synthetic_image(
+        content, width, height, channels, bit_depth, seed);
+
+    lodepng::State state;
+    state.info_raw.colortype = colours[channels];
+    state.info_raw.bitdepth = bit_depth;
+    state.info_png.color.colortype = colours[channels];
+    state.info_png.color.bitdepth = bit_depth;
+    state.info_png.interlace_method = encoding.interlace;
+    state.encoder.auto_convert = 0;
+    state.encoder.filter_strategy = encoding.filter;
+    state.encoder.zlibsettings.btype = encoding.btype;
+    state.encoder.zlibsettings.windowsize = encoding.window_size;
+    std::vector<unsigned char> png;
+    if (auto error = lodepng::encode(png, image, width, height, state))
+      throw std::runtime_error("Error encoding " + name + ": " +
+                               lodepng_error_text(error));
+    if (auto error = lodepng::save_file(png, (directory / name).string()))
+      throw std::runtime_error("Error writing " + name + ": " +
+                               lodepng_error_text(error));
+
+    manifest << name << ' ' << synthetic_content_name(content) << ' ' << width
+             << ' ' << height << ' ' << channels << ' ' << bit_depth << ' '
+             << encoding.name << ' ' << seed << ' ' << std::hex
+             << corpus_hash(image) << std::dec << '\n';
+    log << name << '\n';
+    ++written;
+  };
+
+  const Corpus_Encoding &standard = corpus_encodings[0];
+  constexpr Synthetic_Content contents[] = {
+      Synthetic_Content::NOISE, Synthetic_Content::GRADIENT,
+      Synthetic_Content::PHOTO, Synthetic_Content::UI, Synthetic_Content::TEXT};
+
+  /* Every content at every size, as 8-bit RGB. */
+  for (unsigned int size = 64; size <= max_size; size *= 4)
+    for (Synthetic_Content content : contents)
+      write(content, size, size, 3, 8, standard);
+
+  /* Odd sizes for the scalar tails of vector loops, and 1xN / Nx1 strips. */
+  for (auto [width, height] : {std::pair{67u, 61u}, std::pair{1023u, 769u},
+                               std::pair{1u, 257u}, std::pair{257u, 1u}})
+    write(Synthetic_Content::PHOTO, width, height, 3, 8, standard);
+
+  /* Every PNG layout and bit depth. */
+  const unsigned int layout_size = std::min(max_size, 1024u);
+  for (auto [channels, bit_depth] :
+       {std::pair{1u, 1u}, std::pair{1u, 2u}, std::pair{1u, 4u},
+        std::pair{1u, 8u}, std::pair{1u, 16u}, std::pair{2u, 8u},
+        std::pair{2u, 16u}, std::pair{3u, 16u}, std::pair{4u, 8u},
+        std::pair{4u, 16u}})
+    write(Synthetic_Content::PHOTO, layout_size, layout_size, channels,
+          bit_depth, standard);
+  write(Synthetic_Content::TEXT, layout_size, layout_size, 1, 1, standard);
+
+  /* Filter strategies, compression levels and interlacing. */
+  for (const Corpus_Encoding &encoding : corpus_encodings)
+    if (&encoding != &standard)
+      for (Synthetic_Content content :
+           {Synthetic_Content::PHOTO, Synthetic_Content::UI})
+        write(content, layout_size, layout_size, 3, 8, encoding);
+
+  if (!manifest.flush())
+    throw std::runtime_error("Unable to write the corpus manifest");
+  return written;
+}
+
+#endif
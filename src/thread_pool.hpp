@@ -0,0 +1,381 @@
+#ifndef THREAD_POOL_HPP_
+#define THREAD_POOL_HPP_
+
+#include "priority.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Fixed-size pool of worker threads used to split filters into bands.
+ *
+ * Threads blocked in run() keep executing queued tasks while they wait, so
+ * filters may be nested inside pool tasks without deadlocking the pool.
+ *
+ * The tasks of run() are queued in one lane per priority class and picked by
+ * a Priority_Lanes policy, so a task of an interactive job starts before the
+ * waiting tasks of bulk jobs, at the next task boundary of a running one.
+ */
+class Thread_Pool {
+public:
+  /**
+   * @brief Starts the worker threads.
+   *
+   * @param threads Total number of threads taking part in run(), including
+   * the calling thread. A value of 0 or 1 runs everything inline.
+   */
+  explicit Thread_Pool(unsigned int threads);
+  ~Thread_Pool();
+
+  Thread_Pool(const Thread_Pool &) = delete;
+  Thread_Pool &operator=(const Thread_Pool &) = delete;
+
+  /**
+   * @brief Number of threads that work is split across.
+   *
+   * This is the thread count given to the constructor unless
+   * set_parallelism() lowered it.
+   */
+  unsigned int size() const;
+
+  /**
+   * @brief Caps the number of threads that work is split across.
+   *
+   * Filters on small images can lose more to synchronisation than they gain
+   * from extra threads; lowering the cap makes parallel_for and the other
+   * callers of size() split into fewer bands. Workers stay alive.
+   *
+   * @param threads Maximum thread count, or 0 to use every thread again.
+   */
+  void set_parallelism(unsigned int threads);
+
+  /**
+   * @brief Sets the bulk share and the thread limits of each priority class
+   * for the tasks of run().
+   *
+   * May be called while tasks run: those already started count against the
+   * new limits of their class.
+   *
+   * @param policy The policy; the default serves interactive tasks first with
+   * a tenth of the picks for bulk, and no limits.
+   */
+  void set_priority_policy(const Priority_Policy &policy);
+
+  /**
+   * @brief The policy given to set_priority_policy().
+   */
+  Priority_Policy priority_policy() const;
+
+  /**
+   * @brief Queues a task without waiting for it.
+   *
+   * Submitted tasks have no priority class and start before every task of
+   * run(); they suit loops that schedule work of their own.
+   *
+   * @param task Task to run on a worker thread.
+   */
+  void submit(std::function<void()> task);
+
+  /**
+   * @brief Runs task(i) for every i in [0, count) and waits for completion.
+   *
+   * The calling thread runs task(0) and then helps with queued work of its own
+   * priority class or a more urgent one. Tasks are queued in, and run under,
+   * the caller's current_priority(). The first exception thrown by any task
+   * is rethrown once all tasks have finished.
+   * Tasks run under the caller's current_deadline(); once it expires the
+   * tasks not yet started throw Deadline_Exceeded instead.
+   *
+   * @param count Number of tasks.
+   * @param task Task body, receives the task index.
+   */
+  void run(std::size_t count, const std::function<void(std::size_t)> &task);
+
+  /**
+   * @brief Splits [begin, end) into one contiguous band per thread.
+   *
+   * Under a limited current_deadline() each band is run as several smaller
+   * ones with a deadline check before each, so a filter stops within a
+   * fraction of a band once the deadline expires.
+   *
+   * @param begin First index.
+   * @param end One past the last index.
+   * @param body Band body, receives the band [first, last).
+   */
+  void parallel_for(std::size_t begin, std::size_t end,
+                    const std::function<void(std::size_t, std::size_t)> &body);
+
+  /**
+   * @brief Pops and runs one queued task on the calling thread, choosing
+   * between the priority classes as a worker would.
+   *
+   * @return bool True if a task was run.
+   */
+  bool run_pending_task();
+
+private:
+  void worker_loop(unsigned int index);
+
+  /* Pops the next task, submitted ones first; lane is set to its priority
+   * class or -1. A thread waiting for a run of class own only takes tasks of
+   * that class, even over its limit, or of a more urgent one; idle threads
+   * pass -1. Called with mutex_ held. */
+  bool take_task(std::function<void()> &task, int &lane, int own);
+
+  /* Runs a task taken by take_task under its priority class. */
+  void run_task(std::function<void()> &task, int lane);
+
+  /* Takes and runs one task for a thread waiting for a run of class own. */
+  bool help(int own);
+
+  std::vector<std::thread> workers_;
+  std::deque<std::function<void()>> tasks_;
+  std::deque<std::function<void()>> lanes_[priority_count];
+  Priority_Policy policy_;
+  Priority_Lanes scheduler_;
+  mutable std::mutex mutex_;
+  std::condition_variable available_;
+  bool stopping_ = false;
+  std::atomic<unsigned int> parallelism_{0};
+};
+
+/**
+ * @brief Returns the process-wide pool sized to the hardware concurrency.
+ */
+Thread_Pool &default_thread_pool();
+
+#endif
+
+#ifdef THREAD_POOL_IMPLEMENTATION
+
+#include "deadline.hpp"
+#include "trace.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <memory>
+#include <string>
+
+Thread_Pool::Thread_Pool(unsigned int threads) {
+  for (unsigned int i = 1; i < threads; ++i)
+    workers_.emplace_back([this, i] { worker_loop(i); });
+}
+
+Thread_Pool::~Thread_Pool() {
+  {
+    std::lock_guard lock(mutex_);
+    stopping_ = true;
+  }
+  available_.notify_all();
+  for (auto &worker : workers_)
+    worker.join();
+}
+
+unsigned int Thread_Pool::size() const {
+  const auto threads = static_cast<unsigned int>(workers_.size() + 1);
+  const unsigned int cap = parallelism_.load(std::memory_order_relaxed);
+  return cap == 0 ? threads : std::min(cap, threads);
+}
+
+void Thread_Pool::set_parallelism(unsigned int threads) {
+  parallelism_.store(threads, std::memory_order_relaxed);
+}
+
+void Thread_Pool::set_priority_policy(const Priority_Policy &policy) {
+  {
+    std::lock_guard lock(mutex_);
+    policy_ = policy;
+    scheduler_.set_policy(policy);
+  }
+  available_.notify_all();
+}
+
+Priority_Policy Thread_Pool::priority_policy() const {
+  std::lock_guard lock(mutex_);
+  return policy_;
+}
+
+void Thread_Pool::submit(std::function<void()> task) {
+  {
+    std::lock_guard lock(mutex_);
+    tasks_.push_back(std::move(task));
+  }
+  available_.notify_one();
+}
+
+bool Thread_Pool::take_task(std::function<void()> &task, int &lane,
+                            int own) {
+  if (!tasks_.empty()) {
+    task = std::move(tasks_.front());
+    tasks_.pop_front();
+    lane = -1;
+    return true;
+  }
+  bool waiting[priority_count];
+  for (int p = 0; p < priority_count; ++p)
+    waiting[p] = !lanes_[p].empty() && (own < 0 || p <= own);
+  lane = scheduler_.choose(waiting, own);
+  if (lane < 0)
+    return false;
+  task = std::move(lanes_[lane].front());
+  lanes_[lane].pop_front();
+  return true;
+}
+
+void Thread_Pool::run_task(std::function<void()> &task, int lane) {
+  if (lane < 0)
+    return task();
+  {
+    Priority_Scope scope(static_cast<Priority>(lane));
+    task();
+  }
+  bool freed;
+  {
+    std::lock_guard lock(mutex_);
+    freed = scheduler_.finish(static_cast<Priority>(lane));
+  }
+  if (freed)
+    available_.notify_one();
+}
+
+bool Thread_Pool::help(int own) {
+  std::function<void()> task;
+  int lane;
+  {
+    std::lock_guard lock(mutex_);
+    if (!take_task(task, lane, own))
+      return false;
+  }
+  run_task(task, lane);
+  return true;
+}
+
+bool Thread_Pool::run_pending_task() { return help(-1); }
+
+void Thread_Pool::worker_loop(unsigned int index) {
+  trace_thread_name("worker " + std::to_string(index));
+  for (;;) {
+    std::function<void()> task;
+    int lane;
+    {
+      std::unique_lock lock(mutex_);
+      available_.wait(lock, [&] {
+        return take_task(task, lane, -1) || stopping_;
+      });
+      if (!task)
+        return;
+    }
+    run_task(task, lane);
+  }
+}
+
+void Thread_Pool::run(std::size_t count,
+                      const std::function<void(std::size_t)> &task) {
+  if (count == 0)
+    return;
+
+  if (count == 1 || workers_.empty()) {
+    for (std::size_t i = 0; i < count; ++i) {
+      check_deadline();
+      task(i);
+    }
+    return;
+  }
+
+  struct State {
+    std::atomic<std::size_t> remaining;
+    std::mutex mutex;
+    std::condition_variable done;
+    std::exception_ptr error;
+  };
+
+  auto state = std::make_shared<State>();
+  state->remaining = count;
+  /* A copy: the caller may run other jobs' tasks, and their deadlines, while
+   * it waits. It is made current even when unlimited, so a task run by a
+   * thread waiting for another job does not inherit that job's deadline. */
+  const Deadline deadline = current_deadline();
+
+  auto execute = [state, &task, &deadline](std::size_t i) {
+    try {
+      Deadline_Scope scope(deadline);
+      check_deadline();
+      task(i);
+    } catch (...) {
+      std::lock_guard lock(state->mutex);
+      if (!state->error)
+        state->error = std::current_exception();
+    }
+    if (--state->remaining == 0) {
+      std::lock_guard lock(state->mutex);
+      state->done.notify_all();
+    }
+  };
+
+  const auto own = static_cast<int>(current_priority());
+  {
+    std::lock_guard lock(mutex_);
+    for (std::size_t i = 1; i < count; ++i)
+      lanes_[own].push_back([execute, i] { execute(i); });
+  }
+  if (count == 2)
+    available_.notify_one();
+  else
+    available_.notify_all();
+
+  execute(0);
+
+  /* Time spent here beyond the nested task spans is load imbalance. */
+  Trace_Span wait("pool", "wait");
+  while (state->remaining > 0) {
+    if (help(own))
+      continue;
+    std::unique_lock lock(state->mutex);
+    state->done.wait_for(lock, std::chrono::milliseconds(1),
+                         [&] { return state->remaining == 0; });
+  }
+
+  if (state->error)
+    std::rethrow_exception(state->error);
+}
+
+void Thread_Pool::parallel_for(
+    std::size_t begin, std::size_t end,
+    const std::function<void(std::size_t, std::size_t)> &body) {
+  if (begin >= end)
+    return;
+
+  const std::size_t total = end - begin;
+  const std::size_t bands = std::min<std::size_t>(size(), total);
+
+  /* Sub-bands per band when the deadline is checked inside bands. */
+  const std::size_t checks = current_deadline().limited() ? 8 : 1;
+
+  run(bands, [&](std::size_t band) {
+    const std::size_t first = begin + total * band / bands;
+    const std::size_t last = begin + total * (band + 1) / bands;
+    Trace_Span span("pool", "band", static_cast<std::int64_t>(first),
+                    static_cast<std::int64_t>(last));
+    const std::size_t parts = std::min(checks, last - first);
+    for (std::size_t part = 0; part < parts; ++part) {
+      if (part != 0)
+        check_deadline();
+      body(first + (last - first) * part / parts,
+           first + (last - first) * (part + 1) / parts);
+    }
+  });
+}
+
+Thread_Pool &default_thread_pool() {
+  static Thread_Pool pool(std::max(1u, std::thread::hardware_concurrency()));
+  return pool;
+}
+
+#endif
@@ -0,0 +1,386 @@
+#ifndef THRESHOLD_HPP_
+#define THRESHOLD_HPP_
+
+#include "histogram.hpp"
+
+#include <string>
+#include <vector>
+
+/**
+ * @brief Binarization methods supported by apply_threshold.
+ */
+enum class Threshold_Method {
+  FIXED,
+  OTSU,
+  ADAPTIVE_MEAN,
+  ADAPTIVE_GAUSSIAN,
+  SAUVOLA,
+};
+
+/**
+ * @brief Parameters of the thresholding methods; each method reads only the
+ * fields it needs.
+ *
+ * level is the global threshold of FIXED. window is the side of the square
+ * neighbourhood of the adaptive methods and offset the constant subtracted
+ * from the local mean (ADAPTIVE_MEAN) or Gaussian-weighted mean
+ * (ADAPTIVE_GAUSSIAN). SAUVOLA uses m * (1 + k * (s / range - 1)) with local
+ * mean m and standard deviation s.
+ */
+struct Threshold_Params {
+  unsigned int level = 128;
+  unsigned int window = 25;
+  double offset = 5.0;
+  double k = 0.34;
+  double range = 128.0;
+};
+
+/**
+ * @brief Parses a threshold method name ("fixed", "otsu", "adaptive-mean",
+ * "adaptive-gaussian", "sauvola").
+ *
+ * @param name Method name as passed on the command line.
+ * @return Threshold_Method The matching method.
+ * @throws std::invalid_argument If the name is not a known method.
+ */
+Threshold_Method threshold_method_from_string(const std::string &name);
+
+/**
+ * @brief Finds the Otsu threshold of a histogram.
+ *
+ * @param histogram Histogram of the plane to binarize.
+ * @return unsigned int The level t maximizing the between-class variance of
+ * [0, t] and (t, 255]; 0 for empty or constant histograms.
+ */
+unsigned int otsu_threshold(const Histogram &histogram);
+
+/**
+ * @brief Binarizes a single-channel image.
+ *
+ * Pixels above the threshold become 255 and all others 0. FIXED and OTSU use
+ * one global level, OTSU taking it from a compute_histogram pass. The
+ * adaptive methods derive a per-pixel threshold from the window around each
+ * pixel, clipped at the edges. ADAPTIVE_MEAN and SAUVOLA read summed-area
+ * tables whose row differences are taken four pixels at a time with SSE, in
+ * time independent of the window size. ADAPTIVE_GAUSSIAN runs the separable
+ * Gaussian engine with sigma = window / 6, whose taps grow with the window.
+ * Final comparisons run 16 pixels at a time.
+ *
+ * @param grey Input buffer (1 byte per pixel).
+ * @param width Image width in pixels.
+ * @param height Image height in pixels.
+ * @param method Thresholding method.
+ * @param params Method parameters.
+ * @return std::vector<unsigned char> Binary output of 0 and 255 (same size as
+ * input).
+ * @throws std::invalid_argument If the buffer size does not match the
+ * dimensions, the window is empty, or a SAUVOLA window exceeds 257x257 (the
+ * limit for exact 32-bit squared sums).
+ */
+std::vector<unsigned char>
+apply_threshold(const std::vector<unsigned char> &grey, unsigned int width,
+                unsigned int height, Threshold_Method method,
+                const Threshold_Params &params = {});
+
+/**
+ * @brief Packs a binary image into 1 bit per pixel for 1-bit PNG encoding.
+ *
+ * Bits are stored most significant first with no padding between rows, the
+ * raw layout lodepng expects for 1-bit greyscale. Sixteen pixels are packed
+ * at a time with a byte reversal and _mm_movemask_epi8.
+ *
+ * @param binary Input buffer; bytes with the top bit set (e.g. 255) become 1.
+ * @return std::vector<unsigned char> Packed bits, (size + 7) / 8 bytes.
+ */
+std::vector<unsigned char> pack_bits(const std::vector<unsigned char> &binary);
+
+#endif
+
+#ifdef THRESHOLD_IMPLEMENTATION
+
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#include <xmmintrin.h>
+
+#include "convolve.hpp"
+#include "filters.hpp"
+#include "integral.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+
+Threshold_Method threshold_method_from_string(const std::string &name) {
+  if (name == "fixed")
+    return Threshold_Method::FIXED;
+  else if (name == "otsu")
+    return Threshold_Method::OTSU;
+  else if (name == "adaptive-mean")
+    return Threshold_Method::ADAPTIVE_MEAN;
+  else if (name == "adaptive-gaussian")
+    return Threshold_Method::ADAPTIVE_GAUSSIAN;
+  else if (name == "sauvola")
+    return Threshold_Method::SAUVOLA;
+  else
+    throw std::invalid_argument("Invalid threshold method");
+}
+
+unsigned int otsu_threshold(const Histogram &histogram) {
+  double total = 0.0, weighted = 0.0;
+  for (unsigned int i = 0; i < 256; ++i) {
+    total += histogram[i];
+    weighted += static_cast<double>(i) * histogram[i];
+  }
+
+  double below = 0.0, below_weighted = 0.0, best = 0.0;
+  unsigned int level = 0;
+  for (unsigned int i = 0; i < 256; ++i) {
+    below += histogram[i];
+    if (below == 0.0)
+      continue;
+    const double above = total - below;
+    if (above == 0.0)
+      break;
+    below_weighted += static_cast<double>(i) * histogram[i];
+    const double difference =
+        below_weighted / below - (weighted - below_weighted) / above;
+    const double between = below * above * difference * difference;
+    if (between > best) {
+      best = between;
+      level = i;
+    }
+  }
+  return level;
+}
+
+/* dst = src > level ? 255 : 0 for a constant level. */
+static void threshold_global(const unsigned char *src, unsigned char *dst,
+                             std::size_t count, unsigned int level) {
+  const __m128i l = _mm_set1_epi8(static_cast<char>(std::min(level, 255u)));
+  const __m128i zero = _mm_setzero_si128();
+  std::size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    const __m128i v =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+    /* v > l exactly when the saturating difference is nonzero. */
+    const __m128i le = _mm_cmpeq_epi8(_mm_subs_epu8(v, l), zero);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i),
+                     _mm_andnot_si128(le, _mm_set1_epi8(-1)));
+  }
+  for (; i < count; ++i)
+    dst[i] = src[i] > level ? 255 : 0;
+}
+
+/* dst = src > threshold ? 255 : 0 against a float threshold per pixel. */
+static void threshold_row(const unsigned char *src, const float *threshold,
+                          unsigned char *dst, int count) {
+  const __m128i zero = _mm_setzero_si128();
+  int i = 0;
+  for (; i + 16 <= count; i += 16) {
+    const __m128i v =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+    const __m128i halves[2] = {_mm_unpacklo_epi8(v, zero),
+                               _mm_unpackhi_epi8(v, zero)};
+    __m128i masks[4];
+    for (int q = 0; q < 4; ++q) {
+      const __m128i words = q % 2 ? _mm_unpackhi_epi16(halves[q / 2], zero)
+                                  : _mm_unpacklo_epi16(halves[q / 2], zero);
+      masks[q] = _mm_castps_si128(_mm_cmpgt_ps(
+          _mm_cvtepi32_ps(words), _mm_loadu_ps(threshold + i + 4 * q)));
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i),
+                     _mm_packs_epi16(_mm_packs_epi32(masks[0], masks[1]),
+                                     _mm_packs_epi32(masks[2], masks[3])));
+  }
+  for (; i < count; ++i)
+    dst[i] = static_cast<float>(src[i]) > threshold[i] ? 255 : 0;
+}
+
+/* Converts unsigned 32-bit lanes to float, including those above 2^31. */
+static __m128 u32_to_ps(__m128i v) {
+  const __m128 high = _mm_cvtepi32_ps(_mm_srli_epi32(v, 16));
+  const __m128 low =
+      _mm_cvtepi32_ps(_mm_and_si128(v, _mm_set1_epi32(0xFFFF)));
+  return _mm_add_ps(_mm_mul_ps(high, _mm_set1_ps(65536.0f)), low);
+}
+
+/* out[x] = sum of the table's plane over [x - radius, x + radius] x [y0, y1),
+ * clipped to the image. 32-bit wraparound keeps window sums exact. */
+static void window_sums_row(const Integral_Image<std::uint32_t> &table,
+                            int y0, int y1, int radius, float *out) {
+  const int w = static_cast<int>(table.width());
+  const std::uint32_t *top = table.row(static_cast<unsigned int>(y0));
+  const std::uint32_t *bottom = table.row(static_cast<unsigned int>(y1));
+  const auto sum_at = [&](int x) {
+    const int x0 = std::max(0, x - radius), x1 = std::min(w, x + radius + 1);
+    return static_cast<float>(static_cast<std::uint32_t>(
+        bottom[x1] - bottom[x0] - top[x1] + top[x0]));
+  };
+
+  const int first = std::min(radius, w);
+  const int last = std::max(first, w - radius);
+  int x = 0;
+  for (; x < first; ++x)
+    out[x] = sum_at(x);
+  for (; x + 4 <= last; x += 4) {
+    const auto load = [](const std::uint32_t *p) {
+      return _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+    };
+    const __m128i right = _mm_sub_epi32(load(bottom + x + radius + 1),
+                                        load(top + x + radius + 1));
+    const __m128i left =
+        _mm_sub_epi32(load(bottom + x - radius), load(top + x - radius));
+    _mm_storeu_ps(out + x, u32_to_ps(_mm_sub_epi32(right, left)));
+  }
+  for (; x < w; ++x)
+    out[x] = sum_at(x);
+}
+
+std::vector<unsigned char>
+apply_threshold(const std::vector<unsigned char> &grey, unsigned int width,
+                unsigned int height, Threshold_Method method,
+                const Threshold_Params &params) {
+  if (grey.size() != static_cast<std::size_t>(width) * height)
+    throw std::invalid_argument("Buffer size does not match image dimensions");
+  if (params.window == 0)
+    throw std::invalid_argument("Threshold window must not be empty");
+  if (method == Threshold_Method::SAUVOLA && params.window > 257)
+    throw std::invalid_argument("Sauvola window must be at most 257x257");
+
+  std::vector<unsigned char> output(grey.size());
+  if (grey.empty())
+    return output;
+
+  Thread_Pool &pool = default_thread_pool();
+
+  if (method == Threshold_Method::FIXED || method == Threshold_Method::OTSU) {
+    const unsigned int level =
+        method == Threshold_Method::FIXED
+            ? params.level
+            : otsu_threshold(compute_histogram(grey.data(), grey.size()));
+    pool.parallel_for(0, height, [&](std::size_t first, std::size_t last) {
+      threshold_global(grey.data() + first * width,
+                       output.data() + first * width, (last - first) * width,
+                       level);
+    });
+    return output;
+  }
+
+  const int w = static_cast<int>(width), h = static_cast<int>(height);
+  const float offset = static_cast<float>(params.offset);
+
+  if (method == Threshold_Method::ADAPTIVE_GAUSSIAN) {
+    const std::vector<double> kernel =
+        generate_gaussian_kernel(params.window / 6.0).first;
+    const std::vector<float> taps(kernel.begin(), kernel.end());
+    const std::vector<unsigned char> mean =
+        apply_separable_convolution(grey, width, height, 1, taps, taps);
+
+    pool.parallel_for(0, height, [&](std::size_t first, std::size_t last) {
+      std::vector<float> threshold(width);
+      for (std::size_t y = first; y < last; ++y) {
+        const unsigned char *m = mean.data() + y * width;
+        for (int x = 0; x < w; ++x)
+          threshold[static_cast<std::size_t>(x)] = m[x] - offset;
+        threshold_row(grey.data() + y * width, threshold.data(),
+                      output.data() + y * width, w);
+      }
+    });
+    return output;
+  }
+
+  const bool sauvola = method == Threshold_Method::SAUVOLA;
+  const int radius = static_cast<int>(params.window / 2);
+  const Integral_Image<std::uint32_t> sums(grey.data(), width, height);
+  const Integral_Image<std::uint32_t> squares =
+      sauvola ? Integral_Image<std::uint32_t>(grey.data(), width, height, 1, 0,
+                                              true)
+              : Integral_Image<std::uint32_t>(nullptr, 0, 0);
+
+  /* 1 / (clipped window width) for every column. */
+  std::vector<float> inverse_cols(width);
+  for (int x = 0; x < w; ++x)
+    inverse_cols[static_cast<std::size_t>(x)] =
+        1.0f / static_cast<float>(std::min(w, x + radius + 1) -
+                                  std::max(0, x - radius));
+
+  const __m128 k = _mm_set1_ps(static_cast<float>(params.k));
+  const float inverse_range = static_cast<float>(1.0 / params.range);
+  const __m128 one = _mm_set1_ps(1.0f);
+
+  pool.parallel_for(0, height, [&](std::size_t first, std::size_t last) {
+    std::vector<float> mean(width), square(sauvola ? width : 0);
+    for (int y = static_cast<int>(first); y < static_cast<int>(last); ++y) {
+      const int y0 = std::max(0, y - radius), y1 = std::min(h, y + radius + 1);
+      const float inverse_rows = 1.0f / static_cast<float>(y1 - y0);
+      window_sums_row(sums, y0, y1, radius, mean.data());
+      if (sauvola)
+        window_sums_row(squares, y0, y1, radius, square.data());
+
+      int x = 0;
+      for (; x + 4 <= w; x += 4) {
+        const __m128 inverse_area =
+            _mm_mul_ps(_mm_loadu_ps(inverse_cols.data() + x),
+                       _mm_set1_ps(inverse_rows));
+        const __m128 m =
+            _mm_mul_ps(_mm_loadu_ps(mean.data() + x), inverse_area);
+        __m128 t;
+        if (sauvola) {
+          const __m128 variance = _mm_sub_ps(
+              _mm_mul_ps(_mm_loadu_ps(square.data() + x), inverse_area),
+              _mm_mul_ps(m, m));
+          const __m128 s = _mm_sqrt_ps(_mm_max_ps(variance, _mm_setzero_ps()));
+          const __m128 relative =
+              _mm_sub_ps(_mm_mul_ps(s, _mm_set1_ps(inverse_range)), one);
+          t = _mm_mul_ps(m, _mm_add_ps(one, _mm_mul_ps(k, relative)));
+        } else {
+          t = _mm_sub_ps(m, _mm_set1_ps(offset));
+        }
+        _mm_storeu_ps(mean.data() + x, t);
+      }
+      for (; x < w; ++x) {
+        const std::size_t i = static_cast<std::size_t>(x);
+        const float inverse_area = inverse_cols[i] * inverse_rows;
+        const float m = mean[i] * inverse_area;
+        if (sauvola) {
+          const float s =
+              std::sqrt(std::max(square[i] * inverse_area - m * m, 0.0f));
+          mean[i] = m * (1.0f + static_cast<float>(params.k) *
+                                    (s * inverse_range - 1.0f));
+        } else {
+          mean[i] = m - offset;
+        }
+      }
+
+      const std::size_t row = static_cast<std::size_t>(y) * width;
+      threshold_row(grey.data() + row, mean.data(), output.data() + row, w);
+    }
+  });
+
+  return output;
+}
+
+std::vector<unsigned char> pack_bits(const std::vector<unsigned char> &binary) {
+  std::vector<unsigned char> packed((binary.size() + 7) / 8, 0);
+
+  /* Reverses each group of 8 bytes so movemask yields MSB-first bytes. */
+  const __m128i reverse =
+      _mm_set_epi8(8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7);
+  std::size_t i = 0;
+  for (; i + 16 <= binary.size(); i += 16) {
+    const __m128i v =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(binary.data() + i));
+    const int bits = _mm_movemask_epi8(_mm_shuffle_epi8(v, reverse));
+    packed[i / 8] = static_cast<unsigned char>(bits);
+    packed[i / 8 + 1] = static_cast<unsigned char>(bits >> 8);
+  }
+  for (; i < binary.size(); ++i)
+    if (binary[i] & 0x80)
+      packed[i / 8] |= static_cast<unsigned char>(0x80 >> (i % 8));
+
+  return packed;
+}
+
+#endif
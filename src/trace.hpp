@@ -0,0 +1,254 @@
+#ifndef TRACE_HPP_
+#define TRACE_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+
+/**
+ * @brief Starts recording trace spans, to be written by finish_tracing().
+ *
+ * Each thread records into its own ring buffer without locks; a full buffer
+ * overwrites its oldest spans, which are reported as dropped.
+ *
+ * @param path Chrome trace-event JSON file written by finish_tracing().
+ * @param events_per_thread Ring buffer capacity of each thread.
+ */
+void start_tracing(const std::filesystem::path &path,
+                   std::size_t events_per_thread = 1 << 16);
+
+/**
+ * @brief Whether start_tracing() was called and finish_tracing() was not.
+ */
+bool tracing_enabled();
+
+/**
+ * @brief Names the calling thread in the trace, e.g. "worker 3".
+ *
+ * May be called before tracing starts; threads that never call it are named
+ * "thread <n>".
+ */
+void trace_thread_name(std::string name);
+
+/**
+ * @brief Stops tracing and writes every buffered span.
+ *
+ * The file holds one complete ("X") event per span and one thread_name
+ * metadata event per thread, and loads in chrome://tracing and Perfetto.
+ * Other threads must not be recording while it runs, e.g. the pool must be
+ * idle. Does nothing if tracing was not started.
+ *
+ * @throws std::runtime_error If the file cannot be written.
+ */
+void finish_tracing();
+
+/**
+ * @brief Records the lifetime of a scope as a span on the calling thread.
+ *
+ * Costs one atomic load when tracing is off.
+ */
+class Trace_Span {
+public:
+  /**
+   * @param category Category shown and filterable in the viewer; must be a
+   * string literal or otherwise outlive the trace.
+   * @param name Span name; truncated to 47 characters.
+   * @param first Optional start of the item range the span covers, e.g. the
+   * first row of a band; -1 for none.
+   * @param last Optional end of the item range, one past the last item.
+   */
+  Trace_Span(const char *category, std::string_view name,
+             std::int64_t first = -1, std::int64_t last = -1);
+  ~Trace_Span();
+
+  Trace_Span(const Trace_Span &) = delete;
+  Trace_Span &operator=(const Trace_Span &) = delete;
+
+  /* One span as stored in the ring buffers. */
+  struct Event {
+    char name[48];
+    const char *category;
+    std::int64_t start, end;
+    std::int64_t first, last;
+  };
+
+private:
+  bool active_;
+  Event event_;
+};
+
+#endif
+
+#ifdef TRACE_IMPLEMENTATION
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+/* Single-writer ring: only the owning thread stores events and advances
+ * written; finish_tracing reads it once writers are quiescent. */
+struct Trace_Buffer {
+  std::string thread_name;
+  std::vector<Trace_Span::Event> events;
+  std::atomic<std::uint64_t> written{0};
+};
+
+struct Trace_State {
+  std::atomic<bool> enabled{false};
+  std::chrono::steady_clock::time_point epoch;
+  std::filesystem::path path;
+  std::size_t capacity = 0;
+  std::mutex mutex;
+  std::vector<std::unique_ptr<Trace_Buffer>> buffers;
+};
+
+static Trace_State &trace_state() {
+  static Trace_State state;
+  return state;
+}
+
+static thread_local Trace_Buffer *trace_buffer = nullptr;
+static thread_local std::string trace_name;
+
+static std::int64_t trace_now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now() - trace_state().epoch)
+      .count();
+}
+
+/* Buffers outlive their threads so spans of exited threads are kept. */
+static Trace_Buffer &local_trace_buffer() {
+  if (!trace_buffer) {
+    Trace_State &state = trace_state();
+    auto buffer = std::make_unique<Trace_Buffer>();
+    buffer->events.resize(state.capacity);
+    std::lock_guard lock(state.mutex);
+    buffer->thread_name =
+        trace_name.empty()
+            ? "thread " + std::to_string(state.buffers.size() + 1)
+            : trace_name;
+    trace_buffer = buffer.get();
+    state.buffers.push_back(std::move(buffer));
+  }
+  return *trace_buffer;
+}
+
+void start_tracing(const std::filesystem::path &path,
+                   std::size_t events_per_thread) {
+  Trace_State &state = trace_state();
+  std::lock_guard lock(state.mutex);
+  state.path = path;
+  state.capacity = std::max<std::size_t>(events_per_thread, 1);
+  state.epoch = std::chrono::steady_clock::now();
+  state.enabled.store(true, std::memory_order_release);
+}
+
+bool tracing_enabled() {
+  return trace_state().enabled.load(std::memory_order_acquire);
+}
+
+void trace_thread_name(std::string name) {
+  trace_name = std::move(name);
+  if (trace_buffer) {
+    std::lock_guard lock(trace_state().mutex);
+    trace_buffer->thread_name = trace_name;
+  }
+}
+
+Trace_Span::Trace_Span(const char *category, std::string_view name,
+                       std::int64_t first, std::int64_t last)
+    : active_(tracing_enabled()) {
+  if (!active_)
+    return;
+  const std::size_t length = std::min(name.size(), sizeof event_.name - 1);
+  name.copy(event_.name, length);
+  event_.name[length] = '\0';
+  event_.category = category;
+  event_.first = first;
+  event_.last = last;
+  event_.start = trace_now();
+}
+
+Trace_Span::~Trace_Span() {
+  if (!active_)
+    return;
+  event_.end = trace_now();
+  Trace_Buffer &buffer = local_trace_buffer();
+  const std::uint64_t index = buffer.written.load(std::memory_order_relaxed);
+  buffer.events[index % buffer.events.size()] = event_;
+  buffer.written.store(index + 1, std::memory_order_release);
+}
+
+static void write_json_string(std::ostream &out, std::string_view text) {
+  out << '"';
+  for (char c : text) {
+    if (c == '"' || c == '\\')
+      out << '\\';
+    if (static_cast<unsigned char>(c) >= 0x20)
+      out << c;
+  }
+  out << '"';
+}
+
+void finish_tracing() {
+  Trace_State &state = trace_state();
+  if (!state.enabled.exchange(false, std::memory_order_acquire))
+    return;
+
+  std::lock_guard lock(state.mutex);
+  std::ofstream file(state.path);
+  file << std::fixed << std::setprecision(3) << "{\"traceEvents\":[\n";
+  std::uint64_t dropped = 0;
+  bool first_event = true;
+  auto separator = [&] {
+    if (!first_event)
+      file << ",\n";
+    first_event = false;
+  };
+
+  for (std::size_t tid = 0; tid < state.buffers.size(); ++tid) {
+    const Trace_Buffer &buffer = *state.buffers[tid];
+    separator();
+    file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"
+         << tid + 1 << ",\"args\":{\"name\":";
+    write_json_string(file, buffer.thread_name);
+    file << "}}";
+
+    const std::uint64_t written =
+        buffer.written.load(std::memory_order_acquire);
+    const std::uint64_t kept = std::min<std::uint64_t>(
+        written, buffer.events.size());
+    dropped += written - kept;
+    for (std::uint64_t i = written - kept; i < written; ++i) {
+      const Trace_Span::Event &event =
+          buffer.events[i % buffer.events.size()];
+      separator();
+      file << "{\"name\":";
+      write_json_string(file, event.name);
+      file << ",\"cat\":";
+      write_json_string(file, event.category);
+      file << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << tid + 1
+           << ",\"ts\":" << static_cast<double>(event.start) / 1000.0
+           << ",\"dur\":"
+           << static_cast<double>(event.end - event.start) / 1000.0;
+      if (event.first >= 0)
+        file << ",\"args\":{\"first\":" << event.first
+             << ",\"last\":" << event.last << '}';
+      file << '}';
+    }
+  }
+  file << "\n],\"displayTimeUnit\":\"ms\",\"otherData\":{\"dropped_events\":"
+       << dropped << "}}\n";
+  if (!file.flush())
+    throw std::runtime_error("Unable to write trace: " + state.path.string());
+}
+
+#endif
@@ -0,0 +1,566 @@
+#ifndef TUNING_HPP_
+#define TUNING_HPP_
+
+#include "convolve.hpp"
+#include "orientation.hpp"
+
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Image sizes the tuner picks settings for, by pixel count: SMALL
+ * below 0.5 MP, MEDIUM below 4 MP and LARGE from there on.
+ */
+enum class Size_Class {
+  SMALL,
+  MEDIUM,
+  LARGE,
+};
+
+/**
+ * @brief Returns the size class of a width x height image.
+ */
+Size_Class size_class(unsigned int width, unsigned int height);
+
+/**
+ * @brief Parses a size class name ("small", "medium", "large").
+ *
+ * @throws std::invalid_argument If the name is not a known size class.
+ */
+Size_Class size_class_from_string(const std::string &name);
+
+/**
+ * @brief Returns the name of a size class as used in tuning profiles.
+ */
+std::string size_class_name(Size_Class size);
+
+/**
+ * @brief Deflate settings used when writing PNGs.
+ *
+ * The defaults are lodepng's. A larger window finds more matches at some
+ * speed cost; lazy matching trades speed for a slightly smaller output.
+ */
+struct Encoder_Tuning {
+  unsigned int window_size = 2048;
+  bool lazy_matching = true;
+};
+
+/**
+ * @brief Returns the process-wide encoder settings.
+ */
+Encoder_Tuning &encoder_tuning();
+
+/**
+ * @brief Settings measured on one machine by tune().
+ *
+ * The convolution cost model and encoder settings hold for the whole machine;
+ * transpose tiles are kept per size class and thread counts per filter and
+ * size class. Filters and sizes without an entry use the built-in defaults.
+ */
+struct Tuning_Profile {
+  unsigned int hardware_threads = 0;
+  Convolution_Cost_Model convolution;
+  Encoder_Tuning encoder;
+  std::map<Size_Class, Transpose_Tiling> transpose;
+  std::map<std::pair<std::string, Size_Class>, unsigned int> threads;
+};
+
+/**
+ * @brief Runs one filter on an RGB image; used by tune() to time filters.
+ */
+using Filter_Runner = std::function<void(
+    const std::string &filter, const std::vector<unsigned char> &rgb,
+    unsigned int width, unsigned int height)>;
+
+/**
+ * @brief Returns where the tuning profile of this user is cached:
+ * $XDG_CACHE_HOME/simd-filter/tuning, or ~/.cache/simd-filter/tuning.
+ *
+ * @return std::filesystem::path The cache path, or an empty path if neither
+ * XDG_CACHE_HOME nor HOME is set.
+ */
+std::filesystem::path tuning_cache_path();
+
+/**
+ * @brief Reads a tuning profile.
+ *
+ * @param path Profile file.
+ * @return std::optional<Tuning_Profile> The profile, or nullopt if the file
+ * does not exist or was written by another profile version.
+ * @throws std::invalid_argument If the file is malformed.
+ */
+std::optional<Tuning_Profile>
+load_tuning_profile(const std::filesystem::path &path);
+
+/**
+ * @brief Writes a tuning profile, creating its directory if needed.
+ *
+ * The profile is written to a temporary file that then replaces path, so
+ * concurrent runs never read a partial profile.
+ *
+ * @param profile Profile to write.
+ * @param path Profile file.
+ * @throws std::runtime_error If the file cannot be written.
+ */
+void save_tuning_profile(const Tuning_Profile &profile,
+                         const std::filesystem::path &path);
+
+/**
+ * @brief Installs the machine-wide settings of a profile: the convolution
+ * cost model and the encoder settings.
+ */
+void apply_tuning_profile(const Tuning_Profile &profile);
+
+/**
+ * @brief Installs the settings of a profile for filtering one image: the
+ * thread count of the default pool and the transpose tiling.
+ *
+ * When several filters run on the image, the largest of their thread counts
+ * is used. Filters without an entry use every thread.
+ *
+ * @param profile Tuned settings.
+ * @param filters Filters that will run on the image.
+ * @param width Image width in pixels.
+ * @param height Image height in pixels.
+ */
+void apply_tuning_for_image(const Tuning_Profile &profile,
+                            const std::vector<std::string> &filters,
+                            unsigned int width, unsigned int height);
+
+/**
+ * @brief Benchmarks this machine on synthetic images and returns the fastest
+ * settings.
+ *
+ * Fits the convolution cost model by timing the direct, separable and FFT
+ * engines, picks the fastest deflate settings whose output stays within 1% of
+ * the default size, then for every size class the transpose tiles and for
+ * every filter the thread count. Leaves the process-wide settings as they
+ * were.
+ *
+ * @param filters Filters to pick thread counts for.
+ * @param run Runs one filter.
+ * @param log Receives progress and the chosen settings.
+ * @return Tuning_Profile Settings for this machine.
+ */
+Tuning_Profile tune(const std::vector<std::string> &filters,
+                    const Filter_Runner &run, std::ostream &log);
+
+#endif
+
+#ifdef TUNING_IMPLEMENTATION
+
+#include "filters.hpp"
+#include "lodepng.h"
+#include "synthetic.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+static constexpr unsigned int tuning_profile_version = 1;
+
+Size_Class size_class(unsigned int width, unsigned int height) {
+  const std::size_t pixels = static_cast<std::size_t>(width) * height;
+  if (pixels < (std::size_t{1} << 19))
+    return Size_Class::SMALL;
+  if (pixels < (std::size_t{1} << 22))
+    return Size_Class::MEDIUM;
+  return Size_Class::LARGE;
+}
+
+Size_Class size_class_from_string(const std::string &name) {
+  if (name == "small")
+    return Size_Class::SMALL;
+  if (name == "medium")
+    return Size_Class::MEDIUM;
+  if (name == "large")
+    return Size_Class::LARGE;
+  throw std::invalid_argument("Invalid size class");
+}
+
+std::string size_class_name(Size_Class size) {
+  switch (size) {
+  case Size_Class::SMALL:
+    return "small";
+  case Size_Class::MEDIUM:
+    return "medium";
+  case Size_Class::LARGE:
+    return "large";
+  }
+  return "";
+}
+
+Encoder_Tuning &encoder_tuning() {
+  static Encoder_Tuning tuning;
+  return tuning;
+}
+
+std::filesystem::path tuning_cache_path() {
+  if (const char *cache = std::getenv("XDG_CACHE_HOME"); cache && *cache)
+    return std::filesystem::path(cache) / "simd-filter" / "tuning";
+  if (const char *home = std::getenv("HOME"); home && *home)
+    return std::filesystem::path(home) / ".cache" / "simd-filter" / "tuning";
+  return {};
+}
+
+static bool valid_tile(unsigned int size) {
+  return size != 0 && size % 16 == 0;
+}
+
+/* One "key values..." line per setting; '#' starts a comment line. */
+std::optional<Tuning_Profile>
+load_tuning_profile(const std::filesystem::path &path) {
+  std::ifstream file(path);
+  if (!file)
+    return std::nullopt;
+
+  Tuning_Profile profile;
+  bool versioned = false;
+  std::string line;
+  while (std::getline(file, line)) {
+    std::istringstream fields(line);
+    std::string key;
+    if (!(fields >> key) || key[0] == '#')
+      continue;
+
+    if (key == "version") {
+      unsigned int version;
+      if (!(fields >> version))
+        throw std::invalid_argument("Malformed tuning profile version");
+      if (version != tuning_profile_version)
+        return std::nullopt;
+      versioned = true;
+    } else if (key == "hardware-threads") {
+      fields >> profile.hardware_threads;
+    } else if (key == "convolution") {
+      auto &model = profile.convolution;
+      fields >> model.direct_tap >> model.separable_tap >> model.fft_point;
+      if (fields && !(model.direct_tap > 0 && model.separable_tap > 0 &&
+                      model.fft_point > 0))
+        throw std::invalid_argument("Tuned convolution costs must be positive");
+    } else if (key == "encoder") {
+      unsigned int lazy;
+      fields >> profile.encoder.window_size >> lazy;
+      profile.encoder.lazy_matching = lazy != 0;
+      const unsigned int window = profile.encoder.window_size;
+      if (fields && (window < 256 || window > 32768 || (window & (window - 1))))
+        throw std::invalid_argument("Tuned encoder window must be a power of "
+                                    "two in [256, 32768]");
+    } else if (key == "transpose") {
+      std::string size;
+      Transpose_Tiling tiling;
+      fields >> size >> tiling.leaf >> tiling.block;
+      if (fields && (!valid_tile(tiling.leaf) || !valid_tile(tiling.block)))
+        throw std::invalid_argument("Tuned transpose tiles must be multiples "
+                                    "of 16");
+      if (fields)
+        profile.transpose[size_class_from_string(size)] = tiling;
+    } else if (key == "threads") {
+      std::string filter, size;
+      unsigned int threads;
+      fields >> filter >> size >> threads;
+      if (fields)
+        profile.threads[{filter, size_class_from_string(size)}] = threads;
+    } else {
+      throw std::invalid_argument("Unknown tuning profile entry: " + key);
+    }
+    if (!fields)
+      throw std::invalid_argument("Malformed tuning profile entry: " + line);
+  }
+  if (!versioned)
+    throw std::invalid_argument("Tuning profile has no version");
+  return profile;
+}
+
+void save_tuning_profile(const Tuning_Profile &profile,
+                         const std::filesystem::path &path) {
+  std::filesystem::create_directories(path.parent_path());
+  std::filesystem::path temporary = path;
+  temporary += ".tmp";
+  {
+    std::ofstream file(temporary);
+    if (!file)
+      throw std::runtime_error("Unable to write tuning profile: " +
+                               temporary.string());
+    const auto &model = profile.convolution;
+    file << "# simd-filter tuning profile, written by --tune\n"
+         << "version " << tuning_profile_version << '\n'
+         << "hardware-threads " << profile.hardware_threads << '\n'
+         << "convolution " << model.direct_tap << ' ' << model.separable_tap
+         << ' ' << model.fft_point << '\n'
+         << "encoder " << profile.encoder.window_size << ' '
+         << (profile.encoder.lazy_matching ? 1 : 0) << '\n';
+    for (const auto &[size, tiling] : profile.transpose)
+      file << "transpose " << size_class_name(size) << ' ' << tiling.leaf
+           << ' ' << tiling.block << '\n';
+    for (const auto &[key, threads] : profile.threads)
+      file << "threads " << key.first << ' ' << size_class_name(key.second)
+           << ' ' << threads << '\n';
+    if (!file.flush())
+      throw std::runtime_error("Unable to write tuning profile: " +
+                               temporary.string());
+  }
+  std::filesystem::rename(temporary, path);
+}
+
+void apply_tuning_profile(const Tuning_Profile &profile) {
+  convolution_cost_model() = profile.convolution;
+  encoder_tuning() = profile.encoder;
+}
+
+void apply_tuning_for_image(const Tuning_Profile &profile,
+                            const std::vector<std::string> &filters,
+                            unsigned int width, unsigned int height) {
+  const Size_Class size = size_class(width, height);
+  unsigned int threads = 0;
+  for (const auto &filter : filters) {
+    auto entry = profile.threads.find({filter, size});
+    if (entry == profile.threads.end()) {
+      threads = 0;
+      break;
+    }
+    threads = std::max(threads, entry->second);
+  }
+  default_thread_pool().set_parallelism(threads);
+
+  if (auto entry = profile.transpose.find(size);
+      entry != profile.transpose.end())
+    transpose_tiling() = entry->second;
+}
+
+static std::vector<unsigned char> synthetic_photo(unsigned int width,
+                                                  unsigned int height) {
+  return generate_synthetic_image(Synthetic_Content::PHOTO, width, height);
+}
+
+/* Best of repeats timings of body, in seconds, after one warm-up run. */
+template <typename Body>
+static double time_best(unsigned int repeats, Body &&body) {
+  body();
+  double best = std::numeric_limits<double>::infinity();
+  for (unsigned int i = 0; i < repeats; ++i) {
+    const auto start = std::chrono::steady_clock::now();
+    body();
+    const std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    best = std::min(best, elapsed.count());
+  }
+  return best;
+}
+
+/* Fits the cost model to one image: the direct engine sets the unit, the
+ * separable engine its cost per tap and the FFT engine its cost per point. */
+static Convolution_Cost_Model tune_convolution(unsigned int width,
+                                               unsigned int height,
+                                               std::ostream &log) {
+  const std::vector<unsigned char> image = synthetic_photo(width, height);
+  const double pixels = static_cast<double>(width) * height;
+  const Convolution_Cost_Model saved = convolution_cost_model();
+  Convolution_Cost_Model &model = convolution_cost_model();
+
+  /* A rank-2 kernel, so apply_convolution cannot separate it. */
+  Convolution_Kernel direct{9, 9, std::vector<float>(81)};
+  for (unsigned int y = 0; y < 9; ++y)
+    for (unsigned int x = 0; x < 9; ++x)
+      direct.weights[y * 9 + x] =
+          (x == y ? 0.05f : 0.0f) + (x + y == 8 ? 0.05f : 0.0f);
+  const std::vector<float> taps(31, 1.0f / 31);
+  Convolution_Kernel fft{33, 33, std::vector<float>(33 * 33, 1.0f / (33 * 33))};
+
+  model.fft_point = std::numeric_limits<double>::infinity();
+  const double direct_tap = time_best(2, [&] {
+                              apply_convolution(image, width, height, 3,
+                                                direct);
+                            }) /
+                            (pixels * 81);
+  const double separable_tap =
+      time_best(2, [&] {
+        apply_separable_convolution(image, width, height, 3, taps, taps);
+      }) /
+      (pixels * 62);
+  model = saved;
+  const double fft_pixel = time_best(2, [&] {
+                             apply_fft_convolution(image, width, height, 3,
+                                                   fft);
+                           }) /
+                           pixels;
+  /* The predicted cost scales with fft_point; take it per unit. */
+  const double fft_units =
+      fft_convolution_cost(33, 33, width, height) / saved.fft_point;
+
+  Convolution_Cost_Model tuned;
+  tuned.direct_tap = 1.0;
+  tuned.separable_tap = separable_tap / direct_tap;
+  tuned.fft_point = fft_pixel / direct_tap / fft_units;
+  log << "convolution: separable tap " << tuned.separable_tap
+      << ", fft point " << tuned.fft_point << " direct taps\n";
+  return tuned;
+}
+
+/* The fastest deflate settings whose output is at most 1% larger than with
+ * lodepng's defaults for photos and their edge maps at three widths: short
+ * windows lose the matches in the row above once rows get longer than the
+ * window, so a single width would hide that. */
+static Encoder_Tuning tune_encoder(std::ostream &log) {
+  struct Sample {
+    std::vector<unsigned char> bytes;
+    unsigned int width, height;
+    LodePNGColorType colour;
+  };
+  std::vector<Sample> samples;
+  for (unsigned int width : {256u, 512u, 1024u}) {
+    const unsigned int height = width * 3 / 4;
+    std::vector<unsigned char> photo = synthetic_photo(width, height);
+    samples.push_back({apply_laplacian_rgb(photo, width, height), width,
+                       height, LCT_GREY});
+    samples.push_back({std::move(photo), width, height, LCT_RGB});
+  }
+  auto encode = [&](const Encoder_Tuning &tuning,
+                    std::vector<std::size_t> &sizes) {
+    sizes.clear();
+    for (const Sample &sample : samples) {
+      lodepng::State state;
+      state.info_raw.colortype = sample.colour;
+      state.info_png.color.colortype = sample.colour;
+      state.encoder.zlibsettings.windowsize = tuning.window_size;
+      state.encoder.zlibsettings.lazymatching = tuning.lazy_matching;
+      std::vector<unsigned char> png;
+      if (lodepng::encode(png, sample.bytes, sample.width, sample.height,
+                          state))
+        throw std::runtime_error("Encoding failed while tuning");
+      sizes.push_back(png.size());
+    }
+  };
+
+  std::vector<std::size_t> default_sizes, sizes;
+  Encoder_Tuning best;
+  double best_time = time_best(1, [&] { encode(best, default_sizes); });
+  for (unsigned int window : {512u, 1024u, 2048u, 4096u, 8192u, 32768u}) {
+    for (bool lazy : {false, true}) {
+      const Encoder_Tuning candidate{window, lazy};
+      const double time = time_best(1, [&] { encode(candidate, sizes); });
+      bool small_enough = true;
+      for (std::size_t i = 0; i < sizes.size(); ++i)
+        small_enough &= sizes[i] * 100 <= default_sizes[i] * 101;
+      if (time < best_time && small_enough) {
+        best = candidate;
+        best_time = time;
+      }
+    }
+  }
+  log << "encoder: window " << best.window_size << ", lazy matching "
+      << (best.lazy_matching ? "on" : "off") << '\n';
+  return best;
+}
+
+static Transpose_Tiling tune_transpose(unsigned int width, unsigned int height,
+                                       unsigned int repeats) {
+  const std::vector<unsigned char> image = synthetic_photo(width, height);
+  const Transpose_Tiling saved = transpose_tiling();
+  Transpose_Tiling best;
+
+  double best_time = std::numeric_limits<double>::infinity();
+  for (unsigned int leaf : {32u, 64u, 128u, 256u}) {
+    transpose_tiling().leaf = leaf;
+    const double time = time_best(repeats, [&] {
+      apply_orientation(image, width, height, 3, Orientation::ROTATE90);
+    });
+    if (time < best_time) {
+      best.leaf = leaf;
+      best_time = time;
+    }
+  }
+
+  /* The in-place transpose only runs on squares of the same area. */
+  const auto side = static_cast<unsigned int>(
+      std::sqrt(static_cast<double>(width) * height));
+  std::vector<unsigned char> square = synthetic_photo(side, side);
+  best_time = std::numeric_limits<double>::infinity();
+  for (unsigned int block : {32u, 64u, 128u}) {
+    transpose_tiling().block = block;
+    const double time = time_best(repeats, [&] {
+      unsigned int w = side, h = side;
+      apply_orientation_in_place(square, w, h, 3, Orientation::TRANSPOSE);
+    });
+    if (time < best_time) {
+      best.block = block;
+      best_time = time;
+    }
+  }
+
+  transpose_tiling() = saved;
+  return best;
+}
+
+Tuning_Profile tune(const std::vector<std::string> &filters,
+                    const Filter_Runner &run, std::ostream &log) {
+  struct Sample {
+    Size_Class size;
+    unsigned int width, height, repeats;
+  };
+  /* One image from the middle of each class. */
+  const Sample samples[] = {{Size_Class::SMALL, 512, 384, 5},
+                            {Size_Class::MEDIUM, 1600, 1200, 3},
+                            {Size_Class::LARGE, 3200, 2400, 2}};
+
+  Tuning_Profile profile;
+  profile.hardware_threads = std::thread::hardware_concurrency();
+  profile.convolution = tune_convolution(1024, 768, log);
+  profile.encoder = tune_encoder(log);
+
+  Thread_Pool &pool = default_thread_pool();
+  pool.set_parallelism(0);
+  const unsigned int threads = pool.size();
+  std::vector<unsigned int> candidates;
+  for (unsigned int t = 1; t < threads; t *= 2)
+    candidates.push_back(t);
+  candidates.push_back(threads);
+
+  for (const Sample &sample : samples) {
+    const std::string size = size_class_name(sample.size);
+    const Transpose_Tiling tiling =
+        tune_transpose(sample.width, sample.height, sample.repeats);
+    profile.transpose[sample.size] = tiling;
+    log << size << ": transpose leaf " << tiling.leaf << ", block "
+        << tiling.block << '\n';
+
+    const std::vector<unsigned char> image =
+        synthetic_photo(sample.width, sample.height);
+    for (const auto &filter : filters) {
+      unsigned int best = threads;
+      /* A single candidate needs no timing. */
+      if (candidates.size() > 1) {
+        double best_time = std::numeric_limits<double>::infinity();
+        for (unsigned int t : candidates) {
+          pool.set_parallelism(t);
+          const double time = time_best(sample.repeats, [&] {
+            run(filter, image, sample.width, sample.height);
+          });
+          if (time < best_time) {
+            best = t;
+            best_time = time;
+          }
+        }
+        pool.set_parallelism(0);
+      }
+      profile.threads[{filter, sample.size}] = best;
+      log << size << ": " << filter << " on " << best << " threads\n";
+    }
+  }
+  return profile;
+}
+
+#endif